@@ -19,6 +19,7 @@
 #include "dfscli_conf.h"
 #include "dfscli_put.h"
 #include "dfscli_get.h"
+#include "dfscli_session.h"
 
 #define INVALID_SYMBOLS_IN_PATH "\\:*?\"<>|"
 #define MY_LOG_RAW (1 << 10) // Modifier to log without timestamp
@@ -26,19 +27,26 @@
 #define DEFAULT_CONF_FILE PREFIX"/etc/dfscli.conf"
 
 #define DEFAULT_COUNT 5 // 默认文件切5个
+
+#define CLI_BATCH_BYTES (32 * 1024) // an NN_BATCH request at most
 string_t config_file;
 
 static void log_raw(uint32_t level, const char *msg);
 
 static void help(int argc, char **argv);
 
-static int dfscli_mkdir(char *path);
+static int dfscli_paths(cmd_t cmd, char **argv, int num);
+
+static int packPaths(cmd_t cmd, char (*paths)[PATH_LEN], int num,
+                     int *next, char *req);
 
-static int dfscli_rmr(char *path);
+static void showError(cmd_t cmd, char *path, int ret);
 
 static int dfscli_ls(char *path);
 
-static int showDirsFiles(char *p, int len);
+static int readReply(int sockfd, char **buf);
+
+static int showPage(char *dir, char *p, int len, ls_page_req_t *req);
 
 static int getTimeStr(uint64_t msec, char *str, int len);
 
@@ -46,7 +54,7 @@ static int isPathValid(char *path);
 
 static int getValidPath(char *src, char *dst);
 
-static int dfscli_rm(char *path);
+static int dfscli_mv(char *src, char *dst);
 
 int dfscli_daemon() {
     return 0;
@@ -130,12 +138,13 @@ static void help(int argc, char **argv) {
                     "\t tip: if you use [-cutput local/file remote/file] then the file in remote will be stored in \n"
                     "\t file1,file2,...,file5 (default is 5), and then if you use [-merget remote/file local/file],that \n"
                     "\t (file1,...,file5 in remote) will be download and merge into local/file\n"
-                    "\t -mkdir <path> \n"
-                    "\t -rmr <path> \n"
+                    "\t -mkdir <path> [path ...] \n"
+                    "\t -rmr <path> [path ...] \n"
                     "\t -ls <path> \n"
                     "\t -put <local path> <remote path> \n"
                     "\t -get <remote path> <local path> \n"
-                    "\t -rm <path> \n"
+                    "\t -rm <path> [path ...] \n"
+                    "\t -mv <src path> <dst path> \n"
                     "\t -cutput <local path> <remote path>  \n"
                     "\t -merget <remote path> <local path>  \n",
             argv[0]);
@@ -180,25 +189,9 @@ int main(int argc, char **argv) {
     strcpy(path, argv[2]);
 
     if (0 == strncmp(cmd, "-mkdir", strlen("-mkdir"))) {
-        if (!isPathValid(path)) {
-            dfscli_log(DFS_LOG_WARN,
-                       "path[%s] is invalid, these symbols[%s] can't use in the path",
-                       path, INVALID_SYMBOLS_IN_PATH);
-
-            goto out;
-        }
-
-        char vPath[PATH_LEN] = {0};
-        getValidPath(path, vPath);
-
-        dfscli_mkdir(vPath);
+        dfscli_paths(NN_MKDIR, argv + 2, argc - 2);
     } else if (0 == strncmp(cmd, "-rmr", strlen("-rmr"))) {
-        // check path's pattern
-
-        char vPath[PATH_LEN] = {0};
-        getValidPath(path, vPath);
-
-        dfscli_rmr(vPath);
+        dfscli_paths(NN_RMR, argv + 2, argc - 2);
     } else if (0 == strncmp(cmd, "-ls", strlen("-ls"))) {
         // check path's pattern
 
@@ -231,12 +224,18 @@ int main(int argc, char **argv) {
         int blk_num = 0;
         dfscli_get(src, dst, &blk_num);
     } else if (0 == strncmp(cmd, "-rm", strlen("-rm"))) {
-        // check path's pattern
+        dfscli_paths(NN_RM, argv + 2, argc - 2);
+    } else if (4 == argc && 0 == strncmp(cmd, "-mv", strlen("-mv"))) {
+        char tmp[PATH_LEN] = {0};
+        strncpy(tmp, argv[3], PATH_LEN - 1);
 
-        char vPath[PATH_LEN] = {0};
-        getValidPath(path, vPath);
+        char src[PATH_LEN] = {0};
+        getValidPath(path, src);
+
+        char dst[PATH_LEN] = {0};
+        getValidPath(tmp, dst);
 
-        dfscli_rm(vPath);
+        dfscli_mv(src, dst);
     } else if (0 == strncmp(cmd, "-cutput", strlen("-cutput"))) {
         char tmp[PATH_LEN] = {0};
         strcpy(tmp, argv[3]);
@@ -363,132 +362,253 @@ void getUserInfo(task_t *out_t) {
     strcpy(out_t->group, group->gr_name);
 }
 
-static int dfscli_mkdir(char *path) {
-    conf_server_t *sconf = nullptr;
-    server_bind_t *nn_addr = nullptr;
+// packs the paths from *next on into one NN_BATCH request, returns
+// its length
+static int packPaths(cmd_t cmd, char (*paths)[PATH_LEN], int num,
+                     int *next, char *req) {
+    batch_req_t hdr;
+    int len = sizeof(batch_req_t);
 
-    sconf = (conf_server_t *) dfs_cycle->sconf;
-    nn_addr = (server_bind_t *) sconf->namenode_addr.elts;
-
-    int sockfd = dfs_connect((char *) nn_addr[0].addr.data, nn_addr[0].port);
-    if (sockfd < 0) {
-        return NGX_ERROR;
-    }
-
-    task_t out_t;
-    bzero(&out_t, sizeof(task_t));
-    out_t.cmd = NN_MKDIR;
-    keyEncode((uchar_t *) path, (uchar_t *) out_t.key);
+    hdr.num = 0;
 
-    getUserInfo(&out_t);
+    while (*next < num && hdr.num < BATCH_MAX_OPS) {
+        char key[KEY_LEN] = {0};
+        keyEncode((uchar_t *) paths[*next], (uchar_t *) key);
 
-    out_t.permission = 755;
+        batch_op_t op;
+        bzero(&op, sizeof(batch_op_t));
+        op.cmd = cmd;
+        op.permission = NN_MKDIR == cmd ? 755 : 0;
+        op.key_len = strlen(key);
 
-    char sBuf[BUF_SZ] = "";
-    int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-    int ws = write(sockfd, sBuf, sLen);
-    if (ws != sLen) {
-        dfscli_log(DFS_LOG_WARN, "write err, ws: %d, sLen: %d", ws, sLen);
+        if (len + (int) sizeof(batch_op_t) + op.key_len > CLI_BATCH_BYTES) {
+            break;
+        }
 
-        close(sockfd);
+        memcpy(req + len, &op, sizeof(batch_op_t));
+        len += sizeof(batch_op_t);
+        memcpy(req + len, key, op.key_len);
+        len += op.key_len;
 
-        return NGX_ERROR;
+        hdr.num++;
+        (*next)++;
     }
 
-    char rBuf[BUF_SZ] = "";
-    int rLen = read(sockfd, rBuf, sizeof(rBuf));
-    if (rLen < 0) {
-        dfscli_log(DFS_LOG_WARN, "read err, rLen: %d", rLen);
+    memcpy(req, &hdr, sizeof(batch_req_t));
 
-        close(sockfd);
+    return len;
+}
 
-        return NGX_ERROR;
+// runs cmd on each path. the paths go out in NN_BATCH requests of many
+// ops each, up to NN_SESSION_WINDOW of them in flight on one connection.
+// a reply finds its paths by seq
+static int dfscli_paths(cmd_t cmd, char **argv, int num) {
+    nn_session_t s;
+    char (*paths)[PATH_LEN] = nullptr;
+    int *first = nullptr;
+    int *count = nullptr;
+    char *req = nullptr;
+    int sent = 0;
+    int done = 0;
+    int inflight = 0;
+    int rc = NGX_ERROR;
+
+    paths = (char (*)[PATH_LEN]) calloc(num, PATH_LEN);
+    first = (int *) calloc(num, sizeof(int));
+    count = (int *) calloc(num, sizeof(int));
+    req = (char *) malloc(CLI_BATCH_BYTES);
+    if (nullptr == paths || nullptr == first || nullptr == count
+        || nullptr == req) {
+        goto out;
     }
 
-    task_t in_t;
-    bzero(&in_t, sizeof(task_t));
-    task_decodefstr(rBuf, rLen, &in_t);
+    for (int i = 0; i < num; i++) {
+        if (strlen(argv[i]) >= PATH_LEN) {
+            dfscli_log(DFS_LOG_WARN, "path's len is greater than %d",
+                       (int) PATH_LEN);
 
-    if (in_t.ret != NGX_OK) {
-        if (in_t.ret == KEY_EXIST) {
-            dfscli_log(DFS_LOG_WARN, "mkdir err, path %s is exist.", path);
-        } else if (in_t.ret == NOT_DIRECTORY) {
+            goto out;
+        }
+
+        if (NN_MKDIR == cmd && !isPathValid(argv[i])) {
             dfscli_log(DFS_LOG_WARN,
-                       "mkdir err, parent path is not a directory.");
-        } else if (in_t.ret == PERMISSION_DENY) {
-            dfscli_log(DFS_LOG_WARN, "mkdir err, permission deny.");
-        } else {
-            dfscli_log(DFS_LOG_WARN, "mkdir err, ret: %d", in_t.ret);
+                       "path[%s] is invalid, these symbols[%s] can't use in the path",
+                       argv[i], INVALID_SYMBOLS_IN_PATH);
+
+            goto out;
         }
+
+        getValidPath(argv[i], paths[i]);
     }
 
-    close(sockfd);
+    if (nn_session_open(&s) != NGX_OK) {
+        goto out;
+    }
 
-    return NGX_OK;
-}
+    // the session starts at seq 0, so seq n answers first[n - 1]
+    while (done < num) {
+        while (sent < num && inflight < NN_SESSION_WINDOW) {
+            int from = sent;
+            int len = packPaths(cmd, paths, num, &sent, req);
 
-static int dfscli_rmr(char *path) {
-    conf_server_t *sconf = nullptr;
-    server_bind_t *nn_addr = nullptr;
+            task_t out_t;
+            bzero(&out_t, sizeof(task_t));
+            out_t.cmd = NN_BATCH;
 
-    sconf = (conf_server_t *) dfs_cycle->sconf;
-    nn_addr = (server_bind_t *) sconf->namenode_addr.elts;
+            getUserInfo(&out_t);
 
-    int sockfd = dfs_connect((char *) nn_addr[0].addr.data, nn_addr[0].port);
-    if (sockfd < 0) {
-        return NGX_ERROR;
-    }
+            out_t.data = req;
+            out_t.data_len = len;
 
-    task_t out_t;
-    bzero(&out_t, sizeof(task_t));
-    out_t.cmd = NN_RMR;
-    keyEncode((uchar_t *) path, (uchar_t *) out_t.key);
+            if (nn_session_send(&s, &out_t) != NGX_OK) {
+                goto close;
+            }
 
-    getUserInfo(&out_t);
+            first[out_t.seq - 1] = from;
+            count[out_t.seq - 1] = sent - from;
+            inflight++;
+        }
 
-    char sBuf[BUF_SZ] = "";
-    int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-    int ws = write(sockfd, sBuf, sLen);
-    if (ws != sLen) {
-        dfscli_log(DFS_LOG_WARN, "write err, ws: %d, sLen: %d", ws, sLen);
+        task_t in_t;
+        bzero(&in_t, sizeof(task_t));
 
-        close(sockfd);
+        if (nn_session_recv(&s, &in_t) != NGX_OK) {
+            goto close;
+        }
 
-        return NGX_ERROR;
-    }
+        if (in_t.seq < 1 || in_t.seq > s.seq) {
+            dfscli_log(DFS_LOG_WARN, "reply with unknown seq: %u", in_t.seq);
 
-    char rBuf[BUF_SZ] = "";
-    int rLen = read(sockfd, rBuf, sizeof(rBuf));
-    if (rLen < 0) {
-        dfscli_log(DFS_LOG_WARN, "read err, rLen: %d", rLen);
+            continue;
+        }
 
-        close(sockfd);
+        int from = first[in_t.seq - 1];
+        int n = count[in_t.seq - 1];
 
-        return NGX_ERROR;
+        inflight--;
+        done += n;
+
+        if (in_t.ret != NGX_OK) {
+            for (int i = 0; i < n; i++) {
+                showError(cmd, paths[from + i], in_t.ret);
+            }
+
+            continue;
+        }
+
+        char *p = (char *) in_t.data;
+        char *end = p + in_t.data_len;
+        batch_resp_t resp;
+
+        if (nullptr == p || in_t.data_len < (int) sizeof(batch_resp_t)) {
+            dfscli_log(DFS_LOG_WARN, "bad batch reply, len: %d", in_t.data_len);
+
+            continue;
+        }
+
+        memcpy(&resp, p, sizeof(batch_resp_t));
+        p += sizeof(batch_resp_t);
+
+        for (int i = 0; i < n && i < (int) resp.num; i++) {
+            batch_res_t res;
+
+            if (end - p < (long) sizeof(batch_res_t)) {
+                break;
+            }
+
+            memcpy(&res, p, sizeof(batch_res_t));
+            p += sizeof(batch_res_t) + res.data_len;
+
+            if (res.ret != NGX_OK) {
+                showError(cmd, paths[from + i], res.ret);
+            }
+        }
     }
 
-    task_t in_t;
-    bzero(&in_t, sizeof(task_t));
-    task_decodefstr(rBuf, rLen, &in_t);
+    rc = NGX_OK;
 
-    if (in_t.ret != NGX_OK) {
-        if (in_t.ret == NOT_DIRECTORY) {
+close:
+    nn_session_close(&s);
+
+out:
+    free(paths);
+    free(first);
+    free(count);
+    free(req);
+
+    return rc;
+}
+
+static void showError(cmd_t cmd, char *path, int ret) {
+    if (NN_MKDIR == cmd) {
+        if (ret == KEY_EXIST) {
+            dfscli_log(DFS_LOG_WARN, "mkdir err, path %s is exist.", path);
+        } else if (ret == NOT_DIRECTORY) {
+            dfscli_log(DFS_LOG_WARN,
+                       "mkdir err, parent path is not a directory.");
+        } else if (ret == PERMISSION_DENY) {
+            dfscli_log(DFS_LOG_WARN, "mkdir err, permission deny.");
+        } else {
+            dfscli_log(DFS_LOG_WARN, "mkdir err, ret: %d", ret);
+        }
+    } else if (NN_RMR == cmd) {
+        if (ret == NOT_DIRECTORY) {
             dfscli_log(DFS_LOG_WARN,
                        "rmr err, the target is a file, you should use -rm instead.");
-        } else if (in_t.ret == KEY_NOTEXIST) {
+        } else if (ret == KEY_NOTEXIST) {
             dfscli_log(DFS_LOG_WARN, "rmr err, path %s doesn't exist.", path);
-        } else if (in_t.ret == PERMISSION_DENY) {
+        } else if (ret == PERMISSION_DENY) {
             dfscli_log(DFS_LOG_WARN, "rmr err, permission deny.");
         } else {
-            dfscli_log(DFS_LOG_WARN, "rmr err, ret: %d", in_t.ret);
+            dfscli_log(DFS_LOG_WARN, "rmr err, ret: %d", ret);
+        }
+    } else {
+        if (ret == NOT_FILE) {
+            dfscli_log(DFS_LOG_WARN,
+                       "rm err, the target is a directory, you should use -rmr instead.");
+        } else if (ret == KEY_NOTEXIST) {
+            dfscli_log(DFS_LOG_WARN, "rm err, path %s doesn't exist.", path);
+        } else if (ret == PERMISSION_DENY) {
+            dfscli_log(DFS_LOG_WARN, "rm err, permission deny.");
+        } else {
+            dfscli_log(DFS_LOG_WARN, "rm err, ret: %d", ret);
         }
     }
+}
 
-    close(sockfd);
+// reads one whole reply, the caller frees *buf
+static int readReply(int sockfd, char **buf) {
+    int pLen = 0;
+    int rLen = recv(sockfd, &pLen, sizeof(int), MSG_PEEK | MSG_WAITALL);
+    if (rLen != sizeof(int) || pLen < (int) sizeof(int)) {
+        dfscli_log(DFS_LOG_WARN, "recv err, rLen: %d", rLen);
 
-    return NGX_OK;
+        return NGX_ERROR;
+    }
+
+    char *p = (char *) malloc(pLen);
+    if (nullptr == p) {
+        dfscli_log(DFS_LOG_WARN, "malloc err, pLen: %d", pLen);
+
+        return NGX_ERROR;
+    }
+
+    rLen = recv(sockfd, p, pLen, MSG_WAITALL);
+    if (rLen != pLen) {
+        dfscli_log(DFS_LOG_WARN, "read err, rLen: %d", rLen);
+
+        free(p);
+
+        return NGX_ERROR;
+    }
+
+    *buf = p;
+
+    return pLen;
 }
 
+// asks for one page at a time so a huge directory never comes back as
+// a single reply
 static int dfscli_ls(char *path) {
     conf_server_t *sconf = nullptr;
     server_bind_t *nn_addr = nullptr;
@@ -501,117 +621,114 @@ static int dfscli_ls(char *path) {
         return NGX_ERROR;
     }
 
-    task_t out_t;
-    bzero(&out_t, sizeof(task_t));
-    out_t.cmd = NN_LS;
-    keyEncode((uchar_t *) path, (uchar_t *) out_t.key);
-
-    getUserInfo(&out_t);
-
-    char sBuf[BUF_SZ] = "";
-    int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-    int ws = write(sockfd, sBuf, sLen);
-    if (ws != sLen) {
-        dfscli_log(DFS_LOG_WARN, "write err, ws: %d, sLen: %d", ws, sLen);
+    ls_page_req_t req;
+    bzero(&req, sizeof(ls_page_req_t));
+    req.max_entries = LS_PAGE_MAX_ENTRIES;
 
-        close(sockfd);
+    int more = 1;
 
-        return NGX_ERROR;
-    }
+    while (more) {
+        task_t out_t;
+        bzero(&out_t, sizeof(task_t));
+        out_t.cmd = NN_LS_PAGE;
+        keyEncode((uchar_t *) path, (uchar_t *) out_t.key);
 
-    int pLen = 0;
-    int rLen = recv(sockfd, &pLen, sizeof(int), MSG_PEEK);
-    if (rLen < 0) {
-        dfscli_log(DFS_LOG_WARN, "recv err, rLen: %d", rLen);
+        getUserInfo(&out_t);
 
-        close(sockfd);
+        out_t.data = &req;
+        out_t.data_len = sizeof(ls_page_req_t);
 
-        return NGX_ERROR;
-    }
+        char sBuf[BUF_SZ] = "";
+        int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
+        int ws = write(sockfd, sBuf, sLen);
+        if (ws != sLen) {
+            dfscli_log(DFS_LOG_WARN, "write err, ws: %d, sLen: %d", ws, sLen);
 
-    char *pNext = (char *) malloc(pLen);
-    if (nullptr == pNext) {
-        dfscli_log(DFS_LOG_WARN, "malloc err, pLen: %d", pLen);
+            close(sockfd);
 
-        close(sockfd);
+            return NGX_ERROR;
+        }
 
-        return NGX_ERROR;
-    }
+        char *pNext = nullptr;
+        int rLen = readReply(sockfd, &pNext);
+        if (rLen < 0) {
+            close(sockfd);
 
-    rLen = read(sockfd, pNext, pLen);
-    if (rLen < 0) {
-        dfscli_log(DFS_LOG_WARN, "read err, rLen: %d", rLen);
+            return NGX_ERROR;
+        }
 
-        close(sockfd);
+        task_t in_t;
+        bzero(&in_t, sizeof(task_t));
+        task_decodefstr(pNext, rLen, &in_t);
+
+        more = 0;
+
+        if (in_t.ret != NGX_OK) {
+            if (in_t.ret == KEY_NOTEXIST) {
+                dfscli_log(DFS_LOG_WARN, "ls err, path %s doesn't exist.", path);
+            } else if (in_t.ret == PERMISSION_DENY) {
+                dfscli_log(DFS_LOG_WARN, "ls err, permission deny.");
+            } else {
+                dfscli_log(DFS_LOG_WARN, "ls err, ret: %d", in_t.ret);
+            }
+        } else if (nullptr != in_t.data
+                   && in_t.data_len >= (int) sizeof(ls_page_resp_t)) {
+            more = showPage(path, (char *) in_t.data, in_t.data_len, &req);
+        }
 
         free(pNext);
         pNext = nullptr;
-
-        return NGX_ERROR;
-    }
-
-    task_t in_t;
-    bzero(&in_t, sizeof(task_t));
-    task_decodefstr(pNext, rLen, &in_t);
-
-    if (in_t.ret != NGX_OK) {
-        if (in_t.ret == KEY_NOTEXIST) {
-            dfscli_log(DFS_LOG_WARN, "ls err, path %s doesn't exist.", path);
-        } else if (in_t.ret == PERMISSION_DENY) {
-            dfscli_log(DFS_LOG_WARN, "ls err, permission deny.");
-        } else {
-            dfscli_log(DFS_LOG_WARN, "ls err, ret: %d", in_t.ret);
-        }
-    } else if (nullptr != in_t.data && in_t.data_len > 0) {
-        showDirsFiles((char *) in_t.data, in_t.data_len);
     }
 
     close(sockfd);
 
-    free(pNext);
-    pNext = nullptr;
-
     return NGX_OK;
 }
 
-static int showDirsFiles(char *p, int len) {
-    fi_inode_t fii;
-    int fiiLen = sizeof(fi_inode_t);
-    uchar_t permission[16] = "";
+// prints a page and remembers its last name in req, returns whether
+// more pages follow
+static int showPage(char *dir, char *p, int len, ls_page_req_t *req) {
+    ls_page_resp_t resp;
+    ls_entry_t e;
     char mtime[64] = "";
-    uchar_t path[PATH_LEN] = "";
+    char *end = p + len;
 
-    while (len > 0) {
-        bzero(&fii, sizeof(fi_inode_t));
-        memcpy(&fii, p, fiiLen);
+    memcpy(&resp, p, sizeof(ls_page_resp_t));
+    p += sizeof(ls_page_resp_t);
 
-        printf("%s", fii.is_directory ? "d" : "-");
+    for (uint32_t i = 0; i < resp.num; i++) {
+        if (end - p < (int) sizeof(ls_entry_t)) {
+            return 0;
+        }
 
-        memset(permission, 0x00, sizeof(permission));
-        get_permission(fii.permission, permission);
-        printf("%s", permission);
+        memcpy(&e, p, sizeof(ls_entry_t));
+        p += sizeof(ls_entry_t);
 
-        if (fii.is_directory) {
-            printf("    -");
-        } else {
-            printf("    %d", fii.blk_replication);
+        if (end - p < e.name_len || e.name_len >= LS_NAME_LEN) {
+            return 0;
         }
 
-        printf(" %s %s    %ld", fii.owner, fii.group, fii.length);
-
         memset(mtime, 0x00, sizeof(mtime));
-        getTimeStr(fii.modification_time, mtime, sizeof(mtime));
-        printf(" %s", mtime);
+        getTimeStr(e.modification_time, mtime, sizeof(mtime));
 
-        memset(path, 0x00, sizeof(path));
-        keyDecode((uchar_t *) fii.key, path);
-        printf(" %s\n", path);
+        if (e.name_len == 0) {
+            printf("%s    %ld %s %s\n", e.is_directory ? "d" : "-",
+                   e.length, mtime, dir);
 
-        p += fiiLen;
-        len -= fiiLen;
+            return 0;
+        }
+
+        printf("%s    %ld %s %s/%.*s\n", e.is_directory ? "d" : "-",
+               e.length, mtime, strcmp(dir, "/") ? dir : "",
+               (int) e.name_len, p);
+
+        memcpy(req->start_after, p, e.name_len);
+        req->after_len = e.name_len;
+
+        p += e.name_len;
     }
 
-    return NGX_OK;
+    return resp.more && resp.num > 0;
 }
 
 static int getTimeStr(uint64_t msec, char *str, int len) {
@@ -674,7 +791,8 @@ static int getValidPath(char *src, char *dst) {
     return NGX_OK;
 }
 
-static int dfscli_rm(char *path) {
+// the destination key travels in data
+static int dfscli_mv(char *src, char *dst) {
     conf_server_t *sconf = nullptr;
     server_bind_t *nn_addr = nullptr;
 
@@ -686,13 +804,19 @@ static int dfscli_rm(char *path) {
         return NGX_ERROR;
     }
 
+    char dst_key[PATH_LEN] = {0};
+    keyEncode((uchar_t *) dst, (uchar_t *) dst_key);
+
     task_t out_t;
     bzero(&out_t, sizeof(task_t));
-    out_t.cmd = NN_RM;
-    keyEncode((uchar_t *) path, (uchar_t *) out_t.key);
+    out_t.cmd = NN_RENAME;
+    keyEncode((uchar_t *) src, (uchar_t *) out_t.key);
 
     getUserInfo(&out_t);
 
+    out_t.data = dst_key;
+    out_t.data_len = strlen(dst_key) + 1;
+
     char sBuf[BUF_SZ] = "";
     int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
     int ws = write(sockfd, sBuf, sLen);
@@ -719,15 +843,20 @@ static int dfscli_rm(char *path) {
     task_decodefstr(rBuf, rLen, &in_t);
 
     if (in_t.ret != NGX_OK) {
-        if (in_t.ret == NOT_FILE) {
-            dfscli_log(DFS_LOG_WARN,
-                       "rm err, the target is a directory, you should use -rmr instead.");
-        } else if (in_t.ret == KEY_NOTEXIST) {
-            dfscli_log(DFS_LOG_WARN, "rm err, path %s doesn't exist.", path);
+        if (in_t.ret == KEY_NOTEXIST) {
+            dfscli_log(DFS_LOG_WARN, "mv err, path %s doesn't exist.", src);
+        } else if (in_t.ret == KEY_EXIST) {
+            dfscli_log(DFS_LOG_WARN, "mv err, path %s already exists.", dst);
+        } else if (in_t.ret == NOT_DIRECTORY) {
+            dfscli_log(DFS_LOG_WARN, "mv err, parent of %s is not a directory.", dst);
+        } else if (in_t.ret == KEY_STATE_CREATING) {
+            dfscli_log(DFS_LOG_WARN, "mv err, %s is being written.", src);
         } else if (in_t.ret == PERMISSION_DENY) {
-            dfscli_log(DFS_LOG_WARN, "rm err, permission deny.");
+            dfscli_log(DFS_LOG_WARN, "mv err, permission deny.");
+        } else if (in_t.ret == CROSS_GROUP) {
+            dfscli_log(DFS_LOG_WARN, "mv err, %s and %s are in different paxos groups.", src, dst);
         } else {
-            dfscli_log(DFS_LOG_WARN, "rm err, ret: %d", in_t.ret);
+            dfscli_log(DFS_LOG_WARN, "mv err, ret: %d", in_t.ret);
         }
     }
 
@@ -735,4 +864,3 @@ static int dfscli_rm(char *path) {
 
     return NGX_OK;
 }
-
@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "dfscli_session.h"
+#include "dfscli_conf.h"
+#include "dfscli_cycle.h"
+
+int nn_session_open(nn_session_t *s) {
+    conf_server_t *sconf = nullptr;
+    server_bind_t *nn_addr = nullptr;
+
+    bzero(s, sizeof(nn_session_t));
+    s->fd = -1;
+
+    sconf = (conf_server_t *) dfs_cycle->sconf;
+    nn_addr = (server_bind_t *) sconf->namenode_addr.elts;
+
+    s->out = (char *) malloc(NN_SESSION_BUF);
+    s->in = (char *) malloc(NN_SESSION_BUF);
+    if (!s->out || !s->in) {
+        dfscli_log(DFS_LOG_WARN, "malloc err, size: %d", NN_SESSION_BUF);
+
+        nn_session_close(s);
+
+        return NGX_ERROR;
+    }
+
+    s->fd = dfs_connect((char *) nn_addr[0].addr.data, nn_addr[0].port);
+    if (s->fd < 0) {
+        nn_session_close(s);
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+void nn_session_close(nn_session_t *s) {
+    if (s->fd >= 0) {
+        close(s->fd);
+        s->fd = -1;
+    }
+
+    free(s->out);
+    free(s->in);
+    s->out = nullptr;
+    s->in = nullptr;
+}
+
+int nn_session_flush(nn_session_t *s) {
+    int pos = 0;
+
+    while (pos < s->out_len) {
+        int ws = write(s->fd, s->out + pos, s->out_len - pos);
+        if (ws < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (ws <= 0) {
+            dfscli_log(DFS_LOG_WARN, "write err: %s", strerror(errno));
+
+            return NGX_ERROR;
+        }
+
+        pos += ws;
+    }
+
+    s->out_len = 0;
+
+    return NGX_OK;
+}
+
+// queues t under the next seq, it goes out when the buffer fills or on
+// nn_session_flush and nn_session_recv
+int nn_session_send(nn_session_t *s, task_t *t) {
+    t->seq = ++s->seq;
+
+    int sLen = task_encode2str(t, s->out + s->out_len,
+                               NN_SESSION_BUF - s->out_len);
+    if (sLen == TASK_EAGIN && s->out_len > 0) {
+        if (nn_session_flush(s) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        sLen = task_encode2str(t, s->out, NN_SESSION_BUF);
+    }
+
+    if (sLen <= 0) {
+        dfscli_log(DFS_LOG_WARN, "encode err, seq: %u", t->seq);
+
+        return NGX_ERROR;
+    }
+
+    s->out_len += sLen;
+
+    return NGX_OK;
+}
+
+// the next reply, whichever request it answers. t->data points into
+// the session until the next call
+int nn_session_recv(nn_session_t *s, task_t *t) {
+    if (s->out_len > 0 && nn_session_flush(s) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    for (;;) {
+        int avail = s->in_len - s->in_pos;
+
+        if (avail > 0) {
+            int rLen = task_decodefstr(s->in + s->in_pos, avail, t);
+            if (rLen > 0) {
+                s->in_pos += rLen;
+
+                return NGX_OK;
+            }
+
+            if (rLen != TASK_EAGIN) {
+                dfscli_log(DFS_LOG_WARN, "bad reply, rLen: %d", rLen);
+
+                return NGX_ERROR;
+            }
+        }
+
+        // keep the partial reply at the front, a reply larger than the
+        // buffer can not be taken
+        memmove(s->in, s->in + s->in_pos, avail);
+        s->in_pos = 0;
+        s->in_len = avail;
+
+        if (s->in_len == NN_SESSION_BUF) {
+            dfscli_log(DFS_LOG_WARN, "reply over %d bytes", NN_SESSION_BUF);
+
+            return NGX_ERROR;
+        }
+
+        int rs = read(s->fd, s->in + s->in_len, NN_SESSION_BUF - s->in_len);
+        if (rs < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (rs <= 0) {
+            dfscli_log(DFS_LOG_WARN, "read err, rs: %d", rs);
+
+            return NGX_ERROR;
+        }
+
+        s->in_len += rs;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef DFS_CLI_SESSION_H
+#define DFS_CLI_SESSION_H
+
+#include "dfs_types.h"
+#include "dfscli_main.h"
+
+#define NN_SESSION_BUF    (64 * 1024)
+#define NN_SESSION_WINDOW 128 // requests out at once, below max_tqueue_len
+
+/*
+ * one namenode connection carrying many requests at a time. each
+ * request gets the next seq, replies come back in any order and are
+ * matched to their request by seq
+ */
+typedef struct nn_session_s
+{
+    int       fd;
+    uint32_t  seq;    // of the last request sent
+    char     *out;
+    int       out_len;
+    char     *in;
+    int       in_pos;
+    int       in_len;
+} nn_session_t;
+
+int  nn_session_open(nn_session_t *s);
+void nn_session_close(nn_session_t *s);
+int  nn_session_send(nn_session_t *s, task_t *t);
+int  nn_session_flush(nn_session_t *s);
+int  nn_session_recv(nn_session_t *s, task_t *t);
+
+#endif
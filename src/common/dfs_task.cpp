@@ -3,6 +3,7 @@
 #include <assert.h>
 
 #include "dfs_task.h"
+#include "dfs_varint.h"
 
 task_t * task_new()
 {
@@ -31,65 +32,315 @@ void task_clear(task_t* task)
 	memset(task, 0x00, sizeof(task_t));
 }
 
-//
+static uchar_t *task_put_bytes(uchar_t *p, const void *src, size_t len)
+{
+    p = dfs_varint_encode(p, len);
+    memcpy(p, src, len);
+
+    return p + len;
+}
+
+// nullptr if the field runs past end or is longer than max
+static uchar_t *task_get_bytes(uchar_t *p, uchar_t *end, size_t max,
+    uchar_t **src, size_t *len)
+{
+    uint64_t v = 0;
+
+    p = dfs_varint_decode(p, end, &v);
+    if (!p || v > max || v > (uint64_t)(end - p))
+    {
+        return nullptr;
+    }
+
+    *src = p;
+    *len = v;
+
+    return p + v;
+}
+
+// a string field of task_t, always nul terminated, so one that would
+// fill all max bytes is malformed
+static uchar_t *task_get_str(uchar_t *p, uchar_t *end, char *dst, size_t max)
+{
+    uchar_t *src = nullptr;
+    size_t   len = 0;
+
+    p = task_get_bytes(p, end, max - 1, &src, &len);
+    if (!p)
+    {
+        return nullptr;
+    }
+
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+
+    return p;
+}
+
+// the packet length, TASK_EAGIN if it does not fit in len
 int task_encode2str(task_t *task, char *buff, int len)
 {
-	int need_size = 0;
-    int pkg_size = (int)sizeof(int);
-    int task_size = sizeof(task_t);
-    int data_size = (int)sizeof(int);
+    uint64_t  flags = 0;
+    // the peer keeps room for the nul, an unterminated field is cut
+    size_t    key_len = strnlen(task->key, KEY_LEN - 1);
+    size_t    user_len = strnlen(task->user, OWNER_LEN - 1);
+    size_t    group_len = strnlen(task->group, GROUP_LEN - 1);
+    size_t    need = TASK_WIRE_HDR_LEN + DFS_VARINT_MAX_LEN * 2;
+    uchar_t  *p = nullptr;
 
-    need_size = pkg_size + task_size + data_size + task->data_len;
-    if (len < need_size)
+    if (task->ret)
     {
-        return TASK_EAGIN;
+        flags |= TASK_F_RET;
+        need += DFS_VARINT_MAX_LEN;
     }
 
-    *(int *)buff = need_size;
-    buff += pkg_size;
+    if (task->seq)
+    {
+        flags |= TASK_F_SEQ;
+        need += DFS_VARINT_MAX_LEN;
+    }
 
-    memcpy(buff, task, task_size);
-    buff += task_size;
+    if (task->master_nodeid)
+    {
+        flags |= TASK_F_MASTER;
+        need += DFS_VARINT_MAX_LEN;
+    }
 
-    *(int *)buff = task->data_len;
-    buff += data_size;
+    if (key_len)
+    {
+        flags |= TASK_F_KEY;
+        need += DFS_VARINT_MAX_LEN + key_len;
+    }
 
-    if (task->data_len > 0) 
+    if (user_len)
     {
-        memcpy(buff, task->data, task->data_len);
+        flags |= TASK_F_USER;
+        need += DFS_VARINT_MAX_LEN + user_len;
     }
 
-    return need_size;
+    if (group_len)
+    {
+        flags |= TASK_F_GROUP;
+        need += DFS_VARINT_MAX_LEN + group_len;
+    }
+
+    if (task->permission)
+    {
+        flags |= TASK_F_PERMISSION;
+        need += DFS_VARINT_MAX_LEN;
+    }
+
+    if (task->data_len > 0)
+    {
+        flags |= TASK_F_DATA;
+        need += DFS_VARINT_MAX_LEN + task->data_len;
+    }
+
+    // need is the worst case, only check it exactly when it is close
+    if ((size_t)len < need)
+    {
+        need = TASK_WIRE_HDR_LEN + dfs_varint_len(task->cmd)
+            + dfs_varint_len(flags)
+            + (flags & TASK_F_RET ? dfs_varint_len(dfs_zigzag_encode(task->ret)) : 0)
+            + (flags & TASK_F_SEQ ? dfs_varint_len(task->seq) : 0)
+            + (flags & TASK_F_MASTER
+                ? dfs_varint_len(dfs_zigzag_encode(task->master_nodeid)) : 0)
+            + (key_len ? dfs_varint_len(key_len) + key_len : 0)
+            + (user_len ? dfs_varint_len(user_len) + user_len : 0)
+            + (group_len ? dfs_varint_len(group_len) + group_len : 0)
+            + (flags & TASK_F_PERMISSION
+                ? dfs_varint_len((uint16_t)task->permission) : 0)
+            + (task->data_len > 0
+                ? dfs_varint_len(task->data_len) + task->data_len : 0);
+
+        if ((size_t)len < need)
+        {
+            return TASK_EAGIN;
+        }
+    }
+
+    p = (uchar_t *)buff + sizeof(int);
+    *p++ = TASK_WIRE_VERSION;
+    p = dfs_varint_encode(p, task->cmd);
+    p = dfs_varint_encode(p, flags);
+
+    if (flags & TASK_F_RET)
+    {
+        p = dfs_varint_encode(p, dfs_zigzag_encode(task->ret));
+    }
+
+    if (flags & TASK_F_SEQ)
+    {
+        p = dfs_varint_encode(p, task->seq);
+    }
+
+    if (flags & TASK_F_MASTER)
+    {
+        p = dfs_varint_encode(p, dfs_zigzag_encode(task->master_nodeid));
+    }
+
+    if (flags & TASK_F_KEY)
+    {
+        p = task_put_bytes(p, task->key, key_len);
+    }
+
+    if (flags & TASK_F_USER)
+    {
+        p = task_put_bytes(p, task->user, user_len);
+    }
+
+    if (flags & TASK_F_GROUP)
+    {
+        p = task_put_bytes(p, task->group, group_len);
+    }
+
+    if (flags & TASK_F_PERMISSION)
+    {
+        p = dfs_varint_encode(p, (uint16_t)task->permission);
+    }
+
+    if (flags & TASK_F_DATA)
+    {
+        p = task_put_bytes(p, task->data, task->data_len);
+    }
+
+    *(int *)buff = (int)(p - (uchar_t *)buff);
+
+    return *(int *)buff;
 }
 
+/*
+ * the packet length, TASK_EAGIN if it is not all in buff yet and
+ * TASK_ERROR if it is malformed. task->data points into buff, the
+ * strings are copied into task, opq is kept
+ */
 int task_decodefstr(char *buff, int len, task_t *task)
 {
-    void *data = task->opq;
-    int need_size = *(int *)buff;
-    int pkg_size = (int)sizeof(int);
-    int task_size = sizeof(task_t);
-    int data_size = (int)sizeof(int);
+    void     *opq = task->opq;
+    uchar_t  *p = (uchar_t *)buff;
+    uchar_t  *end = nullptr;
+    uchar_t  *data = nullptr;
+    size_t    data_len = 0;
+    uint64_t  v = 0;
+    uint64_t  flags = 0;
+    int       need_size = 0;
+
+    if (len < (int)sizeof(int))
+    {
+        return TASK_EAGIN;
+    }
+
+    need_size = *(int *)buff;
+    if (need_size < TASK_WIRE_HDR_LEN + 2)
+    {
+        return TASK_ERROR;
+    }
 
     if (len < need_size)
     {
         return TASK_EAGIN;
     }
 
-    buff += pkg_size;
+    end = p + need_size;
+    p += sizeof(int);
+
+    if (*p++ != TASK_WIRE_VERSION)
+    {
+        return TASK_ERROR;
+    }
+
+    task->ret = 0;
+    task->seq = 0;
+    task->master_nodeid = 0;
+    task->key[0] = '\0';
+    task->user[0] = '\0';
+    task->group[0] = '\0';
+    task->permission = 0;
+    task->data_len = 0;
+    task->data = nullptr;
+    task->opq = opq;
 
-    memcpy(task, buff, task_size);
-    buff += task_size;
+    if (!(p = dfs_varint_decode(p, end, &v)))
+    {
+        return TASK_ERROR;
+    }
 
-    int data_len = *(int *)buff;
-    buff += data_size;
+    task->cmd = (cmd_t)v;
 
-    if (data_len > 0)
+    if (!(p = dfs_varint_decode(p, end, &flags)))
     {
-        task->data = buff;
+        return TASK_ERROR;
     }
 
-	task->opq = data;
+    if (flags & TASK_F_RET)
+    {
+        if (!(p = dfs_varint_decode(p, end, &v)))
+        {
+            return TASK_ERROR;
+        }
+
+        task->ret = (int)dfs_zigzag_decode(v);
+    }
+
+    if (flags & TASK_F_SEQ)
+    {
+        if (!(p = dfs_varint_decode(p, end, &v)))
+        {
+            return TASK_ERROR;
+        }
+
+        task->seq = (uint32_t)v;
+    }
+
+    if (flags & TASK_F_MASTER)
+    {
+        if (!(p = dfs_varint_decode(p, end, &v)))
+        {
+            return TASK_ERROR;
+        }
+
+        task->master_nodeid = (int)dfs_zigzag_decode(v);
+    }
+
+    if ((flags & TASK_F_KEY)
+        && !(p = task_get_str(p, end, task->key, KEY_LEN)))
+    {
+        return TASK_ERROR;
+    }
+
+    if ((flags & TASK_F_USER)
+        && !(p = task_get_str(p, end, task->user, OWNER_LEN)))
+    {
+        return TASK_ERROR;
+    }
+
+    if ((flags & TASK_F_GROUP)
+        && !(p = task_get_str(p, end, task->group, GROUP_LEN)))
+    {
+        return TASK_ERROR;
+    }
+
+    if (flags & TASK_F_PERMISSION)
+    {
+        if (!(p = dfs_varint_decode(p, end, &v)))
+        {
+            return TASK_ERROR;
+        }
+
+        task->permission = (short)v;
+    }
+
+    if (flags & TASK_F_DATA)
+    {
+        p = task_get_bytes(p, end, (size_t)(end - p), &data, &data_len);
+        if (!p)
+        {
+            return TASK_ERROR;
+        }
+
+        task->data = data;
+        task->data_len = (int)data_len;
+    }
 
     return need_size;
 }
-
@@ -14,6 +14,25 @@
 #define OWNER_LEN 16
 #define GROUP_LEN 16
 
+/*
+ * wire format of a task: the int length of the whole packet, as before,
+ * then TASK_WIRE_VERSION, the cmd and a bitmap of the TASK_F_* fields
+ * that follow, all varints. only fields that are set are sent, strings
+ * and data as a varint length and the bytes. a decoder stops at the
+ * last field it knows, so new fields go at the end with a new bit
+ */
+#define TASK_WIRE_VERSION 1
+#define TASK_WIRE_HDR_LEN ((int)sizeof(int) + 1)
+
+#define TASK_F_RET        0x01
+#define TASK_F_SEQ        0x02
+#define TASK_F_MASTER     0x04
+#define TASK_F_KEY        0x08
+#define TASK_F_USER       0x10
+#define TASK_F_GROUP      0x20
+#define TASK_F_PERMISSION 0x40
+#define TASK_F_DATA       0x80
+
 typedef struct task_s
 {
 	cmd_t     cmd; // 命令
@@ -33,6 +33,10 @@ typedef enum
     DN_DEL_BLK,
     DN_DEL_BLK_REPORT,
     DN_BLK_REPORT,
+    NN_RENAME,
+    NN_LS_PAGE,
+    NN_READ_BARRIER, // namenodes only, a no-op edit to read behind
+    NN_BATCH, // several edits in one request, see batch_op_t
 } cmd_t;
 
 typedef enum
@@ -50,7 +54,8 @@ typedef enum
     NOT_DIRECTORY = -20,
     NOT_FILE = -21,
     IN_SAFE_MODE = -4,
-    NOT_DATANODE
+    NOT_DATANODE,
+    CROSS_GROUP = -18 // spans the subtrees of two paxos groups
 } opt_err;
 
 typedef enum
@@ -82,6 +87,68 @@ typedef struct create_resp_info_s
     int      total_blk;
 } create_resp_info_t;
 
+#define LS_PAGE_MAX_ENTRIES 1024
+#define LS_NAME_LEN         256
+
+// NN_LS_PAGE request, lists the entries after start_after
+// (from the first one if after_len is 0)
+typedef struct ls_page_req_s
+{
+	uint32_t max_entries;
+	uint32_t after_len;
+	char     start_after[LS_NAME_LEN];
+} ls_page_req_t;
+
+// NN_LS_PAGE reply head, num ls_entry_t follow, each followed by
+// name_len bytes of name. more is set if the listing goes on. a file
+// lists as one entry with no name
+typedef struct ls_page_resp_s
+{
+	uint32_t num;
+	uint32_t more;
+} ls_page_resp_t;
+
+typedef struct ls_entry_s
+{
+	uint64_t length;
+	uint64_t modification_time;
+	uint16_t name_len;
+	uint16_t is_directory;
+} ls_entry_t;
+
+#define BATCH_MAX_OPS 1024
+
+// NN_BATCH request, num batch_op_t follow, each followed by key_len
+// bytes of key and data_len bytes of the data the op takes alone. ops
+// may be NN_MKDIR, NN_RMR, NN_CREATE, NN_CLOSE and NN_RM, they run in
+// order as the task's user and group
+typedef struct batch_req_s
+{
+	uint32_t num;
+} batch_req_t;
+
+typedef struct batch_op_s
+{
+	int32_t  cmd;
+	int16_t  permission;
+	uint16_t key_len;
+	uint32_t data_len;
+} batch_op_t;
+
+// NN_BATCH reply, num batch_res_t in the order of the ops, each
+// followed by data_len bytes of the data the op replies alone
+typedef struct batch_resp_s
+{
+	uint32_t num;
+} batch_resp_t;
+
+typedef struct batch_res_s
+{
+	int32_t  ret;
+	int32_t  master_nodeid;
+	uint32_t data_len;
+} batch_res_t;
+
 typedef struct report_blk_info_s
 {
 	uint64_t blk_id;
@@ -0,0 +1,556 @@
+#include "dfs_btree.h"
+#include "dfs_memory.h"
+
+#define btree_children(n) ((dfs_btree_node_t **)((n)->items + (n)->cap))
+
+#define BTREE_MAX_DEPTH 16
+
+/*
+ * nodes a split needs, taken before the leaf changes so an insert that 
+ * fails leaves the tree as it was. full counts the full inner nodes 
+ * right above the current one, a split climbs through all of them.
+ */
+typedef struct btree_spare_s
+{
+    dfs_btree_node_t *nodes[BTREE_MAX_DEPTH + 1];
+    int               num;
+    int               used;
+    int               depth;
+    int               full;
+} btree_spare_t;
+
+static size_t btree_node_size(int leaf, uint16_t cap)
+{
+    return sizeof(dfs_btree_node_t) + cap * sizeof(void *) * (leaf ? 1 : 2);
+}
+
+static dfs_btree_node_t *btree_node_new(int leaf, uint16_t cap)
+{
+    dfs_btree_node_t *n = nullptr;
+
+    n = (dfs_btree_node_t *)memory_calloc(btree_node_size(leaf, cap));
+    if (!n)
+	{
+        return nullptr;
+    }
+
+    n->leaf = leaf;
+    n->cap = cap;
+
+    return n;
+}
+
+static void btree_node_free(dfs_btree_node_t *n)
+{
+    if (n->leaf)
+	{
+        if (n->prev)
+		{
+            n->prev->next = n->next;
+        }
+
+        if (n->next)
+		{
+            n->next->prev = n->prev;
+        }
+    }
+
+    memory_free(n, btree_node_size(n->leaf, n->cap));
+}
+
+// first position whose item is >= key
+static int btree_leaf_lower(dfs_btree_t *bt, dfs_btree_node_t *n,
+                            const void *key, int *found)
+{
+    int lo = 0;
+    int hi = n->num;
+
+    while (lo < hi)
+	{
+        int mid = (lo + hi) / 2;
+
+        if (bt->cmp(key, n->items[mid]) > 0)
+		{
+            lo = mid + 1;
+        }
+		else
+		{
+            hi = mid;
+        }
+    }
+
+    *found = lo < n->num && bt->cmp(key, n->items[lo]) == 0;
+
+    return lo;
+}
+
+// first position whose item is > key
+static int btree_leaf_upper(dfs_btree_t *bt, dfs_btree_node_t *n,
+                            const void *key)
+{
+    int lo = 0;
+    int hi = n->num;
+
+    while (lo < hi)
+	{
+        int mid = (lo + hi) / 2;
+
+        if (bt->cmp(key, n->items[mid]) >= 0)
+		{
+            lo = mid + 1;
+        }
+		else
+		{
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// the child whose range holds key
+static int btree_inner_child(dfs_btree_t *bt, dfs_btree_node_t *n,
+                             const void *key)
+{
+    int lo = 1;
+    int hi = n->num;
+
+    while (lo < hi)
+	{
+        int mid = (lo + hi) / 2;
+
+        if (bt->cmp(key, n->items[mid]) >= 0)
+		{
+            lo = mid + 1;
+        }
+		else
+		{
+            hi = mid;
+        }
+    }
+
+    return lo - 1;
+}
+
+static void *btree_min(dfs_btree_node_t *n)
+{
+    while (!n->leaf)
+	{
+        n = btree_children(n)[0];
+    }
+
+    return n->items[0];
+}
+
+static void btree_spare_free(btree_spare_t *sp)
+{
+    while (sp->num > sp->used)
+	{
+        btree_node_free(sp->nodes[--sp->num]);
+    }
+}
+
+// a leaf for the leaf split, then one inner node per level it climbs
+static int btree_spare_alloc(btree_spare_t *sp)
+{
+    int need = 1 + sp->full + (sp->full == sp->depth ? 1 : 0);
+
+    if (need > BTREE_MAX_DEPTH + 1)
+	{
+        return DFS_BTREE_ERROR;
+    }
+
+    for (sp->num = 0; sp->num < need; sp->num++)
+	{
+        sp->nodes[sp->num] = btree_node_new(sp->num == 0, DFS_BTREE_ORDER);
+        if (!sp->nodes[sp->num])
+		{
+            btree_spare_free(sp);
+
+            return DFS_BTREE_ERROR;
+        }
+    }
+
+    return DFS_BTREE_OK;
+}
+
+static int btree_leaf_insert(dfs_btree_t *bt, dfs_btree_node_t **pnode,
+                             const void *key, void *item,
+                             dfs_btree_node_t **right, void **sep,
+                             btree_spare_t *sp)
+{
+    dfs_btree_node_t *n = *pnode;
+    int               found = 0;
+    int               pos = btree_leaf_lower(bt, n, key, &found);
+
+    if (found)
+	{
+        return DFS_BTREE_EXIST;
+    }
+
+    if (n->num == n->cap && n->cap < DFS_BTREE_ORDER)
+	{
+        uint16_t cap = n->cap * 2;
+
+        if (cap > DFS_BTREE_ORDER)
+		{
+            cap = DFS_BTREE_ORDER;
+        }
+
+        dfs_btree_node_t *nn = (dfs_btree_node_t *)memory_realloc(n,
+            btree_node_size(1, cap));
+        if (!nn)
+		{
+            return DFS_BTREE_ERROR;
+        }
+
+        nn->cap = cap;
+
+        if (nn->prev)
+		{
+            nn->prev->next = nn;
+        }
+
+        if (nn->next)
+		{
+            nn->next->prev = nn;
+        }
+
+        *pnode = n = nn;
+    }
+	else if (n->num == n->cap)
+	{
+        int               half = n->cap / 2;
+        dfs_btree_node_t *r = nullptr;
+
+        if (btree_spare_alloc(sp) != DFS_BTREE_OK)
+		{
+            return DFS_BTREE_ERROR;
+        }
+
+        r = sp->nodes[sp->used++];
+
+        memory_memcpy(r->items, n->items + half,
+            (n->num - half) * sizeof(void *));
+        r->num = n->num - half;
+        n->num = half;
+
+        r->prev = n;
+        r->next = n->next;
+
+        if (n->next)
+		{
+            n->next->prev = r;
+        }
+
+        n->next = r;
+        *right = r;
+
+        if (pos > half)
+		{
+            n = r;
+            pos -= half;
+        }
+    }
+
+    memmove(n->items + pos + 1, n->items + pos,
+        (n->num - pos) * sizeof(void *));
+    n->items[pos] = item;
+    n->num++;
+
+    if (*right)
+	{
+        *sep = (*right)->items[0];
+    }
+
+    return DFS_BTREE_OK;
+}
+
+// on a split *right is the new right sibling and *sep its smallest item
+static int btree_node_insert(dfs_btree_t *bt, dfs_btree_node_t **pnode,
+                             const void *key, void *item,
+                             dfs_btree_node_t **right, void **sep,
+                             btree_spare_t *sp)
+{
+    dfs_btree_node_t *n = *pnode;
+    dfs_btree_node_t *cr = nullptr;
+    void             *csep = nullptr;
+    int               rc = 0;
+
+    if (n->leaf)
+	{
+        return btree_leaf_insert(bt, pnode, key, item, right, sep, sp);
+    }
+
+    int i = btree_inner_child(bt, n, key);
+
+    sp->depth++;
+    sp->full = n->num == n->cap ? sp->full + 1 : 0;
+
+    rc = btree_node_insert(bt, &btree_children(n)[i], key, item, &cr, &csep,
+        sp);
+    if (rc != DFS_BTREE_OK || !cr)
+	{
+        return rc;
+    }
+
+    // the new child goes right after child i
+    int pos = i + 1;
+
+    if (n->num == n->cap)
+	{
+        int               half = n->cap / 2;
+        dfs_btree_node_t *r = sp->nodes[sp->used++];
+
+        memory_memcpy(r->items, n->items + half,
+            (n->num - half) * sizeof(void *));
+        memory_memcpy(btree_children(r), btree_children(n) + half,
+            (n->num - half) * sizeof(dfs_btree_node_t *));
+        r->num = n->num - half;
+        n->num = half;
+
+        *right = r;
+        *sep = r->items[0];
+
+        if (pos > half)
+		{
+            n = r;
+            pos -= half;
+        }
+    }
+
+    memmove(n->items + pos + 1, n->items + pos,
+        (n->num - pos) * sizeof(void *));
+    memmove(btree_children(n) + pos + 1, btree_children(n) + pos,
+        (n->num - pos) * sizeof(dfs_btree_node_t *));
+    n->items[pos] = csep;
+    btree_children(n)[pos] = cr;
+    n->num++;
+
+    return DFS_BTREE_OK;
+}
+
+void dfs_btree_init(dfs_btree_t *bt, DFS_BTREE_CMP *cmp)
+{
+    bt->root = nullptr;
+    bt->cmp = cmp;
+    bt->num = 0;
+}
+
+static void btree_node_destroy(dfs_btree_node_t *n)
+{
+    if (!n->leaf)
+	{
+        for (int i = 0; i < n->num; i++)
+		{
+            btree_node_destroy(btree_children(n)[i]);
+        }
+    }
+
+    memory_free(n, btree_node_size(n->leaf, n->cap));
+}
+
+// frees the nodes, the items are the caller's
+void dfs_btree_destroy(dfs_btree_t *bt)
+{
+    if (bt->root)
+	{
+        btree_node_destroy(bt->root);
+    }
+
+    bt->root = nullptr;
+    bt->num = 0;
+}
+
+int dfs_btree_insert(dfs_btree_t *bt, const void *key, void *item)
+{
+    dfs_btree_node_t *right = nullptr;
+    void             *sep = nullptr;
+    int               rc = 0;
+    btree_spare_t     sp;
+
+    memory_zero(&sp, sizeof(sp));
+
+    if (!bt->root)
+	{
+        bt->root = btree_node_new(1, DFS_BTREE_ROOT_CAP);
+        if (!bt->root)
+		{
+            return DFS_BTREE_ERROR;
+        }
+    }
+
+    rc = btree_node_insert(bt, &bt->root, key, item, &right, &sep, &sp);
+    if (rc != DFS_BTREE_OK)
+	{
+        return rc;
+    }
+
+    if (right)
+	{
+        // the split reached the root, its spare was taken up front
+        dfs_btree_node_t *root = sp.nodes[sp.used++];
+
+        btree_children(root)[0] = bt->root;
+        btree_children(root)[1] = right;
+        root->items[1] = sep;
+        root->num = 2;
+
+        bt->root = root;
+    }
+
+    bt->num++;
+
+    return DFS_BTREE_OK;
+}
+
+// nodes left empty are freed, underfull ones are not merged
+static void *btree_node_remove(dfs_btree_t *bt, dfs_btree_node_t *n,
+                               const void *key)
+{
+    void *item = nullptr;
+    int   found = 0;
+
+    if (n->leaf)
+	{
+        int pos = btree_leaf_lower(bt, n, key, &found);
+        if (!found)
+		{
+            return nullptr;
+        }
+
+        item = n->items[pos];
+
+        memmove(n->items + pos, n->items + pos + 1,
+            (n->num - pos - 1) * sizeof(void *));
+        n->num--;
+
+        return item;
+    }
+
+    int               i = btree_inner_child(bt, n, key);
+    dfs_btree_node_t *child = btree_children(n)[i];
+
+    item = btree_node_remove(bt, child, key);
+    if (!item)
+	{
+        return nullptr;
+    }
+
+    if (child->num == 0)
+	{
+        btree_node_free(child);
+
+        memmove(n->items + i, n->items + i + 1,
+            (n->num - i - 1) * sizeof(void *));
+        memmove(btree_children(n) + i, btree_children(n) + i + 1,
+            (n->num - i - 1) * sizeof(dfs_btree_node_t *));
+        n->num--;
+    }
+	else if (i > 0)
+	{
+        // the separator may have been the removed item
+        n->items[i] = btree_min(child);
+    }
+
+    return item;
+}
+
+void *dfs_btree_remove(dfs_btree_t *bt, const void *key)
+{
+    void *item = nullptr;
+
+    if (!bt->root)
+	{
+        return nullptr;
+    }
+
+    item = btree_node_remove(bt, bt->root, key);
+    if (!item)
+	{
+        return nullptr;
+    }
+
+    bt->num--;
+
+    if (bt->root->num == 0)
+	{
+        btree_node_free(bt->root);
+        bt->root = nullptr;
+
+        return item;
+    }
+
+    while (!bt->root->leaf && bt->root->num == 1)
+	{
+        dfs_btree_node_t *old = bt->root;
+
+        bt->root = btree_children(old)[0];
+        btree_node_free(old);
+    }
+
+    return item;
+}
+
+void *dfs_btree_find(dfs_btree_t *bt, const void *key)
+{
+    dfs_btree_node_t *n = bt->root;
+    int               found = 0;
+
+    if (!n)
+	{
+        return nullptr;
+    }
+
+    while (!n->leaf)
+	{
+        n = btree_children(n)[btree_inner_child(bt, n, key)];
+    }
+
+    int pos = btree_leaf_lower(bt, n, key, &found);
+
+    return found ? n->items[pos] : nullptr;
+}
+
+// position cur on the first item after key, or the first item if key
+// is nullptr
+void dfs_btree_seek(dfs_btree_t *bt, const void *key,
+                    dfs_btree_cursor_t *cur)
+{
+    dfs_btree_node_t *n = bt->root;
+
+    cur->leaf = nullptr;
+    cur->pos = 0;
+
+    if (!n)
+	{
+        return;
+    }
+
+    while (!n->leaf)
+	{
+        n = btree_children(n)[key ? btree_inner_child(bt, n, key) : 0];
+    }
+
+    cur->leaf = n;
+    cur->pos = key ? btree_leaf_upper(bt, n, key) : 0;
+}
+
+// the item under cur, nullptr at the end. the tree must not change
+// between seek and next
+void *dfs_btree_next(dfs_btree_cursor_t *cur)
+{
+    while (cur->leaf && cur->pos >= cur->leaf->num)
+	{
+        cur->leaf = cur->leaf->next;
+        cur->pos = 0;
+    }
+
+    if (!cur->leaf)
+	{
+        return nullptr;
+    }
+
+    return cur->leaf->items[cur->pos++];
+}
+
@@ -0,0 +1,63 @@
+#ifndef DFS_BTREE_H
+#define DFS_BTREE_H
+
+#include "dfs_types.h"
+
+#define DFS_BTREE_ORDER    64  // max items or children per node
+#define DFS_BTREE_ROOT_CAP 4   // a lone root leaf starts this small
+
+#define DFS_BTREE_OK     0
+#define DFS_BTREE_ERROR -1
+#define DFS_BTREE_EXIST -2
+
+// compares a search key with an item, <0, 0, >0 like memcmp
+typedef int DFS_BTREE_CMP(const void *key, const void *item);
+
+typedef struct dfs_btree_node_s dfs_btree_node_t;
+
+/*
+ * leaves hold the sorted items and are chained for scans. inner nodes
+ * hold num children after the items, items[i] is the smallest item
+ * below child i, items[0] is not used.
+ */
+struct dfs_btree_node_s
+{
+    dfs_btree_node_t *prev;  // leaves only
+    dfs_btree_node_t *next;
+    uint16_t          leaf;
+    uint16_t          num;
+    uint16_t          cap;
+    void             *items[0];
+};
+
+/*
+ * b+tree of caller owned items, kept in cmp order. nodes are wide so a
+ * scan touches few cache lines, a small tree is a single leaf that
+ * grows from DFS_BTREE_ROOT_CAP. not locked, the owner serializes.
+ */
+typedef struct dfs_btree_s
+{
+    dfs_btree_node_t *root;
+    DFS_BTREE_CMP    *cmp;
+    uint64_t          num;
+} dfs_btree_t;
+
+typedef struct dfs_btree_cursor_s
+{
+    dfs_btree_node_t *leaf;
+    int               pos;
+} dfs_btree_cursor_t;
+
+void  dfs_btree_init(dfs_btree_t *bt, DFS_BTREE_CMP *cmp);
+void  dfs_btree_destroy(dfs_btree_t *bt);
+int   dfs_btree_insert(dfs_btree_t *bt, const void *key, void *item);
+void *dfs_btree_remove(dfs_btree_t *bt, const void *key);
+void *dfs_btree_find(dfs_btree_t *bt, const void *key);
+void  dfs_btree_seek(dfs_btree_t *bt, const void *key,
+    dfs_btree_cursor_t *cur);
+void *dfs_btree_next(dfs_btree_cursor_t *cur);
+
+#define dfs_btree_count(bt) ((bt)->num)
+
+#endif
+
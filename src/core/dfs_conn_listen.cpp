@@ -74,6 +74,16 @@ int conn_listening_open(array_t *listening, log_t *log)
                 goto error;
             }
 
+            if (ls[i].reuseport && setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+                (const void *) &reuseaddr, sizeof(int)) == NGX_ERROR)
+            {
+                dfs_log_error(log, DFS_LOG_ERROR, errno,
+                    "conn_listening_open: SO_REUSEPORT %V failed",
+                    &ls[i].addr_text);
+				
+                goto error;
+            }
+
             if (ls[i].rcvbuf != -1) 
 			{
                 if (setsockopt(s, SOL_SOCKET, SO_RCVBUF,
@@ -33,6 +33,7 @@ struct listening_s
     uint32_t               linger:1; 
     uint32_t               inherited:1;  //说明是热升级过程
     uint32_t               listen:1;  //1：已开始监听
+    uint32_t               reuseport:1;  // one of several sockets on the port, kernel spreads accepts
 };
 
 int conn_listening_open(array_t *listening, log_t *log);
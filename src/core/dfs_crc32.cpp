@@ -0,0 +1,66 @@
+#include <pthread.h>
+
+#include "dfs_crc32.h"
+
+#define CRC32C_POLY 0x82f63b78  // reflected
+
+static uint32_t       crc32c_table[4][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init()
+{
+    for (uint32_t i = 0; i < 256; i++)
+	{
+        uint32_t c = i;
+
+        for (int k = 0; k < 8; k++)
+		{
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+
+        crc32c_table[0][i] = c;
+    }
+
+    for (uint32_t i = 0; i < 256; i++)
+	{
+        uint32_t c = crc32c_table[0][i];
+
+        for (int t = 1; t < 4; t++)
+		{
+            c = crc32c_table[0][c & 0xff] ^ (c >> 8);
+            crc32c_table[t][i] = c;
+        }
+    }
+}
+
+// four bytes per step, little endian loads
+uint32_t dfs_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    const uchar_t *p = (const uchar_t *)buf;
+
+    pthread_once(&crc32c_once, crc32c_init);
+
+    crc = ~crc;
+
+    while (len >= 4)
+	{
+        crc ^= (uint32_t)p[0] | (uint32_t)p[1] << 8
+            | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+
+        crc = crc32c_table[3][crc & 0xff]
+            ^ crc32c_table[2][(crc >> 8) & 0xff]
+            ^ crc32c_table[1][(crc >> 16) & 0xff]
+            ^ crc32c_table[0][crc >> 24];
+
+        p += 4;
+        len -= 4;
+    }
+
+    while (len--)
+	{
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
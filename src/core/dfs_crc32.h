@@ -0,0 +1,10 @@
+#ifndef DFS_CRC32_H
+#define DFS_CRC32_H
+
+#include "dfs_types.h"
+
+// crc32c (castagnoli), pass 0 as crc for the first chunk
+uint32_t dfs_crc32c(uint32_t crc, const void *buf, size_t len);
+
+#endif
+
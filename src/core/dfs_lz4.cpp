@@ -0,0 +1,232 @@
+#include <string.h>
+
+#include "dfs_lz4.h"
+
+#define LZ4_MINMATCH     4
+#define LZ4_LASTLITERALS 5   // the block ends with this many literals
+#define LZ4_MFLIMIT      12  // no match starts closer to the end
+#define LZ4_HASH_LOG     12
+#define LZ4_MAX_DISTANCE 65535
+
+static inline uint32_t lz4_read32(const uchar_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static uchar_t *lz4_put_len(uchar_t *op, size_t n)
+{
+    while (n >= 255)
+	{
+        *op++ = 255;
+        n -= 255;
+    }
+
+    *op++ = (uchar_t)n;
+
+    return op;
+}
+
+// returns the compressed length, 0 if it does not fit in cap
+size_t dfs_lz4_compress(const uchar_t *src, size_t len,
+                        uchar_t *dst, size_t cap)
+{
+    uint32_t       table[1 << LZ4_HASH_LOG];
+    const uchar_t *ip = src;
+    const uchar_t *anchor = src;
+    const uchar_t *end = src + len;
+    uchar_t       *op = dst;
+    uchar_t       *oend = dst + cap;
+    size_t         lit = 0;
+
+    memset(table, 0, sizeof(table));
+
+    if (len > LZ4_MFLIMIT)
+	{
+        const uchar_t *mflimit = end - LZ4_MFLIMIT;
+        const uchar_t *mlimit = end - LZ4_LASTLITERALS;
+
+        while (ip < mflimit)
+		{
+            uint32_t       h = lz4_hash(lz4_read32(ip));
+            const uchar_t *ref = src + table[h];
+
+            table[h] = (uint32_t)(ip - src);
+
+            if (ref >= ip || ip - ref > LZ4_MAX_DISTANCE
+                || lz4_read32(ref) != lz4_read32(ip))
+			{
+                ip++;
+
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1])
+			{
+                ip--;
+                ref--;
+            }
+
+            const uchar_t *mstart = ip;
+            size_t         off = ip - ref;
+
+            ip += LZ4_MINMATCH;
+            ref += LZ4_MINMATCH;
+
+            while (ip < mlimit && *ip == *ref)
+			{
+                ip++;
+                ref++;
+            }
+
+            lit = mstart - anchor;
+            size_t mlen = ip - mstart - LZ4_MINMATCH;
+
+            if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit + 2
+                + mlen / 255 + 1)
+			{
+                return 0;
+            }
+
+            uchar_t *token = op++;
+
+            *token = (uchar_t)((lit >= 15 ? 15 : lit) << 4);
+            if (lit >= 15)
+			{
+                op = lz4_put_len(op, lit - 15);
+            }
+
+            memcpy(op, anchor, lit);
+            op += lit;
+
+            *op++ = (uchar_t)off;
+            *op++ = (uchar_t)(off >> 8);
+
+            *token |= (uchar_t)(mlen >= 15 ? 15 : mlen);
+            if (mlen >= 15)
+			{
+                op = lz4_put_len(op, mlen - 15);
+            }
+
+            anchor = ip;
+        }
+    }
+
+    lit = end - anchor;
+
+    if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit)
+	{
+        return 0;
+    }
+
+    *op++ = (uchar_t)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15)
+	{
+        op = lz4_put_len(op, lit - 15);
+    }
+
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return op - dst;
+}
+
+// returns the decoded length, -1 if src is corrupt or needs more than cap
+ssize_t dfs_lz4_decompress(const uchar_t *src, size_t len,
+                           uchar_t *dst, size_t cap)
+{
+    const uchar_t *ip = src;
+    const uchar_t *iend = src + len;
+    uchar_t       *op = dst;
+    uchar_t       *oend = dst + cap;
+    uchar_t        b = 0;
+
+    while (ip < iend)
+	{
+        uchar_t token = *ip++;
+        size_t  lit = token >> 4;
+
+        if (lit == 15)
+		{
+            do
+			{
+                if (ip >= iend)
+				{
+                    return -1;
+                }
+
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+		{
+            return -1;
+        }
+
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+
+        if (ip == iend)
+		{
+            break;
+        }
+
+        if (iend - ip < 2)
+		{
+            return -1;
+        }
+
+        size_t off = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+
+        if (off == 0 || off > (size_t)(op - dst))
+		{
+            return -1;
+        }
+
+        size_t mlen = token & 15;
+
+        if (mlen == 15)
+		{
+            do
+			{
+                if (ip >= iend)
+				{
+                    return -1;
+                }
+
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+
+        mlen += LZ4_MINMATCH;
+
+        if (mlen > (size_t)(oend - op))
+		{
+            return -1;
+        }
+
+        // the match may overlap what it produces
+        const uchar_t *ref = op - off;
+
+        while (mlen--)
+		{
+            *op++ = *ref++;
+        }
+    }
+
+    return op - dst;
+}
+
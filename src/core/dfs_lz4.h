@@ -0,0 +1,19 @@
+#ifndef DFS_LZ4_H
+#define DFS_LZ4_H
+
+#include "dfs_types.h"
+
+// worst case compressed size of n bytes
+#define dfs_lz4_bound(n) ((n) + (n) / 255 + 16)
+
+/*
+ * lz4 block format, greedy single pass. what it writes any lz4 block
+ * decoder reads and the other way round.
+ */
+size_t dfs_lz4_compress(const uchar_t *src, size_t len,
+    uchar_t *dst, size_t cap);
+ssize_t dfs_lz4_decompress(const uchar_t *src, size_t len,
+    uchar_t *dst, size_t cap);
+
+#endif
+
@@ -0,0 +1,143 @@
+#include "dfs_name_arena.h"
+#include "dfs_memory.h"
+
+// slot size of a name of len bytes plus its nul
+#define name_slot_size(len) \
+    (((len) + 1 + DFS_NAME_ARENA_ALIGN - 1) & ~(DFS_NAME_ARENA_ALIGN - 1))
+#define name_slot_class(sz) ((sz) / DFS_NAME_ARENA_ALIGN - 1)
+
+static char *name_chunk_alloc(dfs_name_arena_t *arena, size_t sz);
+
+dfs_name_arena_t *dfs_name_arena_create(size_t chunk_size)
+{
+    dfs_name_arena_t *arena = nullptr;
+
+    arena = (dfs_name_arena_t *)memory_calloc(sizeof(dfs_name_arena_t));
+    if (!arena)
+	{
+        return nullptr;
+    }
+
+    arena->chunk_size = chunk_size > DFS_NAME_ARENA_MAX_LEN
+        ? chunk_size : DFS_NAME_ARENA_CHUNK_SIZE;
+
+    pthread_mutex_init(&arena->lock, nullptr);
+
+    return arena;
+}
+
+void dfs_name_arena_destroy(dfs_name_arena_t *arena)
+{
+    dfs_name_chunk_t *chunk = nullptr;
+    dfs_name_chunk_t *next = nullptr;
+
+    if (!arena)
+	{
+        return;
+    }
+
+    for (chunk = arena->chunks; chunk; chunk = next)
+	{
+        next = chunk->next;
+        memory_free(chunk, sizeof(dfs_name_chunk_t) + chunk->size);
+    }
+
+    pthread_mutex_destroy(&arena->lock);
+    memory_free(arena, sizeof(dfs_name_arena_t));
+}
+
+static char *name_chunk_alloc(dfs_name_arena_t *arena, size_t sz)
+{
+    dfs_name_chunk_t *chunk = arena->chunks;
+    char             *p = nullptr;
+
+    if (!chunk || chunk->size - chunk->used < sz)
+	{
+        chunk = (dfs_name_chunk_t *)memory_alloc(sizeof(dfs_name_chunk_t)
+            + arena->chunk_size);
+        if (!chunk)
+		{
+            return nullptr;
+        }
+
+        chunk->size = arena->chunk_size;
+        chunk->used = 0;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->total_size += chunk->size;
+    }
+
+    p = (char *)(chunk + 1) + chunk->used;
+    chunk->used += sz;
+
+    return p;
+}
+
+/*
+ * dfs_name_arena_dup - copies len bytes of name into the arena and
+ * nul terminates it. Returns nullptr if len is too long or on oom.
+ */
+char *dfs_name_arena_dup(dfs_name_arena_t *arena, const char *name,
+                         size_t len)
+{
+    size_t  sz = name_slot_size(len);
+    size_t  cls = 0;
+    char   *p = nullptr;
+
+    if (sz > DFS_NAME_ARENA_MAX_LEN)
+	{
+        return nullptr;
+    }
+
+    cls = name_slot_class(sz);
+
+    pthread_mutex_lock(&arena->lock);
+
+    if (arena->free_list[cls])
+	{
+        p = (char *)arena->free_list[cls];
+        arena->free_list[cls] = *(void **)p;
+    }
+	else
+	{
+        p = name_chunk_alloc(arena, sz);
+    }
+
+    if (p)
+	{
+        arena->used_size += sz;
+    }
+
+    pthread_mutex_unlock(&arena->lock);
+
+    if (!p)
+	{
+        return nullptr;
+    }
+
+    memory_memcpy(p, name, len);
+    p[len] = '\0';
+
+    return p;
+}
+
+// len must be the length the name was dup'ed with
+void dfs_name_arena_free(dfs_name_arena_t *arena, char *name, size_t len)
+{
+    size_t sz = name_slot_size(len);
+    size_t cls = name_slot_class(sz);
+
+    if (!name || sz > DFS_NAME_ARENA_MAX_LEN)
+	{
+        return;
+    }
+
+    pthread_mutex_lock(&arena->lock);
+
+    *(void **)name = arena->free_list[cls];
+    arena->free_list[cls] = name;
+    arena->used_size -= sz;
+
+    pthread_mutex_unlock(&arena->lock);
+}
+
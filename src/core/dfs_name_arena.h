@@ -0,0 +1,45 @@
+#ifndef DFS_NAME_ARENA_H
+#define DFS_NAME_ARENA_H
+
+#include <pthread.h>
+
+#include "dfs_types.h"
+
+#define DFS_NAME_ARENA_ALIGN      8
+#define DFS_NAME_ARENA_MAX_LEN    512
+#define DFS_NAME_ARENA_CHUNK_SIZE (1024 * 1024)
+#define DFS_NAME_ARENA_CLASS_N    (DFS_NAME_ARENA_MAX_LEN / DFS_NAME_ARENA_ALIGN)
+
+typedef struct dfs_name_chunk_s dfs_name_chunk_t;
+
+struct dfs_name_chunk_s
+{
+    dfs_name_chunk_t *next;
+    size_t            size;
+    size_t            used;
+};
+
+/*
+ * arena for short nul terminated strings, a name costs its length
+ * rounded up to 8 bytes, no per allocation header. freed slots are
+ * kept on a free list per size class and reused by names of the
+ * same class.
+ */
+typedef struct dfs_name_arena_s
+{
+    dfs_name_chunk_t *chunks;
+    size_t            chunk_size;
+    void             *free_list[DFS_NAME_ARENA_CLASS_N];
+    size_t            used_size;  // bytes handed out
+    size_t            total_size; // bytes held in chunks
+    pthread_mutex_t   lock;
+} dfs_name_arena_t;
+
+dfs_name_arena_t *dfs_name_arena_create(size_t chunk_size);
+void  dfs_name_arena_destroy(dfs_name_arena_t *arena);
+char *dfs_name_arena_dup(dfs_name_arena_t *arena, const char *name,
+    size_t len);
+void  dfs_name_arena_free(dfs_name_arena_t *arena, char *name, size_t len);
+
+#endif
+
@@ -1,14 +1,15 @@
+#include <unistd.h>
+#include <sys/eventfd.h>
+
 #include "dfs_notice.h"
 #include "dfs_conn.h"
 
-#define NOTICE_BUFF_SIZE 1024
-
 static void noice_read_event_handler(event_t *ev);
 
-// 进程间通信
+// 线程间通信
 // n -> tq_notice
 // data -> task queue
-// open channel and 分配 pfd
+// open eventfd
 // 添加 event 事件
 int notice_init(event_base_t *base, notice_t *n, 
 	              wake_up_hander handler, void *data)
@@ -16,24 +17,24 @@ int notice_init(event_base_t *base, notice_t *n,
     conn_t  *c = nullptr;
     event_t *rev = nullptr;
 
-    // pfd
-    if (pipe_open(&n->channel) != NGX_OK)
+    n->fd = eventfd(0, EFD_NONBLOCK);
+    if (n->fd == NGX_INVALID_FILE)
 	{
+        dfs_log_error(base->log, DFS_LOG_FATAL, errno, "eventfd failed");
+		
         return NGX_ERROR;
     }
     
-    c = conn_get_from_mem(n->channel.pfd[0]); // 0是读端
+    c = conn_get_from_mem(n->fd);
     if (!c) 
 	{
         goto error;
     }
 
-    // 设置非阻塞
-    conn_nonblocking(n->channel.pfd[0]);
-    conn_nonblocking(n->channel.pfd[1]);
+    n->pending = NGX_FALSE;
     n->call_back = handler; //do_paxos_task_handler // net_response_handler
     n->data = data; // task queue
-    n->wake_up = notice_wake_up; // 向channel 中发送一个 "c"
+    n->wake_up = notice_wake_up; // eventfd 计数加 1
     
     c->ev_base = base; //
     c->conn_data = n; // notice_t
@@ -55,7 +56,8 @@ int notice_init(event_base_t *base, notice_t *n,
     return NGX_OK;
     
 error:
-    pipe_close(&n->channel);
+    close(n->fd);
+    n->fd = NGX_INVALID_FILE;
     
     if (c) 
 	{
@@ -65,10 +67,18 @@ error:
     return NGX_ERROR;
 }
 
-// 向channel 中发送一个 "c"
+// eventfd 计数加 1, 已经有一个没读的就不再写
 int notice_wake_up(notice_t *n)
 {
-    if (dfs_write_fd(n->channel.pfd[1], "C", 1) == NGX_ERROR) // 1 是写端
+    uint64_t count = 1;
+
+    if (n->pending || !__sync_bool_compare_and_swap(&n->pending, 
+        NGX_FALSE, NGX_TRUE)) 
+	{
+        return NGX_OK;
+    }
+
+    if (write(n->fd, &count, sizeof(count)) < 0) 
 	{
         if (errno != DFS_EAGAIN) 
 		{
@@ -81,45 +91,25 @@ int notice_wake_up(notice_t *n)
 }
 
 // 读事件发生后调用 n->call_back(n->data)
-
+// pending is cleared before the call back runs, so a task pushed while 
+// it drains signals again and is not left behind
 static void noice_read_event_handler(event_t *ev)
 {
     conn_t   *c = nullptr;
     notice_t *nt = nullptr;
-    uchar_t   buff[NOTICE_BUFF_SIZE];
-    int       n = 0;
-    char     *errmsg = nullptr;
+    uint64_t  count = 0;
     
     c = (conn_t *)ev->data;
     nt = (notice_t *)c->conn_data;
     
-    while (1) 
+    if (read(nt->fd, &count, sizeof(count)) < 0 && errno != DFS_EAGAIN) 
 	{
-        // read "c"
-        n = dfs_read_fd(nt->channel.pfd[0], buff, NOTICE_BUFF_SIZE);
-        if (n > 0 || (n < 0 && errno == DFS_EINTR)) 
-		{
-            continue;
-        }
-
-        if (n == 0) 
-		{
-            errmsg = (char *)"read 0 byte!";
-        } 
-		else if (errno != DFS_EAGAIN) 
-		{
-            errmsg = (char *)"notice read failed";
-        }
-        
-        break;
+        dfs_log_error(nt->log, DFS_LOG_FATAL, errno,
+            "eventfd fd[%d] notice read failed", nt->fd);
     }
 
-    if (errmsg) 
-	{
-        dfs_log_error(nt->log, DFS_LOG_FATAL, 0,
-                "pipe fd[%d] %s", nt->channel.pfd[0], errmsg);
-    }
+    __sync_lock_release(&nt->pending);
+    __sync_synchronize();
 	
     nt->call_back(nt->data);
 }
-
@@ -3,16 +3,21 @@
 
 #include "dfs_types.h"
 #include "dfs_event.h"
-#include "dfs_pipe.h"
 #include "dfs_epoll.h"
 
 typedef struct notice_s notice_t;
 typedef int  (*wake_up_ptr)(notice_t *n);
 typedef void (*wake_up_hander)(void *data);
 
+/*
+ * cross thread wake up on an eventfd. a wake up already pending is not
+ * signalled again, so producers finishing many tasks before the
+ * consumer runs cost one write and one read in all
+ */
 struct notice_s 
 {
-    pipe_t          channel; //
+    int             fd; // eventfd
+    volatile int    pending; // signalled and not read yet
     wake_up_ptr     wake_up; //
     wake_up_hander  call_back; //
     void           *data; //
@@ -0,0 +1,362 @@
+#include <assert.h>
+
+#include "dfs_shard_hashtable.h"
+#include "dfs_memory.h"
+#include "dfs_math.h"
+
+// spread the raw key hash before taking the shard bits, the bucket
+// index inside a shard is the raw hash modulo a prime
+static inline size_t shard_mix(size_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static size_t shard_num_round(size_t shard_num)
+{
+    size_t n = 1;
+
+    if (!shard_num)
+	{
+        shard_num = DFS_SHARD_HASHTABLE_DEFAULT_SHARDS;
+    }
+
+    if (shard_num > DFS_SHARD_HASHTABLE_MAX_SHARDS)
+	{
+        shard_num = DFS_SHARD_HASHTABLE_MAX_SHARDS;
+    }
+
+    while (n < shard_num)
+	{
+        n <<= 1;
+    }
+
+    return n;
+}
+
+/*
+ * dfs_shard_hashtable_create - creates shard_num (rounded up to a power
+ * of 2) hashtables of hash_sz / shard_num buckets each.
+ * Returns nullptr on error.
+ */
+dfs_shard_hashtable_t * dfs_shard_hashtable_create(DFS_HASHTABLE_CMP *cmp_func,
+                                                   size_t hash_sz,
+                                                   DFS_HASHTABLE_HASH *hash_func,
+                                                   dfs_mem_allocator_t *allocator,
+                                                   size_t shard_num)
+{
+    dfs_shard_hashtable_t *sht = nullptr;
+    size_t                 i = 0;
+    size_t                 shard_sz = 0;
+
+    sht = (dfs_shard_hashtable_t *)memory_calloc(sizeof(dfs_shard_hashtable_t));
+    if (!sht)
+	{
+        return nullptr;
+    }
+
+    sht->shard_num = shard_num_round(shard_num);
+    sht->hash = hash_func;
+    sht->allocator = allocator;
+
+    sht->shards = (dfs_hashtable_shard_t *)memory_calloc(
+        sht->shard_num * sizeof(dfs_hashtable_shard_t));
+    if (!sht->shards)
+	{
+        memory_free(sht, sizeof(dfs_shard_hashtable_t));
+
+        return nullptr;
+    }
+
+    shard_sz = hash_sz / sht->shard_num + 1;
+
+    for (i = 0; i < sht->shard_num; i++)
+	{
+        sht->shards[i].ht = dfs_hashtable_create(cmp_func, shard_sz,
+            hash_func, allocator);
+        if (!sht->shards[i].ht)
+		{
+            goto err_out;
+        }
+
+        pthread_rwlock_init(&sht->shards[i].rwlock, nullptr);
+    }
+
+    return sht;
+
+err_out:
+    while (i-- > 0)
+	{
+        pthread_rwlock_destroy(&sht->shards[i].rwlock);
+        dfs_hashtable_free_memory(sht->shards[i].ht);
+    }
+
+    memory_free(sht->shards, sht->shard_num * sizeof(dfs_hashtable_shard_t));
+    memory_free(sht, sizeof(dfs_shard_hashtable_t));
+
+    return nullptr;
+}
+
+void dfs_shard_hashtable_free_memory(dfs_shard_hashtable_t *sht)
+{
+    size_t i = 0;
+
+    if (!sht)
+	{
+        return;
+    }
+
+    for (i = 0; i < sht->shard_num; i++)
+	{
+        pthread_rwlock_destroy(&sht->shards[i].rwlock);
+        dfs_hashtable_free_memory(sht->shards[i].ht);
+    }
+
+    memory_free(sht->shards, sht->shard_num * sizeof(dfs_hashtable_shard_t));
+    memory_free(sht, sizeof(dfs_shard_hashtable_t));
+}
+
+/*
+ * dfs_shard_hashtable_set_shard_hash - lets keys that differ only in
+ * what shard_hash ignores share a shard, e.g. all entries of a parent.
+ * Must be set before the first join.
+ */
+void dfs_shard_hashtable_set_shard_hash(dfs_shard_hashtable_t *sht,
+                                        DFS_HASHTABLE_HASH *shard_hash)
+{
+    sht->shard_hash = shard_hash;
+}
+
+size_t dfs_shard_hashtable_index(dfs_shard_hashtable_t *sht,
+                                 const void *key, size_t len)
+{
+    DFS_HASHTABLE_HASH *hash = sht->shard_hash ? sht->shard_hash : sht->hash;
+
+    return shard_mix(hash(key, len, (size_t)-1)) & (sht->shard_num - 1);
+}
+
+void dfs_shard_hashtable_rdlock(dfs_shard_hashtable_t *sht, size_t idx)
+{
+    pthread_rwlock_rdlock(&sht->shards[idx].rwlock);
+}
+
+void dfs_shard_hashtable_wrlock(dfs_shard_hashtable_t *sht, size_t idx)
+{
+    pthread_rwlock_wrlock(&sht->shards[idx].rwlock);
+}
+
+void dfs_shard_hashtable_unlock(dfs_shard_hashtable_t *sht, size_t idx)
+{
+    pthread_rwlock_unlock(&sht->shards[idx].rwlock);
+}
+
+// lock two shards for write, always in index order so that two writers
+// touching the same pair can not deadlock
+void dfs_shard_hashtable_wrlock2(dfs_shard_hashtable_t *sht,
+                                 size_t idx1, size_t idx2)
+{
+    if (idx1 == idx2)
+	{
+        dfs_shard_hashtable_wrlock(sht, idx1);
+
+        return;
+    }
+
+    if (idx1 > idx2)
+	{
+        size_t tmp = idx1;
+        idx1 = idx2;
+        idx2 = tmp;
+    }
+
+    dfs_shard_hashtable_wrlock(sht, idx1);
+    dfs_shard_hashtable_wrlock(sht, idx2);
+}
+
+void dfs_shard_hashtable_unlock2(dfs_shard_hashtable_t *sht,
+                                 size_t idx1, size_t idx2)
+{
+    dfs_shard_hashtable_unlock(sht, idx1);
+
+    if (idx1 != idx2)
+	{
+        dfs_shard_hashtable_unlock(sht, idx2);
+    }
+}
+
+void dfs_shard_hashtable_rdlock2(dfs_shard_hashtable_t *sht,
+                                 size_t idx1, size_t idx2)
+{
+    if (idx1 == idx2)
+	{
+        dfs_shard_hashtable_rdlock(sht, idx1);
+
+        return;
+    }
+
+    if (idx1 > idx2)
+	{
+        size_t tmp = idx1;
+        idx1 = idx2;
+        idx2 = tmp;
+    }
+
+    dfs_shard_hashtable_rdlock(sht, idx1);
+    dfs_shard_hashtable_rdlock(sht, idx2);
+}
+
+// sorts idx in place and locks each distinct shard once, in order
+void dfs_shard_hashtable_wrlock_n(dfs_shard_hashtable_t *sht,
+                                  size_t idx[], int n)
+{
+    int i = 0;
+    int j = 0;
+
+    for (i = 1; i < n; i++)
+	{
+        size_t v = idx[i];
+
+        for (j = i; j > 0 && idx[j - 1] > v; j--)
+		{
+            idx[j] = idx[j - 1];
+        }
+
+        idx[j] = v;
+    }
+
+    for (i = 0; i < n; i++)
+	{
+        if (i == 0 || idx[i] != idx[i - 1])
+		{
+            dfs_shard_hashtable_wrlock(sht, idx[i]);
+        }
+    }
+}
+
+// idx as left sorted by dfs_shard_hashtable_wrlock_n
+void dfs_shard_hashtable_unlock_n(dfs_shard_hashtable_t *sht,
+                                  size_t idx[], int n)
+{
+    for (int i = n - 1; i >= 0; i--)
+	{
+        if (i == 0 || idx[i] != idx[i - 1])
+		{
+            dfs_shard_hashtable_unlock(sht, idx[i]);
+        }
+    }
+}
+
+int dfs_shard_hashtable_join_nolock(dfs_shard_hashtable_t *sht,
+                                    dfs_hashtable_link_t *hl)
+{
+    if (!sht || !hl)
+	{
+        return DFS_HASHTABLE_ERROR;
+    }
+
+    size_t idx = dfs_shard_hashtable_index(sht, hl->key, hl->len);
+
+    return dfs_hashtable_join(sht->shards[idx].ht, hl);
+}
+
+int dfs_shard_hashtable_remove_link_nolock(dfs_shard_hashtable_t *sht,
+                                           dfs_hashtable_link_t *hl)
+{
+    if (!sht || !hl)
+	{
+        return DFS_HASHTABLE_ERROR;
+    }
+
+    size_t idx = dfs_shard_hashtable_index(sht, hl->key, hl->len);
+
+    return dfs_hashtable_remove_link(sht->shards[idx].ht, hl);
+}
+
+void * dfs_shard_hashtable_lookup_nolock(dfs_shard_hashtable_t *sht,
+                                         const void *key, size_t len)
+{
+    if (!sht || !key)
+	{
+        return nullptr;
+    }
+
+    size_t idx = dfs_shard_hashtable_index(sht, key, len);
+
+    return dfs_hashtable_lookup(sht->shards[idx].ht, key, len);
+}
+
+int dfs_shard_hashtable_join(dfs_shard_hashtable_t *sht,
+                             dfs_hashtable_link_t *hl)
+{
+    int rc = 0;
+
+    if (!sht || !hl)
+	{
+        return DFS_HASHTABLE_ERROR;
+    }
+
+    size_t idx = dfs_shard_hashtable_index(sht, hl->key, hl->len);
+
+    dfs_shard_hashtable_wrlock(sht, idx);
+    rc = dfs_hashtable_join(sht->shards[idx].ht, hl);
+    dfs_shard_hashtable_unlock(sht, idx);
+
+    return rc;
+}
+
+int dfs_shard_hashtable_remove_link(dfs_shard_hashtable_t *sht,
+                                    dfs_hashtable_link_t *hl)
+{
+    int rc = 0;
+
+    if (!sht || !hl)
+	{
+        return DFS_HASHTABLE_ERROR;
+    }
+
+    size_t idx = dfs_shard_hashtable_index(sht, hl->key, hl->len);
+
+    dfs_shard_hashtable_wrlock(sht, idx);
+    rc = dfs_hashtable_remove_link(sht->shards[idx].ht, hl);
+    dfs_shard_hashtable_unlock(sht, idx);
+
+    return rc;
+}
+
+void * dfs_shard_hashtable_lookup(dfs_shard_hashtable_t *sht,
+                                  const void *key, size_t len)
+{
+    void *obj = nullptr;
+
+    if (!sht || !key)
+	{
+        return nullptr;
+    }
+
+    size_t idx = dfs_shard_hashtable_index(sht, key, len);
+
+    dfs_shard_hashtable_rdlock(sht, idx);
+    obj = dfs_hashtable_lookup(sht->shards[idx].ht, key, len);
+    dfs_shard_hashtable_unlock(sht, idx);
+
+    return obj;
+}
+
+size_t dfs_shard_hashtable_count(dfs_shard_hashtable_t *sht)
+{
+    size_t i = 0;
+    size_t count = 0;
+
+    for (i = 0; i < sht->shard_num; i++)
+	{
+        dfs_shard_hashtable_rdlock(sht, i);
+        count += sht->shards[i].ht->count;
+        dfs_shard_hashtable_unlock(sht, i);
+    }
+
+    return count;
+}
+
@@ -0,0 +1,73 @@
+#ifndef DFS_SHARD_HASHTABLE_H
+#define DFS_SHARD_HASHTABLE_H
+
+#include <pthread.h>
+
+#include "dfs_hashtable.h"
+
+#define DFS_SHARD_HASHTABLE_DEFAULT_SHARDS 64
+#define DFS_SHARD_HASHTABLE_MAX_SHARDS     4096
+
+// one lock stripe: a plain hashtable guarded by its own rwlock
+typedef struct dfs_hashtable_shard_s
+{
+    dfs_hashtable_t  *ht;
+    pthread_rwlock_t  rwlock;
+} dfs_hashtable_shard_t;
+
+/*
+ * lock-striped hashtable, a key always lives in the same shard,
+ * so lookups and updates of unrelated keys never contend.
+ *
+ * the *_nolock functions expect the caller to hold the shard lock
+ * (see dfs_shard_hashtable_rdlock / wrlock), the others take it.
+ */
+typedef struct dfs_shard_hashtable_s
+{
+    dfs_hashtable_shard_t *shards;
+    size_t                 shard_num;   // power of 2
+    DFS_HASHTABLE_HASH    *hash;
+    DFS_HASHTABLE_HASH    *shard_hash;  // picks the shard, hash if nullptr
+    dfs_mem_allocator_t   *allocator;
+} dfs_shard_hashtable_t;
+
+dfs_shard_hashtable_t *dfs_shard_hashtable_create(DFS_HASHTABLE_CMP *cmp_func,
+    size_t hash_sz, DFS_HASHTABLE_HASH *hash_func,
+    dfs_mem_allocator_t *allocator, size_t shard_num);
+void   dfs_shard_hashtable_free_memory(dfs_shard_hashtable_t *sht);
+void   dfs_shard_hashtable_set_shard_hash(dfs_shard_hashtable_t *sht,
+    DFS_HASHTABLE_HASH *shard_hash);
+size_t dfs_shard_hashtable_index(dfs_shard_hashtable_t *sht,
+    const void *key, size_t len);
+
+void dfs_shard_hashtable_rdlock(dfs_shard_hashtable_t *sht, size_t idx);
+void dfs_shard_hashtable_wrlock(dfs_shard_hashtable_t *sht, size_t idx);
+void dfs_shard_hashtable_unlock(dfs_shard_hashtable_t *sht, size_t idx);
+void dfs_shard_hashtable_wrlock2(dfs_shard_hashtable_t *sht,
+    size_t idx1, size_t idx2);
+void dfs_shard_hashtable_unlock2(dfs_shard_hashtable_t *sht,
+    size_t idx1, size_t idx2);
+void dfs_shard_hashtable_rdlock2(dfs_shard_hashtable_t *sht,
+    size_t idx1, size_t idx2);
+void dfs_shard_hashtable_wrlock_n(dfs_shard_hashtable_t *sht,
+    size_t idx[], int n);
+void dfs_shard_hashtable_unlock_n(dfs_shard_hashtable_t *sht,
+    size_t idx[], int n);
+
+int   dfs_shard_hashtable_join_nolock(dfs_shard_hashtable_t *sht,
+    dfs_hashtable_link_t *hl);
+int   dfs_shard_hashtable_remove_link_nolock(dfs_shard_hashtable_t *sht,
+    dfs_hashtable_link_t *hl);
+void *dfs_shard_hashtable_lookup_nolock(dfs_shard_hashtable_t *sht,
+    const void *key, size_t len);
+
+int   dfs_shard_hashtable_join(dfs_shard_hashtable_t *sht,
+    dfs_hashtable_link_t *hl);
+int   dfs_shard_hashtable_remove_link(dfs_shard_hashtable_t *sht,
+    dfs_hashtable_link_t *hl);
+void *dfs_shard_hashtable_lookup(dfs_shard_hashtable_t *sht,
+    const void *key, size_t len);
+size_t dfs_shard_hashtable_count(dfs_shard_hashtable_t *sht);
+
+#endif
+
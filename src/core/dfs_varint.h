@@ -0,0 +1,72 @@
+#ifndef DFS_VARINT_H
+#define DFS_VARINT_H
+
+#include "dfs_types.h"
+
+// base 128 varints, the low 7 bits first, as used by protobuf
+#define DFS_VARINT_MAX_LEN 10
+
+static inline uchar_t *dfs_varint_encode(uchar_t *p, uint64_t v)
+{
+    while (v >= 0x80)
+	{
+        *p++ = (uchar_t)(v | 0x80);
+        v >>= 7;
+    }
+
+    *p++ = (uchar_t)v;
+
+    return p;
+}
+
+// returns nullptr if the varint runs past end or is too long
+static inline uchar_t *dfs_varint_decode(uchar_t *p, uchar_t *end,
+    uint64_t *v)
+{
+    uint64_t r = 0;
+    int      shift = 0;
+
+    while (p < end && shift < 64)
+	{
+        uchar_t b = *p++;
+
+        r |= (uint64_t)(b & 0x7f) << shift;
+
+        if (!(b & 0x80))
+		{
+            *v = r;
+
+            return p;
+        }
+
+        shift += 7;
+    }
+
+    return nullptr;
+}
+
+static inline size_t dfs_varint_len(uint64_t v)
+{
+    size_t n = 1;
+
+    while (v >= 0x80)
+	{
+        v >>= 7;
+        n++;
+    }
+
+    return n;
+}
+
+static inline uint64_t dfs_zigzag_encode(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t dfs_zigzag_decode(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+#endif
+
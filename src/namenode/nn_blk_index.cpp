@@ -8,6 +8,9 @@
 
 #define BLK_NUM_IN_DN 100000
 
+// the layout of block ids in images and datanode reports, keep it.
+// seq is the high word, blocks allocated back to back are one
+// FI_BLK_RUN_STEP apart and pack into one extent of a block list
 typedef struct my_uid_s 
 {
     uint32_t sec;
@@ -81,12 +81,75 @@ static conf_option_t conf_server_option[] =
     { string_make("checkpoint_num"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, checkpoint_num) },
 
+    { string_make("checkpoint_interval"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, checkpoint_interval) },
+
+    { string_make("checkpoint_log_mb"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, checkpoint_log_mb) },
+
+    { string_make("checkpoint_nice"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, checkpoint_nice) },
+
+    { string_make("checkpoint_hold_log"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, checkpoint_hold_log) },
+
     { string_make("index_num"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, index_num) },
 
 	{ string_make("dn_timeout"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, dn_timeout) },
 
+    { string_make("index_shards"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, index_shard_num) },
+
+    { string_make("fsimage_threads"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, fsimage_threads) },
+
+    { string_make("fsimage_compress"), conf_parse_nn_macro,
+        OPE_EQUAL, offsetof(conf_server_t, fsimage_compress) },
+
+    { string_make("fsimage_deltas"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, fsimage_deltas) },
+
+    { string_make("paxos_batch_max"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, paxos_batch_max) },
+
+    { string_make("paxos_inflight"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, paxos_inflight) },
+
+    { string_make("apply_threads"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, apply_threads) },
+
+    { string_make("ckp_send_rate"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, ckp_send_rate) },
+
+    { string_make("read_mode"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, read_mode) },
+
+    { string_make("read_stale_ms"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, read_stale_ms) },
+
+    { string_make("task_stats_interval"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, task_stats_interval) },
+
+    { string_make("cli_threads"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, cli_threads) },
+
+    { string_make("dn_threads"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, dn_threads) },
+
+    { string_make("io_busy_poll"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, io_busy_poll) },
+
+    { string_make("max_inflight"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, max_inflight) },
+
+    { string_make("conn_out_max"), conf_parse_bytes_size,
+        OPE_EQUAL, offsetof(conf_server_t, conn_out_max) },
+
+    { string_make("dn_lane_weight"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, dn_lane_weight) },
+
     { string_null, nullptr, OPE_EQUAL, 0 }
 };
 
@@ -143,6 +206,18 @@ static void *conf_server_init(pool_t *pool)
         return nullptr;
     }
 	
+    // 0 means something for these, see set_def_uint
+    sconf->fsimage_deltas = CONF_INT_NOT_SET;
+    sconf->ckp_send_rate = CONF_INT_NOT_SET;
+    sconf->checkpoint_interval = CONF_INT_NOT_SET;
+    sconf->checkpoint_log_mb = CONF_INT_NOT_SET;
+    sconf->checkpoint_nice = CONF_INT_NOT_SET;
+    sconf->checkpoint_hold_log = CONF_INT_NOT_SET;
+    sconf->read_mode = CONF_INT_NOT_SET;
+    sconf->read_stale_ms = CONF_INT_NOT_SET;
+    sconf->task_stats_interval = CONF_INT_NOT_SET;
+    sconf->dn_lane_weight = CONF_INT_NOT_SET;
+
     if (array_init(&sconf->bind_for_cli, pool, CONF_SERVER_BIND_N, 
         sizeof(server_bind_t)) != NGX_OK)
     {
@@ -161,12 +236,31 @@ static void *conf_server_init(pool_t *pool)
 // make conf_server_t default
 static int conf_server_make_default(void *var)
 {
-    conf_server_t *sconf = (conf_server_t *)var;
+    conf_server_t *sconf = (conf_server_t *)((conf_variable_t *)var)->conf;
     
     set_def_string(&sconf->pid_file,            PID_FILE);
     set_def_int(sconf->recv_buff_len, 		    DEF_RBUFF_LEN);
     set_def_int(sconf->send_buff_len, 		    DEF_SBUFF_LEN);
     set_def_int(sconf->max_tqueue_len, 		    DEF_MMAX_TQUEUE_LEN);
+    set_def_int(sconf->index_shard_num,         DEF_INDEX_SHARD_NUM);
+    set_def_uint(sconf->fsimage_deltas,         DEF_FSIMAGE_DELTAS);
+    set_def_int(sconf->paxos_batch_max,         DEF_PAXOS_BATCH_MAX);
+    set_def_int(sconf->paxos_inflight,          DEF_PAXOS_INFLIGHT);
+    set_def_int(sconf->apply_threads,           DEF_APPLY_THREADS);
+    set_def_uint(sconf->ckp_send_rate,          DEF_CKP_SEND_RATE);
+    set_def_uint(sconf->checkpoint_interval,    DEF_CKP_INTERVAL);
+    set_def_uint(sconf->checkpoint_log_mb,      DEF_CKP_LOG_MB);
+    set_def_uint(sconf->checkpoint_nice,        DEF_CKP_NICE);
+    set_def_uint(sconf->checkpoint_hold_log,    DEF_CKP_HOLD_LOG);
+    set_def_uint(sconf->read_mode,              DEF_READ_MODE);
+    set_def_uint(sconf->read_stale_ms,          DEF_READ_STALE_MS);
+    set_def_uint(sconf->task_stats_interval,    DEF_TASK_STATS_INTERVAL);
+    set_def_int(sconf->cli_threads,             DEF_CLI_THREADS);
+    set_def_int(sconf->dn_threads,              DEF_DN_THREADS);
+    set_def_int(sconf->io_busy_poll,            DEF_IO_BUSY_POLL);
+    set_def_int(sconf->max_inflight,            DEF_MAX_INFLIGHT);
+    set_def_int(sconf->conn_out_max,            DEF_CONN_OUT_MAX);
+    set_def_uint(sconf->dn_lane_weight,         DEF_DN_LANE_WEIGHT);
 	
     return NGX_OK;
 }
@@ -30,8 +30,29 @@ struct conf_server_s
     string_t fsimage_dir;
     uint32_t paxos_group_num;
     uint32_t checkpoint_num;
+	uint32_t checkpoint_interval; // seconds between checkpoints at most
+	uint32_t checkpoint_log_mb; // log applied that forces a checkpoint
+	uint32_t checkpoint_nice; // cpu nice of the checkpoint thread
+	uint32_t checkpoint_hold_log; // instances kept before a checkpoint
 	uint64_t index_num;
 	uint32_t dn_timeout;
+	uint32_t index_shard_num; // lock stripes of the namespace index
+	uint32_t fsimage_threads;
+	uint32_t fsimage_compress; // lz4 the fsimage sections
+	uint32_t fsimage_deltas; // delta images between two full ones
+	uint32_t paxos_batch_max; // tasks proposed together at most
+	uint32_t paxos_inflight; // proposals out at the same time
+	uint32_t apply_threads; // edits of an instance applied at once
+	uint32_t ckp_send_rate; // MB/s a checkpoint is sent to a lagging node, 0 no limit
+	uint32_t read_mode; // PAXOS_READ_*, how followers answer reads
+	uint32_t read_stale_ms; // age of a barrier reads may still use, read_mode 2
+	uint32_t task_stats_interval; // seconds between task queue reports, 0 none
+	uint32_t cli_threads; // client I/O threads, each with its own SO_REUSEPORT socket
+	uint32_t dn_threads; // datanode I/O threads
+	uint32_t io_busy_poll; // us an I/O thread polls after work before it sleeps, 0 none
+	uint32_t max_inflight; // requests in flight over all connections, split among I/O threads
+	uint32_t conn_out_max; // reply bytes a connection may queue before its reads stop
+	uint32_t dn_lane_weight; // datanode tasks run before a waiting client task, 0 strict
 };
 
 conf_object_t *get_nn_conf_object(void);
@@ -39,6 +60,25 @@ conf_object_t *get_nn_conf_object(void);
 #define DEF_RBUFF_LEN          64 * 1024
 #define DEF_SBUFF_LEN          64 * 1024
 #define DEF_MMAX_TQUEUE_LEN    1000
+#define DEF_INDEX_SHARD_NUM    64
+#define DEF_FSIMAGE_DELTAS     16
+#define DEF_PAXOS_BATCH_MAX    64
+#define DEF_PAXOS_INFLIGHT     4
+#define DEF_APPLY_THREADS      4
+#define DEF_CKP_SEND_RATE      64
+#define DEF_CKP_INTERVAL       600
+#define DEF_CKP_LOG_MB         1024
+#define DEF_CKP_NICE           10
+#define DEF_CKP_HOLD_LOG       50000
+#define DEF_READ_MODE          1
+#define DEF_READ_STALE_MS      1000
+#define DEF_TASK_STATS_INTERVAL 60
+#define DEF_CLI_THREADS        1
+#define DEF_DN_THREADS         1
+#define DEF_IO_BUSY_POLL       0
+#define DEF_MAX_INFLIGHT       65536
+#define DEF_CONN_OUT_MAX       4 * 1024 * 1024
+#define DEF_DN_LANE_WEIGHT     8
 
 #define set_def_string(key, value) do { \
     if (!(key)->len) { \
@@ -53,6 +93,14 @@ conf_object_t *get_nn_conf_object(void);
     } \
 } while (0)
 
+// keys whose 0 is a setting of its own start at CONF_INT_NOT_SET in 
+// conf_server_init, so an explicit 0 in the file is kept
+#define set_def_uint(key, value) do { \
+    if ((key) == (uint32_t) CONF_INT_NOT_SET) { \
+        (key) = value; \
+    } \
+} while (0)
+
 #define set_def_time(key, value) do { \
     if ((key) == CONF_TIME_T_NOT_SET) { \
         (key) = value;\
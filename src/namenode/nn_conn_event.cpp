@@ -21,23 +21,24 @@
 #define ADDR_MAX_LEN                   16
 
 
+static int nn_conn_listening_make(cycle_t *cycle, array_t *listening, 
+    array_t *binds, int nthreads);
+
 // listen_rev_handler 处理 listening 事件
 // listen cli and datanode
+// every I/O thread gets its own sockets on the bound ports, with more than 
+// one thread they share the port by SO_REUSEPORT and the kernel spreads 
+// the accepts
 int nn_conn_listening_init(cycle_t *cycle)
 {
-    listening_t   *ls = nullptr;
     conf_server_t *sconf = nullptr;
     uint32_t       i = 0;
-    server_bind_t *bind_for_cli = nullptr;
-    server_bind_t *bind_for_dn = nullptr;
     
     sconf = (conf_server_t *)dfs_cycle->sconf;
-	bind_for_dn = (server_bind_t *)sconf->bind_for_dn.elts;
-	bind_for_cli = (server_bind_t *)sconf->bind_for_cli.elts;
 
-	cycle->listening_for_dn.elts = pool_calloc(cycle->pool,
-        sizeof(listening_t) * sconf->bind_for_dn.nelts);
-    if (!cycle->listening_for_dn.elts) 
+	cycle->listening_for_dn = (array_t *)pool_calloc(cycle->pool,
+        sizeof(array_t) * sconf->dn_threads);
+    if (!cycle->listening_for_dn) 
 	{
          dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0,
             "no space to alloc listen_for_dn pool");
@@ -45,9 +46,9 @@ int nn_conn_listening_init(cycle_t *cycle)
         return NGX_ERROR;
     }
 
-	cycle->listening_for_cli.elts = pool_calloc(cycle->pool,
-        sizeof(listening_t) * sconf->bind_for_cli.nelts);
-    if (!cycle->listening_for_cli.elts) 
+	cycle->listening_for_cli = (array_t *)pool_calloc(cycle->pool,
+        sizeof(array_t) * sconf->cli_threads);
+    if (!cycle->listening_for_cli) 
 	{
          dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0,
             "no space to alloc listen_for_cli pool");
@@ -55,54 +56,66 @@ int nn_conn_listening_init(cycle_t *cycle)
         return NGX_ERROR;
     }
 
-	cycle->listening_for_dn.nelts = 0;
-    cycle->listening_for_dn.size = sizeof(listening_t);
-    cycle->listening_for_dn.nalloc = sconf->bind_for_dn.nelts;
-    cycle->listening_for_dn.pool = cycle->pool;
-	
-    cycle->listening_for_cli.nelts = 0;
-    cycle->listening_for_cli.size = sizeof(listening_t);
-    cycle->listening_for_cli.nalloc = sconf->bind_for_cli.nelts;
-    cycle->listening_for_cli.pool = cycle->pool;
+	for (i = 0; i < sconf->dn_threads; i++) 
+	{
+        if (nn_conn_listening_make(cycle, &cycle->listening_for_dn[i], 
+			&sconf->bind_for_dn, sconf->dn_threads) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
 
-    // 只初始化 listening
-	for (i = 0; i < sconf->bind_for_dn.nelts; i++) 
+	for (i = 0; i < sconf->cli_threads; i++) 
 	{
-        ls = conn_listening_add(&cycle->listening_for_dn, cycle->pool,
-            cycle->error_log, inet_addr((char *)bind_for_dn[i].addr.data), 
-            bind_for_dn[i].port, listen_rev_handler,  // 在这里处理receive 事件
-            ((conf_server_t*)cycle->sconf)->recv_buff_len, 
-            ((conf_server_t*)cycle->sconf)->recv_buff_len);
-		
-        if (!ls) 
-		{
+        if (nn_conn_listening_make(cycle, &cycle->listening_for_cli[i], 
+			&sconf->bind_for_cli, sconf->cli_threads) != NGX_OK)
+        {
             return NGX_ERROR;
         }
     }
 
-	for (i = 0; i < sconf->bind_for_cli.nelts; i++) 
+    return NGX_OK;
+}
+
+// 初始化并 open 一个 I/O thread 的 listening
+static int nn_conn_listening_make(cycle_t *cycle, array_t *listening, 
+    array_t *binds, int nthreads)
+{
+    listening_t   *ls = nullptr;
+    server_bind_t *bind = nullptr;
+    uint32_t       i = 0;
+    uint32_t       len = 0;
+
+    bind = (server_bind_t *)binds->elts;
+    len = ((conf_server_t*)cycle->sconf)->recv_buff_len;
+
+    if (array_init(listening, cycle->pool, binds->nelts, 
+		sizeof(listening_t)) != NGX_OK)
+    {
+        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0,
+            "no space to alloc listening pool");
+		
+        return NGX_ERROR;
+    }
+
+    // 只初始化 listening
+	for (i = 0; i < binds->nelts; i++) 
 	{
-        ls = conn_listening_add(&cycle->listening_for_cli, cycle->pool,
-            cycle->error_log, inet_addr((char *)bind_for_cli[i].addr.data), 
-            bind_for_cli[i].port, listen_rev_handler, 
-            ((conf_server_t*)cycle->sconf)->recv_buff_len, 
-            ((conf_server_t*)cycle->sconf)->recv_buff_len);
+        ls = conn_listening_add(listening, cycle->pool,
+            cycle->error_log, inet_addr((char *)bind[i].addr.data), 
+            bind[i].port, listen_rev_handler,  // 在这里处理receive 事件
+            len, len);
 		
         if (!ls) 
 		{
             return NGX_ERROR;
         }
-    }
 
-	// open listening
-	if (conn_listening_open(&cycle->listening_for_dn,
-        cycle->error_log) != NGX_OK)
-    {
-        return NGX_ERROR;
+        ls->reuseport = nthreads > 1;
     }
 
-    if (conn_listening_open(&cycle->listening_for_cli,
-        cycle->error_log) != NGX_OK)
+	// open listening
+	if (conn_listening_open(listening, cycle->error_log) != NGX_OK)
     {
         return NGX_ERROR;
     }
@@ -124,13 +124,13 @@ int cycle_free(cycle_t *cycle)
     return NGX_OK;
 }
 
-array_t * cycle_get_listen_for_cli()
+array_t * cycle_get_listen_for_cli(int n)
 {
-    return &dfs_cycle->listening_for_cli;
+    return &dfs_cycle->listening_for_cli[n];
 }
 
-array_t * cycle_get_listen_for_dn()
+array_t * cycle_get_listen_for_dn(int n)
 {
-    return &dfs_cycle->listening_for_dn;
+    return &dfs_cycle->listening_for_dn[n];
 }
 
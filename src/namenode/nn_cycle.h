@@ -14,8 +14,8 @@ struct cycle_s
     void      *sconf; // server conf
     pool_t    *pool;
     log_t     *error_log;
-    array_t    listening_for_cli;
-    array_t    listening_for_dn;
+    array_t   *listening_for_cli; // one listening array per cli I/O thread
+    array_t   *listening_for_dn; // one per dn I/O thread
     string_t   conf_file;
     string_t   admin; // suserid
 	uint64_t   namespace_id;
@@ -26,8 +26,8 @@ extern cycle_t *dfs_cycle;
 cycle_t  *cycle_create();
 int       cycle_init(cycle_t *cycle);
 int       cycle_free(cycle_t *cycle);
-array_t  *cycle_get_listen_for_cli();
-array_t  *cycle_get_listen_for_dn();
+array_t  *cycle_get_listen_for_cli(int n);
+array_t  *cycle_get_listen_for_dn(int n);
 int       cycle_check_sys_env(cycle_t *cycle);
 
 #endif
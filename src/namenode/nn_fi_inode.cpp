@@ -0,0 +1,318 @@
+#include "nn_fi_inode.h"
+#include "dfs_memory.h"
+#include "dfs_varint.h"
+
+#define FI_INTERN_SLOTS (FI_INTERN_MAX * 2)  // power of 2
+
+// owner and group names, an id is the index in names
+typedef struct fi_intern_s
+{
+    char             (*names)[FI_INTERN_LEN];
+    uint32_t          *slots; // open addressing, id + 1, 0 is empty
+    uint32_t           num;
+    pthread_rwlock_t   rwlock;
+} fi_intern_t;
+
+static fi_intern_t       g_intern;
+static dfs_name_arena_t *g_name_arena = nullptr;
+
+static uint32_t intern_hash(const char *name, size_t len);
+static uint32_t *intern_slot(const char *name, size_t len);
+static fi_blk_list_t *blk_list_grow(fi_blk_list_t *list, size_t need);
+
+int fi_inode_mgmt_init(size_t arena_chunk_size)
+{
+    g_name_arena = dfs_name_arena_create(arena_chunk_size);
+    if (!g_name_arena)
+	{
+        return NGX_ERROR;
+    }
+
+    g_intern.names = (char (*)[FI_INTERN_LEN])memory_calloc(
+        FI_INTERN_MAX * FI_INTERN_LEN);
+    g_intern.slots = (uint32_t *)memory_calloc(
+        FI_INTERN_SLOTS * sizeof(uint32_t));
+    if (!g_intern.names || !g_intern.slots)
+	{
+        fi_inode_mgmt_release();
+
+        return NGX_ERROR;
+    }
+
+    // id 0 is the empty name
+    g_intern.num = 1;
+    pthread_rwlock_init(&g_intern.rwlock, nullptr);
+
+    return NGX_OK;
+}
+
+void fi_inode_mgmt_release()
+{
+    if (g_intern.names)
+	{
+        memory_free(g_intern.names, FI_INTERN_MAX * FI_INTERN_LEN);
+        memory_free(g_intern.slots, FI_INTERN_SLOTS * sizeof(uint32_t));
+        pthread_rwlock_destroy(&g_intern.rwlock);
+    }
+
+    memory_zero(&g_intern, sizeof(g_intern));
+
+    dfs_name_arena_destroy(g_name_arena);
+    g_name_arena = nullptr;
+}
+
+char *fi_name_dup(const char *name, size_t len)
+{
+    return dfs_name_arena_dup(g_name_arena, name, len);
+}
+
+void fi_name_free(char *name, size_t len)
+{
+    dfs_name_arena_free(g_name_arena, name, len);
+}
+
+static uint32_t intern_hash(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+	{
+        h = (h ^ (uchar_t)name[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+// caller holds the intern lock, returns the matching or the empty slot
+static uint32_t *intern_slot(const char *name, size_t len)
+{
+    uint32_t  i = intern_hash(name, len) & (FI_INTERN_SLOTS - 1);
+    uint32_t *slot = nullptr;
+
+    for (;;)
+	{
+        slot = &g_intern.slots[i];
+
+        if (!*slot)
+		{
+            return slot;
+        }
+
+        char *s = g_intern.names[*slot - 1];
+
+        if (0 == strncmp(s, name, len) && s[len] == '\0')
+		{
+            return slot;
+        }
+
+        i = (i + 1) & (FI_INTERN_SLOTS - 1);
+    }
+}
+
+/*
+ * fi_intern - returns the id of an owner or group name, names longer
+ * than FI_INTERN_LEN - 1 are cut as the fixed size fields were.
+ * Returns FI_INTERN_NONE if the table is full.
+ */
+uint16_t fi_intern(const char *name)
+{
+    size_t    len = strnlen(name, FI_INTERN_LEN - 1);
+    uint32_t *slot = nullptr;
+    uint32_t  id = FI_INTERN_NONE;
+
+    if (!len)
+	{
+        return FI_INTERN_NONE;
+    }
+
+    pthread_rwlock_rdlock(&g_intern.rwlock);
+
+    slot = intern_slot(name, len);
+    if (*slot)
+	{
+        id = *slot - 1;
+    }
+
+    pthread_rwlock_unlock(&g_intern.rwlock);
+
+    if (id != FI_INTERN_NONE)
+	{
+        return (uint16_t)id;
+    }
+
+    pthread_rwlock_wrlock(&g_intern.rwlock);
+
+    slot = intern_slot(name, len);
+    if (*slot)
+	{
+        id = *slot - 1;
+    }
+	else if (g_intern.num < FI_INTERN_MAX)
+	{
+        id = g_intern.num++;
+        memory_memcpy(g_intern.names[id], name, len);
+        *slot = id + 1;
+    }
+
+    pthread_rwlock_unlock(&g_intern.rwlock);
+
+    return (uint16_t)id;
+}
+
+// names never move or change once interned, no lock needed
+const char *fi_intern_name(uint16_t id)
+{
+    return g_intern.names[id];
+}
+
+static fi_blk_list_t *blk_list_grow(fi_blk_list_t *list, size_t need)
+{
+    size_t cap = list ? list->cap : 0;
+
+    if (list && cap - list->len >= need)
+	{
+        return list;
+    }
+
+    cap = cap ? cap * 2 : FI_BLK_LIST_INIT_CAP;
+    while (cap - (list ? list->len : 0) < need)
+	{
+        cap *= 2;
+    }
+
+    fi_blk_list_t *nlist = (fi_blk_list_t *)memory_realloc(list,
+        sizeof(fi_blk_list_t) + cap);
+    if (!nlist)
+	{
+        return nullptr;
+    }
+
+    if (!list)
+	{
+        memory_zero(nlist, sizeof(fi_blk_list_t));
+    }
+
+    nlist->cap = cap;
+
+    return nlist;
+}
+
+// *plist is nullptr for a file without blocks
+int fi_blk_list_append(fi_blk_list_t **plist, uint64_t blk_id)
+{
+    fi_blk_list_t *list = *plist;
+
+    if (list && list->tail_count > 0
+        && blk_id == list->tail_start + list->tail_count * FI_BLK_RUN_STEP)
+	{
+        list->tail_count++;
+        list->blk_num++;
+
+        return NGX_OK;
+    }
+
+    list = blk_list_grow(list, list ? 2 * DFS_VARINT_MAX_LEN : 0);
+    if (!list)
+	{
+        return NGX_ERROR;
+    }
+
+    *plist = list;
+
+    if (list->tail_count > 0)
+	{
+        uchar_t *p = list->data + list->len;
+
+        p = dfs_varint_encode(p,
+            dfs_zigzag_encode((int64_t)(list->tail_start - list->prev_end)));
+        p = dfs_varint_encode(p, list->tail_count);
+
+        list->len = p - list->data;
+        list->prev_end = list->tail_start
+            + list->tail_count * FI_BLK_RUN_STEP;
+    }
+
+    list->tail_start = blk_id;
+    list->tail_count = 1;
+    list->blk_num++;
+
+    return NGX_OK;
+}
+
+uint64_t fi_blk_list_first(fi_blk_list_t *list)
+{
+    uint64_t v = 0;
+
+    if (!list || !list->blk_num)
+	{
+        return (uint64_t)BLK_NOT_EXIST;
+    }
+
+    if (!list->len)
+	{
+        return list->tail_start;
+    }
+
+    dfs_varint_decode(list->data, list->data + list->len, &v);
+
+    return (uint64_t)dfs_zigzag_decode(v);
+}
+
+// decodes up to n block ids into blks, returns the number decoded
+size_t fi_blk_list_get(fi_blk_list_t *list, uint64_t *blks, size_t n)
+{
+    uchar_t  *p = nullptr;
+    uchar_t  *end = nullptr;
+    uint64_t  prev_end = 0;
+    uint64_t  delta = 0;
+    uint64_t  count = 0;
+    size_t    i = 0;
+
+    if (!list)
+	{
+        return 0;
+    }
+
+    p = list->data;
+    end = list->data + list->len;
+
+    while (p < end && i < n)
+	{
+        p = dfs_varint_decode(p, end, &delta);
+        if (!p)
+		{
+            break;
+        }
+
+        p = dfs_varint_decode(p, end, &count);
+        if (!p)
+		{
+            break;
+        }
+
+        uint64_t start = prev_end + (uint64_t)dfs_zigzag_decode(delta);
+
+        for (uint64_t j = 0; j < count && i < n; j++)
+		{
+            blks[i++] = start + j * FI_BLK_RUN_STEP;
+        }
+
+        prev_end = start + count * FI_BLK_RUN_STEP;
+    }
+
+    for (uint64_t j = 0; j < list->tail_count && i < n; j++)
+	{
+        blks[i++] = list->tail_start + j * FI_BLK_RUN_STEP;
+    }
+
+    return i;
+}
+
+void fi_blk_list_free(fi_blk_list_t *list)
+{
+    if (list)
+	{
+        memory_free(list, sizeof(fi_blk_list_t) + list->cap);
+    }
+}
+
@@ -0,0 +1,68 @@
+#ifndef NN_FI_INODE_H
+#define NN_FI_INODE_H
+
+#include "dfs_types.h"
+#include "dfs_name_arena.h"
+
+#define FI_INTERN_MAX  65536
+#define FI_INTERN_LEN  16     // OWNER_LEN, GROUP_LEN
+#define FI_INTERN_NONE 0      // id of ""
+
+#define FI_BLK_LIST_INIT_CAP 16
+
+// between the ids of blocks allocated back to back, one seq of the
+// block uid, see generate_uid
+#define FI_BLK_RUN_STEP (1ULL << 32)
+
+/*
+ * block ids of a file as extents of ids FI_BLK_RUN_STEP apart. closed
+ * extents are stored as varint(zigzag(start - prev_end)) varint(count),
+ * the last one stays decoded so appending the next id of a run is O(1).
+ * a file of any number of blocks fits, a run costs a few bytes.
+ */
+typedef struct fi_blk_list_s
+{
+    uint64_t blk_num;
+    uint64_t tail_start;
+    uint64_t tail_count;
+    uint64_t prev_end;   // end of the last encoded extent
+    uint32_t len;
+    uint32_t cap;
+    uchar_t  data[0];
+} fi_blk_list_t;
+
+// in memory inode, the exchange form is fi_inode_t
+typedef struct fi_cinode_s
+{
+    uint64_t       ino;
+    fi_blk_list_t *blks;     // files only
+    uint64_t       uid;
+    uint64_t       modification_time;
+    uint64_t       access_time;
+    uint64_t       length;
+    uint64_t       blk_size;
+    uint32_t       blk_seq;
+    uint32_t       total_blk;
+    uint16_t       owner_id;
+    uint16_t       group_id;
+    short          permission;
+    short          blk_replication;
+    uint32_t       is_directory:1;
+} fi_cinode_t;
+
+int  fi_inode_mgmt_init(size_t arena_chunk_size);
+void fi_inode_mgmt_release();
+
+char *fi_name_dup(const char *name, size_t len);
+void  fi_name_free(char *name, size_t len);
+
+uint16_t    fi_intern(const char *name);
+const char *fi_intern_name(uint16_t id);
+
+int      fi_blk_list_append(fi_blk_list_t **plist, uint64_t blk_id);
+uint64_t fi_blk_list_first(fi_blk_list_t *list);
+size_t   fi_blk_list_get(fi_blk_list_t *list, uint64_t *blks, size_t n);
+void     fi_blk_list_free(fi_blk_list_t *list);
+
+#endif
+
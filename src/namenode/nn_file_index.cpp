@@ -11,6 +11,10 @@
 #include "nn_net_response_handler.h"
 #include "nn_blk_index.h"
 #include "nn_dn_index.h"
+#include "nn_fsimage.h"
+#include "nn_time.h"
+#include "dfs_varint.h"
+#include "EditlogSM.h"
 
 using namespace phxpaxos;
 using namespace phxeditlog;
@@ -19,23 +23,171 @@ using namespace std;
 #define FINDEX_TIMER_NR 10000
 #define SEC2MSEC(X) ((X) * 1000)
 #define FI_CREATE_TIME_OUT (60 * 60 * 1000)
+#define FI_IMAGE_BUF_SIZE  (1024 * 1024)
+#define FI_IMAGE_SECTION_RECS 8192 // records per fsimage section
+// upper bound of an encoded fsimage record
+#define FI_IMAGE_REC_MAX(blk_num) (16 * DFS_VARINT_MAX_LEN + KEY_LEN \
+        + OWNER_LEN + GROUP_LEN + (blk_num) * DFS_VARINT_MAX_LEN)
+#define FI_LOCK_RETRY      16
+// longest path whose key still fits in KEY_LEN
+#define FI_KEY_PATH_MAX    ((KEY_LEN - 1) / 4 * 3)
+// a group that has applied nothing, as phxpaxos NoCheckpoint
+#define FI_NO_INSTANCE     ((uint64_t) -1)
 
 extern _xvolatile rb_msec_t dfs_current_msec;
 
-uint64_t lastCheckpointInstanceID = 0; // newest ckp id 
+uint64_t lastCheckpointInstanceID = 0; // newest ckp id, see fi_image_id
 extern dfs_thread_t *paxos_thread;
 static fi_cache_mgmt_t *g_fcm;
 static queue_t g_checkpoint_q; //fi_store_t
+// inos are handed out per paxos group: group g takes next + g, then
+// steps by the group num. every replica applies the instances of a
+// group in the same order, so they agree on the inos however the
+// groups interleave. g_next_ino is the floor the image loaders find,
+// the groups start from it when the image does not hold their own
+static uint64_t g_next_ino = FI_ROOT_INO + 1;
+static uint64_t *g_next_inos = nullptr;
+static int g_apply_group = 0;           // of the instance applying
+static uint64_t g_apply_seq = 0;        // instances applied, all groups
+// the paxos groups order their instances independently, so the state
+// of the namespace is the last instance applied of every group,
+// FI_NO_INSTANCE for a group that has none yet
+static int g_group_num = 1;
+static uint64_t *g_applied_ids = nullptr;
+static uint64_t *g_ckp_ids = nullptr;   // of the newest image
+// edits and value bytes applied, under apply_lock, and the figures the
+// newest durable image was taken at. the checkpoint service goes by them
+static uint64_t g_log_edits = 0;
+static uint64_t g_log_bytes = 0;
+static uint64_t g_ckp_edits = 0;
+static uint64_t g_ckp_bytes = 0;
+// creates that time out if not closed, only touched under apply_lock
+static event_timer_t g_create_timer;
+
+/*
+ * a checkpoint in progress. it is taken after id applied instances,
+ * ids of every group: entries created later are skipped, the writers
+ * save the state an entry had at id before they first update it
+ * (fi_snap_cow), and removed entries stay allocated until the image is
+ * written. active, seq and id change under apply_lock and ckp_lock.
+ */
+typedef struct fi_snap_s {
+    int active;
+    int delta;               // only entries with delta_seq == seq count
+    uint64_t seq;
+    uint64_t id;             // g_apply_seq at the snapshot
+    uint64_t *ids;           // the instance of each group
+    uint64_t *next_inos;     // and its next ino
+    uint64_t edits;          // g_log_edits and g_log_bytes at id
+    uint64_t bytes;
+    queue_t *last;           // last ckp queue entry at id
+    fsimage_section_t *cow;  // states saved by fi_snap_cow
+    size_t cow_num;
+    size_t cow_cap;
+    int cow_err;
+    fi_store_t *limbo;
+    pthread_mutex_t run_lock; // one checkpoint at a time
+} fi_snap_t;
+
+static fi_snap_t g_snap;
+
+/*
+ * what changed since the last checkpoint, under ckp_lock: the entries
+ * created or updated and the inos removed. a checkpoint writes just
+ * these as a delta image over the last one; after fsimage_deltas of
+ * them, or once they add up to half the base, it writes a full image
+ * instead, which compacts the chain
+ */
+typedef struct fi_delta_s {
+    queue_t dirty;       // fi_store_t
+    uint64_t *dead;
+    size_t dead_num;
+    size_t dead_cap;
+    int lost;            // a removal was not recorded, go full
+    int chain;           // deltas over the base, -1 if there is no v2 base
+    uint64_t base_recs;
+    uint64_t delta_recs;
+    uint64_t image_id;   // fi_image_id of the newest image
+} fi_delta_t;
+
+static fi_delta_t g_delta;
+
+// an edit of the instance being applied, parsed before apply_lock
+typedef struct fi_op_s {
+    editlog_rec_t rec;       // points into the value or into lopr
+    LogOperator lopr;        // older logs only
+    uint64_t ino;            // for the entry it creates, in log order
+    vector<string> dirs;     // parents it changes, as "/a/b/"
+    int wave;
+    int rc;
+} fi_op_t;
+
+/*
+ * the ops of an instance are applied in waves: an op goes one wave
+ * after the last earlier op with a parent dir on the path of one of
+ * its own, the ops of a wave run on the apply threads at once. an op
+ * only changes its parent dirs and what is below them, so any order
+ * within a wave ends in the state of the serial order
+ */
+typedef struct fi_apply_pool_s {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;     // a wave was posted or is done
+    pthread_t *tids;
+    int num;                 // threads besides the applier
+    int running;
+    fi_op_t **wave;
+    size_t wave_num;
+    size_t next;
+    size_t done;
+    uint64_t id;
+    void *data;
+} fi_apply_pool_t;
+
+static fi_apply_pool_t g_apply_pool;
+// create timers change under it as well, applies of one wave race
+static pthread_mutex_t g_create_lock;
+
+// entries being written to an fsimage, FI_IMAGE_SECTION_RECS a section
+typedef struct fi_image_save_s {
+    fi_store_t **stores;
+    size_t num;
+    fsimage_section_t *secs;
+    size_t secs_num;
+    uint64_t *dead;      // deltas: the inos removed
+    size_t dead_num;
+    int compress;
+} fi_image_save_t;
+
+// an fsimage being loaded, stores[i] is the entry of record i of the
+// base, entries from deltas are appended
+typedef struct fi_image_load_s {
+    fsimage_t *img;
+    fi_store_t **stores;
+    size_t num;
+    size_t cap;
+    size_t dropped;      // stores replaced or removed by a delta
+    uchar_t *orphan;     // records whose parent is missing
+    uint64_t *max_ino;   // per base section
+    uint64_t *linked;    // per FI_IMAGE_SECTION_RECS stores
+} fi_image_load_t;
+
+// shards locked for an update of the entry below parent
+typedef struct fi_lock_s {
+    uint64_t pino;       // FI_NO_INO for the root
+    fi_store_t *parent;  // nullptr for the root
+    size_t idx[2];
+} fi_lock_t;
 
 dfs_atomic_lock_t g_fs_object_num_lock;
 uint64_t g_fs_object_num;
 
 static fi_cache_mgmt_t *fi_cache_mgmt_new_init(conf_server_t *conf);
 
-static fi_cache_mgmt_t *fi_cache_mgmt_create(size_t index_num);
+static fi_cache_mgmt_t *fi_cache_mgmt_create(size_t index_num,
+                                             size_t shard_num);
 
 static int fi_mem_mgmt_create(fi_cache_mem_t *mem_mgmt,
-                              size_t index_num);
+                              size_t index_num, size_t shard_num);
 
 static struct mem_mblks *fi_mblks_create(fi_cache_mem_t *mem_mgmt,
                                          size_t count);
@@ -52,28 +204,103 @@ static int fi_cache_mgmt_timer_new(fi_cache_mgmt_t *fcm,
 static int fi_hash_keycmp(const void *arg1, const void *arg2,
                           size_t size);
 
+static int fi_dentry_keycmp(const void *arg1, const void *arg2,
+                            size_t size);
+
+static size_t fi_dentry_hash(const void *key, size_t len, size_t size);
+
+static size_t fi_dentry_shard_hash(const void *key, size_t len,
+                                   size_t size);
+
+static int fi_ino_keycmp(const void *arg1, const void *arg2, size_t size);
+
+static size_t fi_ino_hash(const void *key, size_t len, size_t size);
+
 static void fi_cache_mgmt_release(fi_cache_mgmt_t *fcm);
 
 static void fi_timer_destroy(void *args);
 
 static void fi_store_destroy(fi_store_t *fis);
 
-static void get_parent_key(uchar_t path[], uchar_t key[]);
+static inline size_t fi_dshard(uint64_t parent);
+
+static fi_store_t *fi_dentry_lookup_nolock(uint64_t parent,
+                                           const char *name, size_t len);
+
+static fi_store_t *fi_store_new(fi_inode_t *fin, uint64_t parent,
+                                const char *name, size_t len);
+
+static void fi_store_join(fi_store_t *fis);
+
+static void fi_store_unjoin(fi_store_t *fis);
+
+static int fi_lock_target(fi_path_t *fp, int num, fi_lock_t *fl);
+
+static void fi_unlock_target(fi_lock_t *fl);
+
+static fi_store_t *fi_path_rdlock(fi_path_t *fp, size_t *idx);
+
+static void fi_ckp_insert(fi_store_t *fis);
+
+static void fi_store_release(fi_store_t *fis);
+
+static void fi_snap_cow(fi_store_t *fis);
+
+static void fi_store_touch(fi_store_t *fis);
 
-static int update_fi_mkdir_nolock(fi_inode_t *fin);
+static int fi_image_put_store(fsimage_section_t *sec, fi_store_t *fis,
+                              uint64_t **blks, uint64_t *blks_cap);
+
+static void fi_op_parse(fi_op_t *op, const char *buf, size_t len);
+
+static int fi_apply_ops(vector<fi_op_t> &ops, const uint64_t llInstanceID,
+                        void *data);
+
+static int fi_apply_op(fi_op_t *op, const uint64_t llInstanceID,
+                       void *data);
+
+static int fi_apply_pool_start(int threads);
+
+static void fi_apply_pool_stop();
 
 static int update_fi_mkdir(fi_inode_t *fin);
 
+static int fi_mkdir(fi_path_t *fp, int num, fi_inode_t *fin);
+
 static int update_fi_rmr(fi_inode_t *fin);
 
-static int clear_children(queue_t *head, uint64_t num);
+static int clear_children(fi_store_t *dir);
+
+static int fi_child_cmp(const void *key, const void *item);
+
+static int fi_child_add(fi_store_t *parent, fi_store_t *fis);
+
+static void fi_child_del(fi_store_t *parent, fi_store_t *fis);
+
+static int clear_store(fi_store_t *fis);
+
+static void fi_blks_del(fi_blk_list_t *blks);
+
+static int save_image(int delta);
+
+static int fi_delta_want();
+
+static int load_image_v1(const char *image_name);
+
+static int load_image_v2(fsimage_t *img);
+
+static void fi_delta_path(char *buf, int n);
 
-static int save_image();
+static int fi_image_threads();
 
 static int save_checkpoinID();
 
 static int read_checkpoinID();
 
+static uint64_t fi_image_id(uint64_t *ids);
+
+static void fi_ckp_sync();
+
 static int mv_current();
 
 static int copy_file(const char *src, const char *dst);
@@ -82,10 +309,16 @@ static int mv_last_checkpoint();
 
 static int delete_dir(const char *dir);
 
+static int fi_image_check(const char *path);
+
 static int update_fi_create(fi_inode_t *fin, uint64_t blk_id, void *data);
 
 static void fi_create_timeout(event_t *ev);
 
+static void fi_create_timer_add(fi_store_t *fis);
+
+static void fi_create_timer_del(fi_store_t *fis);
+
 static int update_fi_get_additional_blk(fi_inode_t *fin,
                                         uint64_t blk_id);
 
@@ -93,12 +326,19 @@ static int update_fi_close(fi_inode_t *fin);
 
 static int update_fi_rm(fi_inode_t *fin);
 
+static int update_fi_rename(uchar_t *src_key, uchar_t *dst_key,
+                            uint64_t mtime);
+
 // 初始化fi_cache_mgmt_t fcm index_num个 fi_store_t
 // init timer
 // init g_checkpoint_q
 int nn_file_index_worker_init(cycle_t *cycle) {
     conf_server_t *conf = (conf_server_t *) cycle->sconf;
 
+    if (fi_inode_mgmt_init(DFS_NAME_ARENA_CHUNK_SIZE) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     // 初始化fi_cache_mgmt_t fcm
     g_fcm = fi_cache_mgmt_new_init(conf);
     if (!g_fcm) {
@@ -109,55 +349,116 @@ int nn_file_index_worker_init(cycle_t *cycle) {
         return NGX_ERROR;
     }
 
+    event_timer_init(&g_create_timer, time_curtime, cycle->error_log);
+    pthread_mutex_init(&g_create_lock, nullptr);
+
+    if (fi_apply_pool_start((int) conf->apply_threads) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     dfs_atomic_lock_init(&g_fs_object_num_lock);
     g_fs_object_num = 0;
 
     queue_init(&g_checkpoint_q);
 
+    memory_zero(&g_snap, sizeof(fi_snap_t));
+    pthread_mutex_init(&g_snap.run_lock, nullptr);
+
+    if (conf->paxos_group_num > 1) {
+        g_group_num = (int) conf->paxos_group_num;
+    }
+
+    g_applied_ids = (uint64_t *) memory_calloc(g_group_num * sizeof(uint64_t));
+    g_ckp_ids = (uint64_t *) memory_calloc(g_group_num * sizeof(uint64_t));
+    g_snap.ids = (uint64_t *) memory_calloc(g_group_num * sizeof(uint64_t));
+    g_next_inos = (uint64_t *) memory_calloc(g_group_num * sizeof(uint64_t));
+    g_snap.next_inos = (uint64_t *) memory_calloc(g_group_num
+                                                  * sizeof(uint64_t));
+    if (!g_applied_ids || !g_ckp_ids || !g_snap.ids || !g_next_inos
+        || !g_snap.next_inos) {
+        return NGX_ERROR;
+    }
+
+    for (int i = 0; i < g_group_num; i++) {
+        g_applied_ids[i] = g_ckp_ids[i] = g_snap.ids[i] = FI_NO_INSTANCE;
+        g_next_inos[i] = g_next_ino + i;
+    }
+
+    memory_zero(&g_delta, sizeof(fi_delta_t));
+    queue_init(&g_delta.dirty);
+    g_delta.chain = -1;
+
     return NGX_OK;
 }
 
 int nn_file_index_worker_release(cycle_t *cycle) {
+    fi_apply_pool_stop();
+
     fi_cache_mgmt_release(g_fcm);
     g_fcm = nullptr;
 
+    memory_free(g_applied_ids, g_group_num * sizeof(uint64_t));
+    memory_free(g_ckp_ids, g_group_num * sizeof(uint64_t));
+    memory_free(g_snap.ids, g_group_num * sizeof(uint64_t));
+    memory_free(g_next_inos, g_group_num * sizeof(uint64_t));
+    memory_free(g_snap.next_inos, g_group_num * sizeof(uint64_t));
+    g_applied_ids = g_ckp_ids = g_snap.ids = nullptr;
+    g_next_inos = g_snap.next_inos = nullptr;
+
+    fi_inode_mgmt_release();
+
     return NGX_OK;
 }
 
 static fi_cache_mgmt_t *fi_cache_mgmt_new_init(conf_server_t *conf) {
     size_t index_num = dfs_math_find_prime(conf->index_num);
+    size_t shard_num = conf->index_shard_num;
 
-    fi_cache_mgmt_t *fcm = fi_cache_mgmt_create(index_num);
+    fi_cache_mgmt_t *fcm = fi_cache_mgmt_create(index_num, shard_num);
     if (!fcm) {
         return nullptr;
     }
 
-    pthread_rwlock_init(&fcm->cache_rwlock, nullptr);
+    pthread_mutex_init(&fcm->ckp_lock, nullptr);
+    pthread_mutex_init(&fcm->apply_lock, nullptr);
 
     return fcm;
 }
 
 // 预先分配index_num个 fi_store_t
-// create hash table
-static fi_cache_mgmt_t *fi_cache_mgmt_create(size_t index_num) {
+// create the sharded dentry and ino tables, shard_num lock stripes
+static fi_cache_mgmt_t *fi_cache_mgmt_create(size_t index_num,
+                                             size_t shard_num) {
     fi_cache_mgmt_t *fcm = (fi_cache_mgmt_t *) memory_alloc(sizeof(*fcm));
     if (!fcm) {
         goto err_out;
     }
     // 预先分配index_num个 fi_store_t
-    if (fi_mem_mgmt_create(&fcm->mem_mgmt, index_num) != NGX_OK) {
+    if (fi_mem_mgmt_create(&fcm->mem_mgmt, index_num, shard_num) != NGX_OK) {
         goto err_mem_mgmt;
     }
 
-    fcm->fi_htable = dfs_hashtable_create(fi_hash_keycmp, index_num,
-            //dfs_hashtable_hash_key8, fcm->mem_mgmt.allocator);
-                                          dfs_hashtable_hash_low, fcm->mem_mgmt.allocator);
+    fcm->fi_htable = dfs_shard_hashtable_create(fi_dentry_keycmp, index_num,
+                                                fi_dentry_hash, fcm->mem_mgmt.allocator,
+                                                shard_num);
     if (!fcm->fi_htable) {
         goto err_htable;
     }
 
+    dfs_shard_hashtable_set_shard_hash(fcm->fi_htable, fi_dentry_shard_hash);
+
+    fcm->ino_htable = dfs_shard_hashtable_create(fi_ino_keycmp, index_num,
+                                                 fi_ino_hash, fcm->mem_mgmt.allocator,
+                                                 shard_num);
+    if (!fcm->ino_htable) {
+        goto err_ino_htable;
+    }
+
     return fcm;
 
+    err_ino_htable:
+    dfs_shard_hashtable_free_memory(fcm->fi_htable);
+
     err_htable:
     fi_mem_mgmt_destroy(&fcm->mem_mgmt);
 
@@ -170,10 +471,14 @@ static fi_cache_mgmt_t *fi_cache_mgmt_create(size_t index_num) {
 
 // 预先分配index_num个 fi_store_t
 static int fi_mem_mgmt_create(fi_cache_mem_t *mem_mgmt,
-                              size_t index_num) {
+                              size_t index_num, size_t shard_num) {
     assert(mem_mgmt);
 
-    size_t mem_size = FI_POOL_SIZE(index_num);
+    if (!shard_num) {
+        shard_num = DFS_SHARD_HASHTABLE_DEFAULT_SHARDS;
+    }
+
+    size_t mem_size = FI_POOL_SIZE(index_num) + FI_SHARD_BUF(shard_num);
 
     mem_mgmt->mem = memory_calloc(mem_size);
     if (!mem_mgmt->mem) {
@@ -270,6 +575,65 @@ static int fi_hash_keycmp(const void *arg1, const void *arg2,
     return string_strncmp(arg1, arg2, size);
 }
 
+static inline size_t fi_ino_mix(uint64_t ino) {
+    ino ^= ino >> 31;
+    ino *= 0x9e3779b97f4a7c15ULL;
+    ino ^= ino >> 29;
+
+    return ino;
+}
+
+static int fi_dentry_keycmp(const void *arg1, const void *arg2,
+                            size_t size) {
+    const fi_dentry_key_t *k1 = (const fi_dentry_key_t *) arg1;
+    const fi_dentry_key_t *k2 = (const fi_dentry_key_t *) arg2;
+
+    if (k1->parent != k2->parent || k1->len != k2->len) {
+        return 1;
+    }
+
+    return memory_memcmp(k1->name, k2->name, k1->len);
+}
+
+static size_t fi_dentry_hash(const void *key, size_t len, size_t size) {
+    const fi_dentry_key_t *dk = (const fi_dentry_key_t *) key;
+    size_t h = fi_ino_mix(dk->parent);
+
+    for (size_t i = 0; i < dk->len; i++) {
+        h = h * 31 + (uchar_t) dk->name[i];
+    }
+
+    return h % size;
+}
+
+// all entries of a directory go to the shard of the directory's ino
+static size_t fi_dentry_shard_hash(const void *key, size_t len,
+                                   size_t size) {
+    return fi_ino_mix(((const fi_dentry_key_t *) key)->parent) % size;
+}
+
+// children are ordered by name bytes, key is a fi_dentry_key_t
+static int fi_child_cmp(const void *key, const void *item) {
+    const fi_dentry_key_t *k = (const fi_dentry_key_t *) key;
+    const fi_store_t *fis = (const fi_store_t *) item;
+    size_t n = k->len < fis->dkey.len ? k->len : fis->dkey.len;
+
+    int rc = memory_memcmp(k->name, fis->dkey.name, n);
+    if (rc) {
+        return rc;
+    }
+
+    return k->len < fis->dkey.len ? -1 : k->len > fis->dkey.len;
+}
+
+static int fi_ino_keycmp(const void *arg1, const void *arg2, size_t size) {
+    return *(const uint64_t *) arg1 != *(const uint64_t *) arg2;
+}
+
+static size_t fi_ino_hash(const void *key, size_t len, size_t size) {
+    return fi_ino_mix(*(const uint64_t *) key) % size;
+}
+
 static void fi_cache_mgmt_release(fi_cache_mgmt_t *fcm) {
     assert(fcm);
 
@@ -277,9 +641,12 @@ static void fi_cache_mgmt_release(fi_cache_mgmt_t *fcm) {
     dfs_hashtable_free_items(fcm->fi_timer_htable, fi_timer_destroy, nullptr);
     pthread_rwlock_unlock(&fcm->timer_rwlock);
 
-    pthread_rwlock_destroy(&fcm->cache_rwlock);
+    pthread_mutex_destroy(&fcm->ckp_lock);
+    pthread_mutex_destroy(&fcm->apply_lock);
     pthread_rwlock_destroy(&fcm->timer_rwlock);
 
+    dfs_shard_hashtable_free_memory(fcm->ino_htable);
+    dfs_shard_hashtable_free_memory(fcm->fi_htable);
     fi_mem_mgmt_destroy(&fcm->mem_mgmt);
     memory_free(fcm, sizeof(*fcm));
 }
@@ -294,991 +661,3416 @@ static void fi_timer_destroy(void *args) {
 static void fi_store_destroy(fi_store_t *fis) {
     assert(fis);
 
-    mem_put(fis);
-}
-
-fi_store_t *get_store_obj(uchar_t *key) {
-    pthread_rwlock_rdlock(&g_fcm->cache_rwlock);
+    fi_name_free((char *) fis->dkey.name, fis->dkey.len);
+    fi_blk_list_free(fis->fin.blks);
+    dfs_btree_destroy(&fis->children);
 
-    fi_store_t *fi = (fi_store_t *) dfs_hashtable_lookup(g_fcm->fi_htable,
-                                                         (void *) key, string_strlen(key));
-
-    pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+    if (fis->creating) {
+        memory_free(fis->creating, sizeof(fi_creating_t));
+    }
 
-    return fi;
+    mem_put(fis);
 }
 
-void get_store_path(uchar_t *key, uchar_t *path) {
-    string_t src;
-    string_set(src, key);
+static uint64_t fi_next_ino() {
+    return __sync_fetch_and_add(&g_next_inos[g_apply_group], g_group_num);
+}
 
-    string_t dst;
-    string_set(dst, path);
+// after an image is loaded. the groups go on from their own next inos
+// if the image had them, from the floor of its inos if not
+static void fi_ino_sync() {
+    for (int i = 0; i < g_group_num; i++) {
+        if (g_next_inos[i] == FI_NO_INO) {
+            for (int k = 0; k < g_group_num; k++) {
+                g_next_inos[k] = g_next_ino + k;
+            }
 
-    string_base64_decode(&dst, &src);
+            return;
+        }
+    }
 }
 
-// 目录按照 “/” 分割
-// eg：/test/a
-// 会分割得到 /  test   a   3个
-int get_path_names(uchar_t *path, uchar_t names[][PATH_LEN]) {
-    uchar_t *str = nullptr;
-    char *saveptr = nullptr;
-    uchar_t *token = nullptr;
-    int i = 1;
-
-    strcpy((char *) names[0], "/"); //
+// the highest ino the groups may have handed out
+static uint64_t fi_max_ino(uint64_t *next_inos) {
+    uint64_t max = g_next_ino - 1;
 
-    for (str = path;; str = nullptr, token = nullptr, i++) {
-        token = (uchar_t *) strtok_r((char *) str, "/", &saveptr);
-        if (token == nullptr) {
-            break;
+    for (int i = 0; i < g_group_num; i++) {
+        if (next_inos[i] - 1 > max) {
+            max = next_inos[i] - 1;
         }
-
-        memset(names[i], 0x00, PATH_LEN);
-        strcpy((char *) names[i], (const char *) token);
     }
 
-    return i;
+    return max;
 }
 
-void key_encode(uchar_t *path, uchar_t *key) {
-    string_t src;
-    string_set(src, path);
+// intern the name, owner and group of fin into a fresh store, a zero
+// fin->ino gets the next free id. fis->fin.blks is left to the caller
+static int fi_store_set_inode(fi_store_t *fis, fi_inode_t *fin,
+                              uint64_t parent, const char *name, size_t len) {
+    fis->dkey.name = fi_name_dup(name, len);
+    if (!fis->dkey.name) {
+        return NGX_ERROR;
+    }
 
-    string_t dst;
-    string_set(dst, key);
+    fis->dkey.parent = parent;
+    fis->dkey.len = len;
 
-    string_base64_encode(&dst, &src);
-}
+    if (fin->ino) {
+        fis->fin.ino = fin->ino;
+    } else {
+        fis->fin.ino = parent == FI_NO_INO ? FI_ROOT_INO : fi_next_ino();
+    }
 
-void get_path_keys(uchar_t names[][PATH_LEN], int num, uchar_t keys[][PATH_LEN]) {
-    uchar_t sub_path[PATH_LEN] = "";
-    uchar_t ancestor_path[PATH_LEN] = "";
+    fis->fin.uid = fin->uid;
+    fis->fin.permission = fin->permission;
+    fis->fin.owner_id = fi_intern(fin->owner);
+    fis->fin.group_id = fi_intern(fin->group);
+    fis->fin.modification_time = fin->modification_time;
+    fis->fin.access_time = fin->access_time;
+    fis->fin.is_directory = fin->is_directory;
+    fis->fin.length = fin->length;
+    fis->fin.blk_size = fin->blk_size;
+    fis->fin.blk_replication = fin->blk_replication;
+    fis->fin.blk_seq = fin->blk_seq;
+    fis->fin.total_blk = fin->total_blk;
 
-    for (int i = 0; i < num; i++) {
-        if (0 == i) {
-            string_xxsprintf(sub_path, "%s", names[i]);
-        } else if (1 == i) {
-            string_xxsprintf(sub_path, "/%s", names[i]);
-        } else {
-            string_xxsprintf(sub_path, "%s/%s", ancestor_path, names[i]);
-        }
+    fis->ln.key = &fis->dkey;
+    fis->ln.len = sizeof(fi_dentry_key_t);
+    fis->ln.next = nullptr;
 
-        string_strncpy(ancestor_path, sub_path, strlen((const char *) sub_path));
+    fis->ino_ln.key = &fis->fin.ino;
+    fis->ino_ln.len = sizeof(uint64_t);
+    fis->ino_ln.next = nullptr;
 
-        memset(keys[i], 0x00, PATH_LEN);
-        key_encode(sub_path, keys[i]);
-    }
+    return NGX_OK;
 }
 
-int get_path_inodes(uchar_t keys[][PATH_LEN], int num,
-                    fi_inode_t *finodes[]) {
-    for (int i = 0; i < num; i++) {
-        fi_store_t *fi = get_store_obj(keys[i]);
-        if (nullptr == fi) {
-            // parent's inode index
-            return i - 1;
-        }
+static fi_store_t *fi_store_new(fi_inode_t *fin, uint64_t parent,
+                                const char *name, size_t len) {
+    fi_store_t *fis = (fi_store_t *) mem_get0(g_fcm->mem_mgmt.free_mblks);
+    if (!fis) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                      "mem_get0 fi_store err");
 
-        finodes[i] = &fi->fin;
+        return nullptr;
     }
 
-    return -1;
-}
-
-//
-int is_FsObjectExceed(int num) {
-    int isExceed = NGX_FALSE;
-    dfs_lock_errno_t lerr;
+    queue_init(&fis->ckp);
+    dfs_btree_init(&fis->children, fi_child_cmp);
 
-    conf_server_t *sconf = (conf_server_t *) dfs_cycle->sconf;
+    fis->ver = g_apply_seq;
 
-    dfs_atomic_lock_on(&g_fs_object_num_lock, &lerr);
+    if (fi_store_set_inode(fis, fin, parent, name, len) != NGX_OK) {
+        mem_put(fis);
 
-    isExceed = g_fs_object_num + num >= sconf->index_num
-               ? NGX_TRUE : NGX_FALSE;
+        return nullptr;
+    }
 
-    dfs_atomic_lock_off(&g_fs_object_num_lock, &lerr);
+    return fis;
+}
 
-    return isExceed;
+// caller holds the shard lock of fis->dkey.parent
+static void fi_store_join(fi_store_t *fis) {
+    dfs_shard_hashtable_join_nolock(g_fcm->fi_htable, &fis->ln);
+    dfs_shard_hashtable_join(g_fcm->ino_htable, &fis->ino_ln);
 }
 
-int inc_FsObjectNum(int num) {
-    dfs_lock_errno_t lerr;
+static void fi_store_unjoin(fi_store_t *fis) {
+    dfs_shard_hashtable_remove_link_nolock(g_fcm->fi_htable, &fis->ln);
+    dfs_shard_hashtable_remove_link(g_fcm->ino_htable, &fis->ino_ln);
 
-    dfs_atomic_lock_on(&g_fs_object_num_lock, &lerr);
+    fis->dead = NGX_TRUE;
+}
 
-    g_fs_object_num += num;
+// caller holds the shard lock of fis, key gets the entry name
+void get_store_inode(fi_store_t *fis, fi_inode_t *fin) {
+    memory_memcpy(fin->key, fis->dkey.name, fis->dkey.len);
+    fin->key[fis->dkey.len] = '\0';
+    fin->ino = fis->fin.ino;
+    fin->parent_ino = fis->dkey.parent;
+    fin->uid = fis->fin.uid;
+    fin->permission = fis->fin.permission;
+    string_strncpy(fin->owner, fi_intern_name(fis->fin.owner_id), 
+        OWNER_LEN - 1);
+    fin->owner[OWNER_LEN - 1] = '\0';
+    string_strncpy(fin->group, fi_intern_name(fis->fin.group_id), 
+        GROUP_LEN - 1);
+    fin->group[GROUP_LEN - 1] = '\0';
+    fin->modification_time = fis->fin.modification_time;
+    fin->access_time = fis->fin.access_time;
+    fin->is_directory = fis->fin.is_directory;
+    fin->length = fis->fin.length;
+    fin->blk_size = fis->fin.blk_size;
+    fin->blk_replication = fis->fin.blk_replication;
+    fin->blk_seq = fis->fin.blk_seq;
+    fin->total_blk = fis->fin.total_blk;
+    fin->blk_num = fis->fin.blks ? fis->fin.blks->blk_num : 0;
+}
 
-    dfs_atomic_lock_off(&g_fs_object_num_lock, &lerr);
+static inline size_t fi_dshard(uint64_t parent) {
+    fi_dentry_key_t dk = {parent, nullptr, 0};
 
-    return NGX_OK;
+    return dfs_shard_hashtable_index(g_fcm->fi_htable, &dk, sizeof(dk));
 }
 
-int sub_FsObjectNum(int num) {
-    dfs_lock_errno_t lerr;
+// caller holds the shard lock of parent
+static fi_store_t *fi_dentry_lookup_nolock(uint64_t parent,
+                                           const char *name, size_t len) {
+    fi_dentry_key_t dk = {parent, name, len};
 
-    dfs_atomic_lock_on(&g_fs_object_num_lock, &lerr);
+    return (fi_store_t *) dfs_shard_hashtable_lookup_nolock(g_fcm->fi_htable,
+                                                            &dk, sizeof(dk));
+}
 
-    g_fs_object_num -= num;
+// caller holds the shard lock of parent->fin.ino
+static int fi_child_add(fi_store_t *parent, fi_store_t *fis) {
+    if (dfs_btree_insert(&parent->children, &fis->dkey, fis) != DFS_BTREE_OK) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                      "add child %s err", fis->dkey.name);
 
-    dfs_atomic_lock_off(&g_fs_object_num_lock, &lerr);
+        return NGX_ERROR;
+    }
 
     return NGX_OK;
 }
 
-int is_InSafeMode() {
-    return NGX_FALSE;
+static void fi_child_del(fi_store_t *parent, fi_store_t *fis) {
+    dfs_btree_remove(&parent->children, &fis->dkey);
 }
 
-//
-int nn_mkdir(task_t *task) {
-    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+static void fi_ckp_insert(fi_store_t *fis) {
+    pthread_mutex_lock(&g_fcm->ckp_lock);
 
-    if (is_InSafeMode()) // default false
-    {
-        task->ret = IN_SAFE_MODE;
+    queue_insert_tail(&g_checkpoint_q, &fis->ckp);
 
-        return write_back(node);
+    if (!fis->dirty.next) {
+        queue_insert_tail(&g_delta.dirty, &fis->dirty);
     }
 
-    // push => paxos thread->task queue
-    push_task(&paxos_thread->tq, node);
-
-    return notice_wake_up(&paxos_thread->tq_notice);
+    pthread_mutex_unlock(&g_fcm->ckp_lock);
 }
 
-int nn_rmr(task_t *task) {
-    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+// the apply path is about to change fis, see fi_snap_cow
+static void fi_store_touch(fi_store_t *fis) {
+    fi_snap_cow(fis);
 
-    if (is_InSafeMode()) {
-        task->ret = IN_SAFE_MODE;
+    pthread_mutex_lock(&g_fcm->ckp_lock);
 
-        return write_back(node);
+    if (!fis->dirty.next) {
+        queue_insert_tail(&g_delta.dirty, &fis->dirty);
     }
 
-    push_task(&paxos_thread->tq, node);
-
-    return notice_wake_up(&paxos_thread->tq_notice);
+    pthread_mutex_unlock(&g_fcm->ckp_lock);
 }
 
-//
-int nn_ls(task_t *task) {
-    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
-    printf("ls key:%s\n", task->key);
-    fi_store_t *fis = get_store_obj((uchar_t *) task->key);
-    // ls 目录不存在
-    if (!fis) {
-        task->ret = KEY_NOTEXIST;
+// under ckp_lock
+static void fi_delta_dead(uint64_t ino) {
+    if (g_delta.dead_num == g_delta.dead_cap) {
+        size_t cap = g_delta.dead_cap ? g_delta.dead_cap * 2 : 1024;
+        uint64_t *dead = (uint64_t *) realloc(g_delta.dead,
+                                              cap * sizeof(uint64_t));
+        if (!dead) {
+            g_delta.lost = NGX_TRUE;
+
+            return;
+        }
 
-        // 重新push到不同的队列里 // dn 和 cli push 到bque队列，其他线程push到 tq队列里
-        // notice_wake_up
-        return write_back(node); // 这里是 cli thread ，直接交给cli thread 处理（直接发送回去）
+        g_delta.dead = dead;
+        g_delta.dead_cap = cap;
     }
 
-    uchar_t path[PATH_LEN] = "";
-    get_store_path((uchar_t *) task->key, path);
+    g_delta.dead[g_delta.dead_num++] = ino;
+}
 
-    // 考虑 用户 发多次 ls ，交给不同的 thread 处理
-    pthread_rwlock_rdlock(&g_fcm->cache_rwlock);
+// free an entry that is out of the tables. a running checkpoint may
+// still read it, then it waits in limbo for the checkpoint to end
+static void fi_store_release(fi_store_t *fis) {
+    pthread_mutex_lock(&g_fcm->ckp_lock);
 
-    fi_inode_t finode = fis->fin;
+    if (fis->dirty.next) {
+        queue_remove(&fis->dirty);
+    }
 
-    pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+    // it may be in the last image
+    if (fis->ckp.next && fis->ckp.next != &fis->ckp) {
+        fi_delta_dead(fis->fin.ino);
+    }
 
-    if (!is_super(task->user, &dfs_cycle->admin)) {
+    if (g_snap.active) {
+        fis->limbo = g_snap.limbo;
+        g_snap.limbo = fis;
 
-        if (check_ancestor_access(path, task, READ_EXECUTE, &finode) != NGX_OK) {
-            task->ret = PERMISSION_DENY;
+        pthread_mutex_unlock(&g_fcm->ckp_lock);
 
-            return write_back(node);
-        }
+        return;
     }
 
-    if (!finode.is_directory)  // 不是目录
-    {
-        task->data_len = sizeof(fi_inode_t);
-        task->data = malloc(task->data_len);
-        if (nullptr == task->data) {
-            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "malloc err");
-        }
+    if (fis->ckp.next) {
+        queue_remove(&fis->ckp);
+    }
 
-        memcpy(task->data, &finode, sizeof(fi_inode_t));
-    } else  // 是目录
-    {
-        pthread_rwlock_rdlock(&g_fcm->cache_rwlock);
+    pthread_mutex_unlock(&g_fcm->ckp_lock);
 
-        uint64_t children_num = fis->children_num;
-        printf("ls: %s %lu key:%s\n", path, fis->children_num, fis->fin.key);
+    fi_store_destroy(fis);
+}
 
-        if (children_num > 0) {
-            task->data_len = children_num * sizeof(fi_inode_t);
-            task->data = malloc(task->data_len);
-            if (nullptr == task->data) {
-                dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
-                              "malloc err");
-            }
-        }
+// called by the apply path before it updates or removes fis, with the
+// write lock of fis's shard held. keeps the state fis had at the
+// checkpoint instance if the checkpoint has not got it yet. the cow
+// sections are shared by the apply threads, they go under ckp_lock
+static void fi_snap_cow(fi_store_t *fis) {
+    if (!g_snap.active || fis->snap_seq == g_snap.seq) {
+        return;
+    }
 
-        char *pData = static_cast<char *>(task->data);
+    fis->snap_seq = g_snap.seq;
 
-        queue_t *head = &fis->children;
-        queue_t *entry = queue_next(head);
+    // created later, not in the image at all or not in this delta
+    if (fis->ver > g_snap.id || fis->state != KEY_STATE_OK || fis->dead
+        || (g_snap.delta && fis->delta_seq != g_snap.seq)) {
+        return;
+    }
 
-        while (children_num > 0) {
-            fi_store_t *fsubdir = queue_data(entry, fi_store_t, me);
+    pthread_mutex_lock(&g_fcm->ckp_lock);
 
-            entry = queue_next(entry);
+    fsimage_section_t *sec = g_snap.cow_num
+                             ? &g_snap.cow[g_snap.cow_num - 1] : nullptr;
 
-            memcpy(pData, &fsubdir->fin, sizeof(fi_inode_t));
-            pData += sizeof(fi_inode_t);
+    if (!sec || sec->hdr.record_num >= FI_IMAGE_SECTION_RECS) {
+        if (g_snap.cow_num == g_snap.cow_cap) {
+            size_t cap = g_snap.cow_cap ? g_snap.cow_cap * 2 : 4;
+            fsimage_section_t *cow = (fsimage_section_t *) realloc(g_snap.cow,
+                                                                   cap * sizeof(fsimage_section_t));
+            if (!cow) {
+                goto err;
+            }
 
-            children_num--;
+            g_snap.cow = cow;
+            g_snap.cow_cap = cap;
         }
 
-        pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+        sec = &g_snap.cow[g_snap.cow_num++];
+        memory_zero(sec, sizeof(fsimage_section_t));
     }
 
-    task->ret = NGX_OK;
-
-    return write_back(node);
-}
+    uint64_t *blks;
+    uint64_t blks_cap;
+    int rc;
 
-int nn_get_file_info(task_t *task) {
-    return NGX_OK;
-}
+    blks = nullptr;
+    blks_cap = 0;
+    rc = fi_image_put_store(sec, fis, &blks, &blks_cap);
 
-// task thread
-int nn_create(task_t *task) {
-    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+    free(blks);
 
-    if (is_InSafeMode()) {
-        task->ret = IN_SAFE_MODE;
+    if (rc == NGX_OK) {
+        pthread_mutex_unlock(&g_fcm->ckp_lock);
 
-        return write_back(node);
+        return;
     }
 
-    push_task(&paxos_thread->tq, node);
-
-    return notice_wake_up(&paxos_thread->tq_notice);
-}
+    err:
+    pthread_mutex_unlock(&g_fcm->ckp_lock);
 
-int nn_get_additional_blk(task_t *task) {
-    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+    // the image would miss fis, fail this checkpoint
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                  "checkpoint copy of %s err", fis->dkey.name);
 
-    if (is_InSafeMode()) {
-        task->ret = IN_SAFE_MODE;
+    g_snap.cow_err = NGX_TRUE;
+}
 
-        return write_back(node);
-    }
+void get_store_path(uchar_t *key, uchar_t *path) {
+    string_t src;
+    string_set(src, key);
 
-    push_task(&paxos_thread->tq, node);
+    string_t dst;
+    string_set(dst, path);
 
-    return notice_wake_up(&paxos_thread->tq_notice);
+    string_base64_decode(&dst, &src);
 }
 
-int nn_close(task_t *task) {
+void key_encode(uchar_t *path, uchar_t *key) {
+    string_t src;
+    string_set(src, path);
+
+    string_t dst;
+    string_set(dst, key);
+
+    string_base64_encode(&dst, &src);
+}
+
+// decode key and split it on "/", empty components are skipped
+// eg：/test/a -> test  a
+int fi_path_parse(uchar_t *key, fi_path_t *fp) {
+    string_t src;
+    string_set(src, key);
+
+    if (src.len >= KEY_LEN) {
+        return NGX_ERROR;
+    }
+
+    string_t dst;
+    dst.data = (uchar_t *) fp->buf;
+    dst.len = 0;
+
+    if (string_base64_decode(&dst, &src) != NGX_OK || dst.len == 0
+        || fp->buf[0] != '/') {
+        return NGX_ERROR;
+    }
+
+    char *p = fp->buf;
+    char *end = fp->buf + dst.len;
+
+    *end = '\0';
+    fp->num = 0;
+
+    while (p < end) {
+        while (p < end && *p == '/') {
+            *p++ = '\0';
+        }
+
+        if (p == end) {
+            break;
+        }
+
+        if (fp->num == FI_PATH_DEPTH) {
+            return NGX_ERROR;
+        }
+
+        fp->names[fp->num] = p;
+
+        while (p < end && *p != '/') {
+            p++;
+        }
+
+        fp->lens[fp->num] = p - fp->names[fp->num];
+        fp->num++;
+    }
+
+    return NGX_OK;
+}
+
+static inline const char *fi_level_name(fi_path_t *fp, int level,
+                                        size_t *len) {
+    if (level == 0) {
+        *len = 1;
+
+        return "/";
+    }
+
+    *len = fp->lens[level - 1];
+
+    return fp->names[level - 1];
+}
+
+// the path of the first level components, "/" for level 0
+static size_t fi_path_str(fi_path_t *fp, int level, char *buf, size_t size) {
+    size_t n = 0;
+
+    if (level == 0) {
+        buf[n++] = '/';
+    }
+
+    for (int i = 0; i < level; i++) {
+        if (n + 1 + fp->lens[i] >= size) {
+            break;
+        }
+
+        buf[n++] = '/';
+        memory_memcpy(buf + n, fp->names[i], fp->lens[i]);
+        n += fp->lens[i];
+    }
+
+    buf[n] = '\0';
+
+    return n;
+}
+
+void fi_path_key(fi_path_t *fp, int level, uchar_t *key) {
+    char path[PATH_LEN] = "";
+
+    fi_path_str(fp, level, path, sizeof(path));
+    memset(key, 0x00, KEY_LEN);
+    key_encode((uchar_t *) path, key);
+}
+
+// is sub fp itself or below it
+int fi_path_is_prefix(fi_path_t *fp, fi_path_t *sub) {
+    if (sub->num < fp->num) {
+        return NGX_FALSE;
+    }
+
+    for (int i = 0; i < fp->num; i++) {
+        if (fp->lens[i] != sub->lens[i]
+            || memory_memcmp(fp->names[i], sub->names[i], fp->lens[i])) {
+            return NGX_FALSE;
+        }
+    }
+
+    return NGX_TRUE;
+}
+
+// walk down from the root one component at a time, each level under
+// its parent's shard lock only. inos[i] (and finodes[i]) get level i,
+// returns the number of levels found
+int fi_path_resolve(fi_path_t *fp, int levels, uint64_t inos[],
+                    fi_inode_t finodes[]) {
+    uint64_t parent = FI_NO_INO;
+    int i = 0;
+
+    if (levels > fp->num + 1) {
+        levels = fp->num + 1;
+    }
+
+    for (i = 0; i < levels; i++) {
+        size_t len = 0;
+        const char *name = fi_level_name(fp, i, &len);
+        size_t idx = fi_dshard(parent);
+
+        dfs_shard_hashtable_rdlock(g_fcm->fi_htable, idx);
+
+        fi_store_t *fis = fi_dentry_lookup_nolock(parent, name, len);
+        if (!fis) {
+            dfs_shard_hashtable_unlock(g_fcm->fi_htable, idx);
+
+            break;
+        }
+
+        inos[i] = fis->fin.ino;
+
+        if (finodes) {
+            get_store_inode(fis, &finodes[i]);
+        }
+
+        dfs_shard_hashtable_unlock(g_fcm->fi_htable, idx);
+
+        parent = inos[i];
+    }
+
+    return i;
+}
+
+// the entry at the end of fp, returned with its shard read locked
+static fi_store_t *fi_path_rdlock(fi_path_t *fp, size_t *idx) {
+    uint64_t inos[FI_PATH_DEPTH + 1];
+
+    if (fi_path_resolve(fp, fp->num, inos, nullptr) < fp->num) {
+        return nullptr;
+    }
+
+    uint64_t parent = fp->num ? inos[fp->num - 1] : FI_NO_INO;
+    size_t len = 0;
+    const char *name = fi_level_name(fp, fp->num, &len);
+
+    *idx = fi_dshard(parent);
+
+    dfs_shard_hashtable_rdlock(g_fcm->fi_htable, *idx);
+
+    fi_store_t *fis = fi_dentry_lookup_nolock(parent, name, len);
+    if (!fis) {
+        dfs_shard_hashtable_unlock(g_fcm->fi_htable, *idx);
+    }
+
+    return fis;
+}
+
+int get_store_stat(uchar_t *key, fi_inode_t *fin, short *state) {
+    fi_path_t fp;
+    size_t idx = 0;
+
+    if (fi_path_parse(key, &fp) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    fi_store_t *fis = fi_path_rdlock(&fp, &idx);
+    if (!fis) {
+        return NGX_ERROR;
+    }
+
+    get_store_inode(fis, fin);
+
+    if (state) {
+        *state = fis->state;
+    }
+
+    dfs_shard_hashtable_unlock(g_fcm->fi_htable, idx);
+
+    return NGX_OK;
+}
+
+// write lock the shards of the entry at level num and of its parent's
+// entry. the parent is looked up again under the locks since it may
+// have been moved meanwhile. DFS_DECLINED if the parent doesn't exist
+static int fi_lock_target(fi_path_t *fp, int num, fi_lock_t *fl) {
+    uint64_t inos[FI_PATH_DEPTH + 1];
+
+    if (num == 0) {
+        fl->pino = FI_NO_INO;
+        fl->parent = nullptr;
+        fl->idx[0] = fl->idx[1] = fi_dshard(FI_NO_INO);
+
+        dfs_shard_hashtable_wrlock(g_fcm->fi_htable, fl->idx[0]);
+
+        return NGX_OK;
+    }
+
+    for (int i = 0; i < FI_LOCK_RETRY; i++) {
+        if (fi_path_resolve(fp, num, inos, nullptr) < num) {
+            return DFS_DECLINED;
+        }
+
+        uint64_t ppino = num > 1 ? inos[num - 2] : FI_NO_INO;
+        size_t len = 0;
+        const char *pname = fi_level_name(fp, num - 1, &len);
+
+        fl->pino = inos[num - 1];
+        fl->idx[0] = fi_dshard(fl->pino);
+        fl->idx[1] = fi_dshard(ppino);
+
+        dfs_shard_hashtable_wrlock2(g_fcm->fi_htable, fl->idx[0], fl->idx[1]);
+
+        fl->parent = fi_dentry_lookup_nolock(ppino, pname, len);
+        if (fl->parent && fl->parent->fin.ino == fl->pino) {
+            return NGX_OK;
+        }
+
+        dfs_shard_hashtable_unlock2(g_fcm->fi_htable, fl->idx[0], fl->idx[1]);
+    }
+
+    return NGX_ERROR;
+}
+
+static void fi_unlock_target(fi_lock_t *fl) {
+    dfs_shard_hashtable_unlock2(g_fcm->fi_htable, fl->idx[0], fl->idx[1]);
+}
+
+//
+int is_FsObjectExceed(int num) {
+    int isExceed = NGX_FALSE;
+    dfs_lock_errno_t lerr;
+
+    conf_server_t *sconf = (conf_server_t *) dfs_cycle->sconf;
+
+    dfs_atomic_lock_on(&g_fs_object_num_lock, &lerr);
+
+    isExceed = g_fs_object_num + num >= sconf->index_num
+               ? NGX_TRUE : NGX_FALSE;
+
+    dfs_atomic_lock_off(&g_fs_object_num_lock, &lerr);
+
+    return isExceed;
+}
+
+int inc_FsObjectNum(int num) {
+    dfs_lock_errno_t lerr;
+
+    dfs_atomic_lock_on(&g_fs_object_num_lock, &lerr);
+
+    g_fs_object_num += num;
+
+    dfs_atomic_lock_off(&g_fs_object_num_lock, &lerr);
+
+    return NGX_OK;
+}
+
+int sub_FsObjectNum(int num) {
+    dfs_lock_errno_t lerr;
+
+    dfs_atomic_lock_on(&g_fs_object_num_lock, &lerr);
+
+    g_fs_object_num -= num;
+
+    dfs_atomic_lock_off(&g_fs_object_num_lock, &lerr);
+
+    return NGX_OK;
+}
+
+int is_InSafeMode() {
+    return NGX_FALSE;
+}
+
+//
+int nn_mkdir(task_t *task) {
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+    if (is_InSafeMode()) // default false
+    {
+        task->ret = IN_SAFE_MODE;
+
+        return write_back(node);
+    }
+
+    // push => paxos thread->task queue
+    push_task(&paxos_thread->tq, node);
+
+    return notice_wake_up(&paxos_thread->tq_notice);
+}
+
+int nn_rmr(task_t *task) {
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+    if (is_InSafeMode()) {
+        task->ret = IN_SAFE_MODE;
+
+        return write_back(node);
+    }
+
+    push_task(&paxos_thread->tq, node);
+
+    return notice_wake_up(&paxos_thread->tq_notice);
+}
+
+// find the listed entry and check the caller may read it, returned
+// with its shard (*pidx) read locked, or nullptr with task->ret set
+static fi_store_t *fi_ls_open(task_t *task, fi_path_t *fp,
+                              fi_inode_t *finode, size_t *pidx) {
+    uchar_t path[PATH_LEN] = "";
+    get_store_path((uchar_t *) task->key, path);
+
+    if (fi_path_parse((uchar_t *) task->key, fp) != NGX_OK) {
+        task->ret = KEY_NOTEXIST;
+
+        return nullptr;
+    }
+
+    fi_store_t *fis = fi_path_rdlock(fp, pidx);
+    if (!fis) {
+        task->ret = KEY_NOTEXIST;
+
+        return nullptr;
+    }
+
+    get_store_inode(fis, finode);
+
+    if (!is_super(task->user, &dfs_cycle->admin)
+        && check_ancestor_access(path, task, READ_EXECUTE, finode) != NGX_OK) {
+        dfs_shard_hashtable_unlock(g_fcm->fi_htable, *pidx);
+
+        task->ret = PERMISSION_DENY;
+
+        return nullptr;
+    }
+
+    return fis;
+}
+
+// the children of a dir live in the shard of its ino, drop the entry's
+// shard and take both in order, then check the entry is still the same
+static fi_store_t *fi_ls_lock_dir(fi_path_t *fp, fi_inode_t *finode,
+                                  size_t pidx, size_t *idx) {
+    size_t len = 0;
+    const char *name = fi_level_name(fp, fp->num, &len);
+
+    *idx = fi_dshard(finode->ino);
+
+    dfs_shard_hashtable_unlock(g_fcm->fi_htable, pidx);
+    dfs_shard_hashtable_rdlock2(g_fcm->fi_htable, pidx, *idx);
+
+    fi_store_t *fis = fi_dentry_lookup_nolock(finode->parent_ino, name, len);
+    if (!fis || fis->fin.ino != finode->ino) {
+        dfs_shard_hashtable_unlock2(g_fcm->fi_htable, pidx, *idx);
+
+        return nullptr;
+    }
+
+    return fis;
+}
+
+//
+int nn_ls(task_t *task) {
     task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+    fi_path_t fp;
+    fi_inode_t finode;
+    size_t pidx = 0;
+    size_t idx = 0;
+
+    // 考虑 用户 发多次 ls ，交给不同的 thread 处理
+    fi_store_t *fis = fi_ls_open(task, &fp, &finode, &pidx);
+    if (!fis) {
+        return write_back(node);
+    }
+
+    if (!finode.is_directory)  // 不是目录
+    {
+        dfs_shard_hashtable_unlock(g_fcm->fi_htable, pidx);
+
+        string_strncpy(finode.key, task->key, KEY_LEN);
+
+        task->data_len = sizeof(fi_inode_t);
+        task->data = malloc(task->data_len);
+        if (nullptr == task->data) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "malloc err");
+        } else {
+            memcpy(task->data, &finode, sizeof(fi_inode_t));
+        }
+
+        task->ret = NGX_OK;
+
+        return write_back(node);
+    }
+
+    // 是目录
+    fis = fi_ls_lock_dir(&fp, &finode, pidx, &idx);
+    if (!fis) {
+        task->ret = KEY_NOTEXIST;
+
+        return write_back(node);
+    }
+
+    uint64_t children_num = dfs_btree_count(&fis->children);
+
+    if (children_num > 0) {
+        task->data_len = children_num * sizeof(fi_inode_t);
+        task->data = malloc(task->data_len);
+        if (nullptr == task->data) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                          "malloc err");
+
+            task->data_len = 0;
+            children_num = 0;
+        }
+    }
+
+    char dir[PATH_LEN] = "";
+    if (fp.num > 0) {
+        fi_path_str(&fp, fp.num, dir, sizeof(dir));
+    }
+
+    fi_inode_t *pData = static_cast<fi_inode_t *>(task->data);
+
+    dfs_btree_cursor_t cur;
+    dfs_btree_seek(&fis->children, nullptr, &cur);
+
+    while (children_num > 0) {
+        fi_store_t *fsubdir = (fi_store_t *) dfs_btree_next(&cur);
+
+        get_store_inode(fsubdir, pData);
+
+        // replies carry the full key of each child
+        char sub_path[PATH_LEN] = "";
+        string_xxsnprintf((uchar_t *) sub_path, FI_KEY_PATH_MAX, "%s/%s",
+                          dir, pData->key);
+        memset(pData->key, 0x00, KEY_LEN);
+        key_encode((uchar_t *) sub_path, (uchar_t *) pData->key);
+
+        pData++;
+        children_num--;
+    }
+
+    dfs_shard_hashtable_unlock2(g_fcm->fi_htable, pidx, idx);
+
+    task->ret = NGX_OK;
+
+    return write_back(node);
+}
+
+static uchar_t *fi_ls_entry_put(uchar_t *p, fi_store_t *fis, size_t name_len) {
+    ls_entry_t e;
+
+    e.length = fis->fin.length;
+    e.modification_time = fis->fin.modification_time;
+    e.name_len = name_len;
+    e.is_directory = fis->fin.is_directory;
+
+    p = memory_cpymem(p, &e, sizeof(ls_entry_t));
+
+    return memory_cpymem(p, fis->dkey.name, name_len);
+}
+
+// one page of a listing in name order, the client passes the last name
+// it got as start_after
+int nn_ls_page(task_t *task) {
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+    ls_page_req_t req;
+    ls_page_resp_t resp;
+    fi_path_t fp;
+    fi_inode_t finode;
+    size_t pidx = 0;
+    size_t idx = 0;
+
+    memory_zero(&req, sizeof(ls_page_req_t));
+    memory_zero(&resp, sizeof(ls_page_resp_t));
+
+    if (task->data && task->data_len > 0) {
+        memcpy(&req, task->data, task->data_len < (int) sizeof(req)
+                                 ? task->data_len : sizeof(req));
+    }
+
+    task->data = nullptr;
+    task->data_len = 0;
+
+    if (req.max_entries == 0 || req.max_entries > LS_PAGE_MAX_ENTRIES) {
+        req.max_entries = LS_PAGE_MAX_ENTRIES;
+    }
+
+    if (req.after_len >= LS_NAME_LEN) {
+        req.after_len = 0;
+    }
+
+    fi_store_t *fis = fi_ls_open(task, &fp, &finode, &pidx);
+    if (!fis) {
+        return write_back(node);
+    }
+
+    if (!finode.is_directory) {
+        resp.num = 1;
+
+        task->data_len = sizeof(resp) + sizeof(ls_entry_t);
+        task->data = malloc(task->data_len);
+        if (task->data) {
+            uchar_t *p = memory_cpymem(task->data, &resp, sizeof(resp));
+            fi_ls_entry_put(p, fis, 0);
+        }
+
+        dfs_shard_hashtable_unlock(g_fcm->fi_htable, pidx);
+
+        if (!task->data) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "malloc err");
+
+            task->data_len = 0;
+        }
+
+        task->ret = NGX_OK;
+
+        return write_back(node);
+    }
+
+    fis = fi_ls_lock_dir(&fp, &finode, pidx, &idx);
+    if (!fis) {
+        task->ret = KEY_NOTEXIST;
+
+        return write_back(node);
+    }
+
+    // size the page first, the cursor is walked again to fill it
+    fi_dentry_key_t after = {finode.ino, req.start_after, req.after_len};
+    dfs_btree_cursor_t cur;
+    fi_store_t *child = nullptr;
+    size_t size = sizeof(resp);
+
+    dfs_btree_seek(&fis->children, req.after_len ? &after : nullptr, &cur);
+
+    dfs_btree_cursor_t start = cur;
+
+    while (resp.num < req.max_entries
+           && (child = (fi_store_t *) dfs_btree_next(&cur)) != nullptr) {
+        size += sizeof(ls_entry_t) + child->dkey.len;
+        resp.num++;
+    }
+
+    resp.more = dfs_btree_next(&cur) != nullptr;
+
+    task->data = malloc(size);
+    if (task->data) {
+        uchar_t *p = memory_cpymem(task->data, &resp, sizeof(resp));
+
+        cur = start;
+
+        for (uint32_t i = 0; i < resp.num; i++) {
+            child = (fi_store_t *) dfs_btree_next(&cur);
+            p = fi_ls_entry_put(p, child, child->dkey.len);
+        }
+
+        task->data_len = size;
+    } else {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "malloc err");
+    }
+
+    dfs_shard_hashtable_unlock2(g_fcm->fi_htable, pidx, idx);
+
+    task->ret = NGX_OK;
+
+    return write_back(node);
+}
+
+int nn_get_file_info(task_t *task) {
+    return NGX_OK;
+}
+
+// task thread
+int nn_create(task_t *task) {
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+    if (is_InSafeMode()) {
+        task->ret = IN_SAFE_MODE;
+
+        return write_back(node);
+    }
+
+    push_task(&paxos_thread->tq, node);
+
+    return notice_wake_up(&paxos_thread->tq_notice);
+}
+
+int nn_get_additional_blk(task_t *task) {
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+    if (is_InSafeMode()) {
+        task->ret = IN_SAFE_MODE;
+
+        return write_back(node);
+    }
+
+    push_task(&paxos_thread->tq, node);
+
+    return notice_wake_up(&paxos_thread->tq_notice);
+}
+
+int nn_close(task_t *task) {
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+    if (is_InSafeMode()) {
+        task->ret = IN_SAFE_MODE;
+
+        return write_back(node);
+    }
+
+    push_task(&paxos_thread->tq, node);
+
+    return notice_wake_up(&paxos_thread->tq_notice);
+}
+
+int nn_rm(task_t *task) {
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+    if (is_InSafeMode()) {
+        task->ret = IN_SAFE_MODE;
+
+        return write_back(node);
+    }
+
+    push_task(&paxos_thread->tq, node);
+
+    return notice_wake_up(&paxos_thread->tq_notice);
+}
+
+
+int nn_rename(task_t *task) {
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+    if (is_InSafeMode()) {
+        task->ret = IN_SAFE_MODE;
+
+        return write_back(node);
+    }
+
+    push_task(&paxos_thread->tq, node);
+
+    return notice_wake_up(&paxos_thread->tq_notice);
+}
+
+// the paxos thread splits it into its ops
+int nn_batch(task_t *task) {
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+    if (is_InSafeMode()) {
+        task->ret = IN_SAFE_MODE;
+
+        return write_back(node);
+    }
+
+    push_task(&paxos_thread->tq, node);
+
+    return notice_wake_up(&paxos_thread->tq_notice);
+}
+
+int nn_open(task_t *task) {
+    create_blk_info_t blk_info;
+    create_resp_info_t resp_info;
+    fi_path_t fp;
+    size_t idx = 0;
+
+    memset(&resp_info, 0x00, sizeof(create_resp_info_t));
+    memset(&blk_info, 0x00, sizeof(create_blk_info_t));
+    memcpy(&blk_info, task->data, sizeof(create_blk_info_t));
+
+    task->data_len = 0;
+    task->data = nullptr;
+
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+    fi_store_t *fi = nullptr;
+
+    if (fi_path_parse((uchar_t *) task->key, &fp) == NGX_OK) {
+        fi = fi_path_rdlock(&fp, &idx);
+    }
+
+    if (!fi) {
+        task->ret = KEY_NOTEXIST;
+
+        return write_back(node);
+    } else if (fi->state == KEY_STATE_CREATING) {
+        dfs_shard_hashtable_unlock(g_fcm->fi_htable, idx);
+
+        task->ret = KEY_STATE_CREATING;
+
+        return write_back(node);
+    }
+
+    fi_inode_t fin;
+    get_store_inode(fi, &fin);
+
+    uint64_t blk_id = fi_blk_list_first(fi->fin.blks);
+
+    dfs_shard_hashtable_unlock(g_fcm->fi_htable, idx);
+
+    if (fin.is_directory) {
+        task->ret = NOT_FILE;
+
+        return write_back(node);
+    }
+
+    uchar_t path[PATH_LEN] = "";
+    get_store_path((uchar_t *) task->key, path);
+
+
+    if (!is_super(task->user, &dfs_cycle->admin)) {
+        if (check_ancestor_access(path, task, READ_EXECUTE, &fin) != NGX_OK) {
+            task->ret = PERMISSION_DENY;
+
+            return write_back(node);
+        }
+    }
+
+    blk_store_t *blk = get_blk_store_obj(blk_id);
+    if (!blk) {
+        task->ret = KEY_NOTEXIST;
+
+        return write_back(node);
+    }
+
+    resp_info.blk_id = blk->id;
+    resp_info.blk_sz = blk->size;
+    resp_info.namespace_id = dfs_cycle->namespace_id;
+
+    resp_info.dn_num = 1;
+    strcpy(resp_info.dn_ips[0], blk->dn_ip);
+    strcpy(resp_info.dn_ips[1], "");
+    strcpy(resp_info.dn_ips[2], "");
+
+    task->data_len = sizeof(create_resp_info_t);
+    task->data = malloc(task->data_len);
+
+    if (nullptr == task->data) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "malloc err");
+    }
+
+    memcpy(task->data, &resp_info, task->data_len);
+
+    task->ret = SUCC;
+
+    return write_back(node);
+}
+
+// paxos 的处理函数
+// an instance carries one edit or a batch of them, all are applied
+// before a checkpoint can start
+int update_fi_cache_mgmt(const int iGroupIdx, const uint64_t llInstanceID,
+                         const std::string &sPaxosValue, void *data) {
+    vector<EditlogOp> bufs;
+    vector<fi_op_t> ops;
+    int rc = NGX_OK;
+
+    if (iGroupIdx < 0 || iGroupIdx >= g_group_num) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                      "instance %lu of unknown group %d",
+                      llInstanceID, iGroupIdx);
+
+        return NGX_ERROR;
+    }
+
+    if (!EditlogIsBatch(sPaxosValue)) {
+        bufs.push_back(EditlogOp(sPaxosValue.data(), sPaxosValue.size()));
+    } else if (EditlogBatchDecode(sPaxosValue, bufs) != NGX_OK) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                      "bad edit batch, instance %lu", llInstanceID);
+
+        rc = NGX_ERROR;
+    }
+
+    ops.resize(bufs.size());
+
+    for (size_t i = 0; i < bufs.size(); i++) {
+        fi_op_parse(&ops[i], bufs[i].first, bufs[i].second);
+    }
+
+    pthread_mutex_lock(&g_fcm->apply_lock);
+
+    g_apply_seq++;
+    g_apply_group = iGroupIdx;
+
+    if (fi_apply_ops(ops, llInstanceID, data) != NGX_OK) {
+        rc = NGX_ERROR;
+    }
+
+    g_applied_ids[iGroupIdx] = llInstanceID;
+    g_log_edits += ops.size();
+    g_log_bytes += sPaxosValue.size();
+
+    pthread_mutex_unlock(&g_fcm->apply_lock);
+
+    return rc;
+}
+
+// a string of a record, cut to fit and terminated
+static void fi_rec_str(char *buf, size_t size, const char *s, size_t len) {
+    if (len >= size) {
+        len = size - 1;
+    }
+
+    memory_memcpy(buf, s, len);
+    buf[len] = '\0';
+}
+
+// "/a/b/" for the parent of key, "/" if it does not parse
+static void fi_op_dir(const char *key, size_t len, vector<string> &dirs) {
+    char buf[KEY_LEN];
+    fi_path_t fp;
+    string dir = "/";
+
+    fi_rec_str(buf, sizeof(buf), key, len);
+
+    if (fi_path_parse((uchar_t *) buf, &fp) == NGX_OK) {
+        for (int i = 0; i + 1 < fp.num; i++) {
+            dir.append(fp.names[i], fp.lens[i]);
+            dir += '/';
+        }
+    }
+
+    dirs.push_back(dir);
+}
+
+// a LogOperator of an older log, as a record pointing into it
+static void fi_rec_from_proto(LogOperator *lopr, editlog_rec_t *rec) {
+    const string *key = nullptr;
+    const string *owner = nullptr;
+    const string *group = nullptr;
+
+    memory_zero(rec, sizeof(editlog_rec_t));
+
+    rec->optype = lopr->optype();
+
+    switch (rec->optype) {
+        case NN_MKDIR:
+            key = &lopr->mkr().key();
+            owner = &lopr->mkr().owner();
+            group = &lopr->mkr().group();
+            rec->permission = lopr->mkr().permission();
+            rec->modification_time = lopr->mkr().modification_time();
+            break;
+
+        case NN_RMR:
+            key = &lopr->rmr().key();
+            rec->modification_time = lopr->rmr().modification_time();
+            break;
+
+        case NN_CREATE:
+            key = &lopr->cre().key();
+            owner = &lopr->cre().owner();
+            group = &lopr->cre().group();
+            rec->permission = lopr->cre().permission();
+            rec->modification_time = lopr->cre().modification_time();
+            rec->blk_id = lopr->cre().blk_id();
+            rec->blk_sz = lopr->cre().blk_sz();
+            rec->blk_rep = lopr->cre().blk_rep();
+            rec->blk_seq = lopr->cre().blk_seq();
+            rec->total_blk = lopr->cre().total_blk();
+            break;
+
+        case NN_GET_ADDITIONAL_BLK:
+            key = &lopr->gab().key();
+            rec->blk_id = lopr->gab().blk_id();
+            rec->blk_sz = lopr->gab().blk_sz();
+            rec->blk_rep = lopr->gab().blk_rep();
+            break;
+
+        case NN_CLOSE:
+            key = &lopr->cle().key();
+            rec->modification_time = lopr->cle().modification_time();
+            rec->len = lopr->cle().len();
+            rec->blk_rep = lopr->cle().blk_rep();
+            break;
+
+        case NN_RM:
+            key = &lopr->rm().key();
+            rec->modification_time = lopr->rm().modification_time();
+            break;
+
+        case NN_RENAME: // rmr carried the source, mkr the destination
+            key = &lopr->rmr().key();
+            rec->modification_time = lopr->rmr().modification_time();
+            rec->dst = lopr->mkr().key().data();
+            rec->dst_len = lopr->mkr().key().size();
+            break;
+
+        default:
+            break;
+    }
+
+    if (key) {
+        rec->key = key->data();
+        rec->key_len = key->size();
+    }
+
+    if (owner) {
+        rec->owner = owner->data();
+        rec->owner_len = owner->size();
+        rec->group = group->data();
+        rec->group_len = group->size();
+    }
+}
+
+// the record points into buf, which has to outlive op
+static void fi_op_parse(fi_op_t *op, const char *buf, size_t len) {
+    editlog_rec_t *rec = &op->rec;
+
+    op->ino = 0;
+    op->wave = 0;
+    op->rc = NGX_OK;
+
+    int rc = EditlogRecDecode(buf, len, rec);
+    if (rc == DFS_DECLINED) {
+        op->lopr.ParseFromArray(buf, (int) len);
+        fi_rec_from_proto(&op->lopr, rec);
+    } else if (rc != NGX_OK) {
+        // applied as an unknown op
+        memory_zero(rec, sizeof(editlog_rec_t));
+    }
+
+    switch (rec->optype) {
+        case NN_MKDIR:
+        case NN_RMR:
+        case NN_CREATE:
+        case NN_GET_ADDITIONAL_BLK:
+        case NN_CLOSE:
+        case NN_RM:
+            fi_op_dir(rec->key, rec->key_len, op->dirs);
+            break;
+
+        case NN_RENAME:
+            fi_op_dir(rec->key, rec->key_len, op->dirs);
+            fi_op_dir(rec->dst, rec->dst_len, op->dirs);
+            break;
+
+        default:
+            // ordered against everything
+            op->dirs.push_back("/");
+            break;
+    }
+}
+
+// whether every parent of the op's key is in the namespace
+static int fi_op_parents_exist(fi_op_t *op) {
+    char buf[KEY_LEN];
+    fi_path_t fp;
+    uint64_t inos[FI_PATH_DEPTH + 1];
+
+    fi_rec_str(buf, sizeof(buf), op->rec.key, op->rec.key_len);
+
+    if (fi_path_parse((uchar_t *) buf, &fp) != NGX_OK) {
+        return NGX_FALSE;
+    }
+
+    return fi_path_resolve(&fp, fp.num, inos, nullptr) == fp.num;
+}
+
+// whether a dir of a is on the path of a dir of b or the other way
+static int fi_op_conflict(fi_op_t *a, fi_op_t *b) {
+    for (size_t i = 0; i < a->dirs.size(); i++) {
+        for (size_t k = 0; k < b->dirs.size(); k++) {
+            const string &da = a->dirs[i];
+            const string &db = b->dirs[k];
+            size_t n = da.size() < db.size() ? da.size() : db.size();
+
+            if (da.compare(0, n, db, 0, n) == 0) {
+                return NGX_TRUE;
+            }
+        }
+    }
+
+    return NGX_FALSE;
+}
+
+static void *fi_apply_worker(void *arg) {
+    fi_apply_pool_t *pool = &g_apply_pool;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;) {
+        while (pool->running && pool->next >= pool->wave_num) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        if (!pool->running) {
+            break;
+        }
+
+        fi_op_t *op = pool->wave[pool->next++];
+
+        pthread_mutex_unlock(&pool->lock);
+
+        fi_apply_op(op, pool->id, pool->data);
+
+        pthread_mutex_lock(&pool->lock);
+
+        if (++pool->done == pool->wave_num) {
+            pthread_cond_broadcast(&pool->cond);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return nullptr;
+}
+
+// run the ops of a wave on the pool, the applier takes its share
+static void fi_apply_wave(fi_op_t **wave, size_t num,
+                          const uint64_t llInstanceID, void *data) {
+    fi_apply_pool_t *pool = &g_apply_pool;
+
+    pthread_mutex_lock(&pool->lock);
+
+    pool->wave = wave;
+    pool->wave_num = num;
+    pool->next = 0;
+    pool->done = 0;
+    pool->id = llInstanceID;
+    pool->data = data;
+
+    pthread_cond_broadcast(&pool->cond);
+
+    while (pool->next < pool->wave_num) {
+        fi_op_t *op = pool->wave[pool->next++];
+
+        pthread_mutex_unlock(&pool->lock);
+
+        fi_apply_op(op, llInstanceID, data);
+
+        pthread_mutex_lock(&pool->lock);
+
+        pool->done++;
+    }
+
+    while (pool->done < pool->wave_num) {
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+
+    pool->wave = nullptr;
+    pool->wave_num = 0;
+    pool->next = 0;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// under apply_lock. the inos are handed out in log order first, so the
+// entries get the same ones whatever order the waves run in
+static int fi_apply_ops(vector<fi_op_t> &ops, const uint64_t llInstanceID,
+                        void *data) {
+    vector<fi_op_t *> wave;
+    int waves = 0;
+    int rc = NGX_OK;
+
+    for (size_t i = 0; i < ops.size(); i++) {
+        int optype = ops[i].rec.optype;
+
+        if (optype == NN_MKDIR || optype == NN_CREATE) {
+            ops[i].ino = fi_next_ino();
+        }
+    }
+
+    if (ops.size() == 1 || g_apply_pool.num == 0) {
+        for (size_t i = 0; i < ops.size(); i++) {
+            fi_apply_op(&ops[i], llInstanceID, data);
+        }
+    } else {
+        int removes = NGX_FALSE;
+
+        // a mkdir that makes its missing parents takes their inos as it
+        // runs, so it keeps its log order against every other op. a
+        // parent may be gone by then if an earlier op removes dirs
+        for (size_t i = 0; i < ops.size(); i++) {
+            int optype = ops[i].rec.optype;
+
+            if (optype == NN_MKDIR
+                && (removes || !fi_op_parents_exist(&ops[i]))) {
+                ops[i].dirs.assign(1, "/");
+            }
+
+            if (optype == NN_RMR || optype == NN_RENAME) {
+                removes = NGX_TRUE;
+            }
+        }
+
+        for (size_t i = 0; i < ops.size(); i++) {
+            for (size_t k = 0; k < i; k++) {
+                if (ops[k].wave >= ops[i].wave
+                    && fi_op_conflict(&ops[k], &ops[i])) {
+                    ops[i].wave = ops[k].wave + 1;
+                }
+            }
+
+            if (ops[i].wave + 1 > waves) {
+                waves = ops[i].wave + 1;
+            }
+        }
+    }
+
+    for (int w = 0; w < waves; w++) {
+        wave.clear();
+
+        for (size_t i = 0; i < ops.size(); i++) {
+            if (ops[i].wave == w) {
+                wave.push_back(&ops[i]);
+            }
+        }
+
+        if (wave.size() == 1) {
+            fi_apply_op(wave[0], llInstanceID, data);
+        } else {
+            fi_apply_wave(&wave[0], wave.size(), llInstanceID, data);
+        }
+    }
+
+    for (size_t i = 0; i < ops.size(); i++) {
+        if (ops[i].rc != NGX_OK) {
+            rc = NGX_ERROR;
+        }
+    }
+
+    return rc;
+}
+
+// apply_threads - 1 workers, the applier is the last one
+static int fi_apply_pool_start(int threads) {
+    fi_apply_pool_t *pool = &g_apply_pool;
+
+    pthread_mutex_init(&pool->lock, nullptr);
+    pthread_cond_init(&pool->cond, nullptr);
+
+    pool->running = NGX_TRUE;
+    pool->num = 0;
+
+    if (threads <= 1) {
+        return NGX_OK;
+    }
+
+    pool->tids = (pthread_t *) memory_calloc((threads - 1) * sizeof(pthread_t));
+    if (!pool->tids) {
+        return NGX_ERROR;
+    }
+
+    for (int i = 0; i < threads - 1; i++) {
+        if (pthread_create(&pool->tids[i], nullptr, fi_apply_worker,
+                           nullptr) != 0) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno,
+                          "apply thread create err");
+
+            break;
+        }
+
+        pool->num++;
+    }
+
+    return NGX_OK;
+}
+
+static void fi_apply_pool_stop() {
+    fi_apply_pool_t *pool = &g_apply_pool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running = NGX_FALSE;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num; i++) {
+        pthread_join(pool->tids[i], nullptr);
+    }
+
+    if (pool->tids) {
+        memory_free(pool->tids, pool->num * sizeof(pthread_t));
+        pool->tids = nullptr;
+    }
+
+    pool->num = 0;
+}
+
+static int fi_apply_op(fi_op_t *op, const uint64_t llInstanceID,
+                       void *data) {
+    fi_inode_t fin;
+    memset(&fin, 0x00, sizeof(fi_inode_t));
+
+    editlog_rec_t *rec = &op->rec;
+    uchar_t dst[KEY_LEN];
+
+    int optype = rec->optype;
+    int rc = NGX_OK;
+
+    fi_rec_str(fin.key, sizeof(fin.key), rec->key, rec->key_len);
+
+    switch (optype) {
+        case NN_MKDIR:
+            fin.uid = llInstanceID;
+            fin.ino = op->ino;
+            fin.permission = rec->permission;
+            fi_rec_str(fin.owner, sizeof(fin.owner), rec->owner,
+                       rec->owner_len);
+            fi_rec_str(fin.group, sizeof(fin.group), rec->group,
+                       rec->group_len);
+            fin.modification_time = rec->modification_time;
+            fin.is_directory = NGX_TRUE;
+            // 更新目录等信息
+            update_fi_mkdir(&fin);
+            break;
+
+        case NN_RMR:
+            fin.modification_time = rec->modification_time;
+
+            update_fi_rmr(&fin);
+            break;
+
+        case NN_GET_FILE_INFO:
+            break;
+
+        case NN_CREATE:
+            fin.uid = llInstanceID;
+            fin.ino = op->ino;
+            fin.permission = rec->permission;
+            fi_rec_str(fin.owner, sizeof(fin.owner), rec->owner,
+                       rec->owner_len);
+            fi_rec_str(fin.group, sizeof(fin.group), rec->group,
+                       rec->group_len);
+            fin.modification_time = rec->modification_time;
+            fin.blk_size = rec->blk_sz;
+            fin.blk_replication = rec->blk_rep;
+            fin.is_directory = NGX_FALSE;
+            fin.blk_seq = rec->blk_seq;
+            fin.total_blk = rec->total_blk;
+
+            update_fi_create(&fin, rec->blk_id, data);
+            break;
+
+        case NN_GET_ADDITIONAL_BLK:
+            fin.uid = llInstanceID;
+            fin.blk_size = rec->blk_sz;
+            fin.blk_replication = rec->blk_rep;
+
+            update_fi_get_additional_blk(&fin, rec->blk_id);
+            break;
+
+        case NN_CLOSE: // blk write done
+            fin.modification_time = rec->modification_time;
+            fin.length = rec->len;
+            fin.blk_replication = rec->blk_rep;
+
+            update_fi_close(&fin);
+            break;
+
+        case NN_RM:
+            fin.modification_time = rec->modification_time;
+
+            update_fi_rm(&fin);
+            break;
+
+        case NN_OPEN:
+            break;
+
+        case NN_READ_BARRIER:
+            break;
+
+        case NN_RENAME:
+            fi_rec_str((char *) dst, sizeof(dst), rec->dst, rec->dst_len);
+
+            update_fi_rename((uchar_t *) fin.key, dst,
+                             rec->modification_time);
+            break;
+
+        default:
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                          "unknown optype: ", optype);
+            rc = NGX_ERROR;
+            break;
+    }
+
+    op->rc = rc;
+
+    return rc;
+}
+
+// 初始化fi_store_t
+// fi node 加入 hash 表
+// insert ckp
+static int update_fi_mkdir(fi_inode_t *fin) {
+    fi_path_t fp;
+
+    if (fi_path_parse((uchar_t *) fin->key, &fp) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return fi_mkdir(&fp, fp.num, fin);
+}
+
+// create the dir at level num of fp, a missing parent is created
+// first (paxos replay may recreate /test/a before /test)
+static int fi_mkdir(fi_path_t *fp, int num, fi_inode_t *fin) {
+    fi_lock_t fl;
+    int rc = NGX_OK;
+
+    while ((rc = fi_lock_target(fp, num, &fl)) == DFS_DECLINED) {
+        // the ino of fin is for the dir itself
+        fi_inode_t pfin = *fin;
+        pfin.ino = 0;
+
+        if (fi_mkdir(fp, num - 1, &pfin) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (rc != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    size_t len = 0;
+    const char *name = fi_level_name(fp, num, &len);
+
+    // check if exist
+    fi_store_t *fnow = fi_dentry_lookup_nolock(fl.pino, name, len);
+    if (fnow) {
+        // if exist , then update uid
+        fi_store_touch(fnow);
+        fnow->fin.uid = fin->uid;
+
+        fi_unlock_target(&fl);
+
+        return NGX_OK;
+    }
+
+    if (fl.parent && !fl.parent->fin.is_directory) {
+        fi_unlock_target(&fl);
+
+        return NGX_ERROR;
+    }
+
+    fi_store_t *fis = fi_store_new(fin, fl.pino, name, len);
+    if (!fis) {
+        fi_unlock_target(&fl);
+
+        return NGX_ERROR;
+    }
+
+    if (fl.parent) {
+        // 将该目录插入父目录
+        if (fi_child_add(fl.parent, fis) != NGX_OK) {
+            fi_unlock_target(&fl);
+
+            fi_store_destroy(fis);
+
+            return NGX_ERROR;
+        }
+
+        fi_store_touch(fl.parent);
+        fl.parent->fin.modification_time = fin->modification_time;
+    }
+
+    fi_store_join(fis);
+
+    // 插入检查点
+    fi_ckp_insert(fis);
+
+    fi_unlock_target(&fl);
+
+    // global ++
+    inc_FsObjectNum(1);
+
+    return NGX_OK;
+}
+
+// detach the dir from its parent and the tables under the parent's
+// locks, then free the subtree one directory shard at a time
+static int update_fi_rmr(fi_inode_t *fin) {
+    fi_path_t fp;
+    fi_lock_t fl;
+
+    if (fi_path_parse((uchar_t *) fin->key, &fp) != NGX_OK || fp.num == 0) {
+        return NGX_ERROR;
+    }
+
+    if (fi_lock_target(&fp, fp.num, &fl) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    size_t len = 0;
+    const char *name = fi_level_name(&fp, fp.num, &len);
+
+    fi_store_t *fcurrent = fi_dentry_lookup_nolock(fl.pino, name, len);
+
+    // do check bcz paxos replay
+    if (!fcurrent) {
+        fi_unlock_target(&fl);
+
+        return NGX_ERROR;
+    }
+
+    fi_snap_cow(fcurrent);
+
+    if (fcurrent->state == KEY_STATE_OK) {
+        fi_store_touch(fl.parent);
+        fl.parent->fin.modification_time = fin->modification_time;
+        fi_child_del(fl.parent, fcurrent);
+    }
+
+    fi_store_unjoin(fcurrent);
+
+    fi_unlock_target(&fl);
+
+    // fcurrent is unreachable now
+    int num = clear_store(fcurrent);
+
+    sub_FsObjectNum(num);
+
+    return NGX_OK;
+}
+
+// drop the blocks of a removed file from the block index
+static void fi_blks_del(fi_blk_list_t *blks) {
+    if (!blks || !blks->blk_num) {
+        return;
+    }
+
+    uint64_t *ids = (uint64_t *) malloc(blks->blk_num * sizeof(uint64_t));
+    if (!ids) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "malloc err");
+
+        return;
+    }
+
+    size_t n = fi_blk_list_get(blks, ids, blks->blk_num);
+
+    for (size_t i = 0; i < n; i++) {
+        if ((int64_t) ids[i] > 0) {
+            block_object_del(ids[i]);
+        }
+    }
+
+    free(ids);
+}
+
+// fis is already out of the tables, returns the number of objects freed
+static int clear_store(fi_store_t *fis) {
+    int num = 1;
+
+    if (fis->fin.is_directory) {
+        num += clear_children(fis);
+    } else {
+        fi_blks_del(fis->fin.blks);
+    }
+
+    fi_store_release(fis);
+
+    return num;
+}
+
+// a resolver may still hold the ino of a removed dir, so its entries
+// leave the table under the dir's shard lock. nothing else reaches
+// dir->children any more, it is walked as is and freed with dir
+static int clear_children(fi_store_t *dir) {
+    int total = 0;
+    size_t idx = fi_dshard(dir->fin.ino);
+    dfs_btree_cursor_t cur;
+    fi_store_t *fis = nullptr;
+
+    dfs_btree_seek(&dir->children, nullptr, &cur);
+
+    while ((fis = (fi_store_t *) dfs_btree_next(&cur)) != nullptr) {
+        dfs_shard_hashtable_wrlock(g_fcm->fi_htable, idx);
+
+        fi_snap_cow(fis);
+        fi_store_unjoin(fis);
+
+        dfs_shard_hashtable_unlock(g_fcm->fi_htable, idx);
+
+        total += clear_store(fis);
+    }
+
+    return total;
+}
+
+//
+int do_checkpoint() {
+    int rc = NGX_ERROR;
+    int delta = NGX_FALSE;
+
+    if (pthread_mutex_trylock(&g_snap.run_lock) != 0) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+                      "do_checkpoint: one is running already");
+
+        return DFS_DECLINED;
+    }
+
+    delta = fi_delta_want();
+
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+                  "do_checkpoint start, lastCheckpointInstanceID: %ld, %s",
+                  lastCheckpointInstanceID, delta ? "delta" : "full");
+
+    // mv file from current to lastcheckpoint.tmp
+    if (!delta && mv_current() != NGX_OK) {
+        goto out;
+    }
+
+    //
+    if (save_image(delta) != NGX_OK) {
+        goto out;
+    }
+
+    if (save_checkpoinID() != NGX_OK) {
+        goto out;
+    }
+
+    // mv lastcheckpoint.tmp to previous.checkpoint
+    if (!delta && mv_last_checkpoint() != NGX_OK) {
+        goto out;
+    }
+
+    fi_ckp_sync();
+
+    pthread_mutex_lock(&g_fcm->apply_lock);
+    g_ckp_edits = g_snap.edits;
+    g_ckp_bytes = g_snap.bytes;
+    pthread_mutex_unlock(&g_fcm->apply_lock);
+
+    rc = NGX_OK;
+
+    out:
+    pthread_mutex_unlock(&g_snap.run_lock);
+
+    return rc;
+}
+
+// edits and value bytes applied since the newest durable image
+void fi_ckp_lag(uint64_t *edits, uint64_t *bytes) {
+    pthread_mutex_lock(&g_fcm->apply_lock);
+    *edits = g_log_edits - g_ckp_edits;
+    *bytes = g_log_bytes - g_ckp_bytes;
+    pthread_mutex_unlock(&g_fcm->apply_lock);
+}
+
+// mv file from current to lastcheckpoint.tmp
+static int mv_current() {
+    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+
+    char src[PATH_LEN] = {0};
+    char dst[PATH_LEN] = {0};
+    string_xxsprintf((uchar_t *) src, "%s/current", conf->fsimage_dir.data);
+    string_xxsprintf((uchar_t *) dst, "%s/lastcheckpoint.tmp",
+                     conf->fsimage_dir.data);
+
+    // mv current to lastcheckpoint.tmp
+    if (mkdir(dst, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH) != NGX_OK) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+                      "mkdir %s err", dst);
+
+        return NGX_ERROR;
+    }
+
+    DIR *dp = nullptr;
+    struct dirent *entry = nullptr;
+
+    if ((dp = opendir(src)) == nullptr) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+                      "opendir %s err", src);
+
+        return NGX_ERROR;
+    }
+
+    while ((entry = readdir(dp)) != nullptr) {
+        if (entry->d_type == 8) {
+            // file
+            char sBuf[PATH_LEN] = {0};
+            char dBuf[PATH_LEN] = {0};
+            sprintf(sBuf, "%s/%s", src, entry->d_name);
+            sprintf(dBuf, "%s/%s", dst, entry->d_name);
+
+            copy_file(sBuf, dBuf);
+        } else if (0 != strcmp(entry->d_name, ".")
+                   && 0 != strcmp(entry->d_name, "..")) {
+            // sub-dir
+        }
+    }
+
+    closedir(dp);
+
+    return NGX_OK;
+}
+
+static int copy_file(const char *src, const char *dst) {
+    int rs = NGX_ERROR;
+    int in_fd = -1;
+    int out_fd = -1;
+    int ws = 0;
+    size_t fsize = 0;
+    struct stat sb;
+
+    in_fd = open(src, O_RDONLY);
+    if (in_fd < 0) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+                      "open file %s err", src);
+
+        goto out;
+    }
+
+    fstat(in_fd, &sb);
+    fsize = sb.st_size;
+
+    out_fd = open(dst, O_RDWR | O_CREAT | O_TRUNC, 0664);
+    if (out_fd < 0) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+                      "open file %s err", dst);
+
+        goto out;
+    }
+
+    while (fsize > 0) {
+        ws = sendfile(out_fd, in_fd, nullptr, fsize);
+        if (ws < 0) {
+            if (errno == DFS_EAGAIN || errno == DFS_EINTR) {
+                continue;
+            }
+
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR,
+                          errno, "sendfile err");
+
+            goto out;
+        }
+
+        fsize -= ws;
+    }
+
+    rs = NGX_OK;
+
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+                  "copy %s to %s successfully.", src, dst);
+
+    out:
+    if (in_fd > 0) {
+        close(in_fd);
+        in_fd = -1;
+    }
+
+    if (out_fd > 0) {
+        close(out_fd);
+        out_fd = -1;
+    }
+
+    return rs;
+}
+
+static int mv_last_checkpoint() {
+    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+
+    char src[PATH_LEN] = {0};
+    char dst[PATH_LEN] = {0};
+    string_xxsprintf((uchar_t *) src, "%s/lastcheckpoint.tmp",
+                     conf->fsimage_dir.data);
+    string_xxsprintf((uchar_t *) dst, "%s/previous.checkpoint",
+                     conf->fsimage_dir.data);
+
+    if (access(dst, F_OK) == NGX_OK) {
+        delete_dir(dst);
+    }
+
+    // mv lastcheckpoint.tmp to previous.checkpoint
+    if (rename(src, dst) != NGX_OK) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+                      "rename %s to %s err", src, dst);
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+static int delete_dir(const char *dir) {
+    DIR *dp = nullptr;
+    struct dirent *entry = nullptr;
+
+    if ((dp = opendir(dir)) == nullptr) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+                      "opendir %s err", dir);
+
+        return NGX_ERROR;
+    }
+
+    while ((entry = readdir(dp)) != nullptr) {
+        if (entry->d_type == 8) {
+            // file
+            char sBuf[PATH_LEN] = {0};
+            sprintf(sBuf, "%s/%s", dir, entry->d_name);
+
+            unlink(sBuf);
+        } else if (0 != strcmp(entry->d_name, ".")
+                   && 0 != strcmp(entry->d_name, "..")) {
+            // sub-dir
+            char sBuf[PATH_LEN] = {0};
+            sprintf(sBuf, "%s/%s", dir, entry->d_name);
+
+            delete_dir(sBuf);
+        }
+    }
+
+    closedir(dp);
+
+    rmdir(dir);
+
+    return NGX_OK;
+}
+
+// a lagging node is sent the files of our last checkpoint by paxos, they
+// must not change until it is done, so no checkpoint runs meanwhile
+int fi_ckp_state_lock() {
+    pthread_mutex_lock(&g_snap.run_lock);
+
+    return NGX_OK;
+}
+
+void fi_ckp_state_unlock() {
+    pthread_mutex_unlock(&g_snap.run_lock);
+}
+
+// the base image, its deltas and ckpid, relative to dir
+int fi_ckp_state_files(string &dir, vector<string> &files) {
+    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+    char path[PATH_LEN] = {0};
+
+    string_xxsprintf((uchar_t *) path, "%s/current/fsimage",
+                     conf->fsimage_dir.data);
+
+    if (access(path, F_OK) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    dir = string((const char *) conf->fsimage_dir.data) + "/current";
+    files.clear();
+    files.push_back("fsimage");
+
+    for (int n = 1; n <= g_delta.chain; n++) {
+        files.push_back("fsimage.delta." + std::to_string(n));
+    }
+
+    files.push_back("ckpid");
+
+    return NGX_OK;
+}
+
+// the checkpoint of another node was received into tmp files. they are
+// checked, then become current in place of ours, which is kept as
+// previous.checkpoint. paxos restarts us next, load_image takes the
+// image and only the instances after it are replayed
+int fi_ckp_state_load(const string &dir, const vector<string> &files,
+                      uint64_t instance_id) {
+    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+    int image = NGX_FALSE;
+
+    char cur[PATH_LEN] = {0};
+    char tmp[PATH_LEN] = {0};
+    char prev[PATH_LEN] = {0};
+    string_xxsprintf((uchar_t *) cur, "%s/current", conf->fsimage_dir.data);
+    string_xxsprintf((uchar_t *) tmp, "%s/current.recv",
+                     conf->fsimage_dir.data);
+    string_xxsprintf((uchar_t *) prev, "%s/previous.checkpoint",
+                     conf->fsimage_dir.data);
 
-    if (is_InSafeMode()) {
-        task->ret = IN_SAFE_MODE;
+    for (size_t i = 0; i < files.size(); i++) {
+        const char *name = strrchr(files[i].c_str(), '/');
+        name = name ? name + 1 : files[i].c_str();
 
-        return write_back(node);
+        if (strcmp(name, "fsimage") == 0) {
+            image = NGX_TRUE;
+        }
+
+        if (strncmp(name, "fsimage", 7) == 0
+            && fi_image_check(files[i].c_str()) != NGX_OK) {
+            return NGX_ERROR;
+        }
     }
 
-    push_task(&paxos_thread->tq, node);
+    if (!image) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                      "checkpoint %lu in %s has no fsimage",
+                      instance_id, dir.c_str());
 
-    return notice_wake_up(&paxos_thread->tq_notice);
-}
+        return NGX_ERROR;
+    }
 
-int nn_rm(task_t *task) {
-    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+    if (access(tmp, F_OK) == NGX_OK) {
+        delete_dir(tmp);
+    }
 
-    if (is_InSafeMode()) {
-        task->ret = IN_SAFE_MODE;
+    if (mkdir(tmp, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH) != NGX_OK) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+                      "mkdir %s err", tmp);
 
-        return write_back(node);
+        return NGX_ERROR;
     }
 
-    push_task(&paxos_thread->tq, node);
+    for (size_t i = 0; i < files.size(); i++) {
+        const char *name = strrchr(files[i].c_str(), '/');
+        char dst[PATH_LEN] = {0};
 
-    return notice_wake_up(&paxos_thread->tq_notice);
-}
+        name = name ? name + 1 : files[i].c_str();
+        sprintf(dst, "%s/%s", tmp, name);
 
-int nn_open(task_t *task) {
-    create_blk_info_t blk_info;
-    create_resp_info_t resp_info;
+        if (copy_file(files[i].c_str(), dst) != NGX_OK) {
+            delete_dir(tmp);
 
-    memset(&resp_info, 0x00, sizeof(create_resp_info_t));
-    memset(&blk_info, 0x00, sizeof(create_blk_info_t));
-    memcpy(&blk_info, task->data, sizeof(create_blk_info_t));
+            return NGX_ERROR;
+        }
+    }
 
-    task->data_len = 0;
-    task->data = nullptr;
+    if (access(cur, F_OK) == NGX_OK) {
+        if (access(prev, F_OK) == NGX_OK) {
+            delete_dir(prev);
+        }
 
-    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+        if (rename(cur, prev) != NGX_OK) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+                          "rename %s to %s err", cur, prev);
 
-    fi_store_t *fi = get_store_obj((uchar_t *) task->key);
-    if (!fi) {
-        task->ret = KEY_NOTEXIST;
+            return NGX_ERROR;
+        }
+    }
 
-        return write_back(node);
-    } else if (fi->state == KEY_STATE_CREATING) {
-        task->ret = KEY_STATE_CREATING;
+    if (rename(tmp, cur) != NGX_OK) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno,
+                      "rename %s to %s err", tmp, cur);
 
-        return write_back(node);
+        return NGX_ERROR;
     }
 
-    fi_inode_t fin = fi->fin;
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+                  "checkpoint %lu installed, %lu files",
+                  instance_id, files.size());
 
-    if (fin.is_directory) {
-        task->ret = NOT_FILE;
+    return NGX_OK;
+}
 
-        return write_back(node);
+// header and section crcs of a received image, a v1 image has none
+static int fi_image_check(const char *path) {
+    fsimage_t img;
+    int rc = NGX_OK;
+
+    rc = fsimage_open(path, &img);
+    if (rc == DFS_DECLINED) {
+        return NGX_OK;
     }
 
-    uchar_t path[PATH_LEN] = "";
-    get_store_path((uchar_t *) task->key, path);
+    if (rc != NGX_OK) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                      "received fsimage %s is bad", path);
 
+        return NGX_ERROR;
+    }
 
-    if (!is_super(task->user, &dfs_cycle->admin)) {
-        if (check_ancestor_access(path, task, READ_EXECUTE, &fin) != NGX_OK) {
-            task->ret = PERMISSION_DENY;
+    for (size_t i = 0; i < img.hdr.section_num; i++) {
+        uchar_t *data = nullptr;
+        uchar_t *buf = nullptr;
 
-            return write_back(node);
+        rc = fsimage_section_read(&img, i, &data, &buf);
+
+        free(buf);
+
+        if (rc != NGX_OK) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                          "received fsimage %s is bad", path);
+
+            break;
         }
     }
 
-    blk_store_t *blk = get_blk_store_obj(fin.blks[0]);
+    fsimage_close(&img);
 
-    resp_info.blk_id = blk->id;
-    resp_info.blk_sz = blk->size;
-    resp_info.namespace_id = dfs_cycle->namespace_id;
+    return rc;
+}
 
-    resp_info.dn_num = 1;
-    strcpy(resp_info.dn_ips[0], blk->dn_ip);
-    strcpy(resp_info.dn_ips[1], "");
-    strcpy(resp_info.dn_ips[2], "");
 
-    task->data_len = sizeof(create_resp_info_t);
-    task->data = malloc(task->data_len);
+// link an entry read back from the fsimage under its parent, the
+// parent's shard lock guards its children
+static int fi_load_link(fi_store_t *fis) {
+    fi_store_t *fparent = nullptr;
+    size_t idx = fi_dshard(fis->dkey.parent);
+    int rc = NGX_OK;
 
-    if (nullptr == task->data) {
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "malloc err");
+    if (fis->dkey.parent != FI_NO_INO) {
+        fparent = (fi_store_t *) dfs_shard_hashtable_lookup(g_fcm->ino_htable,
+                                                            &fis->dkey.parent, sizeof(uint64_t));
+        if (!fparent || !fparent->fin.is_directory) {
+            return NGX_ERROR;
+        }
     }
 
-    memcpy(task->data, &resp_info, task->data_len);
+    dfs_shard_hashtable_wrlock(g_fcm->fi_htable, idx);
 
-    task->ret = SUCC;
+    if (fparent && fi_child_add(fparent, fis) != NGX_OK) {
+        rc = NGX_ERROR;
+    } else {
+        dfs_shard_hashtable_join_nolock(g_fcm->fi_htable, &fis->ln);
+    }
 
-    return write_back(node);
+    dfs_shard_hashtable_unlock(g_fcm->fi_htable, idx);
+
+    return rc;
 }
 
-// paxos 的处理函数
-int update_fi_cache_mgmt(const uint64_t llInstanceID,
-                         const std::string &sPaxosValue, void *data) {
+static int fi_image_threads() {
+    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+
+    return conf->fsimage_threads > 0 ? conf->fsimage_threads
+                                     : FSIMAGE_DEF_THREADS;
+}
+
+static uchar_t *fi_image_put_str(uchar_t *p, const char *str, size_t len) {
+    p = dfs_varint_encode(p, len);
+
+    return memory_cpymem(p, str, len);
+}
+
+// fsimage v2 record, all varints: ino parent uid mtime atime length
+// blk_size blk_seq total_blk permission replication is_directory,
+// then name owner group as length and bytes, then blk_num and the
+// block ids as zigzag deltas
+static uchar_t *fi_image_put(uchar_t *p, fi_store_t *fis, uint64_t *blks,
+                             uint64_t blk_num) {
+    const char *owner = fi_intern_name(fis->fin.owner_id);
+    const char *group = fi_intern_name(fis->fin.group_id);
+    uint64_t prev = 0;
+
+    p = dfs_varint_encode(p, fis->fin.ino);
+    p = dfs_varint_encode(p, fis->dkey.parent);
+    p = dfs_varint_encode(p, fis->fin.uid);
+    p = dfs_varint_encode(p, fis->fin.modification_time);
+    p = dfs_varint_encode(p, fis->fin.access_time);
+    p = dfs_varint_encode(p, fis->fin.length);
+    p = dfs_varint_encode(p, fis->fin.blk_size);
+    p = dfs_varint_encode(p, fis->fin.blk_seq);
+    p = dfs_varint_encode(p, fis->fin.total_blk);
+    p = dfs_varint_encode(p, (uint16_t) fis->fin.permission);
+    p = dfs_varint_encode(p, (uint16_t) fis->fin.blk_replication);
+    p = dfs_varint_encode(p, fis->fin.is_directory);
+
+    p = fi_image_put_str(p, fis->dkey.name, fis->dkey.len);
+    p = fi_image_put_str(p, owner, string_strlen(owner));
+    p = fi_image_put_str(p, group, string_strlen(group));
+
+    p = dfs_varint_encode(p, blk_num);
+
+    for (uint64_t i = 0; i < blk_num; i++) {
+        p = dfs_varint_encode(p, dfs_zigzag_encode(blks[i] - prev));
+        prev = blks[i];
+    }
+
+    return p;
+}
+
+// the string is copied into dst of size bytes and terminated
+static uchar_t *fi_image_get_str(uchar_t *p, uchar_t *end, char *dst,
+                                 size_t size) {
+    uint64_t len = 0;
+
+    p = dfs_varint_decode(p, end, &len);
+    if (!p || len >= size || len > (uint64_t) (end - p)) {
+        return nullptr;
+    }
+
+    memory_memcpy(dst, p, len);
+    dst[len] = '\0';
+
+    return p + len;
+}
+
+// decodes one record into a new entry, nullptr if it is corrupt
+static uchar_t *fi_image_get(uchar_t *p, uchar_t *end, fi_store_t **pfis) {
+    uint64_t v[12];
+    uint64_t blk_num = 0;
+    uint64_t prev = 0;
+    uint64_t delta = 0;
     fi_inode_t fin;
-    memset(&fin, 0x00, sizeof(fi_inode_t));
 
-    string str;
-    LogOperator lopr; // 反序列化 proto
-    lopr.ParseFromString(sPaxosValue);
+    for (size_t i = 0; i < sizeof(v) / sizeof(v[0]); i++) {
+        if (!(p = dfs_varint_decode(p, end, &v[i]))) {
+            return nullptr;
+        }
+    }
+
+    memory_zero(&fin, sizeof(fi_inode_t));
+
+    fin.ino = v[0];
+    fin.parent_ino = v[1];
+    fin.uid = v[2];
+    fin.modification_time = v[3];
+    fin.access_time = v[4];
+    fin.length = v[5];
+    fin.blk_size = v[6];
+    fin.blk_seq = v[7];
+    fin.total_blk = v[8];
+    fin.permission = (short) v[9];
+    fin.blk_replication = (short) v[10];
+    fin.is_directory = v[11] ? 1 : 0;
+
+    if (!(p = fi_image_get_str(p, end, fin.key, KEY_LEN))
+        || !(p = fi_image_get_str(p, end, fin.owner, OWNER_LEN))
+        || !(p = fi_image_get_str(p, end, fin.group, GROUP_LEN))
+        || !(p = dfs_varint_decode(p, end, &blk_num))) {
+        return nullptr;
+    }
 
-    int optype = lopr.optype();
+    fi_store_t *fis = fi_store_new(&fin, fin.parent_ino, fin.key,
+                                   string_strlen(fin.key));
+    if (!fis) {
+        return nullptr;
+    }
 
-    switch (optype) {
-        case NN_MKDIR:
-            fin.uid = llInstanceID;
-            strcpy(fin.key, lopr.mutable_mkr()->key().c_str());
-            fin.permission = lopr.mutable_mkr()->permission();
-            strcpy(fin.owner, lopr.mutable_mkr()->owner().c_str());
-            strcpy(fin.group, lopr.mutable_mkr()->group().c_str());
-            fin.modification_time = lopr.mutable_mkr()->modification_time();
-            fin.is_directory = NGX_TRUE;
-            // 更新目录等信息
-            update_fi_mkdir(&fin);
+    for (uint64_t i = 0; i < blk_num; i++) {
+        if (!(p = dfs_varint_decode(p, end, &delta))) {
             break;
+        }
 
-        case NN_RMR:
-            strcpy(fin.key, lopr.mutable_rmr()->key().c_str());
-            fin.modification_time = lopr.mutable_rmr()->modification_time();
+        prev += dfs_zigzag_decode(delta);
 
-            update_fi_rmr(&fin);
-            break;
+        if (fi_blk_list_append(&fis->fin.blks, prev) != NGX_OK) {
+            p = nullptr;
 
-        case NN_GET_FILE_INFO:
             break;
+        }
+    }
 
-        case NN_CREATE:
-            fin.uid = llInstanceID;
-            strcpy(fin.key, lopr.mutable_cre()->key().c_str());
-            fin.permission = lopr.mutable_cre()->permission();
-            strcpy(fin.owner, lopr.mutable_cre()->owner().c_str());
-            strcpy(fin.group, lopr.mutable_cre()->group().c_str());
-            fin.modification_time = lopr.mutable_cre()->modification_time();
-            fin.blk_size = lopr.mutable_cre()->blk_sz();
-            fin.blk_replication = lopr.mutable_cre()->blk_rep();
-            fin.is_directory = NGX_FALSE;
-            fin.blk_seq = lopr.mutable_cre()->blk_seq();
-            fin.total_blk = lopr.mutable_cre()->total_blk();
+    if (!p) {
+        fi_store_destroy(fis);
 
-            update_fi_create(&fin, lopr.mutable_cre()->blk_id(), data);
-            break;
+        return nullptr;
+    }
 
-        case NN_GET_ADDITIONAL_BLK:
-            fin.uid = llInstanceID;
-            strcpy(fin.key, lopr.mutable_gab()->key().c_str());
-            fin.blk_size = lopr.mutable_gab()->blk_sz();
-            fin.blk_replication = lopr.mutable_gab()->blk_rep();
+    *pfis = fis;
+
+    return p;
+}
+
+// decode section i into entries, they go into the ino table only
+static int fi_image_load_section(void *arg, size_t i) {
+    fi_image_load_t *ld = (fi_image_load_t *) arg;
+    fsimage_ref_t *ref = &ld->img->refs[i];
+    uchar_t *data = nullptr;
+    uchar_t *buf = nullptr;
+    uint64_t max_ino = 0;
+    int rc = NGX_OK;
+
+    if (fsimage_section_read(ld->img, i, &data, &buf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    uchar_t *p = data;
+    uchar_t *end = data + ref->hdr.raw_len;
+
+    for (uint32_t k = 0; k < ref->hdr.record_num; k++) {
+        fi_store_t *fis = nullptr;
+
+        p = fi_image_get(p, end, &fis);
+        if (!p) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                          "fsimage section %lu: bad record %u", i, k);
+
+            rc = NGX_ERROR;
 
-            update_fi_get_additional_blk(&fin, lopr.mutable_gab()->blk_id());
             break;
+        }
 
-        case NN_CLOSE: // blk write done
-            strcpy(fin.key, lopr.mutable_cle()->key().c_str());
-            fin.modification_time = lopr.mutable_cle()->modification_time();
-            fin.length = lopr.mutable_cle()->len();
-            fin.blk_replication = lopr.mutable_cle()->blk_rep();
+        dfs_shard_hashtable_join(g_fcm->ino_htable, &fis->ino_ln);
+        ld->stores[ref->first + k] = fis;
 
-            update_fi_close(&fin);
+        if (fis->fin.ino > max_ino) {
+            max_ino = fis->fin.ino;
+        }
+    }
+
+    ld->max_ino[i] = max_ino;
+
+    free(buf);
+
+    return rc;
+}
+
+// link the stores from i * FI_IMAGE_SECTION_RECS on
+static int fi_image_link_section(void *arg, size_t i) {
+    fi_image_load_t *ld = (fi_image_load_t *) arg;
+    size_t start = i * FI_IMAGE_SECTION_RECS;
+    size_t end = start + FI_IMAGE_SECTION_RECS;
+
+    if (end > ld->num) {
+        end = ld->num;
+    }
+
+    for (size_t k = start; k < end; k++) {
+        if (fi_load_link(ld->stores[k]) != NGX_OK) {
+            ld->orphan[k] = 1;
+
+            continue;
+        }
+
+        ld->linked[i]++;
+    }
+
+    return NGX_OK;
+}
+
+// an entry of a delta replaces the one with its ino, a removed ino
+// drops it. the dropped ones are left in stores marked dead
+static int fi_image_load_delta(fi_image_load_t *ld, fsimage_t *img) {
+    uint64_t max_ino = 0;
+    int rc = NGX_OK;
+
+    for (size_t i = 0; i < img->hdr.section_num && rc == NGX_OK; i++) {
+        fsimage_ref_t *ref = &img->refs[i];
+        uchar_t *data = nullptr;
+        uchar_t *buf = nullptr;
+
+        if (fsimage_section_read(img, i, &data, &buf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        uchar_t *p = data;
+        uchar_t *end = data + ref->hdr.raw_len;
+
+        for (uint32_t k = 0; k < ref->hdr.record_num; k++) {
+            fi_store_t *fis = nullptr;
+            uint64_t ino = 0;
+
+            if (ref->hdr.flags & FSIMAGE_F_DEAD) {
+                p = dfs_varint_decode(p, end, &ino);
+            } else if ((p = fi_image_get(p, end, &fis)) != nullptr) {
+                ino = fis->fin.ino;
+            }
+
+            if (!p) {
+                dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                              "fsimage delta section %lu: bad record %u",
+                              i, k);
+
+                rc = NGX_ERROR;
+
+                break;
+            }
+
+            fi_store_t *old = (fi_store_t *) dfs_shard_hashtable_lookup(
+                g_fcm->ino_htable, &ino, sizeof(uint64_t));
+            if (old) {
+                dfs_shard_hashtable_remove_link(g_fcm->ino_htable,
+                                                &old->ino_ln);
+                old->dead = NGX_TRUE;
+                ld->dropped++;
+            }
+
+            if (!fis) {
+                continue;
+            }
+
+            if (ld->num == ld->cap) {
+                size_t cap = ld->cap * 2;
+                fi_store_t **stores = (fi_store_t **) realloc(ld->stores,
+                                                              cap * sizeof(fi_store_t *));
+                if (!stores) {
+                    fi_store_destroy(fis);
+
+                    rc = NGX_ERROR;
+
+                    break;
+                }
+
+                ld->stores = stores;
+                ld->cap = cap;
+            }
+
+            dfs_shard_hashtable_join(g_fcm->ino_htable, &fis->ino_ln);
+            ld->stores[ld->num++] = fis;
+
+            if (ino > max_ino) {
+                max_ino = ino;
+            }
+        }
+
+        free(buf);
+    }
+
+    if (max_ino >= g_next_ino) {
+        g_next_ino = max_ino + 1;
+    }
+
+    return rc;
+}
+
+// the group instances of an image, DFS_DECLINED for an image from
+// before groups, its instance id is that of group 0. the next inos
+// follow in newer images, they are kept if the group num is the same
+static int fi_image_load_groups(fsimage_t *img) {
+    for (size_t i = 0; i < img->hdr.section_num; i++) {
+        fsimage_ref_t *ref = &img->refs[i];
+        uchar_t *data = nullptr;
+        uchar_t *buf = nullptr;
+        uint64_t num = 0;
+
+        if (!(ref->hdr.flags & FSIMAGE_F_GROUPS)) {
+            continue;
+        }
+
+        if (fsimage_section_read(img, i, &data, &buf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        uchar_t *p = data;
+        uchar_t *end = data + ref->hdr.raw_len;
+
+        p = dfs_varint_decode(p, end, &num);
+
+        for (uint64_t k = 0; p && k < num; k++) {
+            uint64_t id = 0;
+
+            p = dfs_varint_decode(p, end, &id);
+            if (p && k < (uint64_t) g_group_num) {
+                g_ckp_ids[k] = id;
+            }
+        }
+
+        for (uint64_t k = 0; p && p < end && k < num; k++) {
+            uint64_t ino = 0;
+
+            p = dfs_varint_decode(p, end, &ino);
+            if (p && num == (uint64_t) g_group_num) {
+                g_next_inos[k] = ino;
+            }
+        }
+
+        free(buf);
+
+        if (!p) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                          "fsimage section %lu: bad group instances", i);
+
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    g_ckp_ids[0] = img->hdr.instance_id;
+
+    return DFS_DECLINED;
+}
+
+// apply fsimage.delta.1, 2, ... in turn, each one has to follow the
+// image before it. deltas older than the base are left over from a
+// checkpoint that did not get to remove them
+static int fi_image_load_deltas(fi_image_load_t *ld, uint64_t base_id) {
+    uint64_t id = base_id;
+    int n = 0;
+
+    for (n = 1; ; n++) {
+        char path[PATH_LEN] = {0};
+        fsimage_t img;
+        int rc = NGX_OK;
+
+        fi_delta_path(path, n);
+
+        rc = fsimage_open(path, &img);
+        if (rc == DFS_DECLINED) {
             break;
+        }
 
-        case NN_RM:
-            strcpy(fin.key, lopr.mutable_rm()->key().c_str());
-            fin.modification_time = lopr.mutable_rm()->modification_time();
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (!(img.hdr.flags & FSIMAGE_F_DELTA)
+            || (img.hdr.instance_id > id && img.hdr.base_id != id)) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                          "%s does not follow instance %lu", path, id);
+
+            fsimage_close(&img);
+
+            return NGX_ERROR;
+        }
+
+        if (img.hdr.instance_id <= id) {
+            fsimage_close(&img);
 
-            update_fi_rm(&fin);
             break;
+        }
+
+        rc = fi_image_load_delta(ld, &img);
+
+        if (rc == NGX_OK && fi_image_load_groups(&img) == NGX_ERROR) {
+            rc = NGX_ERROR;
+        }
+
+        if (img.hdr.max_ino >= g_next_ino) {
+            g_next_ino = img.hdr.max_ino + 1;
+        }
 
-        case NN_OPEN:
-            break;
+        g_delta.delta_recs += img.hdr.record_num;
+        id = img.hdr.instance_id;
 
-        default:
-            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
-                          "unknown optype: ", optype);
+        fsimage_close(&img);
+
+        if (rc != NGX_OK) {
             return NGX_ERROR;
+        }
     }
 
+    g_delta.chain = n - 1;
+    g_delta.image_id = id;
+
     return NGX_OK;
 }
 
-// 返回 encode 的上级目录
-static void get_parent_key(uchar_t path[], uchar_t key[]) {
-    uchar_t *pTemp = path;
-    uchar_t *pPath = (uchar_t *) strrchr((const char *) path, '/'); //strrchr() 函数用于查找某字符在字符串中最后一次出现的位置
-    int pIndex = pPath - pTemp;
+// sections are decoded in parallel into the ino table, the deltas are
+// applied over them, then all are linked under their parents in
+// parallel, records may come in any order
+static int load_image_v2(fsimage_t *img) {
+    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+    size_t sec_num = img->hdr.section_num;
+    size_t rec_num = img->hdr.record_num;
+    size_t chunks = 0;
+    size_t live = 0;
+    int threads = fi_image_threads();
+    uint64_t max_ino = FI_ROOT_INO;
+    uint64_t linked = 0;
+    fi_image_load_t ld;
+    int rc = NGX_ERROR;
+
+    if (rec_num > conf->index_num) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                      "fsimage has %lu entries, index_num is %lu",
+                      rec_num, conf->index_num);
 
-    uchar_t pName[PATH_LEN] = "";
-    if (0 == pIndex)  // 说明 path就是 /
-    {
-        // /home
-        memcpy(pName, "/", 1);
-    } else // 前一级目录
-    {
-        memcpy(pName, pTemp, pIndex);
+        return NGX_ERROR;
     }
 
-    key_encode(pName, key);
-}
+    if (img->hdr.flags & FSIMAGE_F_DELTA) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                      "fsimage is a delta");
 
-static int update_fi_mkdir_nolock(fi_inode_t *fin) {
-//    pthread_rwlock_wrlock(&g_fcm->cache_rwlock);
+        return NGX_ERROR;
+    }
 
-    // check if exist
-    auto *fnow = (fi_store_t *) dfs_hashtable_lookup(g_fcm->fi_htable,
-                                                     (void *) fin->key, string_strlen(fin->key));
-    fi_store_t *fis = nullptr;
-    if (!fnow) {
-        fis = (fi_store_t *) mem_get0(g_fcm->mem_mgmt.free_mblks);
+    memory_zero(&ld, sizeof(fi_image_load_t));
 
-        queue_init(&fis->ckp);
-        queue_init(&fis->me);
-        queue_init(&fis->children);
+    ld.img = img;
+    ld.num = rec_num;
+    ld.cap = rec_num + 1;
+    ld.stores = (fi_store_t **) calloc(ld.cap, sizeof(fi_store_t *));
+    ld.max_ino = (uint64_t *) calloc(sec_num + 1, sizeof(uint64_t));
+    if (!ld.stores || !ld.max_ino) {
+        goto out;
+    }
 
-        memcpy(&fis->fin, fin, sizeof(fi_inode_t));
+    if (fsimage_parallel(threads, sec_num, fi_image_load_section,
+                         &ld) != NGX_OK) {
+        goto out;
+    }
 
-        fis->ln.key = fis->fin.key;
-        fis->ln.len = string_strlen(fis->fin.key);
-        fis->ln.next = nullptr;
-        //
-        printf("join hash table key: %s uid:%lu\n", fis->fin.key, fis->fin.uid);
-        dfs_hashtable_join(g_fcm->fi_htable, &fis->ln);
-    } else {
-        // if exist , then update uid
-        fnow->fin.uid = fin->uid;
-        return NGX_OK;
+    for (size_t i = 0; i < sec_num; i++) {
+        if (ld.max_ino[i] > max_ino) {
+            max_ino = ld.max_ino[i];
+        }
     }
-    // end
 
-    uchar_t path[PATH_LEN] = "";
-    get_store_path((uchar_t *) fin->key, path); // decode
-    printf("%s %lu\n", path, fin->uid);
+    if (img->hdr.max_ino > max_ino) {
+        max_ino = img->hdr.max_ino;
+    }
 
-    // 如果不是根目录
-    if (0 != string_strncmp("/", path, string_strlen(path))) {
-        uchar_t pKey[PATH_LEN] = "";
-        get_parent_key(path, pKey); // 上一级目录并且encode
+    g_next_ino = max_ino + 1;
 
-        fi_store_t *fparent = (fi_store_t *) dfs_hashtable_lookup(g_fcm->fi_htable,
-                                                                  (void *) pKey, string_strlen(pKey));
+    g_delta.base_recs = rec_num;
+    g_delta.delta_recs = 0;
 
-        // fix bugs:here
-        // when paxos get replay, multiple thread maybe firstly recreate the first dir ,eg: /test/a,
-        // however its parent /test not exist
+    if (fi_image_load_groups(img) == NGX_ERROR) {
+        goto out;
+    }
 
-//
-        if (!fparent) {
-            fi_inode_t tmpinode;
-            memory_memcpy(&tmpinode, fin, sizeof(fi_inode_t));
-            memory_memcpy(&tmpinode.key, pKey, PATH_LEN);
-            update_fi_mkdir_nolock(&tmpinode);
-            // refind again
-            fparent = (fi_store_t *) dfs_hashtable_lookup(g_fcm->fi_htable,
-                                                          (void *) pKey, string_strlen(pKey));
+    if (fi_image_load_deltas(&ld, img->hdr.instance_id) != NGX_OK) {
+        goto out;
+    }
+
+    // what the deltas replaced or removed
+    for (size_t k = 0; k < ld.num; k++) {
+        if (ld.stores[k]->dead) {
+            fi_store_destroy(ld.stores[k]);
+
+            continue;
         }
 
-        // fix end
+        ld.stores[live++] = ld.stores[k];
+    }
+
+    ld.num = live;
+    chunks = (ld.num + FI_IMAGE_SECTION_RECS - 1) / FI_IMAGE_SECTION_RECS;
 
-        fparent->fin.modification_time = fin->modification_time;
-        // 将该目录插入父目录
+    ld.orphan = (uchar_t *) calloc(ld.num + 1, sizeof(uchar_t));
+    ld.linked = (uint64_t *) calloc(chunks + 1, sizeof(uint64_t));
+    if (!ld.orphan || !ld.linked) {
+        goto out;
+    }
 
-        queue_insert_tail(&fparent->children, &fis->me);
-        fparent->children_num++;
+    // image order, as save_image walked it
+    pthread_mutex_lock(&g_fcm->ckp_lock);
 
-        // test
-        uchar_t path1[PATH_LEN] = "";
-        get_store_path((uchar_t *) fparent->fin.key, path1); // decode
-        printf("parent : %s child num:%lu key:%s\n", path1, fparent->children_num, fparent->fin.key);
+    for (size_t k = 0; k < ld.num; k++) {
+        queue_insert_tail(&g_checkpoint_q, &ld.stores[k]->ckp);
     }
-    // 插入检查点
-    queue_insert_tail(&g_checkpoint_q, &fis->ckp);
 
-//    pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+    pthread_mutex_unlock(&g_fcm->ckp_lock);
 
-    // global ++
-    inc_FsObjectNum(1);
+    fsimage_parallel(threads, chunks, fi_image_link_section, &ld);
 
+    for (size_t i = 0; i < chunks; i++) {
+        linked += ld.linked[i];
+    }
 
-    return NGX_OK;
-}
+    inc_FsObjectNum(linked);
 
-// 初始化fi_store_t
-// fi node 加入 hash 表
-// insert ckp
-static int update_fi_mkdir(fi_inode_t *fin) {
-    pthread_rwlock_wrlock(&g_fcm->cache_rwlock);
+    for (size_t k = 0; k < ld.num; k++) {
+        fi_store_t *fis = ld.stores[k];
 
-    update_fi_mkdir_nolock(fin);
+        if (!ld.orphan[k]) {
+            continue;
+        }
 
-    //test
-//    fi_store_t *tfis = nullptr;
-//    tfis = get_store_obj((uchar_t *) fin->key);
-//    printf("test key:%s: child num: %lu\n",tfis->fin.key,tfis->children_num);
-//
-//    fi_store_t *tfis1 = nullptr;
-//    tfis1 = get_store_obj((uchar_t *) "Lw==");
-//    printf("test key:%s: child num: %lu\n",tfis1->fin.key,tfis1->children_num);
-//    fi_store_t *tfis2 = nullptr;
-//    tfis2 = get_store_obj((uchar_t *) "L3Rlc3Q=");
-//    printf("test key:%s: child num: %lu\n",tfis2->fin.key,tfis2->children_num);
-//    fi_store_t *tfis3 = nullptr;
-//    tfis3 = get_store_obj((uchar_t *) "L3Rlc3QvYQ==");
-//    printf("test key:%s: child num: %lu\n",tfis3->fin.key,tfis3->children_num);
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+                      "fsimage entry %s has no parent %lu, dropped",
+                      fis->dkey.name, fis->dkey.parent);
 
+        // along with whatever got linked below it already
+        dfs_shard_hashtable_remove_link(g_fcm->ino_htable, &fis->ino_ln);
+        sub_FsObjectNum(clear_store(fis) - 1);
+    }
 
-    pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+    rc = NGX_OK;
 
-//	// global ++
-//	inc_FsObjectNum(1);
+    out:
+    free(ld.stores);
+    free(ld.orphan);
+    free(ld.max_ino);
+    free(ld.linked);
 
-    return NGX_OK;
+    return rc;
 }
 
-static int update_fi_rmr(fi_inode_t *fin) {
-    uchar_t path[PATH_LEN] = "";
-    get_store_path((uchar_t *) fin->key, path);
+// the v1 image is an array of fi_inode_t, each followed by its block ids
+static int load_image_v1(const char *image_name) {
+    int fd = open(image_name, O_RDWR | O_CREAT, 0777);
+    if (fd < 0) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno,
+                      "open[%s] err", image_name);
+
+        return NGX_ERROR;
+    }
 
-    uchar_t pKey[PATH_LEN] = "";
-    get_parent_key(path, pKey);
+    fi_inode_t fin;
+    bzero(&fin, sizeof(fi_inode_t));
 
-    pthread_rwlock_wrlock(&g_fcm->cache_rwlock);
+    uint64_t *blks = nullptr;
+    size_t blks_cap = 0;
 
-    fi_store_t *fparent = (fi_store_t *) dfs_hashtable_lookup(g_fcm->fi_htable,
-                                                              (void *) pKey, string_strlen(pKey));
+    // records may come in any order, they are all read into the ino
+    // table first and linked under their parents afterwards
+    fi_store_t **stores = nullptr;
+    size_t stores_num = 0;
+    size_t stores_cap = 0;
+    uint64_t max_ino = FI_ROOT_INO;
 
-    fparent->fin.modification_time = fin->modification_time;
+    // a file's record is followed by its blk_num block ids
+    while (read(fd, &fin, sizeof(fi_inode_t)) == sizeof(fi_inode_t)) {
+        size_t blks_sz = fin.blk_num * sizeof(uint64_t);
 
-    fi_store_t *fcurrent = (fi_store_t *) dfs_hashtable_lookup(g_fcm->fi_htable,
-                                                               (void *) fin->key, string_strlen(fin->key));
+        if (blks_sz > blks_cap) {
+            uint64_t *nblks = (uint64_t *) realloc(blks, blks_sz);
+            if (!nblks) {
+                break;
+            }
 
-    // do check bcz paxos replay
-    if (!fcurrent) {
-        return NGX_ERROR;
-    }
-    //
-    int num = clear_children(&fcurrent->children, fcurrent->children_num);
+            blks = nblks;
+            blks_cap = blks_sz;
+        }
 
-    dfs_hashtable_remove_link(g_fcm->fi_htable, &fcurrent->ln);
+        if (blks_sz > 0 && read(fd, blks, blks_sz) != (ssize_t) blks_sz) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+                          "read[%s] blks of %s err", image_name, fin.key);
 
-    queue_remove(&fcurrent->me);
-    queue_remove(&fcurrent->ckp);
+            break;
+        }
 
-    fi_store_destroy(fcurrent);
+        if (stores_num == stores_cap) {
+            size_t cap = stores_cap ? stores_cap * 2 : 1024;
+            fi_store_t **nstores = (fi_store_t **) realloc(stores,
+                                                           cap * sizeof(fi_store_t *));
+            if (!nstores) {
+                break;
+            }
 
-    num++;
+            stores = nstores;
+            stores_cap = cap;
+        }
 
-    fparent->children_num--;
+        fin.key[KEY_LEN - 1] = '\0';
 
-    pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+        fi_store_t *fis = fi_store_new(&fin, fin.parent_ino, fin.key,
+                                       string_strlen(fin.key));
+        if (!fis) {
+            break;
+        }
 
-    sub_FsObjectNum(num);
+        for (size_t i = 0; i < fin.blk_num; i++) {
+            fi_blk_list_append(&fis->fin.blks, blks[i]);
+        }
 
-    return NGX_OK;
-}
+        dfs_shard_hashtable_join(g_fcm->ino_htable, &fis->ino_ln);
+        fi_ckp_insert(fis);
 
-static int clear_children(queue_t *head, uint64_t num) {
-    int file_num = 0;
-    int dir_num = 0;
+        stores[stores_num++] = fis;
 
-    queue_t *entry = queue_next(head);
+        if (fis->fin.ino > max_ino) {
+            max_ino = fis->fin.ino;
+        }
+    }
 
-    while (num > 0) {
-        fi_store_t *fis = queue_data(entry, fi_store_t, me);
+    free(blks);
+    close(fd);
 
-        entry = queue_next(entry);
+    g_next_ino = max_ino + 1;
 
-        queue_remove(&fis->me);
-        queue_remove(&fis->ckp);
+    for (size_t i = 0; i < stores_num; i++) {
+        fi_store_t *fis = stores[i];
 
-        if (fis->fin.is_directory) {
-            dir_num += clear_children(&fis->children, fis->children_num);
-            dir_num++;
-        } else {
-            uint64_t del_blks[BLK_LIMIT];
-            memcpy(&del_blks, &fis->fin.blks, sizeof(fis->fin.blks));
+        if (fi_load_link(fis) != NGX_OK) {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+                          "fsimage entry %s has no parent %lu, dropped",
+                          fis->dkey.name, fis->dkey.parent);
 
-            for (int i = 0; i < BLK_LIMIT; i++) {
-                if (del_blks[i] > 0) {
-                    block_object_del(del_blks[i]);
-                }
-            }
+            // along with whatever got linked below it already
+            dfs_shard_hashtable_remove_link(g_fcm->ino_htable, &fis->ino_ln);
+            sub_FsObjectNum(clear_store(fis) - 1);
 
-            file_num++;
+            continue;
         }
 
-        dfs_hashtable_remove_link(g_fcm->fi_htable, &fis->ln);
-        fi_store_destroy(fis);
-
-        num--;
+        inc_FsObjectNum(1);
     }
 
-    return file_num + dir_num;
+    free(stores);
+
+    return NGX_OK;
 }
 
 //
-int do_checkpoint() {
+int load_image() {
     dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
-                  "do_checkpoint start, lastCheckpointInstanceID: %ld",
+                  "load_image start, lastCheckpointInstanceID: %l",
                   lastCheckpointInstanceID);
 
-    // mv file from current to lastcheckpoint.tmp
-    if (mv_current() != NGX_OK) {
-        return NGX_ERROR;
-    }
+    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+    struct timeval start;
+    struct timeval end;
+    fsimage_t img;
+    int rc = NGX_OK;
 
-    //
-    if (save_image() != NGX_OK) {
-        return NGX_ERROR;
-    }
+    gettimeofday(&start, nullptr);
 
-    if (save_checkpoinID() != NGX_OK) {
-        return NGX_ERROR;
+    // set from the image, see fi_ino_sync
+    memory_zero(g_next_inos, g_group_num * sizeof(uint64_t));
+
+    char image_name[PATH_LEN] = {0};
+    string_xxsprintf((uchar_t *) image_name, "%s/current/fsimage",
+                     conf->fsimage_dir.data);
+
+    rc = fsimage_open(image_name, &img);
+    if (rc == DFS_DECLINED) {
+        rc = load_image_v1(image_name);
+    } else if (rc == NGX_OK) {
+        rc = load_image_v2(&img);
+
+        fsimage_close(&img);
     }
 
-    // mv lastcheckpoint.tmp to previous.checkpoint
-    if (mv_last_checkpoint() != NGX_OK) {
+    if (rc != NGX_OK) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                      "load fsimage %s err", image_name);
+
         return NGX_ERROR;
     }
 
-    set_checkpoint_instanceID(lastCheckpointInstanceID);
+    fi_ino_sync();
+
+    // cold start time, the figure to watch when tuning fsimage_threads
+    gettimeofday(&end, nullptr);
+
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+                  "fsimage loaded, %lu entries in %ld ms",
+                  g_fs_object_num, (end.tv_sec - start.tv_sec) * 1000
+                  + (end.tv_usec - start.tv_usec) / 1000);
+
+    // read ckpid: last check point id, it is written after the image
+    read_checkpoinID();
+
+    memory_memcpy(g_applied_ids, g_ckp_ids, g_group_num * sizeof(uint64_t));
+    // geditlog set check point
+    fi_ckp_sync();
 
     return NGX_OK;
 }
 
-// mv file from current to lastcheckpoint.tmp
-static int mv_current() {
-    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+// append the record of fis to sec
+static int fi_image_put_store(fsimage_section_t *sec, fi_store_t *fis,
+                              uint64_t **blks, uint64_t *blks_cap) {
+    uint64_t blk_num = fis->fin.blks ? fis->fin.blks->blk_num : 0;
 
-    char src[PATH_LEN] = {0};
-    char dst[PATH_LEN] = {0};
-    string_xxsprintf((uchar_t *) src, "%s/current", conf->fsimage_dir.data);
-    string_xxsprintf((uchar_t *) dst, "%s/lastcheckpoint.tmp",
-                     conf->fsimage_dir.data);
+    if (blk_num > *blks_cap) {
+        uint64_t *nblks = (uint64_t *) realloc(*blks,
+                                               blk_num * sizeof(uint64_t));
+        if (!nblks) {
+            return NGX_ERROR;
+        }
 
-    // mv current to lastcheckpoint.tmp
-    if (mkdir(dst, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH) != NGX_OK) {
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
-                      "mkdir %s err", dst);
+        *blks = nblks;
+        *blks_cap = blk_num;
+    }
+
+    fi_blk_list_get(fis->fin.blks, *blks, blk_num);
 
+    uchar_t *p = fsimage_section_reserve(sec, FI_IMAGE_REC_MAX(blk_num));
+    if (!p) {
         return NGX_ERROR;
     }
 
-    DIR *dp = nullptr;
-    struct dirent *entry = nullptr;
+    fsimage_section_commit(sec, fi_image_put(p, fis, *blks, blk_num));
 
-    if ((dp = opendir(src)) == nullptr) {
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
-                      "opendir %s err", src);
+    return NGX_OK;
+}
 
-        return NGX_ERROR;
+// encode the entries of section i that still hold their state at the
+// checkpoint instance, each under its shard's read lock
+static int fi_image_encode(void *arg, size_t i) {
+    fi_image_save_t *sv = (fi_image_save_t *) arg;
+    fsimage_section_t *sec = &sv->secs[i];
+    size_t start = i * FI_IMAGE_SECTION_RECS;
+    size_t end = start + FI_IMAGE_SECTION_RECS;
+    uint64_t *blks = nullptr;
+    uint64_t blks_cap = 0;
+    int rc = NGX_OK;
+
+    if (end > sv->num) {
+        end = sv->num;
     }
 
-    while ((entry = readdir(dp)) != nullptr) {
-        if (entry->d_type == 8) {
-            // file
-            char sBuf[PATH_LEN] = {0};
-            char dBuf[PATH_LEN] = {0};
-            sprintf(sBuf, "%s/%s", src, entry->d_name);
-            sprintf(dBuf, "%s/%s", dst, entry->d_name);
+    for (size_t k = start; k < end && rc == NGX_OK; k++) {
+        fi_store_t *fis = sv->stores[k];
+        uint64_t parent = 0;
+        size_t idx = 0;
 
-            copy_file(sBuf, dBuf);
-        } else if (0 != strcmp(entry->d_name, ".")
-                   && 0 != strcmp(entry->d_name, "..")) {
-            // sub-dir
+        // a rename may move it to another shard meanwhile
+        for (;;) {
+            parent = __atomic_load_n(&fis->dkey.parent, __ATOMIC_ACQUIRE);
+            idx = fi_dshard(parent);
+
+            dfs_shard_hashtable_rdlock(g_fcm->fi_htable, idx);
+
+            if (fis->dkey.parent == parent) {
+                break;
+            }
+
+            dfs_shard_hashtable_unlock(g_fcm->fi_htable, idx);
+        }
+
+        if (!fis->dead && fis->snap_seq != g_snap.seq
+            && fis->ver <= g_snap.id && fis->state == KEY_STATE_OK) {
+            fis->snap_seq = g_snap.seq;
+
+            rc = fi_image_put_store(sec, fis, &blks, &blks_cap);
         }
+
+        dfs_shard_hashtable_unlock(g_fcm->fi_htable, idx);
     }
 
-    closedir(dp);
+    free(blks);
 
-    return NGX_OK;
+    return rc;
 }
 
-static int copy_file(const char *src, const char *dst) {
-    int rs = NGX_ERROR;
-    int in_fd = -1;
-    int out_fd = -1;
-    int ws = 0;
-    size_t fsize = 0;
-    struct stat sb;
+static int fi_image_seal(void *arg, size_t i) {
+    fi_image_save_t *sv = (fi_image_save_t *) arg;
 
-    in_fd = open(src, O_RDONLY);
-    if (in_fd < 0) {
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
-                      "open file %s err", src);
+    return fsimage_section_seal(&sv->secs[i], sv->compress);
+}
 
-        goto out;
-    }
+static void fi_delta_path(char *buf, int n) {
+    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
 
-    fstat(in_fd, &sb);
-    fsize = sb.st_size;
+    string_xxsprintf((uchar_t *) buf, "%s/current/fsimage.delta.%d",
+                     conf->fsimage_dir.data, n);
+}
 
-    out_fd = open(dst, O_RDWR | O_CREAT | O_TRUNC, 0664);
-    if (out_fd < 0) {
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
-                      "open file %s err", dst);
+// whether the next checkpoint can be a delta
+static int fi_delta_want() {
+    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+    int want = NGX_FALSE;
 
-        goto out;
-    }
+    pthread_mutex_lock(&g_fcm->ckp_lock);
 
-    while (fsize > 0) {
-        ws = sendfile(out_fd, in_fd, nullptr, fsize);
-        if (ws < 0) {
-            if (errno == DFS_EAGAIN || errno == DFS_EINTR) {
-                continue;
+    want = !g_delta.lost && g_delta.chain >= 0
+           && (uint32_t) g_delta.chain < conf->fsimage_deltas
+           && g_delta.delta_recs * 2 < g_delta.base_recs;
+
+    pthread_mutex_unlock(&g_fcm->ckp_lock);
+
+    return want;
+}
+
+// move the dirty entries into sv, under apply_lock and ckp_lock
+static int fi_delta_take(fi_image_save_t *sv) {
+    size_t cap = 0;
+
+    while (!queue_empty(&g_delta.dirty)) {
+        queue_t *q = queue_head(&g_delta.dirty);
+        fi_store_t *fis = queue_data(q, fi_store_t, dirty);
+
+        if (sv->num == cap) {
+            size_t ncap = cap ? cap * 2 : FI_IMAGE_SECTION_RECS;
+            fi_store_t **nstores = (fi_store_t **) realloc(sv->stores,
+                                                           ncap * sizeof(fi_store_t *));
+            if (!nstores) {
+                return NGX_ERROR;
             }
 
-            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR,
-                          errno, "sendfile err");
+            sv->stores = nstores;
+            cap = ncap;
+        }
 
-            goto out;
+        queue_remove(q);
+
+        fis->delta_seq = g_snap.seq;
+        sv->stores[sv->num++] = fis;
+    }
+
+    return NGX_OK;
+}
+
+// the inos removed since the last image, one record each
+static int fi_image_dead_section(fsimage_section_t *sec, uint64_t *dead,
+                                 size_t num) {
+    sec->hdr.flags = FSIMAGE_F_DEAD;
+
+    for (size_t i = 0; i < num; i++) {
+        uchar_t *p = fsimage_section_reserve(sec, DFS_VARINT_MAX_LEN);
+        if (!p) {
+            return NGX_ERROR;
         }
 
-        fsize -= ws;
+        fsimage_section_commit(sec, dfs_varint_encode(p, dead[i]));
     }
 
-    rs = NGX_OK;
+    return NGX_OK;
+}
 
-    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
-                  "copy %s to %s successfully.", src, dst);
+// the instance of every group. they are not entries, so the section
+// does not count in the records of the image
+static int fi_image_groups_section(fsimage_section_t *sec, uint64_t *ids,
+                                   uint64_t *next_inos) {
+    sec->hdr.flags = FSIMAGE_F_GROUPS;
 
-    out:
-    if (in_fd > 0) {
-        close(in_fd);
-        in_fd = -1;
+    uchar_t *p = fsimage_section_reserve(sec, (2 * g_group_num + 1)
+                                              * DFS_VARINT_MAX_LEN);
+    if (!p) {
+        return NGX_ERROR;
     }
 
-    if (out_fd > 0) {
-        close(out_fd);
-        out_fd = -1;
+    p = dfs_varint_encode(p, g_group_num);
+
+    for (int i = 0; i < g_group_num; i++) {
+        p = dfs_varint_encode(p, ids[i]);
     }
 
-    return rs;
+    for (int i = 0; i < g_group_num; i++) {
+        p = dfs_varint_encode(p, next_inos[i]);
+    }
+
+    fsimage_section_commit(sec, p);
+    sec->hdr.record_num = 0;
+
+    return NGX_OK;
 }
 
-static int mv_last_checkpoint() {
+// from do_checkpoint. the image is the namespace as of the last
+// applied instance: the applier only waits for the ckp queue tail or
+// the dirty entries to be taken, then keeps going while the entries
+// are encoded by several threads. whatever it changes or removes
+// before the encoders get there is saved by fi_snap_cow or kept in
+// limbo. a delta holds the dirty entries and the removed inos only
+static int save_image(int delta) {
     conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+    int threads = fi_image_threads();
+    size_t sec_num = 0;
+    size_t cap = 0;
+    size_t total = 0;
+    int dead_sec = NGX_FALSE;
+    int chain = g_delta.chain;
+    fi_image_save_t sv;
+    fsimage_header_t hdr;
+    fi_store_t *limbo = nullptr;
+    int rc = NGX_ERROR;
 
-    char src[PATH_LEN] = {0};
-    char dst[PATH_LEN] = {0};
-    string_xxsprintf((uchar_t *) src, "%s/lastcheckpoint.tmp",
-                     conf->fsimage_dir.data);
-    string_xxsprintf((uchar_t *) dst, "%s/previous.checkpoint",
-                     conf->fsimage_dir.data);
+    char image_name[PATH_LEN] = {0};
+
+    if (delta) {
+        fi_delta_path(image_name, chain + 1);
+    } else {
+        string_xxsprintf((uchar_t *) image_name, "%s/current/fsimage",
+                         conf->fsimage_dir.data);
+    }
+
+    memory_zero(&sv, sizeof(fi_image_save_t));
+    memory_zero(&hdr, sizeof(fsimage_header_t));
+
+    sv.compress = conf->fsimage_compress == 1;
+
+    pthread_mutex_lock(&g_fcm->apply_lock);
+    pthread_mutex_lock(&g_fcm->ckp_lock);
+
+    g_snap.id = g_apply_seq;
+    memory_memcpy(g_snap.ids, g_applied_ids, g_group_num * sizeof(uint64_t));
+    memory_memcpy(g_snap.next_inos, g_next_inos,
+                  g_group_num * sizeof(uint64_t));
+    g_snap.edits = g_log_edits;
+    g_snap.bytes = g_log_bytes;
+    g_snap.seq++;
+    g_snap.delta = delta;
+    g_snap.last = queue_tail(&g_checkpoint_q);
+    g_snap.cow_err = NGX_FALSE;
+
+    if (delta) {
+        if (g_delta.lost || fi_delta_take(&sv) != NGX_OK) {
+            g_delta.lost = NGX_TRUE;
+
+            pthread_mutex_unlock(&g_fcm->ckp_lock);
+            pthread_mutex_unlock(&g_fcm->apply_lock);
+
+            goto out;
+        }
+    } else {
+        // a full image has it all
+        while (!queue_empty(&g_delta.dirty)) {
+            queue_remove(queue_head(&g_delta.dirty));
+        }
 
-    if (access(dst, F_OK) == NGX_OK) {
-        delete_dir(dst);
+        g_delta.lost = NGX_FALSE;
     }
 
-    // mv lastcheckpoint.tmp to previous.checkpoint
-    if (rename(src, dst) != NGX_OK) {
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
-                      "rename %s to %s err", src, dst);
+    sv.dead = g_delta.dead;
+    sv.dead_num = g_delta.dead_num;
+    g_delta.dead = nullptr;
+    g_delta.dead_num = 0;
+    g_delta.dead_cap = 0;
 
-        return NGX_ERROR;
-    }
+    g_snap.active = NGX_TRUE;
 
-    return NGX_OK;
-}
+    pthread_mutex_unlock(&g_fcm->ckp_lock);
+    pthread_mutex_unlock(&g_fcm->apply_lock);
 
-static int delete_dir(const char *dir) {
-    DIR *dp = nullptr;
-    struct dirent *entry = nullptr;
+    // nothing before last leaves the queue while the snapshot is active
+    pthread_mutex_lock(&g_fcm->ckp_lock);
 
-    if ((dp = opendir(dir)) == nullptr) {
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
-                      "opendir %s err", dir);
+    queue_t *head;
+    queue_t *entry;
 
-        return NGX_ERROR;
-    }
+    head = &g_checkpoint_q;
+    entry = delta ? g_snap.last : head;
 
-    while ((entry = readdir(dp)) != nullptr) {
-        if (entry->d_type == 8) {
-            // file
-            char sBuf[PATH_LEN] = {0};
-            sprintf(sBuf, "%s/%s", dir, entry->d_name);
+    while (entry != g_snap.last) {
+        entry = queue_next(entry);
 
-            unlink(sBuf);
-        } else if (0 != strcmp(entry->d_name, ".")
-                   && 0 != strcmp(entry->d_name, "..")) {
-            // sub-dir
-            char sBuf[PATH_LEN] = {0};
-            sprintf(sBuf, "%s/%s", dir, entry->d_name);
+        if (sv.num == cap) {
+            size_t ncap = cap ? cap * 2 : FI_IMAGE_SECTION_RECS;
+            fi_store_t **nstores = (fi_store_t **) realloc(sv.stores,
+                                                           ncap * sizeof(fi_store_t *));
+            if (!nstores) {
+                pthread_mutex_unlock(&g_fcm->ckp_lock);
 
-            delete_dir(sBuf);
+                goto stop;
+            }
+
+            sv.stores = nstores;
+            cap = ncap;
         }
+
+        sv.stores[sv.num++] = queue_data(entry, fi_store_t, ckp);
     }
 
-    closedir(dp);
+    pthread_mutex_unlock(&g_fcm->ckp_lock);
 
-    rmdir(dir);
+    sec_num = (sv.num + FI_IMAGE_SECTION_RECS - 1) / FI_IMAGE_SECTION_RECS;
 
-    return NGX_OK;
-}
+    sv.secs = (fsimage_section_t *) calloc(sec_num + 1,
+                                           sizeof(fsimage_section_t));
+    if (!sv.secs) {
+        goto stop;
+    }
 
-//
-int load_image() {
-    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
-                  "load_image start, lastCheckpointInstanceID: %l",
-                  lastCheckpointInstanceID);
+    sv.secs_num = sec_num;
 
-    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+    rc = fsimage_parallel(threads, sec_num, fi_image_encode, &sv);
 
-    char image_name[PATH_LEN] = {0};
-    string_xxsprintf((uchar_t *) image_name, "%s/current/fsimage",
-                     conf->fsimage_dir.data);
+    stop:
+    pthread_mutex_lock(&g_fcm->apply_lock);
+    pthread_mutex_lock(&g_fcm->ckp_lock);
 
-    int fd = open(image_name, O_RDWR | O_CREAT, 0777);
-    if (fd < 0) {
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno,
-                      "open[%s] err", image_name);
+    g_snap.active = NGX_FALSE;
+    limbo = g_snap.limbo;
+    g_snap.limbo = nullptr;
 
-        return NGX_ERROR;
-    }
+    pthread_mutex_unlock(&g_fcm->ckp_lock);
+    pthread_mutex_unlock(&g_fcm->apply_lock);
 
-    fi_inode_t fin;
-    bzero(&fin, sizeof(fi_inode_t));
-    //?
-    while (read(fd, &fin, sizeof(fi_inode_t)) > 0) {
-        update_fi_mkdir(&fin);
+    if (rc == NGX_OK && g_snap.cow_err) {
+        rc = NGX_ERROR;
     }
 
-    // read ckpid: last check point id
-    read_checkpoinID();
-    // geditlog set check point
-    set_checkpoint_instanceID(lastCheckpointInstanceID);
+    // the saved states go after the live ones, then the removed inos
+    // and the group instances
+    dead_sec = delta && sv.dead_num > 0;
+    total = sec_num + g_snap.cow_num + dead_sec + 1;
+
+    if (rc == NGX_OK) {
+        fsimage_section_t *secs = (fsimage_section_t *) realloc(sv.secs,
+                                                                total * sizeof(fsimage_section_t));
+        if (secs) {
+            memory_memcpy(secs + sec_num, g_snap.cow,
+                          g_snap.cow_num * sizeof(fsimage_section_t));
+            memory_zero(secs + sec_num + g_snap.cow_num,
+                        (total - sec_num - g_snap.cow_num)
+                        * sizeof(fsimage_section_t));
+
+            sv.secs = secs;
+            sv.secs_num = total;
+            g_snap.cow_num = 0;
+
+            if (dead_sec) {
+                rc = fi_image_dead_section(&secs[total - 2], sv.dead,
+                                           sv.dead_num);
+            }
 
-    return NGX_OK;
-}
+            if (rc == NGX_OK) {
+                rc = fi_image_groups_section(&secs[total - 1], g_snap.ids,
+                                             g_snap.next_inos);
+            }
+        } else {
+            rc = NGX_ERROR;
+        }
+    }
 
-// from do_checkpoint
-static int save_image() {
-    conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
-    rb_msec_t start_time = dfs_current_msec;
-    uint64_t uid = 0;
+    for (size_t i = 0; i < g_snap.cow_num; i++) {
+        fsimage_section_free(&g_snap.cow[i]);
+    }
 
-    char image_name[PATH_LEN] = {0};
-    string_xxsprintf((uchar_t *) image_name, "%s/current/fsimage",
-                     conf->fsimage_dir.data);
+    g_snap.cow_num = 0;
 
-    int fd = open(image_name, O_RDWR | O_CREAT | O_TRUNC, 0664);
-    if (fd < 0) {
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
-                      "open[%s] err", image_name);
+    if (rc != NGX_OK
+        || fsimage_parallel(threads, sv.secs_num, fi_image_seal, &sv) != NGX_OK) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+                      "encode fsimage err");
 
-        return NGX_ERROR;
-    }
+        rc = NGX_ERROR;
 
-    queue_t qhead;
-    queue_init(&qhead);
+        goto out;
+    }
 
-    pthread_rwlock_rdlock(&g_fcm->cache_rwlock);
+    for (size_t i = 0; i < sv.secs_num; i++) {
+        hdr.record_num += sv.secs[i].hdr.record_num;
+    }
 
-    if (!queue_empty(&g_checkpoint_q)) {
-        qhead.next = g_checkpoint_q.next;
-        qhead.prev = g_checkpoint_q.prev;
+    hdr.flags = sv.compress ? FSIMAGE_F_LZ4 : 0;
+    hdr.max_ino = fi_max_ino(g_snap.next_inos);
+    hdr.instance_id = fi_image_id(g_snap.ids);
 
-        qhead.next->prev = &qhead;
-        qhead.prev->next = &qhead;
+    if (delta) {
+        hdr.flags |= FSIMAGE_F_DELTA;
+        hdr.base_id = g_delta.image_id;
     }
 
-    pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+    rc = fsimage_write(image_name, &hdr, sv.secs, sv.secs_num);
+    if (rc != NGX_OK) {
+        goto out;
+    }
 
-    queue_t *head = &qhead;
-    queue_t *entry = queue_next(head);
+    memory_memcpy(g_ckp_ids, g_snap.ids, g_group_num * sizeof(uint64_t));
+    lastCheckpointInstanceID = hdr.instance_id;
+    g_delta.image_id = hdr.instance_id;
 
-    while (head != entry) {
-        fi_store_t *fis = queue_data(entry, fi_store_t, ckp);
-        fi_inode_t fii = fis->fin;
+    if (delta) {
+        g_delta.chain++;
+        g_delta.delta_recs += hdr.record_num;
+    } else {
+        // the old chain is folded into the new base
+        for (int n = 1; n <= chain; n++) {
+            char path[PATH_LEN] = {0};
 
-        if (fii.modification_time > start_time) //
-        {
-            break;
+            fi_delta_path(path, n);
+            unlink(path);
         }
 
-        if (write(fd, &fii, sizeof(fi_inode_t)) < 0) {
-            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
-                          "write[%s] err", image_name);
+        g_delta.chain = 0;
+        g_delta.base_recs = hdr.record_num;
+        g_delta.delta_recs = 0;
+    }
 
-            return NGX_ERROR;
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+                  "%s written, %lu records", image_name, hdr.record_num);
+
+    out:
+    if (rc != NGX_OK) {
+        // what this one took is gone, the next has to be full
+        pthread_mutex_lock(&g_fcm->ckp_lock);
+        g_delta.lost = NGX_TRUE;
+        pthread_mutex_unlock(&g_fcm->ckp_lock);
+    }
+
+    while (limbo) {
+        fi_store_t *next = limbo->limbo;
+
+        pthread_mutex_lock(&g_fcm->ckp_lock);
+
+        if (limbo->ckp.next) {
+            queue_remove(&limbo->ckp);
         }
 
-        uid = fii.uid;
+        pthread_mutex_unlock(&g_fcm->ckp_lock);
 
-        entry = queue_next(entry);
+        fi_store_destroy(limbo);
+        limbo = next;
     }
 
-    close(fd);
+    if (sv.secs) {
+        for (size_t i = 0; i < sv.secs_num; i++) {
+            fsimage_section_free(&sv.secs[i]);
+        }
 
-    lastCheckpointInstanceID = uid;
+        free(sv.secs);
+    }
 
-    return NGX_OK;
+    free(sv.stores);
+    free(sv.dead);
+
+    return rc;
 }
 
-// from do_checkpoint
+// from do_checkpoint, the instance of every group
 
 static int save_checkpoinID() {
     conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+    size_t len = g_group_num * sizeof(uint64_t);
 
     char ckp_name[PATH_LEN] = {0};
     string_xxsprintf((uchar_t *) ckp_name, "%s/current/ckpid",
@@ -1292,10 +4084,13 @@ static int save_checkpoinID() {
         return NGX_ERROR;
     }
 
-    if (write(fd, &lastCheckpointInstanceID, sizeof(uint64_t)) < 0) {
+    // the paxos log before it is dropped once this is on disk
+    if (write(fd, g_ckp_ids, len) != (ssize_t) len || fsync(fd) != 0) {
         dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
                       "write[%s] err", ckp_name);
 
+        close(fd);
+
         return NGX_ERROR;
     }
 
@@ -1304,9 +4099,12 @@ static int save_checkpoinID() {
     return NGX_OK;
 }
 
-// 检查点
+// 检查点. a group keeps the newer of its ckpid and image instance, a
+// ckpid from before groups holds group 0 only
 static int read_checkpoinID() {
     conf_server_t *conf = (conf_server_t *) dfs_cycle->sconf;
+    uint64_t *ids = nullptr;
+    ssize_t n = 0;
 
     char ckp_name[PATH_LEN] = {0};
     string_xxsprintf((uchar_t *) ckp_name, "%s/current/ckpid",
@@ -1320,67 +4118,167 @@ static int read_checkpoinID() {
         return NGX_ERROR;
     }
 
-    if (read(fd, &lastCheckpointInstanceID, sizeof(uint64_t)) < 0) {
+    ids = (uint64_t *) memory_calloc(g_group_num * sizeof(uint64_t));
+    if (!ids) {
+        close(fd);
+
+        return NGX_ERROR;
+    }
+
+    n = read(fd, ids, g_group_num * sizeof(uint64_t));
+    if (n < 0) {
         dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
                       "read %s err", ckp_name);
 
+        memory_free(ids, g_group_num * sizeof(uint64_t));
         close(fd);
 
         return NGX_ERROR;
     }
 
+    for (int i = 0; i < n / (ssize_t) sizeof(uint64_t); i++) {
+        if (ids[i] == FI_NO_INSTANCE) {
+            continue;
+        }
+
+        if (g_ckp_ids[i] == FI_NO_INSTANCE || ids[i] > g_ckp_ids[i]) {
+            g_ckp_ids[i] = ids[i];
+        }
+    }
+
+    memory_free(ids, g_group_num * sizeof(uint64_t));
     close(fd);
 
     return NGX_OK;
 }
 
+// the id of an image: the sum of the group instances. it grows with
+// every instance applied and is the instance id with one group
+static uint64_t fi_image_id(uint64_t *ids) {
+    uint64_t id = 0;
+
+    for (int i = 0; i < g_group_num; i++) {
+        if (ids[i] != FI_NO_INSTANCE) {
+            id += ids[i];
+        }
+    }
+
+    return id;
+}
+
+// paxos may drop what the newest image holds, and replays each group
+// from there. a group the image has nothing of goes as NoCheckpoint,
+// so its instance 0 is still replayed and kept
+static void fi_ckp_sync() {
+    lastCheckpointInstanceID = fi_image_id(g_ckp_ids);
+
+    for (int i = 0; i < g_group_num; i++) {
+        set_checkpoint_instanceID(i, g_ckp_ids[i]);
+    }
+}
+
+
 // read file create func
 static int update_fi_create(fi_inode_t *fin, uint64_t blk_id, void *data) {
-    dfs_thread_t *thread = (dfs_thread_t *) data;
+    fi_path_t fp;
+    fi_lock_t fl;
 
-    pthread_rwlock_wrlock(&g_fcm->cache_rwlock);
+    // store blk seq, blk_seq should start from 1
+    //
+    if (fin->blk_seq < 1 || fin->blk_seq > fin->total_blk) {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+                      "create %s invalid blk_seq %lu", fin->key, fin->blk_seq);
 
-    fi_store_t *fis = (fi_store_t *) mem_get0(g_fcm->mem_mgmt.free_mblks);
+        return NGX_ERROR;
+    }
 
-    queue_init(&fis->ckp);
-    queue_init(&fis->me);
-    fis->state = KEY_STATE_CREATING;
+    if (fi_path_parse((uchar_t *) fin->key, &fp) != NGX_OK || fp.num == 0) {
+        return NGX_ERROR;
+    }
+
+    if (fi_lock_target(&fp, fp.num, &fl) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-    memcpy(&fis->fin, fin, sizeof(fi_inode_t));
+    size_t len = 0;
+    const char *name = fi_level_name(&fp, fp.num, &len);
 
-    for (unsigned long &blk : fis->fin.blks) {
-        blk = BLK_NOT_EXIST;
+    if (!fl.parent->fin.is_directory
+        || fi_dentry_lookup_nolock(fl.pino, name, len)) {
+        fi_unlock_target(&fl);
+
+        return NGX_ERROR;
     }
 
-    // store blk seq, blk_seq should start from 1
-    //
-    if (fin->blk_seq < 1 || fin->blk_seq > fin->total_blk || fin->blk_seq > BLK_LIMIT) {
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
-                      "read %s err", fin->blk_seq);
+    fi_store_t *fis = fi_store_new(fin, fl.pino, name, len);
+    if (!fis) {
+        fi_unlock_target(&fl);
+
         return NGX_ERROR;
     }
-    fis->fin.blks[0] = blk_id;
 
-    // end
-    fis->ln.key = fis->fin.key;
-    fis->ln.len = string_strlen(fis->fin.key);
-    fis->ln.next = nullptr;
+    fis->state = KEY_STATE_CREATING;
+
+    if (fi_blk_list_append(&fis->fin.blks, blk_id) != NGX_OK) {
+        goto err_store;
+    }
+
+    // only the namenode that proposed the create times it out
+    if (data != nullptr) {
+        fis->creating = (fi_creating_t *) memory_calloc(sizeof(fi_creating_t));
+        if (!fis->creating) {
+            goto err_store;
+        }
+
+        fis->creating->timer_ev.data = fis;
+        fis->creating->timer_ev.handler = fi_create_timeout;
+    }
 
-    dfs_hashtable_join(g_fcm->fi_htable, &fis->ln);
+    // not a child of the parent until it is closed
+    fi_store_join(fis);
 
-    if (thread != nullptr) {
-        fis->thread = thread;
-        fis->timer_ev.data = fis;
-        fis->timer_ev.handler = fi_create_timeout;
-        event_timer_add(&fis->thread->event_timer,
-                        &fis->timer_ev, FI_CREATE_TIME_OUT);
+    if (fis->creating) {
+        fi_create_timer_add(fis);
     }
 
-    pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+    fi_unlock_target(&fl);
 
     inc_FsObjectNum(1);
 
     return NGX_OK;
+
+    err_store:
+    fi_unlock_target(&fl);
+
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                  "create %s store err", fin->key);
+
+    fi_store_destroy(fis);
+
+    return NGX_ERROR;
+}
+
+static void fi_create_timer_add(fi_store_t *fis) {
+    pthread_mutex_lock(&g_create_lock);
+    event_timer_add(&g_create_timer, &fis->creating->timer_ev,
+                    FI_CREATE_TIME_OUT);
+    pthread_mutex_unlock(&g_create_lock);
+}
+
+static void fi_create_timer_del(fi_store_t *fis) {
+    pthread_mutex_lock(&g_create_lock);
+    event_timer_del(&g_create_timer, &fis->creating->timer_ev);
+    pthread_mutex_unlock(&g_create_lock);
+}
+
+// runs the create timeouts that are due. they take apply_lock like
+// the edits, so a timeout never races the close or rm of its file
+void fi_create_expire() {
+    pthread_mutex_lock(&g_fcm->apply_lock);
+
+    event_timers_expire(&g_create_timer);
+
+    pthread_mutex_unlock(&g_fcm->apply_lock);
 }
 
 static void fi_create_timeout(event_t *ev) {
@@ -1388,46 +4286,90 @@ static void fi_create_timeout(event_t *ev) {
 
     fis = (fi_store_t *) ev->data;
 
-    dfs_hashtable_remove_link(g_fcm->fi_htable, &fis->ln);
+    // a creating file is never moved, its parent is stable
+    size_t idx = fi_dshard(fis->dkey.parent);
 
-    //queue_remove(&fis->me);
-    //queue_remove(&fis->ckp);
+    dfs_shard_hashtable_wrlock(g_fcm->fi_htable, idx);
 
-    fi_store_destroy(fis);
+    fi_store_unjoin(fis);
+
+    dfs_shard_hashtable_unlock(g_fcm->fi_htable, idx);
+
+    fi_store_release(fis);
 }
 
 static int update_fi_get_additional_blk(fi_inode_t *fin,
                                         uint64_t blk_id) {
-    fi_store_t *fis = get_store_obj((uchar_t *) fin->key);
+    fi_path_t fp;
+    fi_lock_t fl;
 
-    pthread_rwlock_wrlock(&g_fcm->cache_rwlock);
+    if (fi_path_parse((uchar_t *) fin->key, &fp) != NGX_OK
+        || fi_lock_target(&fp, fp.num, &fl) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-    for (int i = 0; i < BLK_LIMIT; i++) {
-        if (-1 == fis->fin.blks[i]) {
-            fis->fin.blks[i] = blk_id;
+    size_t len = 0;
+    const char *name = fi_level_name(&fp, fp.num, &len);
 
-            break;
-        }
+    fi_store_t *fis = fi_dentry_lookup_nolock(fl.pino, name, len);
+    if (!fis) {
+        fi_unlock_target(&fl);
+
+        return NGX_ERROR;
+    }
+
+    fi_store_touch(fis);
+
+    if (fi_blk_list_append(&fis->fin.blks, blk_id) != NGX_OK) {
+        fi_unlock_target(&fl);
+
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+                      "add blk %lu to %s err", blk_id, fin->key);
+
+        return NGX_ERROR;
     }
 
-    if (fis->thread != nullptr) {
-        event_timer_add(&fis->thread->event_timer,
-                        &fis->timer_ev, FI_CREATE_TIME_OUT);
+    if (fis->creating != nullptr) {
+        fi_create_timer_add(fis);
     }
 
-    pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+    fi_unlock_target(&fl);
 
     return NGX_OK;
 }
 
 static int update_fi_close(fi_inode_t *fin) {
-    fi_store_t *fis = get_store_obj((uchar_t *) fin->key);
+    fi_path_t fp;
+    fi_lock_t fl;
+
+    if (fi_path_parse((uchar_t *) fin->key, &fp) != NGX_OK || fp.num == 0
+        || fi_lock_target(&fp, fp.num, &fl) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-    pthread_rwlock_wrlock(&g_fcm->cache_rwlock);
+    size_t len = 0;
+    const char *name = fi_level_name(&fp, fp.num, &len);
+
+    fi_store_t *fis = fi_dentry_lookup_nolock(fl.pino, name, len);
+    if (!fis || fis->state != KEY_STATE_CREATING) {
+        fi_unlock_target(&fl);
+
+        return NGX_ERROR;
+    }
+
+    fi_store_touch(fis);
+    fi_store_touch(fl.parent);
+
+    if (fi_child_add(fl.parent, fis) != NGX_OK) {
+        fi_unlock_target(&fl);
+
+        return NGX_ERROR;
+    }
 
-    if (fis->thread != nullptr) {
-        event_timer_del(&fis->thread->event_timer, &fis->timer_ev);
-        fis->thread = nullptr;
+    if (fis->creating != nullptr) {
+        fi_create_timer_del(fis);
+        memory_free(fis->creating, sizeof(fi_creating_t));
+        fis->creating = nullptr;
     }
 
     fis->state = KEY_STATE_OK;
@@ -1435,68 +4377,190 @@ static int update_fi_close(fi_inode_t *fin) {
     fis->fin.length = fin->length;
     fis->fin.blk_replication = fin->blk_replication;
 
-    uchar_t path[PATH_LEN] = "";
-    get_store_path((uchar_t *) fin->key, path);
+    fl.parent->fin.modification_time = fin->modification_time;
 
-    uchar_t pKey[PATH_LEN] = "";
-    get_parent_key(path, pKey);
+    fi_ckp_insert(fis);
 
-    fi_store_t *fparent = (fi_store_t *) dfs_hashtable_lookup(g_fcm->fi_htable,
-                                                              (void *) pKey, string_strlen(pKey));
+    fi_unlock_target(&fl);
 
-    fparent->fin.modification_time = fin->modification_time;
+    return NGX_OK;
+}
 
-    queue_insert_tail(&fparent->children, &fis->me);
-    fparent->children_num++;
+static int update_fi_rm(fi_inode_t *fin) {
+    fi_path_t fp;
+    fi_lock_t fl;
 
-    queue_insert_tail(&g_checkpoint_q, &fis->ckp);
+    if (fi_path_parse((uchar_t *) fin->key, &fp) != NGX_OK || fp.num == 0
+        || fi_lock_target(&fp, fp.num, &fl) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    size_t len = 0;
+    const char *name = fi_level_name(&fp, fp.num, &len);
+
+    fi_store_t *fcurrent = fi_dentry_lookup_nolock(fl.pino, name, len);
+    if (!fcurrent) {
+        fi_unlock_target(&fl);
+
+        return NGX_ERROR;
+    }
+
+    fi_snap_cow(fcurrent);
+
+    if (fcurrent->state == KEY_STATE_OK) {
+        fi_store_touch(fl.parent);
+        fl.parent->fin.modification_time = fin->modification_time;
+        fi_child_del(fl.parent, fcurrent);
+    }
+
+    fi_blk_list_t *del_blks = fcurrent->fin.blks;
+    fcurrent->fin.blks = nullptr;
+
+    fi_store_unjoin(fcurrent);
+
+    if (fcurrent->creating != nullptr) {
+        fi_create_timer_del(fcurrent);
+    }
+
+    fi_unlock_target(&fl);
+
+    fi_store_release(fcurrent);
+
+    //
+    sub_FsObjectNum(1);
 
-    pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+    fi_blks_del(del_blks);
+    fi_blk_list_free(del_blks);
 
     return NGX_OK;
 }
 
-static int update_fi_rm(fi_inode_t *fin) {
-    uchar_t path[PATH_LEN] = "";
-    get_store_path((uchar_t *) fin->key, path);
+// move the entry between parents, its inode and everything below it
+// keep their ino so the subtree is not touched
+static int update_fi_rename(uchar_t *src_key, uchar_t *dst_key,
+                            uint64_t mtime) {
+    fi_path_t sp;
+    fi_path_t dp;
+    uint64_t sinos[FI_PATH_DEPTH + 1];
+    uint64_t dinos[FI_PATH_DEPTH + 1];
+    size_t idx[4];
+    fi_store_t *sparent = nullptr;
+    fi_store_t *dparent = nullptr;
+    int i = 0;
+
+    if (fi_path_parse(src_key, &sp) != NGX_OK || sp.num == 0
+        || fi_path_parse(dst_key, &dp) != NGX_OK || dp.num == 0
+        || fi_path_is_prefix(&sp, &dp)) {
+        return NGX_ERROR;
+    }
+
+    size_t slen = 0;
+    const char *sname = fi_level_name(&sp, sp.num, &slen);
+    size_t dlen = 0;
+    const char *dname = fi_level_name(&dp, dp.num, &dlen);
+
+    for (i = 0; i < FI_LOCK_RETRY; i++) {
+        if (fi_path_resolve(&sp, sp.num, sinos, nullptr) < sp.num
+            || fi_path_resolve(&dp, dp.num, dinos, nullptr) < dp.num) {
+            return NGX_ERROR;
+        }
 
-    uchar_t pKey[PATH_LEN] = "";
-    get_parent_key(path, pKey);
+        uint64_t spino = sinos[sp.num - 1];
+        uint64_t sppino = sp.num > 1 ? sinos[sp.num - 2] : FI_NO_INO;
+        uint64_t dpino = dinos[dp.num - 1];
+        uint64_t dppino = dp.num > 1 ? dinos[dp.num - 2] : FI_NO_INO;
 
-    pthread_rwlock_wrlock(&g_fcm->cache_rwlock);
+        idx[0] = fi_dshard(spino);
+        idx[1] = fi_dshard(sppino);
+        idx[2] = fi_dshard(dpino);
+        idx[3] = fi_dshard(dppino);
 
-    fi_store_t *fparent = (fi_store_t *) dfs_hashtable_lookup(g_fcm->fi_htable,
-                                                              (void *) pKey, string_strlen(pKey));
+        dfs_shard_hashtable_wrlock_n(g_fcm->fi_htable, idx, 4);
 
-    fparent->fin.modification_time = fin->modification_time;
+        size_t len = 0;
+        const char *name = fi_level_name(&sp, sp.num - 1, &len);
+        sparent = fi_dentry_lookup_nolock(sppino, name, len);
 
-    fi_store_t *fcurrent = (fi_store_t *) dfs_hashtable_lookup(g_fcm->fi_htable,
-                                                               (void *) fin->key, string_strlen(fin->key));
+        name = fi_level_name(&dp, dp.num - 1, &len);
+        dparent = fi_dentry_lookup_nolock(dppino, name, len);
+
+        if (sparent && sparent->fin.ino == spino
+            && dparent && dparent->fin.ino == dpino) {
+            break;
+        }
 
-    uint64_t del_blks[BLK_LIMIT];
-    memcpy(&del_blks, &fcurrent->fin.blks, sizeof(fcurrent->fin.blks));
+        dfs_shard_hashtable_unlock_n(g_fcm->fi_htable, idx, 4);
+    }
 
-    dfs_hashtable_remove_link(g_fcm->fi_htable, &fcurrent->ln);
+    if (i == FI_LOCK_RETRY) {
+        return NGX_ERROR;
+    }
 
-    queue_remove(&fcurrent->me);
-    queue_remove(&fcurrent->ckp);
+    fi_store_t *fis = fi_dentry_lookup_nolock(sparent->fin.ino, sname, slen);
+    if (!fis || fis->state != KEY_STATE_OK || !dparent->fin.is_directory
+        || fi_dentry_lookup_nolock(dparent->fin.ino, dname, dlen)) {
+        goto err_out;
+    }
 
-    fi_store_destroy(fcurrent);
+    // the destination must not be below the source
+    for (i = 0; i < dp.num; i++) {
+        if (dinos[i] == fis->fin.ino) {
+            goto err_out;
+        }
+    }
 
-    fparent->children_num--;
+    char *new_name;
+    new_name = (char *) fis->dkey.name;
 
-    pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+    if (slen != dlen || memory_memcmp(sname, dname, slen)) {
+        new_name = fi_name_dup(dname, dlen);
+        if (!new_name) {
+            goto err_out;
+        }
+    }
 
-    //
-    sub_FsObjectNum(1);
+    fi_store_touch(fis);
+    fi_store_touch(sparent);
+    fi_store_touch(dparent);
 
-    for (int i = 0; i < BLK_LIMIT; i++) {
-        if (del_blks[i] > 0) {
-            block_object_del(del_blks[i]);
+    fi_dentry_key_t old_key;
+    old_key = fis->dkey;
+
+    dfs_shard_hashtable_remove_link_nolock(g_fcm->fi_htable, &fis->ln);
+    fi_child_del(sparent, fis);
+
+    fis->dkey.parent = dparent->fin.ino;
+    fis->dkey.name = new_name;
+    fis->dkey.len = dlen;
+
+    if (fi_child_add(dparent, fis) != NGX_OK) {
+        fis->dkey = old_key;
+
+        fi_child_add(sparent, fis);
+        dfs_shard_hashtable_join_nolock(g_fcm->fi_htable, &fis->ln);
+
+        if (new_name != old_key.name) {
+            fi_name_free(new_name, dlen);
         }
+
+        goto err_out;
+    }
+
+    if (new_name != old_key.name) {
+        fi_name_free((char *) old_key.name, old_key.len);
     }
 
+    dfs_shard_hashtable_join_nolock(g_fcm->fi_htable, &fis->ln);
+
+    sparent->fin.modification_time = mtime;
+    dparent->fin.modification_time = mtime;
+
+    dfs_shard_hashtable_unlock_n(g_fcm->fi_htable, idx, 4);
+
     return NGX_OK;
-}
 
+    err_out:
+    dfs_shard_hashtable_unlock_n(g_fcm->fi_htable, idx, 4);
 
+    return NGX_ERROR;
+}
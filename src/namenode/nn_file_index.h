@@ -1,7 +1,11 @@
 #ifndef NN_FILE_INDEX_H
 #define NN_FILE_INDEX_H
 
+#include <string>
+#include <vector>
 #include "dfs_hashtable.h"
+#include "dfs_shard_hashtable.h"
+#include "dfs_btree.h"
 #include "dfs_mem_allocator.h"
 #include "dfs_mblks.h"
 #include "dfs_commpool.h"
@@ -9,6 +13,7 @@
 #include "dfs_event.h"
 #include "nn_cycle.h"
 #include "nn_thread.h"
+#include "nn_fi_inode.h"
 
 #define OP_INVALID        -1
 #define OP_ADD             0
@@ -35,7 +40,6 @@
 #define KEY_LEN   256
 #define OWNER_LEN 16
 #define GROUP_LEN 16
-#define BLK_LIMIT 64
 
 #define HASH_BUF_PER_SZ sizeof(void *) 
 #define DFS_ALIGNMENT sizeof(uint64_t)
@@ -47,12 +51,27 @@
 #define FI_HASH_BUF(fi_count)  (fi_count * HASH_BUF_PER_SZ)
 #define FI_STORE_BUF(fi_count) (fi_count * FI_STORE_BUF_PER_SZ)
 
-#define FI_POOL_SIZE(fi_count) (FI_HASH_BUF(fi_count) \
+// dentry and ino tables
+#define FI_POOL_SIZE(fi_count) (2 * FI_HASH_BUF(fi_count) \
         + FI_STORE_BUF(fi_count) + FI_POOL_REMAIN_MEM) 
 
+// per shard hashtable head plus the prime rounding of its buckets,
+// for both tables
+#define FI_SHARD_BUF(shard_num) (2 * (shard_num) * (sizeof(dfs_hashtable_t) \
+        + 256 * HASH_BUF_PER_SZ))
+
+#define FI_NO_INO      0  // parent of the root
+#define FI_ROOT_INO    1
+#define FI_PATH_DEPTH  (PATH_LEN / 2)
+
+// exchange form of an inode: ls replies, fsimage records, permission
+// checks. the fsimage appends blk_num block ids to a file's record.
+// key is the entry name, ls replies carry the encoded full path
 typedef struct fi_inode_s
 {
     char     key[KEY_LEN];
+	uint64_t ino;
+	uint64_t parent_ino;
 	uint64_t uid;
 	short    permission;
 	char     owner[OWNER_LEN];
@@ -63,22 +82,41 @@ typedef struct fi_inode_s
 	uint64_t length;
 	uint64_t blk_size;
 	short    blk_replication;
-	uint64_t blks[BLK_LIMIT]; // 每块的hash
     uint32_t blk_seq; // 当前访问块 序列
 	uint32_t total_blk; // 总的块数
+	uint64_t blk_num; // 已分配的块数
 } fi_inode_t;
 
+// only allocated while a file is being created
+typedef struct fi_creating_s
+{
+	event_t timer_ev;
+} fi_creating_t;
+
+// a directory entry is (parent inode id, name)
+typedef struct fi_dentry_key_s
+{
+	uint64_t    parent;
+	const char *name;
+	size_t      len;
+} fi_dentry_key_t;
+
 typedef struct fi_store_s 
 {
-	dfs_hashtable_link_t  ln; //
+	dfs_hashtable_link_t  ln; // dentry table, key is &dkey
+	dfs_hashtable_link_t  ino_ln; // ino table, key is &fin.ino
+	fi_dentry_key_t       dkey;
 	queue_t               ckp; // check point
-	queue_t 	          me; // child queue point
-	queue_t               children; // 子目录
-	uint64_t              children_num;
-	fi_inode_t            fin; // file node
+	queue_t               dirty; // changed since the last checkpoint
+	dfs_btree_t           children; // 子目录, sorted by name
+	fi_cinode_t           fin; // file node
+	fi_creating_t        *creating;
 	short	              state;
-	dfs_thread_t	     *thread;
-	event_t 		      timer_ev;
+	short                 dead; // out of the tables, set under its shard lock
+	uint64_t              ver;  // instance that created it
+	uint64_t              snap_seq; // checkpoint that has its state already
+	uint64_t              delta_seq; // checkpoint whose delta it is in
+	struct fi_store_s    *limbo; // freed once that checkpoint is done
 } fi_store_t;
         
 typedef struct fi_cache_mem_s 
@@ -89,14 +127,22 @@ typedef struct fi_cache_mem_s
     struct mem_mblks    *free_mblks;
 } fi_cache_mem_t;
 
+// fi_htable maps (parent ino, name) to the entry and is sharded by
+// the parent ino only, so all entries of a directory share a shard.
+// that shard's lock guards the entries, their inodes and the
+// directory's children queue. updates touching the parent's own entry
+// take both shards with dfs_shard_hashtable_wrlock2. ino_htable maps
+// inode ids to entries, its locks are taken last.
 typedef struct fi_cache_mgmt_s 
 {
-    dfs_hashtable_t  *fi_htable;
-    pthread_rwlock_t  cache_rwlock;
-    fi_cache_mem_t    mem_mgmt;
-    dfs_hashtable_t  *fi_timer_htable;
-    pthread_rwlock_t  timer_rwlock;
-	int               timer_delay; // MSec
+    dfs_shard_hashtable_t *fi_htable;
+    dfs_shard_hashtable_t *ino_htable;
+    pthread_mutex_t        ckp_lock; // g_checkpoint_q
+    pthread_mutex_t        apply_lock; // held while an instance is applied
+    fi_cache_mem_t         mem_mgmt;
+    dfs_hashtable_t       *fi_timer_htable;
+    pthread_rwlock_t       timer_rwlock;
+	int                    timer_delay; // MSec
 } fi_cache_mgmt_t;
 
 int nn_file_index_worker_init(cycle_t *cycle);
@@ -111,18 +157,34 @@ int nn_get_additional_blk(task_t *task);
 int nn_close(task_t *task);
 int nn_rm(task_t *task);
 int nn_open(task_t *task);
+int nn_rename(task_t *task);
+int nn_ls_page(task_t *task);
+int nn_batch(task_t *task);
 
-int update_fi_cache_mgmt(const uint64_t llInstanceID, 
+int update_fi_cache_mgmt(const int iGroupIdx, const uint64_t llInstanceID, 
 	const std::string & sPaxosValue, void *data); 
+void fi_create_expire();
 
-fi_store_t *get_store_obj(uchar_t *key);
+// a decoded path split into its components, the root is level 0 and
+// names[i] is level i + 1
+typedef struct fi_path_s
+{
+	char    buf[PATH_LEN];
+	char   *names[FI_PATH_DEPTH];
+	size_t  lens[FI_PATH_DEPTH];
+	int     num;
+} fi_path_t;
+
+int fi_path_parse(uchar_t *key, fi_path_t *fp);
+int fi_path_resolve(fi_path_t *fp, int levels, uint64_t inos[], 
+	fi_inode_t finodes[]);
+void fi_path_key(fi_path_t *fp, int level, uchar_t *key);
+int fi_path_is_prefix(fi_path_t *fp, fi_path_t *sub);
+
+int get_store_stat(uchar_t *key, fi_inode_t *fin, short *state);
+void get_store_inode(fi_store_t *fis, fi_inode_t *fin);
 void get_store_path(uchar_t *key, uchar_t *path);
-int get_path_names(uchar_t *path, uchar_t names[][PATH_LEN]);
 void key_encode(uchar_t *path, uchar_t *key);
-void get_path_keys(uchar_t names[][PATH_LEN], int num, 
-	uchar_t keys[][PATH_LEN]);
-int get_path_inodes(uchar_t keys[][PATH_LEN], int num, 
-	fi_inode_t *finodes[]);
 int is_FsObjectExceed(int num);
 int inc_FsObjectNum(int num);
 int sub_FsObjectNum(int num);
@@ -130,6 +192,13 @@ int is_InSafeMode();
 
 int do_checkpoint();
 int load_image();
+void fi_ckp_lag(uint64_t *edits, uint64_t *bytes);
+
+int fi_ckp_state_lock();
+void fi_ckp_state_unlock();
+int fi_ckp_state_files(std::string & dir, std::vector<std::string> & files);
+int fi_ckp_state_load(const std::string & dir, 
+	const std::vector<std::string> & files, uint64_t instance_id);
 
 #endif
 
@@ -0,0 +1,471 @@
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
+
+#include "nn_fsimage.h"
+#include "nn_cycle.h"
+#include "dfs_error_log.h"
+#include "dfs_memory.h"
+#include "dfs_crc32.h"
+#include "dfs_lz4.h"
+
+#define FSIMAGE_IOV_MAX 64
+
+typedef struct fsimage_pool_s
+{
+	fsimage_work_pt work;
+	void           *arg;
+	size_t          num;
+	size_t          next;
+	int             failed;
+} fsimage_pool_t;
+
+static uint32_t fsimage_header_crc(fsimage_header_t *hdr);
+static int fsimage_writev(int fd, struct iovec *iov, int n);
+static void *fsimage_worker(void *arg);
+
+// room for need more bytes, returns where they go
+uchar_t *fsimage_section_reserve(fsimage_section_t *sec, size_t need)
+{
+	if (sec->raw_cap - sec->raw_len < need)
+	{
+		size_t cap = sec->raw_cap ? sec->raw_cap * 2 : 64 * 1024;
+
+		while (cap - sec->raw_len < need)
+		{
+			cap *= 2;
+		}
+
+		uchar_t *raw = (uchar_t *)realloc(sec->raw, cap);
+		if (!raw)
+		{
+			return nullptr;
+		}
+
+		sec->raw = raw;
+		sec->raw_cap = cap;
+	}
+
+	return sec->raw + sec->raw_len;
+}
+
+// one record was written up to end
+void fsimage_section_commit(fsimage_section_t *sec, uchar_t *end)
+{
+	sec->raw_len = end - sec->raw;
+	sec->hdr.record_num++;
+}
+
+// fills in the header, keeps the lz4 copy only if it is smaller
+int fsimage_section_seal(fsimage_section_t *sec, int compress)
+{
+	uchar_t *stored = sec->raw;
+
+	if (sec->raw_len > UINT32_MAX)
+	{
+		return NGX_ERROR;
+	}
+
+	sec->hdr.magic = FSIMAGE_SECTION_MAGIC;
+	sec->hdr.flags &= ~FSIMAGE_F_LZ4;
+	sec->hdr.raw_len = sec->raw_len;
+	sec->hdr.stored_len = sec->raw_len;
+
+	if (compress && sec->raw_len > 0)
+	{
+		sec->zbuf = (uchar_t *)malloc(sec->raw_len);
+		if (!sec->zbuf)
+		{
+			return NGX_ERROR;
+		}
+
+		size_t zlen = dfs_lz4_compress(sec->raw, sec->raw_len,
+			sec->zbuf, sec->raw_len - 1);
+		if (zlen > 0)
+		{
+			sec->hdr.flags |= FSIMAGE_F_LZ4;
+			sec->hdr.stored_len = zlen;
+			stored = sec->zbuf;
+		}
+		else
+		{
+			free(sec->zbuf);
+			sec->zbuf = nullptr;
+		}
+	}
+
+	sec->hdr.crc = dfs_crc32c(0, stored, sec->hdr.stored_len);
+
+	return NGX_OK;
+}
+
+void fsimage_section_free(fsimage_section_t *sec)
+{
+	free(sec->raw);
+	free(sec->zbuf);
+
+	memory_zero(sec, sizeof(fsimage_section_t));
+}
+
+static uint32_t fsimage_header_crc(fsimage_header_t *hdr)
+{
+	return dfs_crc32c(0, hdr, offsetof(fsimage_header_t, crc));
+}
+
+static int fsimage_writev(int fd, struct iovec *iov, int n)
+{
+	while (n > 0)
+	{
+		ssize_t ws = writev(fd, iov, n);
+		if (ws < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return NGX_ERROR;
+		}
+
+		while (n > 0 && (size_t)ws >= iov->iov_len)
+		{
+			ws -= iov->iov_len;
+			iov++;
+			n--;
+		}
+
+		if (n > 0)
+		{
+			iov->iov_base = (uchar_t *)iov->iov_base + ws;
+			iov->iov_len -= ws;
+		}
+	}
+
+	return NGX_OK;
+}
+
+/*
+ * fsimage_write - writes the sealed sections to path.tmp a batch of
+ * sections per syscall, syncs it and renames it over path, so a crash
+ * leaves either the old image or the new one.
+ */
+int fsimage_write(const char *path, fsimage_header_t *hdr,
+	              fsimage_section_t *secs, size_t num)
+{
+	struct iovec iov[FSIMAGE_IOV_MAX];
+	char         tmp[PATH_MAX] = {0};
+	int          n = 0;
+	int          fd = -1;
+
+	string_xxsnprintf((uchar_t *)tmp, sizeof(tmp) - 1, "%s.tmp", path);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0)
+	{
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"open[%s] err", tmp);
+
+		return NGX_ERROR;
+	}
+
+	hdr->magic = FSIMAGE_MAGIC;
+	hdr->version = FSIMAGE_VERSION;
+	hdr->section_num = num;
+	hdr->crc = fsimage_header_crc(hdr);
+
+	iov[n].iov_base = hdr;
+	iov[n++].iov_len = sizeof(fsimage_header_t);
+
+	for (size_t i = 0; i < num; i++)
+	{
+		if (n + 2 > FSIMAGE_IOV_MAX)
+		{
+			if (fsimage_writev(fd, iov, n) != NGX_OK)
+			{
+				goto err;
+			}
+
+			n = 0;
+		}
+
+		iov[n].iov_base = &secs[i].hdr;
+		iov[n++].iov_len = sizeof(fsimage_section_hdr_t);
+		iov[n].iov_base = (secs[i].hdr.flags & FSIMAGE_F_LZ4)
+			? secs[i].zbuf : secs[i].raw;
+		iov[n++].iov_len = secs[i].hdr.stored_len;
+	}
+
+	if (fsimage_writev(fd, iov, n) != NGX_OK || fsync(fd) != 0)
+	{
+		goto err;
+	}
+
+	close(fd);
+
+	if (rename(tmp, path) != 0)
+	{
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"rename %s to %s err", tmp, path);
+
+		unlink(tmp);
+
+		return NGX_ERROR;
+	}
+
+	return NGX_OK;
+
+err:
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+		"write[%s] err", tmp);
+
+	close(fd);
+	unlink(tmp);
+
+	return NGX_ERROR;
+}
+
+/*
+ * fsimage_open - maps a v2 image and indexes its sections.
+ * Returns DFS_DECLINED if path is empty or in the v1 format.
+ */
+int fsimage_open(const char *path, fsimage_t *img)
+{
+	struct stat sb;
+	uchar_t    *p = nullptr;
+	uchar_t    *end = nullptr;
+	uint64_t    first = 0;
+	int         fd = -1;
+
+	memory_zero(img, sizeof(fsimage_t));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return errno == ENOENT ? DFS_DECLINED : NGX_ERROR;
+	}
+
+	if (fstat(fd, &sb) != 0 || sb.st_size < (off_t)sizeof(fsimage_header_t))
+	{
+		close(fd);
+
+		return DFS_DECLINED;
+	}
+
+	img->size = sb.st_size;
+	img->map = (uchar_t *)mmap(nullptr, img->size, PROT_READ, MAP_PRIVATE,
+		fd, 0);
+
+	close(fd);
+
+	if (img->map == MAP_FAILED)
+	{
+		img->map = nullptr;
+
+		return NGX_ERROR;
+	}
+
+	memory_memcpy(&img->hdr, img->map, sizeof(fsimage_header_t));
+
+	if (img->hdr.magic != FSIMAGE_MAGIC)
+	{
+		fsimage_close(img);
+
+		return DFS_DECLINED;
+	}
+
+	if (img->hdr.version != FSIMAGE_VERSION
+		|| img->hdr.crc != fsimage_header_crc(&img->hdr)
+		|| img->hdr.section_num > img->size / sizeof(fsimage_section_hdr_t))
+	{
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"fsimage %s: bad header", path);
+
+		goto err;
+	}
+
+	madvise(img->map, img->size, MADV_WILLNEED);
+
+	img->refs = (fsimage_ref_t *)malloc(
+		(img->hdr.section_num + 1) * sizeof(fsimage_ref_t));
+	if (!img->refs)
+	{
+		goto err;
+	}
+
+	p = img->map + sizeof(fsimage_header_t);
+	end = img->map + img->size;
+
+	for (uint64_t i = 0; i < img->hdr.section_num; i++)
+	{
+		fsimage_ref_t *ref = &img->refs[i];
+
+		if ((size_t)(end - p) < sizeof(fsimage_section_hdr_t))
+		{
+			goto corrupt;
+		}
+
+		memory_memcpy(&ref->hdr, p, sizeof(fsimage_section_hdr_t));
+		p += sizeof(fsimage_section_hdr_t);
+
+		if (ref->hdr.magic != FSIMAGE_SECTION_MAGIC
+			|| ref->hdr.stored_len > (size_t)(end - p))
+		{
+			goto corrupt;
+		}
+
+		ref->data = p;
+		ref->first = first;
+
+		p += ref->hdr.stored_len;
+		first += ref->hdr.record_num;
+	}
+
+	if (first != img->hdr.record_num)
+	{
+		goto corrupt;
+	}
+
+	return NGX_OK;
+
+corrupt:
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+		"fsimage %s: truncated or corrupt section table", path);
+
+err:
+	fsimage_close(img);
+
+	return NGX_ERROR;
+}
+
+/*
+ * fsimage_section_read - checks section i and points *data at its raw
+ * records. *buf is what to free afterwards, nullptr if they were read
+ * in place.
+ */
+int fsimage_section_read(fsimage_t *img, size_t i, uchar_t **data,
+	                     uchar_t **buf)
+{
+	fsimage_ref_t *ref = &img->refs[i];
+
+	*buf = nullptr;
+
+	if (dfs_crc32c(0, ref->data, ref->hdr.stored_len) != ref->hdr.crc)
+	{
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"fsimage section %lu: crc mismatch", i);
+
+		return NGX_ERROR;
+	}
+
+	if (!(ref->hdr.flags & FSIMAGE_F_LZ4))
+	{
+		if (ref->hdr.stored_len != ref->hdr.raw_len)
+		{
+			return NGX_ERROR;
+		}
+
+		*data = ref->data;
+
+		return NGX_OK;
+	}
+
+	*buf = (uchar_t *)malloc(ref->hdr.raw_len + 1);
+	if (!*buf)
+	{
+		return NGX_ERROR;
+	}
+
+	if (dfs_lz4_decompress(ref->data, ref->hdr.stored_len, *buf,
+		ref->hdr.raw_len) != (ssize_t)ref->hdr.raw_len)
+	{
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"fsimage section %lu: bad lz4 data", i);
+
+		free(*buf);
+		*buf = nullptr;
+
+		return NGX_ERROR;
+	}
+
+	*data = *buf;
+
+	return NGX_OK;
+}
+
+void fsimage_close(fsimage_t *img)
+{
+	if (img->map)
+	{
+		munmap(img->map, img->size);
+	}
+
+	free(img->refs);
+
+	memory_zero(img, sizeof(fsimage_t));
+}
+
+static void *fsimage_worker(void *arg)
+{
+	fsimage_pool_t *pool = (fsimage_pool_t *)arg;
+	size_t          i = 0;
+
+	while ((i = __sync_fetch_and_add(&pool->next, 1)) < pool->num)
+	{
+		if (pool->work(pool->arg, i) != NGX_OK)
+		{
+			pool->failed = 1;
+		}
+	}
+
+	return nullptr;
+}
+
+/*
+ * fsimage_parallel - runs work(arg, i) for every i below num on up to
+ * threads threads, the caller being one of them. NGX_ERROR if any
+ * call failed.
+ */
+int fsimage_parallel(int threads, size_t num, fsimage_work_pt work,
+	                 void *arg)
+{
+	pthread_t      tids[FSIMAGE_MAX_THREADS];
+	fsimage_pool_t pool;
+	int            n = 0;
+
+	pool.work = work;
+	pool.arg = arg;
+	pool.num = num;
+	pool.next = 0;
+	pool.failed = 0;
+
+	if (threads > FSIMAGE_MAX_THREADS)
+	{
+		threads = FSIMAGE_MAX_THREADS;
+	}
+
+	if ((size_t)threads > num)
+	{
+		threads = num;
+	}
+
+	for (n = 0; n < threads - 1; n++)
+	{
+		if (pthread_create(&tids[n], nullptr, fsimage_worker, &pool) != 0)
+		{
+			dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno,
+				"fsimage worker create err");
+
+			break;
+		}
+	}
+
+	fsimage_worker(&pool);
+
+	for (int i = 0; i < n; i++)
+	{
+		pthread_join(tids[i], nullptr);
+	}
+
+	return pool.failed ? NGX_ERROR : NGX_OK;
+}
+
@@ -0,0 +1,93 @@
+#ifndef NN_FSIMAGE_H
+#define NN_FSIMAGE_H
+
+#include "dfs_types.h"
+
+#define FSIMAGE_MAGIC         0x32474d4953464e4eULL // "NNFSIMG2"
+#define FSIMAGE_VERSION       2
+#define FSIMAGE_SECTION_MAGIC 0x54434553            // "SECT"
+#define FSIMAGE_F_LZ4         0x1  // section is lz4 compressed
+#define FSIMAGE_F_DELTA       0x2  // image holds changes over base_id
+#define FSIMAGE_F_DEAD        0x4  // section holds removed inos
+#define FSIMAGE_F_GROUPS      0x8  // section holds the paxos group instances
+#define FSIMAGE_DEF_THREADS   4
+#define FSIMAGE_MAX_THREADS   64
+
+/*
+ * fsimage v2: a header, then section_num sections of packed records.
+ * a section is stored raw or lz4 compressed and carries the crc32c of
+ * its stored bytes, so sections are written, checked and decoded
+ * independently of each other. a delta image only has the entries
+ * changed since the image at base_id and the inos removed since. the
+ * last section has the instance applied of every paxos group, the
+ * header instance_id is their sum.
+ */
+typedef struct fsimage_header_s
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint64_t section_num;
+	uint64_t record_num;
+	uint64_t max_ino;
+	uint64_t instance_id;
+	uint64_t base_id; // deltas only
+	uint32_t reserved;
+	uint32_t crc; // of the fields above
+} fsimage_header_t;
+
+typedef struct fsimage_section_hdr_s
+{
+	uint32_t magic;
+	uint32_t flags;
+	uint32_t raw_len;
+	uint32_t stored_len;
+	uint32_t record_num;
+	uint32_t crc;
+} fsimage_section_hdr_t;
+
+// a section being built, raw records until sealed
+typedef struct fsimage_section_s
+{
+	fsimage_section_hdr_t  hdr;
+	uchar_t               *raw;
+	size_t                 raw_len;
+	size_t                 raw_cap;
+	uchar_t               *zbuf;   // compressed copy, if it was smaller
+} fsimage_section_t;
+
+// a section of a mapped image
+typedef struct fsimage_ref_s
+{
+	fsimage_section_hdr_t  hdr;
+	uchar_t               *data;
+	uint64_t               first; // index of its first record
+} fsimage_ref_t;
+
+typedef struct fsimage_s
+{
+	uchar_t          *map;
+	size_t            size;
+	fsimage_header_t  hdr;
+	fsimage_ref_t    *refs;
+} fsimage_t;
+
+typedef int (*fsimage_work_pt)(void *arg, size_t i);
+
+uchar_t *fsimage_section_reserve(fsimage_section_t *sec, size_t need);
+void     fsimage_section_commit(fsimage_section_t *sec, uchar_t *end);
+int      fsimage_section_seal(fsimage_section_t *sec, int compress);
+void     fsimage_section_free(fsimage_section_t *sec);
+int      fsimage_write(const char *path, fsimage_header_t *hdr,
+	fsimage_section_t *secs, size_t num);
+
+int  fsimage_open(const char *path, fsimage_t *img);
+int  fsimage_section_read(fsimage_t *img, size_t i, uchar_t **data,
+	uchar_t **buf);
+void fsimage_close(fsimage_t *img);
+
+int fsimage_parallel(int threads, size_t num, fsimage_work_pt work,
+	void *arg);
+
+#endif
+
@@ -1,4 +1,5 @@
 #include "nn_net_response_handler.h"
+#include "nn_paxos.h"
 
 #define task_data(q, type, link) \
     (type *) ((uchar_t *) q - offsetof(type, link))
@@ -17,6 +18,12 @@ int write_back(task_queue_node_t *node)
 
     task = &node->tk;
     wbt  = (nn_wb_t *)task->opq;
+
+    // an op of an NN_BATCH is answered with the others
+    if (wbt->compound)
+	{
+        return nn_paxos_compound_done(node);
+	}
 	/*
 	*struct nn_wb_s 
 {
@@ -68,6 +75,9 @@ void net_response_handler(void *data)
             //
             write_back_pack_queue(&q, NGX_TRUE);
         }
+
+        // the replies gave credits back
+        nn_conn_resume_paused(th);
     } else
 	{
         tq = &th->tq; //task queue // write back时会写入 tq
@@ -10,14 +10,20 @@ struct nn_wb_s // write back?
 {
     nn_conn_t    *mc;
     dfs_thread_t *thread;
+    void         *compound; // the NN_BATCH an op of it belongs to
 };
 
 typedef struct nn_wb_s nn_wb_t;
 
+#define WB_REQ_DATA_MAX 512 // request data of a task at most
+
+// req holds the request data once the task is decoded, the connection
+// buffer moves on while pipelined tasks are still being served
 typedef struct wb_node_s
 {
     task_queue_node_t qnode;
     nn_wb_t           wbt;
+    uchar_t          *req;
 } wb_node_t;
 
 int  write_back(task_queue_node_t *node);
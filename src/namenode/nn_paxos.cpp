@@ -1,35 +1,137 @@
 #include <string>
+#include <list>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include "nn_paxos.h"
 #include "dfs_task.h"
 #include "FSEditlog.h"
-#include "phxeditlog.pb.h"
 #include "fs_permission.h"
 #include "nn_conf.h"
 #include "nn_task_queue.h"
 #include "nn_thread.h"
+#include "dfs_memory.h"
 #include "nn_net_response_handler.h"
 #include "nn_blk_index.h"
 #include "nn_dn_index.h"
+#include "nn_rpc_server.h"
 
 using namespace phxpaxos;
-using namespace phxeditlog;
 using namespace std;
 
-static FSEditlog *g_editlog = nullptr;
-static uint32_t   g_edit_op_num = 0;
+#define PAXOS_BATCH_BYTES (1024 * 1024)
+#define PAXOS_CKP_TICK    1
+// see ioprio_set(2), best effort class at its lowest level
+#define PAXOS_IOPRIO_WHO_PROCESS 1
+#define PAXOS_IOPRIO_CKP         ((2 << 13) | 7)
+
+// the edits of several tasks that go out as one proposal. the tasks
+// were checked before any of them is applied, so a task that reads a
+// path an earlier one writes closes the batch first
+typedef struct paxos_batch_s
+{
+    string           ops;     // packed edits, see EditlogRecAppend
+    int              op_num;
+    vector<string>   writes;  // paths the edits change, as "/a/b/"
+    vector<task_t *> tasks;   // replied to after the proposal
+    size_t           bytes;
+    int              objects; // fs objects the edits add
+    int              group;
+    string           key;     // picks the paxos group
+    int              busy;    // a proposer has it
+} paxos_batch_t;
+
+// closed batches wait here for a proposer. several are out at once and
+// may be chosen in any order, so a task that touches a path of one of
+// them waits until that one is applied
+typedef struct paxos_pipe_s
+{
+    pthread_mutex_t        lock;
+    pthread_cond_t         cond;    // a batch was queued or answered
+    list<paxos_batch_t *>  batches; // queued or being proposed
+    int                    objects; // fs objects the batches add
+    dfs_thread_t          *proposers;
+    int                    proposer_num;
+    int                    running;
+} paxos_pipe_t;
+
+// one long lived thread takes the checkpoints. it looks every
+// PAXOS_CKP_TICK seconds whether enough edits, log bytes or time went
+// by since the last one, and runs at a lower cpu and io priority than
+// the task threads
+typedef struct paxos_ckp_s
+{
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;
+    pthread_t        tid;
+    int              running;
+    time_t           last;    // when the last checkpoint was done
+    int              cleaner; // the paxos log cleaner runs
+} paxos_ckp_t;
+
+/*
+ * reads on a follower. the master answers reads from its own state: it
+ * holds the master lease and has applied every write it acknowledged.
+ * a follower first has a no-op barrier edit of the read's group chosen
+ * and applied here, then it has applied every write acknowledged before
+ * the read came in. reads that queue up while a barrier is out share the
+ * next one. with PAXOS_READ_STALE a read is answered at once if a
+ * barrier went out at most read_stale_ms ago
+ */
+typedef struct paxos_read_s
+{
+    pthread_mutex_t   lock;
+    pthread_cond_t    cond;
+    dfs_thread_t      reader;
+    int               running;
+    list<task_t *>    tasks;
+    vector<uint64_t>  fresh;   // by group, ms the last barrier went out
+} paxos_read_t;
+
+typedef struct paxos_compound_s paxos_compound_t;
+
+// an op of an NN_BATCH, runs as a task of its own
+typedef struct paxos_sub_s
+{
+    task_queue_node_t  node;
+    nn_wb_t            wbt;
+} paxos_sub_t;
+
+// an NN_BATCH, answered once the last of its ops is
+struct paxos_compound_s
+{
+    task_queue_node_t *parent;
+    paxos_sub_t       *subs;
+    int                num;
+    int                left; // ops not answered yet
+};
+
+static FSEditlog    *g_editlog = nullptr;
+static paxos_pipe_t  g_pipe;
+static paxos_ckp_t   g_ckp;
+static paxos_read_t  g_read;
 
 extern uint64_t g_fs_object_num;
 extern _xvolatile rb_msec_t dfs_current_msec;
 
-static int do_paxos_task(task_t *task);
-static int log_mkdir(task_t *task);
-static int log_rmr(task_t *task);
-static int inc_edit_op_num();
-static void *checkpoint_start(void *arg);
-static int log_create(task_t *task);
-static int log_get_additional_blk(task_t *task);
-static int log_close(task_t *task);
-static int log_rm(task_t *task);
+static int do_paxos_task(task_t *task, paxos_batch_t *batch);
+static int log_mkdir(task_t *task, paxos_batch_t *batch);
+static int log_rmr(task_t *task, paxos_batch_t *batch);
+static int paxos_read_start();
+static void paxos_read_stop();
+static int paxos_ckp_start();
+static void paxos_ckp_stop();
+static void *paxos_ckp_cycle(void *arg);
+static int log_create(task_t *task, paxos_batch_t *batch);
+static int log_get_additional_blk(task_t *task, paxos_batch_t *batch);
+static int log_close(task_t *task, paxos_batch_t *batch);
+static int log_rm(task_t *task, paxos_batch_t *batch);
+static int log_rename(task_t *task, paxos_batch_t *batch);
+static int paxos_compound_run(task_t *task, paxos_batch_t *batch);
+static int paxos_compound_reply(paxos_compound_t *c);
+static void paxos_batch_flush(paxos_batch_t *batch);
+static int paxos_pipe_start();
+static void paxos_pipe_stop();
+static void *paxos_proposer_cycle(void *arg);
 
 FSEditlog* nn_get_paxos_obj(){
     return g_editlog;
@@ -126,11 +228,17 @@ int nn_paxos_worker_init(cycle_t *cycle)
         return NGX_ERROR;
     }
 
+    g_editlog->SetCheckpointSendRate((int)sconf->ckp_send_rate);
+
     return NGX_OK;
 }
 
 int nn_paxos_worker_release(cycle_t *cycle)
 {
+    paxos_read_stop();
+    paxos_ckp_stop();
+    paxos_pipe_stop();
+
     if (nullptr != g_editlog)
     {
         delete g_editlog;
@@ -142,17 +250,382 @@ int nn_paxos_worker_release(cycle_t *cycle)
 
 int nn_paxos_run()
 {
+    if (g_editlog->RunPaxos() != NGX_OK)
+	{
+        return NGX_ERROR;
+	}
+
+    if (paxos_pipe_start() != NGX_OK)
+	{
+        return NGX_ERROR;
+	}
+
+    if (paxos_ckp_start() != NGX_OK)
+	{
+        return NGX_ERROR;
+	}
+
+    return paxos_read_start();
+}
+
+void set_checkpoint_instanceID(const int iGroupIdx, 
+	const uint64_t llInstanceID)
+{
+    g_editlog->setCheckpointInstanceID(iGroupIdx, llInstanceID);
+}
+
+// "/a/b/" for the key of /a/b, "/" if it does not parse
+static void paxos_path_str(uchar_t *key, string & sPath)
+{
+    fi_path_t fp;
+
+    sPath = "/";
+
+    if (fi_path_parse(key, &fp) != NGX_OK)
+	{
+        return;
+	}
+
+    for (int i = 0; i < fp.num; i++)
+	{
+        sPath.append(fp.names[i], fp.lens[i]);
+        sPath += '/';
+	}
+}
+
+// whether the checks of a task on sPath could see an edit of the batch
+static int paxos_batch_conflict(paxos_batch_t *batch, const string & sPath)
+{
+    for (size_t i = 0; i < batch->writes.size(); i++)
+	{
+        const string & w = batch->writes[i];
+
+        if (sPath.compare(0, w.size(), w) == 0)
+		{
+            return NGX_TRUE;
+		}
+	}
+
+    return NGX_FALSE;
+}
+
+// whether a task on sPath and the batch must be chosen in order. either
+// may be applied first, so an edit below sPath counts as well
+static int paxos_pipe_conflict(paxos_batch_t *batch, const string & sPath)
+{
+    for (size_t i = 0; i < batch->writes.size(); i++)
+	{
+        const string & w = batch->writes[i];
+        size_t         n = w.size() < sPath.size() ? w.size() : sPath.size();
+
+        if (w.compare(0, n, sPath, 0, n) == 0)
+		{
+            return NGX_TRUE;
+		}
+	}
+
+    return NGX_FALSE;
+}
+
+// hold the task until no batch out touches its paths
+static void paxos_pipe_wait(const string & sKey, const string & sDst)
+{
+    list<paxos_batch_t *>::iterator it;
+
+    pthread_mutex_lock(&g_pipe.lock);
+
+    for (it = g_pipe.batches.begin(); it != g_pipe.batches.end(); )
+	{
+        if (paxos_pipe_conflict(*it, sKey) 
+			|| (!sDst.empty() && paxos_pipe_conflict(*it, sDst)))
+		{
+            pthread_cond_wait(&g_pipe.cond, &g_pipe.lock);
+            it = g_pipe.batches.begin();
+
+            continue;
+		}
+
+        ++it;
+	}
+
+    pthread_mutex_unlock(&g_pipe.lock);
+}
+
+// fs objects the open batch and the batches out will add
+static int paxos_batch_objects(paxos_batch_t *batch)
+{
+    int objects = 0;
+
+    pthread_mutex_lock(&g_pipe.lock);
+    objects = batch->objects + g_pipe.objects;
+    pthread_mutex_unlock(&g_pipe.lock);
+
+    return objects;
+}
+
+static void paxos_batch_write(paxos_batch_t *batch, uchar_t *key)
+{
+    string sPath;
+
+    paxos_path_str(key, sPath);
+    batch->writes.push_back(sPath);
+}
+
+// an edit that changes key
+static void paxos_batch_op(paxos_batch_t *batch, uchar_t *key, 
+	const editlog_rec_t *rec)
+{
+    if (batch->op_num == 0)
+	{
+        batch->key = (const char *)key;
+	}
+
+    EditlogRecAppend(batch->ops, rec);
+    batch->op_num++;
+    batch->bytes = batch->ops.size();
+
+    paxos_batch_write(batch, key);
+}
+
+// an edit of task->key by task->user, the rest is up to the caller
+static void paxos_rec_init(editlog_rec_t *rec, task_t *task)
+{
+    memset(rec, 0x00, sizeof(editlog_rec_t));
+
+    rec->optype = task->cmd;
+    rec->key = (const char *)task->key;
+    rec->key_len = strnlen((const char *)task->key, KEY_LEN);
+    rec->modification_time = dfs_current_msec;
+}
+
+static void paxos_rec_owner(editlog_rec_t *rec, task_t *task)
+{
+    rec->permission = task->permission;
+    rec->owner = (const char *)task->user;
+    rec->owner_len = strnlen((const char *)task->user, OWNER_LEN);
+    rec->group = (const char *)task->group;
+    rec->group_len = strnlen((const char *)task->group, GROUP_LEN);
+}
+
+// the task is answered once its edits are chosen
+static int paxos_batch_task(paxos_batch_t *batch, task_t *task, 
+	int objects)
+{
+    conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
+
+    batch->tasks.push_back(task);
+    batch->objects += objects;
+
+    if (batch->tasks.size() >= conf->paxos_batch_max 
+		|| batch->bytes >= PAXOS_BATCH_BYTES)
+	{
+        paxos_batch_flush(batch);
+	}
+
+    return NGX_OK;
+}
+
+// hand the batch to the proposers and start a new one. only waits when
+// paxos_inflight batches are already queued behind the ones out
+static void paxos_batch_flush(paxos_batch_t *batch)
+{
+    paxos_batch_t *b = nullptr;
+
+    if (batch->tasks.empty())
+	{
+        return;
+	}
+
+    b = new paxos_batch_t;
+    // a copy, the open batch keeps its buffer for the next edits
+    b->ops = batch->ops;
+    b->op_num = batch->op_num;
+    b->writes.swap(batch->writes);
+    b->tasks.swap(batch->tasks);
+    b->key.swap(batch->key);
+    b->bytes = batch->bytes;
+    b->objects = batch->objects;
+    b->group = batch->group;
+    b->busy = NGX_FALSE;
+
+    batch->ops.clear();
+    batch->op_num = 0;
+    batch->bytes = 0;
+    batch->objects = 0;
+
+    pthread_mutex_lock(&g_pipe.lock);
+
+    while (g_pipe.batches.size() >= 2 * (size_t)g_pipe.proposer_num)
+	{
+        pthread_cond_wait(&g_pipe.cond, &g_pipe.lock);
+	}
+
+    g_pipe.batches.push_back(b);
+    g_pipe.objects += b->objects;
+
+    pthread_cond_broadcast(&g_pipe.cond);
+    pthread_mutex_unlock(&g_pipe.lock);
+}
+
+// propose the edits and answer the tasks in order. the ops of a batch
+// are applied one by one as before, only the consensus round is shared
+static void paxos_batch_propose(paxos_batch_t *batch, dfs_thread_t *me)
+{
+    int ret = NGX_OK;
+
+    if (batch->op_num > 0)
+	{
+        PhxEditlogSMCtx oEditlogSMCtx;
+        oEditlogSMCtx.data = me;
+
+        ret = g_editlog->ProposeBatch(batch->key, batch->ops, batch->op_num,
+			oEditlogSMCtx);
+	}
+
+    for (size_t i = 0; i < batch->tasks.size(); i++)
+	{
+        task_t            *task = batch->tasks[i];
+        task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+        if (ret != NGX_OK)
+		{
+            task->ret = FAIL;
+		}
+
+        write_back(node);
+	}
+}
+
+// proposer thread, proposes the oldest batch nobody has taken. a
+// proposal blocks until it is chosen and applied here, paxos_inflight
+// of them overlap their rounds
+static void *paxos_proposer_cycle(void *arg)
+{
+    dfs_thread_t                    *me = (dfs_thread_t *)arg;
+    paxos_batch_t                   *batch = nullptr;
+    list<paxos_batch_t *>::iterator  it;
+
+    // write_back picks a reply queue by the local thread
+    thread_bind_key(me);
+
+    pthread_mutex_lock(&g_pipe.lock);
+
+    for ( ;; )
+	{
+        batch = nullptr;
+
+        for (it = g_pipe.batches.begin(); it != g_pipe.batches.end(); ++it)
+		{
+            if (!(*it)->busy)
+			{
+                batch = *it;
+
+                break;
+			}
+		}
+
+        if (!batch)
+		{
+            // the queue is drained before a stop
+            if (!g_pipe.running)
+			{
+                break;
+			}
+
+            pthread_cond_wait(&g_pipe.cond, &g_pipe.lock);
+
+            continue;
+		}
+
+        batch->busy = NGX_TRUE;
+
+        pthread_mutex_unlock(&g_pipe.lock);
+
+        paxos_batch_propose(batch, me);
+
+        pthread_mutex_lock(&g_pipe.lock);
 
-    return g_editlog->RunPaxos();
+        g_pipe.batches.remove(batch);
+        g_pipe.objects -= batch->objects;
+
+        pthread_cond_broadcast(&g_pipe.cond);
+
+        delete batch;
+	}
+
+    pthread_mutex_unlock(&g_pipe.lock);
+
+    return nullptr;
 }
 
-void set_checkpoint_instanceID(const uint64_t llInstanceID)
+static int paxos_pipe_start()
 {
-    g_editlog->setCheckpointInstanceID(llInstanceID);
+    conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
+    int            i = 0;
+
+    pthread_mutex_init(&g_pipe.lock, nullptr);
+    pthread_cond_init(&g_pipe.cond, nullptr);
+
+    g_pipe.objects = 0;
+    g_pipe.proposer_num = (int)conf->paxos_inflight;
+    g_pipe.running = NGX_TRUE;
+
+    g_pipe.proposers = (dfs_thread_t *)memory_calloc(
+		g_pipe.proposer_num * sizeof(dfs_thread_t));
+    if (!g_pipe.proposers)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"memory_calloc err");
+
+        return NGX_ERROR;
+	}
+
+    for (i = 0; i < g_pipe.proposer_num; i++)
+	{
+        g_pipe.proposers[i].type = THREAD_PAXOS;
+        g_pipe.proposers[i].run_func = paxos_proposer_cycle;
+        g_pipe.proposers[i].running = NGX_TRUE;
+
+        if (thread_create(&g_pipe.proposers[i]) != NGX_OK)
+		{
+            g_pipe.proposer_num = i;
+
+            return NGX_ERROR;
+		}
+	}
+
+    return NGX_OK;
+}
+
+// the proposers finish what is queued and exit
+static void paxos_pipe_stop()
+{
+    int num = g_pipe.proposer_num;
+
+    if (!g_pipe.proposers)
+	{
+        return;
+	}
+
+    pthread_mutex_lock(&g_pipe.lock);
+    g_pipe.running = NGX_FALSE;
+    pthread_cond_broadcast(&g_pipe.cond);
+    pthread_mutex_unlock(&g_pipe.lock);
+
+    for (int i = 0; i < num; i++)
+	{
+        pthread_join(g_pipe.proposers[i].thread_id, nullptr);
+	}
+
+    memory_free(g_pipe.proposers, num * sizeof(dfs_thread_t));
+    g_pipe.proposers = nullptr;
+    g_pipe.proposer_num = 0;
 }
 
 // paxos event call back
-// pop task from task queue and do_paxos_task()
+// pop task from task queue and do_paxos_task(). whatever queued up
+// since the last wake up goes into the next batch, so batches grow
+// with the load and a lone task is handed to a proposer at once
 void do_paxos_task_handler(void *q) // param task queue
 {
     task_queue_node_t *tnode = nullptr;
@@ -161,9 +634,20 @@ void do_paxos_task_handler(void *q) // param task queue
 	queue_t            qhead;
 	task_queue_t      *tq = nullptr;
     dfs_thread_t      *thread = nullptr;
+	paxos_batch_t      batch;
+
+    // the edit buffer outlives the batch, encoding reuses its capacity
+    static thread_local string ops;
 
 	tq = (task_queue_t *)q; // task que
     thread = get_local_thread(); // THREAD_TASK
+
+    batch.ops.swap(ops);
+    batch.op_num = 0;
+    batch.bytes = 0;
+    batch.objects = 0;
+    batch.group = -1;
+    batch.busy = NGX_FALSE;
 	
     queue_init(&qhead);
 	pop_all(tq, &qhead);
@@ -177,25 +661,74 @@ void do_paxos_task_handler(void *q) // param task queue
 		
         queue_remove(cur);
 		
-        do_paxos_task(t);
+        do_paxos_task(t, &batch);
 		
 		cur = queue_head(&qhead);
 	}
+
+    paxos_batch_flush(&batch);
+
+    batch.ops.clear();
+    batch.ops.swap(ops);
 }
 
 //paxos thread
-static int do_paxos_task(task_t *task)
+static int do_paxos_task(task_t *task, paxos_batch_t *batch)
 {
-    int optype = task->cmd;
+    int     optype = task->cmd;
+    int     group = g_editlog->GetGroupIdx((const char *)task->key);
+    int     dst_group = group;
+    uchar_t dst_key[KEY_LEN] = "";
+    string  sKey;
+    string  sDst;
+
+    if (optype == NN_BATCH)
+	{
+        return paxos_compound_run(task, batch);
+	}
+
+    if (optype == NN_RENAME && task->data && task->data_len > 0 
+		&& task->data_len < KEY_LEN)
+	{
+        memcpy(dst_key, task->data, task->data_len);
+        paxos_path_str(dst_key, sDst);
+        dst_group = g_editlog->GetGroupIdx((const char *)dst_key);
+	}
+
+    paxos_path_str((uchar_t *)task->key, sKey);
+
+    // replicas apply the groups in any interleaving, so an edit has to
+    // stay in the subtree of one group: no rename between groups, no
+    // rmr of the root
+    if (dst_group != group 
+		|| (optype == NN_RMR && sKey == "/" && g_editlog->GetGroupCount() > 1))
+	{
+        task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+        task->ret = CROSS_GROUP;
+
+        return write_back(node);
+	}
+
+    if (!batch->tasks.empty() && (group != batch->group 
+		|| paxos_batch_conflict(batch, sKey)
+		|| (!sDst.empty() && paxos_batch_conflict(batch, sDst))))
+	{
+        paxos_batch_flush(batch);
+	}
+
+    paxos_pipe_wait(sKey, sDst);
+
+    batch->group = group;
 
 	switch (optype)
     {
     case NN_MKDIR:
-		log_mkdir(task);
+		log_mkdir(task, batch);
 		break;
 
 	case NN_RMR:
-		log_rmr(task);
+		log_rmr(task, batch);
 		break;
 		
 	case NN_GET_FILE_INFO:
@@ -203,23 +736,27 @@ static int do_paxos_task(task_t *task)
 
 	// cli put file
 	case NN_CREATE:
-		log_create(task);
+		log_create(task, batch);
 		break;
 
 	case NN_GET_ADDITIONAL_BLK:
-		log_get_additional_blk(task);
+		log_get_additional_blk(task, batch);
 		break;
 
 	case NN_CLOSE:
-		log_close(task);
+		log_close(task, batch);
 		break;
 
 	case NN_RM:
-		log_rm(task);
+		log_rm(task, batch);
 		break;
 
 	case NN_OPEN:
 		break;
+
+	case NN_RENAME:
+		log_rename(task, batch);
+		break;
 		
 	default:
 		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
@@ -231,19 +768,273 @@ static int do_paxos_task(task_t *task)
     return NGX_OK;
 }
 
+// the request data of a batch is its own copy unless it fit in the node
+static void paxos_compound_release(task_t *task)
+{
+    wb_node_t *wb = (wb_node_t *)queue_data(task, task_queue_node_t, tk);
+
+    if (task->data && task->data != wb->req)
+	{
+        free(task->data);
+	}
+
+    task->data = nullptr;
+    task->data_len = 0;
+}
+
+// the request data an op needs, -1 if it can not be batched
+static int paxos_compound_op(int cmd)
+{
+    switch (cmd)
+    {
+    case NN_MKDIR:
+    case NN_RMR:
+    case NN_RM:
+        return 0;
+
+    case NN_CREATE:
+        return sizeof(create_blk_info_t);
+
+    case NN_CLOSE:
+        return sizeof(uint64_t);
+
+    default:
+        return -1;
+    }
+}
+
+// checks the ops of a batch request, their number or -1
+static int paxos_compound_check(task_t *task)
+{
+    uchar_t     *p = (uchar_t *)task->data;
+    uchar_t     *end = p + task->data_len;
+    batch_req_t  req;
+    batch_op_t   op;
+
+    if (!p || task->data_len < (int)sizeof(batch_req_t))
+	{
+        return -1;
+	}
+
+    memcpy(&req, p, sizeof(batch_req_t));
+    p += sizeof(batch_req_t);
+
+    if (req.num > BATCH_MAX_OPS)
+	{
+        return -1;
+	}
+
+    for (uint32_t i = 0; i < req.num; i++)
+	{
+        if ((size_t)(end - p) < sizeof(batch_op_t))
+		{
+            return -1;
+		}
+
+        memcpy(&op, p, sizeof(batch_op_t));
+        p += sizeof(batch_op_t);
+
+        int need = paxos_compound_op(op.cmd);
+
+        if (need < 0 || op.data_len < (uint32_t)need || op.key_len >= KEY_LEN
+			|| (size_t)(end - p) < (size_t)op.key_len + op.data_len)
+		{
+            return -1;
+		}
+
+        p += op.key_len + op.data_len;
+	}
+
+    return (int)req.num;
+}
+
+// each op becomes a task that goes down the paxos path like any other,
+// the edits of a run of them are proposed together
+static int paxos_compound_run(task_t *task, paxos_batch_t *batch)
+{
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+    nn_wb_t           *wbt = (nn_wb_t *)task->opq;
+    paxos_compound_t  *c = nullptr;
+    uchar_t           *p = nullptr;
+    batch_op_t         op;
+    int                num = 0;
+
+    num = paxos_compound_check(task);
+    if (num < 0)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0, 
+			"bad batch request, data_len: %d", task->data_len);
+
+        paxos_compound_release(task);
+        task->ret = FAIL;
+
+        return write_back(node);
+	}
+
+    c = (paxos_compound_t *)calloc(1, sizeof(paxos_compound_t));
+    if (c && num > 0)
+	{
+        c->subs = (paxos_sub_t *)calloc(num, sizeof(paxos_sub_t));
+	}
+
+    if (!c || (num > 0 && !c->subs))
+	{
+        free(c);
+
+        paxos_compound_release(task);
+        task->ret = FAIL;
+
+        return write_back(node);
+	}
+
+    c->parent = node;
+    c->num = num;
+    c->left = num;
+
+    p = (uchar_t *)task->data + sizeof(batch_req_t);
+
+    for (int i = 0; i < num; i++)
+	{
+        paxos_sub_t *sub = &c->subs[i];
+        task_t      *t = &sub->node.tk;
+
+        memcpy(&op, p, sizeof(batch_op_t));
+        p += sizeof(batch_op_t);
+
+        queue_init(&sub->node.qe);
+
+        t->cmd = (cmd_t)op.cmd;
+        t->permission = op.permission;
+        memcpy(t->key, p, op.key_len);
+        memcpy(t->user, task->user, OWNER_LEN);
+        memcpy(t->group, task->group, GROUP_LEN);
+        p += op.key_len;
+
+        t->data = op.data_len > 0 ? p : nullptr;
+        t->data_len = op.data_len;
+        p += op.data_len;
+
+        sub->wbt.mc = wbt->mc;
+        sub->wbt.thread = wbt->thread;
+        sub->wbt.compound = c;
+        t->opq = &sub->wbt;
+	}
+
+    if (num == 0)
+	{
+        return paxos_compound_reply(c);
+	}
+
+    // c is gone once the last op is answered, so num is used from here
+    for (int i = 0; i < num; i++)
+	{
+        do_paxos_task(&c->subs[i].node.tk, batch);
+	}
+
+    return NGX_OK;
+}
+
+// a task of an NN_BATCH was answered, the last one answers the batch
+int nn_paxos_compound_done(task_queue_node_t *node)
+{
+    nn_wb_t          *wbt = (nn_wb_t *)node->tk.opq;
+    paxos_compound_t *c = (paxos_compound_t *)wbt->compound;
+
+    if (__sync_sub_and_fetch(&c->left, 1) > 0)
+	{
+        return NGX_OK;
+	}
+
+    return paxos_compound_reply(c);
+}
+
+// the reply data a handler allocated, not request data it left behind
+static int paxos_compound_owned(task_t *t, task_t *task)
+{
+    uchar_t *d = (uchar_t *)t->data;
+    uchar_t *req = (uchar_t *)task->data;
+
+    return d && t->data_len > 0 
+		&& (d < req || d >= req + task->data_len);
+}
+
+// answers the batch with what each of its ops got, in order
+static int paxos_compound_reply(paxos_compound_t *c)
+{
+    task_queue_node_t *parent = c->parent;
+    task_t            *task = &parent->tk;
+    uchar_t           *data = nullptr;
+    uchar_t           *p = nullptr;
+    size_t             size = sizeof(batch_resp_t);
+    batch_resp_t       resp;
+    batch_res_t        res;
+
+    for (int i = 0; i < c->num; i++)
+	{
+        task_t *t = &c->subs[i].node.tk;
+
+        size += sizeof(batch_res_t);
+        size += paxos_compound_owned(t, task) ? t->data_len : 0;
+	}
+
+    data = (uchar_t *)malloc(size);
+    p = data;
+
+    if (data)
+	{
+        resp.num = c->num;
+        memcpy(p, &resp, sizeof(batch_resp_t));
+        p += sizeof(batch_resp_t);
+	}
+
+    for (int i = 0; i < c->num; i++)
+	{
+        task_t *t = &c->subs[i].node.tk;
+        int     own = paxos_compound_owned(t, task);
+
+        if (data)
+		{
+            res.ret = t->ret;
+            res.master_nodeid = t->master_nodeid;
+            res.data_len = own ? t->data_len : 0;
+
+            memcpy(p, &res, sizeof(batch_res_t));
+            p += sizeof(batch_res_t);
+
+            if (own)
+			{
+                memcpy(p, t->data, t->data_len);
+                p += t->data_len;
+			}
+		}
+
+        if (own)
+		{
+            free(t->data);
+		}
+	}
+
+    paxos_compound_release(task);
+
+    task->ret = data ? SUCC : FAIL;
+    task->data = data;
+    task->data_len = data ? (int)size : 0;
+
+    free(c->subs);
+    free(c);
+
+    return write_back(parent);
+}
+
+// num is the number of resolved ancestors in finodes
 int check_traverse(uchar_t *path, task_t *task, 
-	fi_inode_t *finodes[], int num)
+	fi_inode_t finodes[], int num)
 {
     uchar_t err[1024] = "";
 
 	for (int i = 0; i < num; i++) 
 	{
-	    if (nullptr == finodes[i])
-		{
-            break;
-		}
-		
-		if (check_permission(task, finodes[i], EXECUTE, err) != NGX_OK)
+		if (check_permission(task, &finodes[i], EXECUTE, err) != NGX_OK)
 		{
 		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
 				"check_permission err: %s, path: %s", err, path);
@@ -273,11 +1064,15 @@ int check_ancestor_access(uchar_t *path, task_t *task,
 }
 
 //
-static int log_mkdir(task_t *task)
+static int log_mkdir(task_t *task, paxos_batch_t *batch)
 {
     int            expect_mkdir_num = 0;
 	int            parent_index = 0;
-	fi_inode_t    *finodes[PATH_LEN]={};
+	int            found = 0;
+	fi_path_t      fp;
+	uint64_t       inos[FI_PATH_DEPTH + 1];
+	fi_inode_t     finodes[FI_PATH_DEPTH + 1];
+	uchar_t        key[KEY_LEN];
 
 	conf_server_t *sconf = (conf_server_t *)dfs_cycle->sconf;
 	
@@ -287,239 +1082,535 @@ static int log_mkdir(task_t *task)
 
     if (!g_editlog->IsIMMaster(task->key)) // 不是master 节点 就重定向到master节点
 	{
-        task->ret = MASTER_REDIRECT;
-		task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
-        printf("master node id:%d\n ",task->master_nodeid);
+        task->ret = MASTER_REDIRECT;
+		task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
+        printf("master node id:%d\n ",task->master_nodeid);
+
+		return write_back(node);
+	}
+
+	// 如果是master节点
+	if (fi_path_parse((uchar_t *)task->key, &fp) != NGX_OK) 
+	{
+		task->ret = KEY_NOTEXIST;
+
+		return write_back(node);
+	}
+
+	// 找到哪一级目录不存在, level i of fp is finodes[i]
+	found = fi_path_resolve(&fp, fp.num + 1, inos, finodes);
+	if (found == fp.num + 1) 
+	{
+		task->ret = KEY_EXIST;
+
+		return write_back(node);
+	}
+
+	// 不存在就创建
+	uchar_t path[PATH_LEN] = "";
+	get_store_path((uchar_t *)task->key, path);
+
+	parent_index = found - 1;
+
+	if (0 == fp.num)
+	{
+	    goto do_paxos;
+	}
+
+	if (parent_index >= 0 && finodes[parent_index].is_directory == NGX_FALSE)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+			"Parent path is not a directory: %s", path);
+
+		task->ret = NOT_DIRECTORY;
+
+		return write_back(node);
+	}
+	// authentic check permission
+    if (!is_super(task->user, &dfs_cycle->admin))
+    {
+        if (parent_index < 0) // PERMISSION_DENY
+		{
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+				"mkdir %s err, user: %s, group: %s", 
+				path, task->user, task->group);
+
+			task->ret = PERMISSION_DENY;
+
+			return write_back(node);
+		}
+		
+        if (check_traverse(path, task, finodes, parent_index + 1) != NGX_OK)
+	    {
+            task->ret = PERMISSION_DENY;
+
+			return write_back(node);
+	    }
+
+		if (check_ancestor_access(path, task, WRITE, &finodes[parent_index]) 
+			!= NGX_OK)
+	    {
+            task->ret = PERMISSION_DENY;
+
+			return write_back(node);
+	    }
+    }
+
+	expect_mkdir_num = fp.num - parent_index;
+
+    // 是否超过了最大目录数
+	if (is_FsObjectExceed(expect_mkdir_num + paxos_batch_objects(batch)))
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+			"fs object exceed, current num: %ld, max num: %ld, path: %s", 
+			g_fs_object_num, sconf->index_num, path);
+		
+        task->ret = FSOBJECT_EXCEED;
+
+		return write_back(node);
+	}
+
+do_paxos:
+	editlog_rec_t rec;
+	paxos_rec_init(&rec, task);
+	paxos_rec_owner(&rec, task);
+
+	// only the missing levels, encoded one at a time
+	for (int i = found; i <= fp.num; i++) 
+	{
+		fi_path_key(&fp, i, key);
+
+		rec.key = (const char *)key;
+		rec.key_len = strnlen((const char *)key, KEY_LEN);
+        // 写入
+	    paxos_batch_op(batch, key, &rec);
+	}
+
+	task->ret = SUCC;
+
+	return paxos_batch_task(batch, task, expect_mkdir_num);
+}
+
+static int log_rmr(task_t *task, paxos_batch_t *batch)
+{
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+	if (!g_editlog->IsIMMaster(task->key)) 
+	{
+        task->ret = MASTER_REDIRECT;
+		task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
+
+		return write_back(node);
+	}
+
+	fi_inode_t finode;
+	if (get_store_stat((uchar_t *)task->key, &finode, nullptr) != NGX_OK) 
+	{
+		task->ret = KEY_NOTEXIST;
+
+		return write_back(node);
+	}
+	else if (!finode.is_directory)
+	{
+        task->ret = NOT_DIRECTORY;
+
+		return write_back(node);
+	}
+
+	uchar_t path[PATH_LEN] = "";
+	get_store_path((uchar_t *)task->key, path);
+	
+    if (!is_super(task->user, &dfs_cycle->admin))
+    {
+		if (check_ancestor_access(path, task, WRITE, &finode) != NGX_OK)
+	    {
+            task->ret = PERMISSION_DENY;
+
+			return write_back(node);
+	    }
+    }
+	
+	editlog_rec_t rec;
+	paxos_rec_init(&rec, task);
+
+	paxos_batch_op(batch, (uchar_t *)task->key, &rec);
+
+	task->ret = SUCC;
+
+	return paxos_batch_task(batch, task, 0);
+}
+
+static uint64_t paxos_now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// the groups a read looks at, ls of the root lists the top level
+// directories of all of them
+static void paxos_read_groups(task_t *task, int *first, int *last)
+{
+    fi_path_t fp;
+
+    if (fi_path_parse((uchar_t *)task->key, &fp) == NGX_OK && fp.num == 0)
+	{
+        *first = 0;
+        *last = g_editlog->GetGroupCount() - 1;
+
+        return;
+	}
+
+    *first = g_editlog->GetGroupIdx((const char *)task->key);
+    *last = *first;
+}
+
+// NGX_OK if the read was queued behind a barrier, DFS_DECLINED if it
+// can be answered now
+int nn_paxos_read(task_t *task)
+{
+    conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
+    uint64_t       now = paxos_now_ms();
+    int            first = 0;
+    int            last = 0;
+    int            g = 0;
+
+    if (conf->read_mode == PAXOS_READ_LOCAL || !g_read.running)
+	{
+        return DFS_DECLINED;
+	}
+
+    paxos_read_groups(task, &first, &last);
+
+    pthread_mutex_lock(&g_read.lock);
+
+    for (g = first; g <= last; g++)
+	{
+        if (g_editlog->IsIMMaster(g))
+		{
+            continue;
+		}
 
-		return write_back(node);
+        if (conf->read_mode == PAXOS_READ_STALE
+            && now - g_read.fresh[g] <= conf->read_stale_ms)
+		{
+            continue;
+		}
+
+        break;
 	}
 
-	// 如果是master节点
-	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
-	if (fi) 
+    if (g > last || !g_read.running)
 	{
-		task->ret = KEY_EXIST;
+        pthread_mutex_unlock(&g_read.lock);
 
-		return write_back(node);
+        return DFS_DECLINED;
 	}
 
-	// 不存在就创建
-	uchar_t path[PATH_LEN] = "";
-	get_store_path((uchar_t *)task->key, path);
-
-	uchar_t names[PATH_LEN][PATH_LEN];
-    int names_sz = get_path_names(path, names); // 按照 "/" 分割
+    g_read.tasks.push_back(task);
 
-	uchar_t keys[PATH_LEN][PATH_LEN];
-    get_path_keys(names, names_sz, keys); // encode 分成每一层/a/b/c /a /a/b /a/b/c
+    pthread_cond_signal(&g_read.cond);
+    pthread_mutex_unlock(&g_read.lock);
 
-	if (0 == string_strncmp("/", path, string_strlen(path)))
-	{
-	    goto do_paxos;
-	}
+    return NGX_OK;
+}
 
-	// init finodes?
+static int paxos_read_barrier(int group)
+{
+    PhxEditlogSMCtx oEditlogSMCtx;
+    editlog_rec_t   rec;
+    string          sOps;
+    string          sPaxosValue;
+    uint64_t        start = paxos_now_ms();
 
+    memset(&rec, 0x00, sizeof(editlog_rec_t));
+    rec.optype = NN_READ_BARRIER;
 
-	// 找到哪一级目录不存在
-	parent_index = get_path_inodes(keys, names_sz, finodes);
+    EditlogRecAppend(sOps, &rec);
+    EditlogBatchEncode(sOps, 1, sPaxosValue);
 
-	if (parent_index > 0 && finodes[parent_index]->is_directory == NGX_FALSE)
+    if (g_editlog->Propose(group, sPaxosValue, oEditlogSMCtx) != NGX_OK)
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
-			"Parent path is not a directory: %s", path);
+        return NGX_ERROR;
+	}
 
-		task->ret = NOT_DIRECTORY;
+    pthread_mutex_lock(&g_read.lock);
 
-		return write_back(node);
+    if (g_read.fresh[group] < start)
+	{
+        g_read.fresh[group] = start;
 	}
-	// authentic check permission
-    if (!is_super(task->user, &dfs_cycle->admin))
-    {
-        if (parent_index < 0) // PERMISSION_DENY
-		{
-            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
-				"mkdir %s err, user: %s, group: %s", 
-				path, task->user, task->group);
 
-			task->ret = PERMISSION_DENY;
+    pthread_mutex_unlock(&g_read.lock);
 
-			return write_back(node);
-		}
-		
-        if (check_traverse(path, task, finodes, names_sz) != NGX_OK)
-	    {
-            task->ret = PERMISSION_DENY;
+    return NGX_OK;
+}
 
-			return write_back(node);
-	    }
+static void *paxos_read_cycle(void *arg)
+{
+    dfs_thread_t             *me = (dfs_thread_t *)arg;
+    list<task_t *>            tasks;
+    list<task_t *>::iterator  it;
+    vector<int>               want;
+    int                       first = 0;
+    int                       last = 0;
 
-		if (check_ancestor_access(path, task, WRITE, finodes[parent_index]) 
-			!= NGX_OK)
-	    {
-            task->ret = PERMISSION_DENY;
+    thread_bind_key(me);
 
-			return write_back(node);
-	    }
-    }
+    want.resize(g_editlog->GetGroupCount());
 
-	expect_mkdir_num = names_sz - parent_index - 1;
+    pthread_mutex_lock(&g_read.lock);
 
-    // 是否超过了最大目录数
-	if (is_FsObjectExceed(expect_mkdir_num))
+    for ( ;; )
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
-			"fs object exceed, current num: %ld, max num: %ld, path: %s", 
-			g_fs_object_num, sconf->index_num, path);
-		
-        task->ret = FSOBJECT_EXCEED;
+        while (g_read.running && g_read.tasks.empty())
+		{
+            pthread_cond_wait(&g_read.cond, &g_read.lock);
+		}
 
-		return write_back(node);
-	}
+        if (g_read.tasks.empty())
+		{
+            break;
+		}
 
-do_paxos:
-	string sPaxosValue;
-	PhxEditlogSMCtx oEditlogSMCtx;
-	string sKey;
-	LogOperator lopr; // protobuf
-	lopr.set_optype(task->cmd);
-	lopr.mutable_mkr()->set_permission(task->permission); // mutable 若该对象存在，则直接返回该对象，若不存在则新new 一个
-	lopr.mutable_mkr()->set_owner(task->user);
-	lopr.mutable_mkr()->set_group(task->group);
-	lopr.mutable_mkr()->set_modification_time(dfs_current_msec);
-
-	for (int i = 0; i < names_sz; i++) 
-	{
-	    if (1 == names_sz) 
+        tasks.swap(g_read.tasks);
+
+        pthread_mutex_unlock(&g_read.lock);
+
+        want.assign(want.size(), NGX_FALSE);
+
+        for (it = tasks.begin(); it != tasks.end(); ++it)
 		{
-			// create "/" dir only
-			sKey = string((const char *)task->key);
+            paxos_read_groups(*it, &first, &last);
+
+            for (int g = first; g <= last; g++)
+			{
+                want[g] = NGX_TRUE;
+			}
 		}
-		else if (parent_index < 0)  // 整个目录都不在
+
+        // want ends up NGX_ERROR for a group whose barrier failed
+        for (size_t g = 0; g < want.size(); g++)
 		{
-            // create "/home/..." dir at one time
-            sKey = string((const char *)keys[i]);
+            if (want[g] && !g_editlog->IsIMMaster((int)g)
+                && paxos_read_barrier((int)g) != NGX_OK)
+			{
+                want[g] = NGX_ERROR;
+			}
 		}
-		else
+
+        for (it = tasks.begin(); it != tasks.end(); ++it)
 		{
-		    // parent path is exist
-		    if (nullptr != finodes[i]
-				&& (0 == string_strncmp(finodes[i]->key, 
-				keys[i], string_strlen(keys[i])))) 
+            int failed = NGX_FALSE;
+
+            paxos_read_groups(*it, &first, &last);
+
+            for (int g = first; g <= last; g++)
+			{
+                failed |= want[g] == NGX_ERROR;
+			}
+
+            if (failed)
 			{
-			    continue;
+                (*it)->ret = NO_MASTER;
+                write_back_task(*it);
+
+                continue;
 			}
 
-			sKey = string((const char *)keys[i]);
+            nn_rpc_read_run(*it);
 		}
 
-		lopr.mutable_mkr()->set_key(sKey);
-	    lopr.SerializeToString(&sPaxosValue);
-        // 写入
-	    g_editlog->Propose(sKey, sPaxosValue, oEditlogSMCtx);
+        tasks.clear();
+
+        pthread_mutex_lock(&g_read.lock);
 	}
 
-	task->ret = SUCC;
+    pthread_mutex_unlock(&g_read.lock);
 
-	inc_edit_op_num();
-	
-	return write_back(node);
+    return nullptr;
 }
 
-static int log_rmr(task_t *task)
+static int paxos_read_start()
 {
-    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+    pthread_mutex_init(&g_read.lock, nullptr);
+    pthread_cond_init(&g_read.cond, nullptr);
 
-	if (!g_editlog->IsIMMaster(task->key)) 
-	{
-        task->ret = MASTER_REDIRECT;
-		task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
+    g_read.fresh.assign(g_editlog->GetGroupCount(), 0);
+    g_read.running = NGX_TRUE;
 
-		return write_back(node);
-	}
+    g_read.reader.type = THREAD_PAXOS;
+    g_read.reader.run_func = paxos_read_cycle;
+    g_read.reader.running = NGX_TRUE;
 
-	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
-	if (!fi) 
+    if (thread_create(&g_read.reader) != NGX_OK)
 	{
-		task->ret = KEY_NOTEXIST;
+        g_read.running = NGX_FALSE;
 
-		return write_back(node);
+        return NGX_ERROR;
 	}
-	else if (!fi->fin.is_directory)
-	{
-        task->ret = NOT_DIRECTORY;
 
-		return write_back(node);
+    return NGX_OK;
+}
+
+// the reads still queued are answered before the reader exits
+static void paxos_read_stop()
+{
+    if (!g_read.running)
+	{
+        return;
 	}
 
-	uchar_t path[PATH_LEN] = "";
-	get_store_path((uchar_t *)task->key, path);
+    pthread_mutex_lock(&g_read.lock);
+    g_read.running = NGX_FALSE;
+    pthread_cond_broadcast(&g_read.cond);
+    pthread_mutex_unlock(&g_read.lock);
 
-	fi_inode_t finode = fi->fin;
-	
-    if (!is_super(task->user, &dfs_cycle->admin))
-    {
-		if (check_ancestor_access(path, task, WRITE, &finode) != NGX_OK)
-	    {
-            task->ret = PERMISSION_DENY;
+    pthread_join(g_read.reader.thread_id, nullptr);
+}
 
-			return write_back(node);
-	    }
-    }
-	
-    string sPaxosValue;
-	PhxEditlogSMCtx oEditlogSMCtx;
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_rmr()->set_key((const char *)task->key);
-	lopr.mutable_rmr()->set_modification_time(dfs_current_msec);
-	lopr.SerializeToString(&sPaxosValue);
+// whether a checkpoint is due: checkpoint_num edits applied, 
+// checkpoint_log_mb of them, or checkpoint_interval seconds with any
+static int paxos_ckp_due(time_t now)
+{
+    conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
+    uint64_t       edits = 0;
+    uint64_t       bytes = 0;
 
-	g_editlog->Propose((const char *)task->key, sPaxosValue, oEditlogSMCtx);
+    fi_ckp_lag(&edits, &bytes);
 
-	task->ret = SUCC;
+    if (edits == 0)
+	{
+        return NGX_FALSE;
+	}
 
-	inc_edit_op_num();
-	
-	return write_back(node);
+    return (conf->checkpoint_num > 0 && edits >= conf->checkpoint_num)
+        || (conf->checkpoint_log_mb > 0 
+            && bytes >= ((uint64_t)conf->checkpoint_log_mb << 20))
+        || (conf->checkpoint_interval > 0 
+            && now - g_ckp.last >= (time_t)conf->checkpoint_interval);
 }
 
-// inc g_edit_op_num
-static int inc_edit_op_num()
+// the log before a durable image is only needed by a lagging node,
+// which is sent the image instead, see PhxEditlogSM
+static void paxos_ckp_truncate()
 {
     conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
-	
-    g_edit_op_num++;
-	if (g_edit_op_num == conf->checkpoint_num) // 操作数达到了 checkpoint_num
+
+    if (g_ckp.cleaner)
 	{
-	    pthread_t pid;
-		
-	    if (pthread_create(&pid, nullptr, &checkpoint_start, nullptr) != NGX_OK)
+        return;
+	}
+
+    g_editlog->TruncateLog(conf->checkpoint_hold_log);
+    g_ckp.cleaner = NGX_TRUE;
+}
+
+static void *paxos_ckp_cycle(void *arg)
+{
+    conf_server_t   *conf = (conf_server_t *)dfs_cycle->sconf;
+    struct timespec  ts;
+
+    // the fsimage threads of a checkpoint inherit both
+    if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), 
+        (int)conf->checkpoint_nice) != 0)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno, 
+			"checkpoint nice %u err", conf->checkpoint_nice);
+	}
+
+    if (syscall(SYS_ioprio_set, PAXOS_IOPRIO_WHO_PROCESS, 0, 
+        PAXOS_IOPRIO_CKP) != 0)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno, 
+			"checkpoint ioprio err");
+	}
+
+    pthread_mutex_lock(&g_ckp.lock);
+
+    while (g_ckp.running)
+	{
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += PAXOS_CKP_TICK;
+
+        pthread_cond_timedwait(&g_ckp.cond, &g_ckp.lock, &ts);
+
+        if (!g_ckp.running || !paxos_ckp_due(time(nullptr)))
+		{
+            continue;
+		}
+
+        pthread_mutex_unlock(&g_ckp.lock);
+
+        // busy while the checkpoint is sent to a lagging node
+        int rc = do_checkpoint();
+
+        pthread_mutex_lock(&g_ckp.lock);
+
+        // a failed one is not retried at once either
+        if (rc != DFS_DECLINED)
 		{
-		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno, 
-				"create checkpoint thread failed");
+            g_ckp.last = time(nullptr);
+		}
 
-			//return NGX_ERROR;
+        if (rc == NGX_OK)
+		{
+            paxos_ckp_truncate();
 		}
-	    
-	    g_edit_op_num = 0; 
 	}
-	
+
+    pthread_mutex_unlock(&g_ckp.lock);
+
+    return nullptr;
+}
+
+static int paxos_ckp_start()
+{
+    pthread_mutex_init(&g_ckp.lock, nullptr);
+    pthread_cond_init(&g_ckp.cond, nullptr);
+
+    g_ckp.running = NGX_TRUE;
+    g_ckp.last = time(nullptr);
+    g_ckp.cleaner = NGX_FALSE;
+
+    if (pthread_create(&g_ckp.tid, nullptr, paxos_ckp_cycle, nullptr) != 0)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
+			"create checkpoint thread failed");
+
+        g_ckp.running = NGX_FALSE;
+
+        return NGX_ERROR;
+	}
+
     return NGX_OK;
 }
 
-static void * checkpoint_start(void *arg)
+static void paxos_ckp_stop()
 {
-	do_checkpoint();
-	
-    return nullptr;
+    if (!g_ckp.running)
+	{
+        return;
+	}
+
+    pthread_mutex_lock(&g_ckp.lock);
+    g_ckp.running = NGX_FALSE;
+    pthread_cond_broadcast(&g_ckp.cond);
+    pthread_mutex_unlock(&g_ckp.lock);
+
+    pthread_join(g_ckp.tid, nullptr);
 }
 
 // cli put file
-static int log_create(task_t *task)
+static int log_create(task_t *task, paxos_batch_t *batch)
 {
 	int                parent_index = 0;
-	fi_inode_t        *finodes[PATH_LEN];
+	fi_path_t          fp;
+	uint64_t           inos[FI_PATH_DEPTH + 1];
+	fi_inode_t         finodes[FI_PATH_DEPTH + 1];
+	short              state = KEY_STATE_OK;
 	conf_server_t     *sconf = nullptr;
 	create_blk_info_t  blk_info;
 	create_resp_info_t resp_info;
@@ -545,11 +1636,10 @@ static int log_create(task_t *task)
 	}
 
 	// master 节点
-	fi_store_t *fi = get_store_obj((uchar_t *)task->key); // key 是dst 目录
-	if (fi) // 元数据存在
+	if (get_store_stat((uchar_t *)task->key, &finodes[0], &state) == NGX_OK) // 元数据存在
 	{
 	    //
-	    if (fi->state == KEY_STATE_OK) 
+	    if (state == KEY_STATE_OK) 
 		{
             task->ret = KEY_EXIST;
 		}
@@ -564,16 +1654,19 @@ static int log_create(task_t *task)
 	uchar_t path[PATH_LEN] = "";
 	get_store_path((uchar_t *)task->key, path); // decode path
 
-	uchar_t names[PATH_LEN][PATH_LEN];
-    int names_sz = get_path_names(path, names); //
-
-	uchar_t keys[PATH_LEN][PATH_LEN];
-    get_path_keys(names, names_sz, keys); // 把每一级目录都 encode方便查找是否已经创建过
-
-	parent_index = get_path_inodes(keys, names_sz, finodes);
+	// 找到每一级目录, the whole parent path must exist
+	if (fi_path_parse((uchar_t *)task->key, &fp) != NGX_OK 
+		|| fi_path_resolve(&fp, fp.num, inos, finodes) < fp.num)
+	{
+		parent_index = -1;
+	}
+	else
+	{
+		parent_index = fp.num - 1;
+	}
 
 	if ((parent_index <= 0) || (parent_index > 0 
-		&& finodes[parent_index]->is_directory == NGX_FALSE))
+		&& finodes[parent_index].is_directory == NGX_FALSE))
 	{
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
 			"Parent path is not a directory: %s", path);
@@ -596,14 +1689,14 @@ static int log_create(task_t *task)
 			return write_back(node);
 		}
 		
-        if (check_traverse(path, task, finodes, names_sz) != NGX_OK)
+        if (check_traverse(path, task, finodes, parent_index + 1) != NGX_OK)
 	    {
             task->ret = PERMISSION_DENY;
 
 			return write_back(node);
 	    }
 
-		if (check_ancestor_access(path, task, WRITE, finodes[parent_index]) 
+		if (check_ancestor_access(path, task, WRITE, &finodes[parent_index]) 
 			!= NGX_OK)
 	    {
             task->ret = PERMISSION_DENY;
@@ -612,7 +1705,7 @@ static int log_create(task_t *task)
 	    }
     }
 
-	if (is_FsObjectExceed(1))
+	if (is_FsObjectExceed(1 + paxos_batch_objects(batch)))
 	{
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
 			"fs object exceed, current num: %ld, max num: %ld, path: %s", 
@@ -635,27 +1728,17 @@ static int log_create(task_t *task)
 	resp_info.blk_id = generate_uid();
 	resp_info.namespace_id = dfs_cycle->namespace_id;
 	
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_cre()->set_key((const char *)task->key);
-	lopr.mutable_cre()->set_permission(task->permission);
-	lopr.mutable_cre()->set_owner(task->user);
-	lopr.mutable_cre()->set_group(task->group);
-	lopr.mutable_cre()->set_modification_time(dfs_current_msec);
-	lopr.mutable_cre()->set_blk_id(resp_info.blk_id);
-	lopr.mutable_cre()->set_blk_sz(blk_info.blk_sz);
-	lopr.mutable_cre()->set_blk_rep(blk_info.blk_rep);
+	editlog_rec_t rec;
+	paxos_rec_init(&rec, task);
+	paxos_rec_owner(&rec, task);
+	rec.blk_id = resp_info.blk_id;
+	rec.blk_sz = blk_info.blk_sz;
+	rec.blk_rep = blk_info.blk_rep;
 	// add blk seq
-	lopr.mutable_cre()->set_blk_seq(blk_info.blk_seq);
-    lopr.mutable_cre()->set_total_blk(blk_info.total_blk);
-
-	string sPaxosValue;
-	lopr.SerializeToString(&sPaxosValue);
+	rec.blk_seq = blk_info.blk_seq;
+	rec.total_blk = blk_info.total_blk;
 
-    PhxEditlogSMCtx oEditlogSMCtx;
-	oEditlogSMCtx.data = get_local_thread();
-	
-	g_editlog->Propose((const char *)task->key, sPaxosValue, oEditlogSMCtx);
+	paxos_batch_op(batch, (uchar_t *)task->key, &rec);
 
 	// response {blk_id, namespace_id, dn_ips}
 	task->data_len = sizeof(create_resp_info_t);
@@ -669,12 +1752,10 @@ static int log_create(task_t *task)
 
 	task->ret = SUCC;
 
-	inc_edit_op_num();
-	
-	return write_back(node);
+	return paxos_batch_task(batch, task, 1);
 }
 
-static int log_get_additional_blk(task_t *task)
+static int log_get_additional_blk(task_t *task, paxos_batch_t *batch)
 {
 	create_blk_info_t  blk_info;
 	create_resp_info_t resp_info;
@@ -696,8 +1777,10 @@ static int log_get_additional_blk(task_t *task)
 		return write_back(node);
 	}
 
-	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
-	if (fi && fi->state != KEY_STATE_CREATING) 
+	fi_inode_t finode;
+	short      state = KEY_STATE_OK;
+	if (get_store_stat((uchar_t *)task->key, &finode, &state) == NGX_OK 
+		&& state != KEY_STATE_CREATING) 
 	{
         task->ret = FAIL;
 		
@@ -714,18 +1797,13 @@ static int log_get_additional_blk(task_t *task)
 	resp_info.blk_id = generate_uid();
 	resp_info.namespace_id = dfs_cycle->namespace_id;
 
-	string sPaxosValue;
-	PhxEditlogSMCtx oEditlogSMCtx;
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_gab()->set_key((const char *)task->key);
-	lopr.mutable_gab()->set_blk_id(resp_info.blk_id);
-	lopr.mutable_gab()->set_blk_sz(blk_info.blk_sz);
-	lopr.mutable_gab()->set_blk_rep(blk_info.blk_rep);
-    
-	lopr.SerializeToString(&sPaxosValue);
+	editlog_rec_t rec;
+	paxos_rec_init(&rec, task);
+	rec.blk_id = resp_info.blk_id;
+	rec.blk_sz = blk_info.blk_sz;
+	rec.blk_rep = blk_info.blk_rep;
 
-	g_editlog->Propose((const char *)task->key, sPaxosValue, oEditlogSMCtx);
+	paxos_batch_op(batch, (uchar_t *)task->key, &rec);
 
 	// response {blk_id, namespace_id, dn_ips}
 	task->data_len = sizeof(create_resp_info_t);
@@ -739,12 +1817,10 @@ static int log_get_additional_blk(task_t *task)
 
 	task->ret = SUCC;
 
-	inc_edit_op_num();
-	
-	return write_back(node);
+	return paxos_batch_task(batch, task, 0);
 }
 
-static int log_close(task_t *task)
+static int log_close(task_t *task, paxos_batch_t *batch)
 {
     task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
 
@@ -761,35 +1837,29 @@ static int log_close(task_t *task)
 	//	return write_back(node);
 	//}
 
-	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
-	if (fi && fi->state != KEY_STATE_CREATING) 
+	fi_inode_t finode;
+	short      state = KEY_STATE_OK;
+	if (get_store_stat((uchar_t *)task->key, &finode, &state) == NGX_OK 
+		&& state != KEY_STATE_CREATING) 
 	{
         task->ret = FAIL;
 		
 		return write_back(node);
 	}
 
-	string sPaxosValue;
-	PhxEditlogSMCtx oEditlogSMCtx;
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_cle()->set_key((const char *)task->key);
-	lopr.mutable_cle()->set_modification_time(dfs_current_msec);
-	lopr.mutable_cle()->set_len(len);
-	lopr.mutable_cle()->set_blk_rep(task->ret);
-    
-	lopr.SerializeToString(&sPaxosValue);
+	editlog_rec_t rec;
+	paxos_rec_init(&rec, task);
+	rec.len = len;
+	rec.blk_rep = task->ret;
 
-	g_editlog->Propose((const char *)task->key, sPaxosValue, oEditlogSMCtx);
+	paxos_batch_op(batch, (uchar_t *)task->key, &rec);
 
 	task->ret = SUCC;
 
-	inc_edit_op_num();
-	
-	return write_back(node);
+	return paxos_batch_task(batch, task, 0);
 }
 
-static int log_rm(task_t *task)
+static int log_rm(task_t *task, paxos_batch_t *batch)
 {
     task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
 
@@ -801,14 +1871,14 @@ static int log_rm(task_t *task)
 		return write_back(node);
 	}
 
-	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
-	if (!fi) 
+	fi_inode_t finode;
+	if (get_store_stat((uchar_t *)task->key, &finode, nullptr) != NGX_OK) 
 	{
 		task->ret = KEY_NOTEXIST;
 
 		return write_back(node);
 	}
-	else if (fi->fin.is_directory)
+	else if (finode.is_directory)
 	{
         task->ret = NOT_FILE;
 
@@ -817,8 +1887,6 @@ static int log_rm(task_t *task)
 
 	uchar_t path[PATH_LEN] = "";
 	get_store_path((uchar_t *)task->key, path);
-
-	fi_inode_t finode = fi->fin;
 	
     if (!is_super(task->user, &dfs_cycle->admin))
     {
@@ -830,20 +1898,111 @@ static int log_rm(task_t *task)
 	    }
     }
 	
-    string sPaxosValue;
-	PhxEditlogSMCtx oEditlogSMCtx;
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_rm()->set_key((const char *)task->key);
-	lopr.mutable_rm()->set_modification_time(dfs_current_msec);
-	lopr.SerializeToString(&sPaxosValue);
+	editlog_rec_t rec;
+	paxos_rec_init(&rec, task);
 
-	g_editlog->Propose((const char *)task->key, sPaxosValue, oEditlogSMCtx);
+	paxos_batch_op(batch, (uchar_t *)task->key, &rec);
 
 	task->ret = SUCC;
 
-	inc_edit_op_num();
-	
-	return write_back(node);
+	return paxos_batch_task(batch, task, 0);
 }
 
+
+// key is the source, data the destination key
+static int log_rename(task_t *task, paxos_batch_t *batch)
+{
+	fi_path_t  sp;
+	fi_path_t  dp;
+	uint64_t   inos[FI_PATH_DEPTH + 1];
+	fi_inode_t finodes[FI_PATH_DEPTH + 1];
+	fi_inode_t finode;
+	short      state = KEY_STATE_OK;
+	uchar_t    dst_key[KEY_LEN] = "";
+	
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+	if (task->data && task->data_len > 0 && task->data_len < KEY_LEN) 
+	{
+		memcpy(dst_key, task->data, task->data_len);
+	}
+
+	task->data = nullptr;
+	task->data_len = 0;
+
+	if (!g_editlog->IsIMMaster(task->key)) 
+	{
+        task->ret = MASTER_REDIRECT;
+		task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
+
+		return write_back(node);
+	}
+
+	if (get_store_stat((uchar_t *)task->key, &finode, &state) != NGX_OK) 
+	{
+		task->ret = KEY_NOTEXIST;
+
+		return write_back(node);
+	}
+	else if (state != KEY_STATE_OK)
+	{
+        task->ret = KEY_STATE_CREATING;
+
+		return write_back(node);
+	}
+
+	if (get_store_stat(dst_key, &finodes[0], nullptr) == NGX_OK) 
+	{
+		task->ret = KEY_EXIST;
+
+		return write_back(node);
+	}
+
+	if (fi_path_parse((uchar_t *)task->key, &sp) != NGX_OK 
+		|| fi_path_parse(dst_key, &dp) != NGX_OK 
+		|| 0 == sp.num || 0 == dp.num || fi_path_is_prefix(&sp, &dp))
+	{
+        task->ret = FAIL;
+
+		return write_back(node);
+	}
+
+	if (fi_path_resolve(&dp, dp.num, inos, finodes) < dp.num 
+		|| !finodes[dp.num - 1].is_directory)
+	{
+        task->ret = NOT_DIRECTORY;
+
+		return write_back(node);
+	}
+
+	uchar_t path[PATH_LEN] = "";
+	get_store_path((uchar_t *)task->key, path);
+
+	uchar_t dst_path[PATH_LEN] = "";
+	get_store_path(dst_key, dst_path);
+	
+    if (!is_super(task->user, &dfs_cycle->admin))
+    {
+		if (check_ancestor_access(path, task, WRITE, &finode) != NGX_OK
+			|| check_traverse(dst_path, task, finodes, dp.num) != NGX_OK
+			|| check_ancestor_access(dst_path, task, WRITE, 
+			&finodes[dp.num - 1]) != NGX_OK)
+	    {
+            task->ret = PERMISSION_DENY;
+
+			return write_back(node);
+	    }
+    }
+
+	editlog_rec_t rec;
+	paxos_rec_init(&rec, task);
+	rec.dst = (const char *)dst_key;
+	rec.dst_len = strnlen((const char *)dst_key, KEY_LEN);
+
+	paxos_batch_op(batch, (uchar_t *)task->key, &rec);
+	paxos_batch_write(batch, dst_key);
+
+	task->ret = SUCC;
+
+	return paxos_batch_task(batch, task, 0);
+}
@@ -4,14 +4,21 @@
 #include "nn_cycle.h"
 #include "nn_file_index.h"
 
+#define PAXOS_READ_LOCAL 0 // any node answers reads from its own state
+#define PAXOS_READ_INDEX 1 // followers read behind a barrier edit
+#define PAXOS_READ_STALE 2 // the same, but a barrier is good read_stale_ms
+
 int nn_paxos_worker_init(cycle_t *cycle);
 int nn_paxos_worker_release(cycle_t *cycle);
 int nn_paxos_run();
+int nn_paxos_read(task_t *task);
+int nn_paxos_compound_done(task_queue_node_t *node);
 FSEditlog* nn_get_paxos_obj();
-void set_checkpoint_instanceID(const uint64_t llInstanceID);
+void set_checkpoint_instanceID(const int iGroupIdx, 
+	const uint64_t llInstanceID);
 void do_paxos_task_handler(void *q);
 int check_traverse(uchar_t *path, task_t *task, 
-	fi_inode_t *finodes[], int num);
+	fi_inode_t finodes[], int num);
 int check_ancestor_access(uchar_t *path, task_t *task, 
 	short access, fi_inode_t *finode);
 
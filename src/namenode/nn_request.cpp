@@ -22,8 +22,6 @@
 #define NN_TASK_POOL_MAX_SIZE 64
 #define NN_TASK_POOL_MIN_SIZE 8
 
-extern dfs_thread_t  *dn_thread;
-extern dfs_thread_t  *cli_thread;
 task_t                busy_task;
 
 static void nn_event_process_handler(event_t *ev);
@@ -35,24 +33,10 @@ static void nn_conn_free_queue(nn_conn_t *mc);
 static void nn_conn_close(nn_conn_t *mc);
 static int  nn_conn_recv(nn_conn_t *mc);
 static int  nn_conn_decode(nn_conn_t *mc);
+static int  nn_conn_has_credit(nn_conn_t *mc);
+static void nn_conn_pause(nn_conn_t *mc);
 
 
-static void  nn_conn_timer_handler(event_t *ev)
-{
-    nn_conn_t *mc = (nn_conn_t *)ev->data;
-	
-    event_timer_del(mc->connection->ev_timer, ev);
-    if (event_handle_read(mc->connection->ev_base, mc->connection->read, 0)) 
-    {
-        nn_conn_finalize(mc);
-		
-        return;
-    }
-
-    nn_conn_write_handler(mc);
-    nn_conn_read_handler(mc);
-}
-
 // 入口。。。
 // from listen_rev_handler
 // 初始化分配 max task个 wb_node *
@@ -115,6 +99,9 @@ void nn_conn_init(conn_t *c)
     mc->count = 0;
     mc->connection = c;
     mc->slow = 0;
+    mc->out_bytes = 0;
+    mc->out_max = ((conf_server_t*)dfs_cycle->sconf)->conn_out_max;
+    mc->thread = thread;
 	
     snprintf(mc->ipaddr, sizeof(mc->ipaddr), "%s", c->addr_text.data);
 	
@@ -133,25 +120,17 @@ void nn_conn_init(conn_t *c)
         node = buff + i; // 每个node都是一个单独的 queue
         node->qnode.tk.opq = &node->wbt;
 		node->qnode.tk.data = nullptr;
+		node->req = nullptr;
         (node->wbt).mc = mc;
+        (node->wbt).compound = nullptr;
 
         // process event 时 accept事件 只会由 THREAD_DN OR THREAD_CLI 处理
-		if (THREAD_DN == thread->type)
-		{
-			(node->wbt).thread = dn_thread;
-		} 
-		else if (THREAD_CLI == thread->type)
-		{
-			(node->wbt).thread = cli_thread;
-		}
-		
+        // replies go back to the I/O thread that accepted the conn
+		(node->wbt).thread = thread;
+
         queue_insert_head(&mc->free_task, &node->qnode.qe);
     }
 	
-    memset(&mc->ev_timer, 0, sizeof(event_t));
-    mc->ev_timer.data = mc; //
-    mc->ev_timer.handler = nn_conn_timer_handler;
-
     rev->handler = nn_event_process_handler;
     wev->handler = nn_event_process_handler;
 	
@@ -271,6 +250,62 @@ static int nn_conn_recv(nn_conn_t *mc)
 	return NGX_OK;
 }
 
+// copy the request data out of mc->in, the handlers take it from
+// there after more requests have been read in behind it
+static int nn_conn_keep_data(nn_conn_t *mc, task_queue_node_t *node)
+{
+    wb_node_t *wb = (wb_node_t *)node;
+	task_t    *task = &node->tk;
+
+    if (!task->data || task->data_len <= 0)
+	{
+        return NGX_OK;
+	}
+
+    // only a batch is larger, it gets a copy of its own
+    if (task->data_len > WB_REQ_DATA_MAX && task->cmd == NN_BATCH)
+	{
+        void *data = malloc(task->data_len);
+		if (!data)
+		{
+			task->data = nullptr;
+
+			return NGX_ERROR;
+		}
+
+        memcpy(data, task->data, task->data_len);
+		task->data = data;
+
+        return NGX_OK;
+	}
+
+    if (task->data_len > WB_REQ_DATA_MAX)
+	{
+        dfs_log_error(mc->log, DFS_LOG_ERROR, 0,
+			"request data too long: %d", task->data_len);
+
+		task->data = nullptr;
+
+        return NGX_ERROR;
+	}
+
+    if (!wb->req)
+	{
+        wb->req = (uchar_t *)pool_alloc(mc->mempool, WB_REQ_DATA_MAX);
+		if (!wb->req)
+		{
+			task->data = nullptr;
+
+			return NGX_ERROR;
+		}
+	}
+
+    memcpy(wb->req, task->data, task->data_len);
+	task->data = wb->req;
+
+    return NGX_OK;
+}
+
 // from nn_conn_read_handler
 // decode task from mc->in
 // dispatch task to task_threads[]
@@ -281,27 +316,34 @@ static int nn_conn_decode(nn_conn_t *mc)
 	
 	while (true)
 	{
+        // out of credits, the rest waits in mc->in till replies free some
+        if (!nn_conn_has_credit(mc))
+		{
+            nn_conn_pause(mc);
+			
+            return NGX_BUSY;
+		}
+
         // pop free task from free_task queue
         node = (task_queue_node_t *)nn_conn_get_task(mc);
 		if (!node) 
 		{
-            dfs_log_error(mc->log,DFS_LOG_ERROR, 0, 
-				"mc to repiad remove from epoll");
-   
-			mc->slow = 1;
-			event_del_read(mc->connection->ev_base, mc->connection->read);
-            event_timer_add(mc->connection->ev_timer, &mc->ev_timer, 1000);
+            nn_conn_pause(mc);
 			
             return NGX_BUSY;
     	}	
 
 		// decode task to _in buffer
         rc = task_decode(mc->in, &node->tk);
+        if (rc == NGX_OK && nn_conn_keep_data(mc, node) != NGX_OK)
+		{
+			rc = NGX_ERROR;
+		}
+
         if (rc == NGX_OK)
 		{
             // dispatch task when recv it
-            // push task to last_task->tq
-            // notice_wake_up (&last_task->tq_notice
+            // push task to the tq of a task thread, see dispatch_pick
             dispatch_task(node);
 
             node = nullptr;
@@ -419,6 +461,9 @@ static void nn_conn_write_handler(nn_conn_t *mc)
     // send buffer
     // add event
 	nn_conn_output(mc);  
+
+    // a slow reader caught up
+	nn_conn_resume_paused(get_local_thread());
 }
 
 void nn_conn_close(nn_conn_t *mc)
@@ -487,6 +532,7 @@ int nn_conn_outtask(nn_conn_t *mc, task_t *t)
 	}
 
 	queue_insert_tail(&mc->out_task, &node->qe);
+	mc->out_bytes += t->data_len > 0 ? t->data_len : 0;
     
 	return nn_conn_output(mc);
 }
@@ -526,6 +572,7 @@ repack:
 		if (rc == NGX_OK)  // 这个task push完成就释放空间
 		{
 			queue_remove(qe);
+			mc->out_bytes -= t->data_len > 0 ? t->data_len : 0;
 			nn_conn_free_task(mc, qe);
 			
 			continue;
@@ -539,6 +586,7 @@ repack:
 		if (rc == NGX_ERROR)
 		{
             queue_remove(qe);
+			mc->out_bytes -= t->data_len > 0 ? t->data_len : 0;
 			nn_conn_free_task(mc, qe);
         }
 	}
@@ -599,6 +647,7 @@ void * nn_conn_get_task(nn_conn_t *mc)
     node = queue_data(queue, task_queue_node_t, qe); //
     queue_remove(queue);
     mc->count++; //
+    mc->thread->inflight++;
 	
     return node;  
 }
@@ -607,10 +656,14 @@ void * nn_conn_get_task(nn_conn_t *mc)
 void nn_conn_free_task(nn_conn_t *mc, queue_t *q)
 {
    mc->count--;
+   mc->thread->inflight--;
 
    task_queue_node_t *node = queue_data(q, task_queue_node_t, qe);
    task_t *task = &node->tk;
-   if (nullptr != task->data && task->data_len > 0)
+   
+   // request data left in place lives in the node
+   if (nullptr != task->data && task->data_len > 0
+       && task->data != ((wb_node_t *)node)->req)
    {
        free(task->data);
 	   task->data = nullptr;
@@ -635,6 +688,90 @@ static void nn_conn_free_queue(nn_conn_t *mc)
         queue_remove(qn);
         nn_conn_free_task(mc, qn);
     }
+	
+    mc->out_bytes = 0;
+}
+
+// credits: a task node of the conn, a share of the thread's inflight, 
+// and room for the replies it already has queued
+static int nn_conn_has_credit(nn_conn_t *mc)
+{
+    return mc->count < mc->max_task 
+		&& mc->thread->inflight < mc->thread->inflight_max
+		&& mc->out_bytes < mc->out_max;
+}
+
+// stop reading till nn_conn_resume_paused sees enough credits again
+static void nn_conn_pause(nn_conn_t *mc)
+{
+    if (mc->slow)
+	{
+        return;
+	}
+
+    dfs_log_debug(mc->log, DFS_LOG_DEBUG, 0, 
+		"conn %s paused, tasks:%d inflight:%d out:%z", mc->ipaddr, 
+		mc->count, mc->thread->inflight, mc->out_bytes);
+
+    mc->slow = 1;
+	event_del_read(mc->connection->ev_base, mc->connection->read);
+	queue_insert_tail(&mc->thread->paused, &mc->pause_qe);
+}
+
+// a quarter of the credits back, so a conn at its limit is not paused 
+// and resumed for every reply
+static int nn_conn_can_resume(nn_conn_t *mc)
+{
+    return mc->count <= mc->max_task - mc->max_task / 4 
+		&& mc->thread->inflight 
+		<= mc->thread->inflight_max - mc->thread->inflight_max / 4
+		&& mc->out_bytes <= mc->out_max / 2;
+}
+
+// called on the I/O thread once replies were queued or sent, reads 
+// the paused conns that got their credits back, the requests already 
+// in mc->in first
+void nn_conn_resume_paused(dfs_thread_t *thread)
+{
+    queue_t    q;
+    queue_t   *qe = nullptr;
+    nn_conn_t *mc = nullptr;
+
+    if (queue_empty(&thread->paused))
+	{
+        return;
+	}
+
+    queue_init(&q);
+    queue_add_queue(&q, &thread->paused);
+    queue_init(&thread->paused);
+
+    while (!queue_empty(&q))
+	{
+        qe = queue_head(&q);
+        queue_remove(qe);
+        mc = queue_data(qe, nn_conn_t, pause_qe);
+
+        if (!nn_conn_can_resume(mc))
+		{
+            queue_insert_tail(&thread->paused, qe);
+			
+            continue;
+		}
+
+        mc->slow = 0;
+		
+        if (event_handle_read(mc->connection->ev_base, 
+			mc->connection->read, 0) == NGX_ERROR)
+		{
+            nn_conn_finalize(mc);
+			
+            continue;
+		}
+
+        // may pause it again, or finalize it
+        nn_conn_read_handler(mc);
+    }
 }
 
 int nn_conn_update_state(nn_conn_t *mc, int state)
@@ -653,9 +790,10 @@ void nn_conn_finalize(nn_conn_t *mc)
 {
     if (mc->state == ST_CONNCECTED) 
 	{
-        if (mc->ev_timer.timer_set) 
+        if (mc->slow) 
 		{
-            event_timer_del(mc->connection->ev_timer,&mc->ev_timer);
+            queue_remove(&mc->pause_qe);
+            mc->slow = 0;
         }
 		
         nn_conn_close(mc);
@@ -6,6 +6,7 @@
 #include "dfs_buffer.h"
 #include "dfs_queue.h"
 #include "dfs_task.h"
+#include "nn_thread.h"
 
 typedef struct nn_conn_s nn_conn_t;
 typedef void (*nn_event_handler_pt)(nn_conn_t *);
@@ -26,10 +27,13 @@ struct nn_conn_s
     nn_event_handler_pt  read_event_handler; //nn_conn_read_handler
     nn_event_handler_pt  write_event_handler;
     int32_t              count; // used freetask que count
-    int32_t              slow; //
+    int32_t              slow; // reads stopped till credits come back
+    queue_t              pause_qe; // in thread->paused while slow
     queue_t              free_task;
     pool_t              *mempool; // pool
-    event_t              ev_timer;
+    size_t               out_bytes; // reply data waiting in out_task
+    size_t               out_max; // out_bytes that stops reads
+    dfs_thread_t        *thread; // the I/O thread owning the conn
     int32_t              max_task;
     int32_t              state; // CONNECTED
     char                 ipaddr[32];
@@ -45,6 +49,7 @@ int  nn_conn_outtask(nn_conn_t *mc, task_t *t);
 int  nn_conn_update_state(nn_conn_t *mc, int state);
 int  nn_conn_get_state(nn_conn_t *mc);
 void nn_conn_finalize(nn_conn_t *mc);
+void nn_conn_resume_paused(dfs_thread_t *thread);
 
 #endif
 
@@ -6,6 +6,7 @@
 #include "nn_conf.h"
 #include "nn_file_index.h"
 #include "nn_dn_index.h"
+#include "nn_paxos.h"
 
 int nn_rpc_worker_init(cycle_t *cycle)
 {
@@ -40,11 +41,14 @@ int nn_rpc_service_run(task_t *task)
 		break;
 
 	case NN_LS:
-		nn_ls(task); // diff:
-		break;
-		
-	case NN_GET_FILE_INFO: // no use
-		nn_get_file_info(task);
+	case NN_LS_PAGE:
+	case NN_GET_FILE_INFO:
+	case NN_OPEN:
+		// a follower may have to catch up first, see nn_paxos_read
+		if (nn_paxos_read(task) == DFS_DECLINED)
+		{
+			nn_rpc_read_run(task);
+		}
 		break;
     // cli put file
     //
@@ -64,8 +68,12 @@ int nn_rpc_service_run(task_t *task)
 		nn_rm(task); // same
 		break;
 
-	case NN_OPEN:
-		nn_open(task); // diff :
+	case NN_RENAME:
+		nn_rename(task); // same
+		break;
+
+	case NN_BATCH:
+		nn_batch(task); // same
 		break;
 
 	case DN_REGISTER:
@@ -98,3 +106,31 @@ int nn_rpc_service_run(task_t *task)
     return NGX_OK;
 }
 
+// the reads, on the task thread or the paxos reader
+int nn_rpc_read_run(task_t *task)
+{
+    switch (task->cmd)
+    {
+	case NN_LS:
+		nn_ls(task); // diff:
+		break;
+
+	case NN_LS_PAGE:
+		nn_ls_page(task); // same as ls
+		break;
+		
+	case NN_GET_FILE_INFO: // no use
+		nn_get_file_info(task);
+		break;
+
+	case NN_OPEN:
+		nn_open(task); // diff :
+		break;
+
+	default:
+		return NGX_ERROR;
+	}
+
+    return NGX_OK;
+}
+
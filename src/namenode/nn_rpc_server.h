@@ -8,6 +8,7 @@ int nn_rpc_worker_init(cycle_t *cycle);
 int nn_rpc_worker_release(cycle_t *cycle);
 
 int nn_rpc_service_run(task_t *task);
+int nn_rpc_read_run(task_t *task);
 
 #endif 
 
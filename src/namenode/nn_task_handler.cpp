@@ -15,38 +15,50 @@ static void do_task(task_t *task)
 }
 
 // do task
-// 对应Thread_TASK 的task queue
-// 分发 task 到不同线程
-void do_task_handler(void *q) // thread->tq
+// 对应Thread_TASK 的 tq_dn 和 tq
+// the datanode lane goes first, after lane_weight dn tasks in a row a 
+// waiting client task gets its turn, lane_weight 0 is strict priority
+void do_task_handler(void *data) // task thread
 {
 	task_queue_node_t *tnode = nullptr;
-	task_t            *t = nullptr;
-	queue_t           *cur = nullptr;
-	queue_t            qhead;
-	task_queue_t      *tq = nullptr;
     dfs_thread_t      *thread = nullptr;
+	uint32_t           run = 0; // dn tasks since the last cli one
+	int                lane = 0;
 
-	tq = (task_queue_t *)q;
-    thread = get_local_thread(); // task_threads[]
+    thread = (dfs_thread_t *)data; // task_threads[]
 	
-    queue_init(&qhead);
-	pop_all(tq, &qhead);
-	
-	cur = queue_head(&qhead);
-	
-	while (!queue_empty(&qhead) && thread->running)
+	while (thread->running)
 	{
-		// |task_queue_node_t    |  qe |
-		// |                     |     |
-		// 所以 qe 减去偏移 得到 对应 task_queue_node_t
-		tnode = queue_data(cur, task_queue_node_t, qe);
-		t = &tnode->tk;
+        tnode = nullptr;
 		
-        queue_remove(cur);
+        if (!thread->lane_weight || run < thread->lane_weight)
+		{
+            tnode = pop_task(&thread->tq_dn);
+			lane = TASK_LANE_DN;
+		}
 
-        do_task(t);
-		
-		cur = queue_head(&qhead);
+        if (!tnode)
+		{
+            tnode = pop_task(&thread->tq);
+			lane = TASK_LANE_CLI;
+		}
+
+        if (!tnode && run)
+		{
+            tnode = pop_task(&thread->tq_dn);
+			lane = TASK_LANE_DN;
+		}
+
+        if (!tnode)
+		{
+            break;
+		}
+
+        run = lane == TASK_LANE_DN ? run + 1 : 0;
+
+        do_task(&tnode->tk);
+
+        __sync_sub_and_fetch(&thread->tq_len[lane], 1);
+        thread->tq_done[lane]++;
 	}
 }
-
@@ -48,14 +48,8 @@ task_queue_node_t * queue_node_create()
 
 int task_queue_init(task_queue_t* tq)
 {
-	if (pthread_spin_init(&tq->lock, 0) != 0)
-	{
-		free(tq);
-		
-		return -1;
-	}
-
-	queue_init(&(tq->qh));
+	tq->head = nullptr;
+	queue_init(&tq->ready);
 	
 	return 0;
 }
@@ -68,78 +62,101 @@ task_queue_t *task_queue_create()
 		return nullptr;
 	}
 	
-	queue_init(&tq->qh);
-	
-	if (pthread_spin_init(&tq->lock, 0) != 0)
-	{
-		free(tq);
-		
-		return nullptr;
-	}
-
-	queue_init(&(tq->qh));
+	task_queue_init(tq);
 	
 	return tq;
 }
 
 void task_queue_destory(task_queue_t* q)
 {
-	pthread_spin_destroy(&(q->lock));
 	free(q);
 }
 
+// consumer only, moves what was pushed so far to the end of ready
+static void task_queue_take(task_queue_t* tq)
+{
+	queue_t *q = nullptr;
+	queue_t  in;
+	
+	// polled often for a lane that is mostly empty, skip the exchange
+	if (!tq->head)
+	{
+		return;
+	}
+
+	q = __sync_lock_test_and_set(&tq->head, nullptr);
+	if (!q)
+	{
+		return;
+	}
+
+	queue_init(&in);
+
+	// newest first, each goes in front of the ones pushed after it
+	while (q)
+	{
+		queue_t *next = q->next;
+		
+		queue_insert_head(&in, q);
+		q = next;
+	}
+
+	queue_add_queue(&tq->ready, &in);
+}
+
+// the oldest task, consumer only
 task_queue_node_t* pop_task(task_queue_t* queue)
 {
-	task_queue_node_t *tnode = nullptr;
-	queue_t           *q = nullptr;
+	queue_t *q = nullptr;
 	
 	assert(queue);
 	
-	pthread_spin_lock(&queue->lock);
-	
-	if (queue_empty(&queue->qh))
+	if (queue_empty(&queue->ready))
 	{
-		pthread_spin_unlock(&queue->lock);
+		task_queue_take(queue);
 		
-		return nullptr;
+		if (queue_empty(&queue->ready))
+		{
+			return nullptr;
+		}
 	}
 
-	q = queue_tail(&queue->qh);
+	q = queue_head(&queue->ready);
 	queue_remove(q);
-	
-	pthread_spin_unlock(&queue->lock);
 
-	tnode = queue_data(q, task_queue_node_t, qe);
-
-	return tnode;
+	return queue_data(q, task_queue_node_t, qe);
 }
 
+// all tasks in push order, consumer only
 void pop_all(task_queue_t* tq, queue_t* queue)
 {
-	pthread_spin_lock(&tq->lock);
+	assert(tq);
+	assert(queue);
+	
+	task_queue_take(tq);
 	
-	if (!queue_empty(&tq->qh)) 
+	if (!queue_empty(&tq->ready)) 
 	{
-        queue->next = tq->qh.next;
-        queue->prev = tq->qh.prev;
+        queue->next = tq->ready.next;
+        queue->prev = tq->ready.prev;
         
         queue->next->prev = queue;
         queue->prev->next = queue;
-        queue_init(&tq->qh);
+        queue_init(&tq->ready);
 	}
-	
-	pthread_spin_unlock(&tq->lock);
 }
 
+// any thread
 void push_task(task_queue_t*queue, task_queue_node_t* tnode)
 {
+	queue_t *head = nullptr;
+	
 	assert(queue);
 	assert(tnode);
 	
-	pthread_spin_lock(&queue->lock);
-	
-	queue_insert_head(&queue->qh, &tnode->qe);
-	
-	pthread_spin_unlock(&queue->lock);
+	do
+	{
+		head = queue->head;
+		tnode->qe.next = head;
+	} while (!__sync_bool_compare_and_swap(&queue->head, head, &tnode->qe));
 }
-
@@ -14,10 +14,17 @@ typedef struct task_queue_node_s
 
 typedef void (*opq_free)(void*);
 
+/*
+ * many threads push, one thread pops. push links the node onto head
+ * with a compare and swap, the consumer takes the whole chain with one
+ * exchange and turns it around, so tasks come out in the order they
+ * were pushed. no lock and no allocation, the nodes are the callers'
+ * (per connection, see wb_node_t)
+ */
 typedef struct
 { 
-	queue_t            qh; // task queue queue head?
-	pthread_spinlock_t lock;
+	queue_t *head;  // pushed nodes linked by qe.next, newest first
+	queue_t  ready; // taken off head in order, not popped yet
 } task_queue_t;
 
 task_queue_node_t * queue_node_create();
@@ -94,25 +94,51 @@ int thread_event_init(dfs_thread_t *thread)
     return NGX_OK;
 }
 
-// 不同的线程 处理 epoll 事件
+static uint64_t thread_usec()
+{
+    struct timeval tv;
+
+    time_gettimeofday(&tv);
 
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// 不同的线程 处理 epoll 事件
+// dn and cli threads sleep in epoll until a socket, a timer or the 
+// tq_notice of write_back wakes them, with busy_poll set they poll 
+// for that many us after the last work before they sleep
 void thread_event_process(dfs_thread_t *thread)
 {
     uint32_t      flags = 0;
     rb_msec_t     timer = 0;
     rb_msec_t     delta = 0;
     event_base_t *ev_base;
+    int           io = 0;
     
     ev_base = &thread->event_base;
+    io = THREAD_DN == thread->type || THREAD_CLI == thread->type;
     
-    if (THREAD_DN == thread->type || THREAD_CLI == thread->type) 
+    if (io) 
 	{
         flags = EVENT_POST_EVENTS | EVENT_UPDATE_TIME;
     }
+	else if (THREAD_MASTER == thread->type)
+	{
+	    // the I/O threads may sleep long, the worker main loop keeps 
+	    // the cached time going
+        flags = EVENT_UPDATE_TIME;
+	}
     
     timer = event_find_timer(&thread->event_timer);
 
-    if ((timer > 10) || (timer == EVENT_TIMER_INFINITE)) 
+    if (io) 
+	{
+        if (thread->busy_poll && thread_usec() < thread->busy_until) 
+		{
+            timer = 0;
+        }
+    }
+    else if ((timer > 10) || (timer == EVENT_TIMER_INFINITE)) 
 	{
         timer = 10;
     }
@@ -123,15 +149,20 @@ void thread_event_process(dfs_thread_t *thread)
     // 把  THREAD_DN or THREAD_CLI 的 events 先缓存起来，顺序处理
     (void) epoll_process_events(ev_base, timer, flags);
 
+    if (io && thread->busy_poll 
+		&& (!queue_empty(&ev_base->posted_accept_events) 
+		|| !queue_empty(&ev_base->posted_events)))
+    {
+        thread->busy_until = thread_usec() + thread->busy_poll;
+    }
+
     //  THREAD_DN or THREAD_CLI thread process accept events
-    if ((THREAD_DN == thread->type || THREAD_CLI == thread->type) 
-		&& !queue_empty(&ev_base->posted_accept_events)) 
+    if (io && !queue_empty(&ev_base->posted_accept_events)) 
     {
         event_process_posted(&ev_base->posted_accept_events, ev_base->log);
     }
 
-    if ((THREAD_DN == thread->type || THREAD_CLI == thread->type) 
-		&& !queue_empty(&ev_base->posted_events)) 
+    if (io && !queue_empty(&ev_base->posted_events)) 
     {
         event_process_posted(&ev_base->posted_events, ev_base->log);
     }
@@ -11,6 +11,15 @@
 #include "nn_cycle.h"
 #include "nn_task_queue.h"
 
+// scheduling classes of the task threads, datanode heartbeats and 
+// reports must not wait behind a client storm
+enum 
+{
+    TASK_LANE_CLI,
+    TASK_LANE_DN,
+    TASK_LANE_N
+};
+
 typedef void *(*TREAD_FUNC)(void *);
 typedef struct dfs_thread_s  dfs_thread_t;
 
@@ -22,12 +31,22 @@ struct dfs_thread_s
     event_timer_t  event_timer;
     conn_pool_t    conn_pool;
     task_queue_t   tq; // task queue
+    task_queue_t   tq_dn; // task threads, the datanode lane, run first
     task_queue_t  *bque; // write back queue 结构体数组
     int            queue_size; // bqueue size // sconf-> worker_n
     notice_t       tq_notice; // task queue notice
     TREAD_FUNC     run_func;
     uint32_t       state;
     int            running;
+    uint64_t       tq_len[TASK_LANE_N];  // task threads, tasks queued and not run yet
+    uint64_t       tq_max[TASK_LANE_N];  // the deepest tq_len since the last report
+    uint64_t       tq_done[TASK_LANE_N]; // tasks run
+    uint32_t       lane_weight; // dn tasks run before a waiting cli one, 0 strict
+    uint32_t       busy_poll;  // I/O threads, us to keep polling after work
+    uint64_t       busy_until; // poll without sleeping till then, in us
+    int32_t        inflight;     // I/O threads, requests taken and not freed
+    int32_t        inflight_max; // its share of max_inflight
+    queue_t        paused;       // conns whose reads wait for credits
 };
 
 enum 
@@ -25,15 +25,18 @@ static int cur_runing_threads = 0;
 static int cur_exited_threads = 0;
 
 dfs_thread_t *task_threads;
-dfs_thread_t *last_task; // 用于 dispatch task
 int           task_num = 0;
 
+static rb_msec_t task_stats_last = 0;
+
 extern dfs_thread_t *main_thread;
-dfs_thread_t        *dn_thread;
-dfs_thread_t        *cli_thread;
+dfs_thread_t        *dn_threads;
+int                  dn_thread_num = 0;
+dfs_thread_t        *cli_threads;
+int                  cli_thread_num = 0;
 dfs_thread_t        *paxos_thread;
 
-static inline int hash_task_key(char* str, int len);
+static inline uint32_t hash_task_key(const char *str, size_t len);
 static void  thread_registration_init();
 static void  threads_total_add(int n);
 static int   thread_setup(dfs_thread_t *thread, int type);
@@ -47,11 +50,10 @@ static void stop_task_thread(cycle_t *cycle);
 static int channel_add_event(int fd, int event,
     event_handler_pt handler, void *data);
 static void channel_handler(event_t *ev);
-static int create_dn_thread(cycle_t *cycle);
-static void stop_dn_thread();
+static int create_io_threads(cycle_t *cycle, dfs_thread_t **threads, 
+    int num, int type, TREAD_FUNC func);
+static void stop_io_threads(dfs_thread_t *threads, int num);
 static void *thread_dn_cycle(void * args);
-static int create_cli_thread(cycle_t *cycle);
-static void stop_cli_thread();
 static void *thread_cli_cycle(void * args);
 static int create_paxos_thread(cycle_t *cycle);
 static void *thread_paxos_cycle(void *arg);
@@ -151,23 +153,110 @@ void register_thread_exit(void)
     pthread_mutex_unlock(&init_lock);
 }
 
+// logs the queue depth of every task thread and lane, at most once per
+// task_stats_interval, from whichever thread dispatches then
+static void task_stats_report()
+{
+    conf_server_t *sconf = (conf_server_t *)dfs_cycle->sconf;
+    rb_msec_t      now = dfs_current_msec;
+    rb_msec_t      last = task_stats_last;
+    char           buf[TASK_LANE_N][1024];
+    size_t         n = 0;
+    int            lane = 0;
+
+    if (!sconf->task_stats_interval 
+		|| now - last < (rb_msec_t)sconf->task_stats_interval * 1000
+        || !__sync_bool_compare_and_swap(&task_stats_last, last, now))
+	{
+        return;
+    }
+
+    for (lane = 0; lane < TASK_LANE_N; lane++)
+	{
+        n = 0;
+        buf[lane][0] = '\0';
+		
+        for (int i = 0; i < task_num && n < sizeof(buf[lane]) - 64; i++)
+	    {
+            dfs_thread_t *th = &task_threads[i];
+
+            n += snprintf(buf[lane] + n, sizeof(buf[lane]) - n, 
+				" %lu/%lu/%lu", (unsigned long)th->tq_len[lane], 
+				(unsigned long)th->tq_max[lane], 
+				(unsigned long)th->tq_done[lane]);
+
+            th->tq_max[lane] = th->tq_len[lane];
+        }
+    }
+
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+		"task threads queued/max/done cli:%s dn:%s", 
+		buf[TASK_LANE_CLI], buf[TASK_LANE_DN]);
+}
+
+/*
+ * reads need no order among themselves, they go to the shorter queue of
+ * two threads, one by the hash of the whole key and one in turn. the
+ * rest stays on the thread of its connection, so what one client or
+ * datanode sends reaches the paxos thread and the dn index in order
+ */
+static dfs_thread_t *dispatch_pick(task_queue_node_t *node)
+{
+    static __thread uint32_t  turn = 0;
+    task_t                   *t = &node->tk;
+    nn_wb_t                  *wbt = (nn_wb_t *)t->opq;
+    dfs_thread_t             *a = nullptr;
+    dfs_thread_t             *b = nullptr;
+
+    switch (t->cmd)
+	{
+    case NN_LS:
+    case NN_LS_PAGE:
+    case NN_GET_FILE_INFO:
+    case NN_OPEN:
+        a = &task_threads[hash_task_key(t->key, strnlen(t->key, KEY_LEN)) 
+			% task_num];
+        b = &task_threads[turn++ % task_num];
+
+        return b->tq_len[TASK_LANE_CLI] < a->tq_len[TASK_LANE_CLI] ? b : a;
+
+    default:
+        return &task_threads[hash_task_key((const char *)&wbt->mc, 
+			sizeof(wbt->mc)) % task_num];
+    }
+}
+
 // dispatch task when recv it
 // data is task_queue_node_t
-// push task to last_task->tq
-// notice_wake_up (&last_task->tq_notice
+// push task to the picked thread's lane and notice_wake_up it, what 
+// comes in on a dn thread takes the datanode lane
 void dispatch_task(void *data)
 {
     task_queue_node_t *node = nullptr;
-    task_t            *t = nullptr;
-    uint32_t           index = 0;
+    dfs_thread_t      *th = nullptr;
+    nn_wb_t           *wbt = nullptr;
+    uint64_t           len = 0;
+    int                lane = TASK_LANE_CLI;
 
 	node = (task_queue_node_t *)data;
-    t = &node->tk;
-		
-    index = hash_task_key(t->key, 16); // index is key address
-    last_task = &task_threads[index % task_num]; // 初始化 last_task = &task_threads[0];
-    push_task(&last_task->tq, (task_queue_node_t *)data); //
-    notice_wake_up(&last_task->tq_notice);
+    wbt = (nn_wb_t *)node->tk.opq;
+    th = dispatch_pick(node);
+
+    if (THREAD_DN == wbt->thread->type)
+	{
+        lane = TASK_LANE_DN;
+    }
+
+    len = __sync_add_and_fetch(&th->tq_len[lane], 1);
+    if (len > th->tq_max[lane])
+	{
+        th->tq_max[lane] = len;
+    }
+
+    push_task(lane == TASK_LANE_DN ? &th->tq_dn : &th->tq, node);
+    notice_wake_up(&th->tq_notice);
+
+    task_stats_report();
 }
 
 
@@ -188,6 +277,7 @@ void ngx_worker_process_cycle(cycle_t *cycle, void *data)
 
     process_type = PROCESS_WORKER;
     main_thread->event_base.nevents = 512;
+    main_thread->event_base.time_update = time_update;
 
     // epoll init： fd\ event_list\ timer
     if (thread_event_init(main_thread) != NGX_OK)
@@ -223,7 +313,13 @@ void ngx_worker_process_cycle(cycle_t *cycle, void *data)
 
 	// load fsimage
 	// set check point
-	load_image();
+	if (load_image() != NGX_OK)
+	{
+		dfs_log_error(cycle->error_log, DFS_LOG_ALERT, 0, 
+			"load_image() failed");
+		
+        exit(PROCESS_FATAL_EXIT);
+	}
 
 	/*
 	 * 每一个thread cycle都 有 notice_init ,当notice pipe被唤醒的时候执行对应的handler
@@ -254,8 +350,12 @@ void ngx_worker_process_cycle(cycle_t *cycle, void *data)
      * 入口函数 ：listen_rev_handler ！important
      * */
 
+    dn_thread_num = ((conf_server_t *)cycle->sconf)->dn_threads;
+    cli_thread_num = ((conf_server_t *)cycle->sconf)->cli_threads;
+
     // THREAD_DN
-	if (create_dn_thread(cycle) != NGX_OK)
+	if (create_io_threads(cycle, &dn_threads, dn_thread_num, 
+		THREAD_DN, thread_dn_cycle) != NGX_OK)
 	{
         dfs_log_error(cycle->error_log, DFS_LOG_ALERT, errno, 
             "create dn thread failed");
@@ -265,7 +365,8 @@ void ngx_worker_process_cycle(cycle_t *cycle, void *data)
 
 	// THREAD_CLI
 	// same like dn thread
-    if (create_cli_thread(cycle) != NGX_OK)
+    if (create_io_threads(cycle, &cli_threads, cli_thread_num, 
+		THREAD_CLI, thread_cli_cycle) != NGX_OK)
 	{
         dfs_log_error(cycle->error_log, DFS_LOG_ALERT, errno, 
             "create cli thread failed");
@@ -288,8 +389,8 @@ void ngx_worker_process_cycle(cycle_t *cycle, void *data)
 
         if (process_quit_check()) 
 		{
-            stop_cli_thread();
-			stop_dn_thread();
+            stop_io_threads(cli_threads, cli_thread_num);
+			stop_io_threads(dn_threads, dn_thread_num);
             stop_task_thread(cycle);
 			stop_paxos_thread();
 			
@@ -394,6 +495,7 @@ static void * thread_paxos_cycle(void *arg) //paxos_thread
 //
 //        }
         thread_event_process(me); // nn thread
+        fi_create_expire();
     }
 
 exit:
@@ -436,13 +538,13 @@ int create_task_thread(cycle_t *cycle)
         }
     }
     
-    last_task = &task_threads[0];
-        
     for (i = 0; i < task_num; i++) 
 	{
         task_threads[i].run_func = thread_task_cycle;
         task_threads[i].running = NGX_TRUE;
         task_queue_init(&task_threads[i].tq);
+        task_queue_init(&task_threads[i].tq_dn);
+        task_threads[i].lane_weight = sconf->dn_lane_weight;
         task_threads[i].state = THREAD_ST_UNSTART;
 		
         if (thread_create(&task_threads[i]) != NGX_OK)
@@ -491,7 +593,7 @@ static void * thread_task_cycle(void *arg)
 
     // 把一些task 直接push到paxoas 的tq
     // call from ... listening_rev_handler ... dispatch_task
-    notice_init(&me->event_base, &me->tq_notice, do_task_handler, &me->tq);
+    notice_init(&me->event_base, &me->tq_notice, do_task_handler, me);
 
     while (me->running) 
 	{
@@ -506,61 +608,84 @@ exit:
     return nullptr;
 }
 
-// datannode thread
-static int create_dn_thread(cycle_t *cycle)
+// dn and cli I/O threads, each one accepts on its own listening sockets 
+// and owns its event_base and bque
+static int create_io_threads(cycle_t *cycle, dfs_thread_t **threads, 
+    int num, int type, TREAD_FUNC func)
 {
-    int i = 0; 
+    dfs_thread_t *th = nullptr;
+    int           i = 0; 
+    int           j = 0; 
 	
-    dn_thread = (dfs_thread_t *)pool_calloc(cycle->pool, sizeof(dfs_thread_t));
-    if (!dn_thread) 
+    *threads = (dfs_thread_t *)pool_calloc(cycle->pool, 
+		num * sizeof(dfs_thread_t));
+    if (!*threads) 
 	{
         dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "pool_calloc err");
 		
         return NGX_ERROR;
     }
-    
-    if (thread_setup(dn_thread, THREAD_DN) != NGX_OK)
+
+    for (i = 0; i < num; i++) 
 	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "thread_setup err");
+        th = &(*threads)[i];
 		
-        return NGX_ERROR;
-    }
+        if (thread_setup(th, type) != NGX_OK)
+		{
+            dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
+				"thread_setup err");
+		
+            return NGX_ERROR;
+        }
 
-    //
-    task_queue_init(&dn_thread->tq);
-	
-    dn_thread->queue_size = ((conf_server_t*)cycle->sconf)->worker_n;
-	// write que queue 数组
-    dn_thread->bque = (task_queue_t *)malloc(sizeof(task_queue_t) * dn_thread->queue_size);
-    if (!dn_thread->bque)
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "queue malloc fail");
-    }
+        th->queue_size = ((conf_server_t*)cycle->sconf)->worker_n;
+	    // write que queue 数组
+        th->bque = (task_queue_t *)malloc(sizeof(task_queue_t) * th->queue_size);
+        if (!th->bque)
+	    {
+            dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
+				"queue malloc fail");
+			
+            return NGX_ERROR;
+        }
 
-    // 初始化 bque 数组的每一个数组
-    for (i = 0; i < dn_thread->queue_size; i++ )
-	{
-        task_queue_init(&dn_thread->bque[i]);
-    }
+        // 初始化 bque 数组的每一个数组
+        for (j = 0; j < th->queue_size; j++)
+	    {
+            task_queue_init(&th->bque[j]);
+        }
 	
-    dn_thread->run_func= thread_dn_cycle; //
-    dn_thread->running = NGX_TRUE;
-    dn_thread->state = THREAD_ST_UNSTART;
+        th->busy_poll = ((conf_server_t*)cycle->sconf)->io_busy_poll;
+        th->inflight_max = ((conf_server_t*)cycle->sconf)->max_inflight 
+			/ (dn_thread_num + cli_thread_num);
+        th->inflight_max = th->inflight_max ? th->inflight_max : 1;
+        queue_init(&th->paused);
+        th->run_func = func;
+        th->running = NGX_TRUE;
+        th->state = THREAD_ST_UNSTART;
 	
-    if (thread_create(dn_thread) != NGX_OK)
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
-			"thread_create error");
+        if (thread_create(th) != NGX_OK)
+	    {
+            dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
+			    "thread_create error");
 		
-        return NGX_ERROR;
+            return NGX_ERROR;
+        }
+	
+        threads_total_add(1);
     }
 	
-    threads_total_add(1);
     wait_for_thread_registration();
 	
-    if (dn_thread->state != THREAD_ST_OK) 
+    for (i = 0; i < num; i++) 
 	{
-        return NGX_ERROR;
+        if ((*threads)[i].state != THREAD_ST_OK) 
+		{
+            dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0,
+                "create io thread[%d] err", i);
+			
+            return NGX_ERROR;
+        }
     }
 	
     return NGX_OK;
@@ -572,14 +697,14 @@ static void * thread_dn_cycle(void * args)
     dfs_thread_t *me = (dfs_thread_t *)args;
     array_t      *listens = nullptr;
     
-    listens = cycle_get_listen_for_dn();
+    listens = cycle_get_listen_for_dn(me - dn_threads);
     thread_bind_key(me); //THREAD_DN
 
     // 添加读事件
     // 唤醒时执行 net_response_handler => write_back_pack_queue
     notice_init(&me->event_base, &me->tq_notice, net_response_handler, me);
 
-    // 对所有的datanode 监听的listens 添加listening 的 read event
+    // 对这个线程的 datanode listens 添加listening 的 read event
     // rev->handler = ls->handler
     // listen_rev_handler
     if (conn_listening_add_event(&me->event_base, listens) != NGX_OK)
@@ -593,8 +718,6 @@ static void * thread_dn_cycle(void * args)
     while (me->running)
 	{
         thread_event_process(me);
-
-		usleep(3000);
     }
 
 exit:
@@ -605,69 +728,12 @@ exit:
     return nullptr;
 }
 
-static int create_cli_thread(cycle_t *cycle)
-{
-    int i = 0; 
-	
-    cli_thread = (dfs_thread_t *)pool_calloc(cycle->pool, sizeof(dfs_thread_t));
-    if (!cli_thread) 
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "pool_calloc err");
-		
-        return NGX_ERROR;
-    }
-    
-    if (thread_setup(cli_thread, THREAD_CLI) != NGX_OK)
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "thread_setup err");
-		
-        return NGX_ERROR;
-    }
-	
-    task_queue_init(&cli_thread->tq);
-	
-    cli_thread->queue_size = ((conf_server_t*)cycle->sconf)->worker_n;
-	
-    cli_thread->bque = (task_queue_t *)malloc(sizeof(task_queue_t) * cli_thread->queue_size);
-    if (!cli_thread->bque)
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "queue malloc fail");
-    }
-	
-    for (i = 0; i < cli_thread->queue_size; i++ )
-	{
-        task_queue_init(&cli_thread->bque[i]);
-    }
-	
-    cli_thread->run_func= thread_cli_cycle;
-    cli_thread->running = NGX_TRUE;
-    cli_thread->state = THREAD_ST_UNSTART;
-	
-    if (thread_create(cli_thread) != NGX_OK)
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
-			"thread_create error");
-		
-        return NGX_ERROR;
-    }
-	
-    threads_total_add(1);
-    wait_for_thread_registration();
-	
-    if (cli_thread->state != THREAD_ST_OK) 
-	{
-        return NGX_ERROR;
-    }
-	
-    return NGX_OK;
-}
-
 static void * thread_cli_cycle(void * args)
 {
     dfs_thread_t *me = (dfs_thread_t *)args;
     array_t      *listens = nullptr;
     
-    listens = cycle_get_listen_for_cli();
+    listens = cycle_get_listen_for_cli(me - cli_threads);
     thread_bind_key(me);
     
     notice_init(&me->event_base, &me->tq_notice, net_response_handler, me);
@@ -830,14 +896,17 @@ static void channel_handler(event_t *ev)
     }
 }
 
-static void stop_cli_thread()
+static void stop_io_threads(dfs_thread_t *threads, int num)
 {
-    cli_thread->running = NGX_FALSE;
-}
-
-static void stop_dn_thread()
-{
-    dn_thread->running = NGX_FALSE;
+    int i = 0;
+	
+    for (i = 0; i < num; i++) 
+	{
+        threads[i].running = NGX_FALSE;
+		
+        // it may sleep in epoll with no timer pending
+        notice_wake_up(&threads[i].tq_notice);
+    }
 }
 
 static void stop_task_thread(cycle_t *cycle)
@@ -864,9 +933,17 @@ static void threads_total_add(int n)
     total_threads += n;
 }
 
-static inline int hash_task_key(char* str, int len)
+// fnv-1a of all len bytes, keys that share a prefix still spread
+static inline uint32_t hash_task_key(const char *str, size_t len)
 {
-    (void) len;
-    return str[0];
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+	{
+        h ^= (uchar_t)str[i];
+        h *= 16777619u;
+    }
+
+    return h;
 }
 
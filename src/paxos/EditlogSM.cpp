@@ -1,6 +1,7 @@
 
 #include "EditlogSM.h"
 #include "dfs_types.h"
+#include "dfs_varint.h"
 
 #include "nn_file_index.h"
 
@@ -8,7 +9,7 @@
 
 
 
-PhxEditlogSM::PhxEditlogSM() : m_llCheckpointInstanceID(NoCheckpoint)
+PhxEditlogSM::PhxEditlogSM()
 {
 }
 
@@ -30,11 +31,12 @@ bool PhxEditlogSM::Execute(const int iGroupIdx, const uint64_t llInstanceID,
         poPhxEditlogSMCtx->iExecuteRet = NGX_OK;
         poPhxEditlogSMCtx->llInstanceID = llInstanceID; // 提议的值
         // paxos handler
-		update_fi_cache_mgmt(llInstanceID, sPaxosValue, poPhxEditlogSMCtx->data);
+		update_fi_cache_mgmt(iGroupIdx, llInstanceID, sPaxosValue, 
+			poPhxEditlogSMCtx->data);
     }
 	else 
 	{
-        update_fi_cache_mgmt(llInstanceID, sPaxosValue, nullptr);
+        update_fi_cache_mgmt(iGroupIdx, llInstanceID, sPaxosValue, nullptr);
 	}
 //    printf(                  "[SM Execute] ok, smid: %d, instanceid: %lu, value: %s\n",
 //                  SMID(), llInstanceID, sPaxosValue.c_str());
@@ -46,14 +48,238 @@ const int PhxEditlogSM::SMID() const
     return 1; 
 }
 
+// each group is replayed from its own checkpoint instance
 const uint64_t PhxEditlogSM::GetCheckpointInstanceID(const int iGroupIdx) const
 {
-    return m_llCheckpointInstanceID;
+    if (iGroupIdx < 0 || (size_t)iGroupIdx >= m_vecCheckpointInstanceID.size())
+    {
+        return NoCheckpoint;
+    }
+
+    return m_vecCheckpointInstanceID[iGroupIdx];
+}
+
+int PhxEditlogSM::SyncCheckpointInstanceID(const int iGroupIdx, 
+    const uint64_t llInstanceID)
+{
+    if (iGroupIdx < 0)
+    {
+        return NGX_ERROR;
+    }
+
+    if ((size_t)iGroupIdx >= m_vecCheckpointInstanceID.size())
+    {
+        m_vecCheckpointInstanceID.resize(iGroupIdx + 1, NoCheckpoint);
+    }
+
+    m_vecCheckpointInstanceID[iGroupIdx] = llInstanceID;
+
+    return NGX_OK;
+}
+
+int PhxEditlogSM::LockCheckpointState()
+{
+    return fi_ckp_state_lock();
+}
+
+// one image holds every group, any group that asks is sent all of it
+int PhxEditlogSM::GetCheckpointState(const int iGroupIdx, 
+    string & sDirPath, vector<string> & vecFileList)
+{
+    return fi_ckp_state_files(sDirPath, vecFileList);
+}
+
+void PhxEditlogSM::UnLockCheckpointState()
+{
+    fi_ckp_state_unlock();
+}
+
+// paxos kills the process after this, the restart loads the image
+int PhxEditlogSM::LoadCheckpointState(const int iGroupIdx, 
+    const string & sCheckpointTmpFileDirPath,
+    const vector<string> & vecFileList, 
+    const uint64_t llCheckpointInstanceID)
+{
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+        "group %d loads checkpoint %lu from %s", iGroupIdx, 
+        llCheckpointInstanceID, sCheckpointTmpFileDirPath.c_str());
+
+    return fi_ckp_state_load(sCheckpointTmpFileDirPath, vecFileList, 
+        llCheckpointInstanceID);
+}
+
+bool EditlogIsBatch(const string & sValue)
+{
+    return !sValue.empty() && sValue[0] == EDITLOG_BATCH_TAG;
+}
+
+// sOps is the length and bytes of each of iOpNum edits, as
+// EditlogRecAppend leaves them
+void EditlogBatchEncode(const string & sOps, const int iOpNum, 
+    string & sValue)
+{
+    uchar_t num[DFS_VARINT_MAX_LEN];
+
+    sValue.clear();
+    sValue.reserve(1 + dfs_varint_len(iOpNum) + sOps.size());
+    sValue.push_back(EDITLOG_BATCH_TAG);
+    sValue.append((const char *)num, dfs_varint_encode(num, iOpNum) - num);
+    sValue.append(sOps);
 }
 
-int PhxEditlogSM::SyncCheckpointInstanceID(const uint64_t llInstanceID)
+// the ops point into sValue
+int EditlogBatchDecode(const string & sValue, vector<EditlogOp> & vecOps)
 {
-    m_llCheckpointInstanceID = llInstanceID;
+    uchar_t  *p = (uchar_t *)sValue.data() + 1;
+    uchar_t  *end = (uchar_t *)sValue.data() + sValue.size();
+    uint64_t  num = 0;
+    uint64_t  len = 0;
+
+    if (!EditlogIsBatch(sValue) 
+        || (p = dfs_varint_decode(p, end, &num)) == nullptr)
+    {
+        return NGX_ERROR;
+    }
+
+    vecOps.clear();
+
+    for (uint64_t i = 0; i < num; i++)
+    {
+        p = dfs_varint_decode(p, end, &len);
+        if (p == nullptr || len > (uint64_t)(end - p))
+        {
+            return NGX_ERROR;
+        }
+
+        vecOps.push_back(EditlogOp((const char *)p, len));
+        p += len;
+    }
+
+    return NGX_OK;
+}
+
+static size_t EditlogStrLen(size_t iLen)
+{
+    return dfs_varint_len(iLen) + iLen;
+}
+
+static uchar_t *EditlogPutStr(uchar_t *p, const char *s, size_t iLen)
+{
+    p = dfs_varint_encode(p, iLen);
+
+    if (iLen > 0)
+    {
+        memcpy(p, s, iLen);
+    }
+
+    return p + iLen;
+}
+
+static uchar_t *EditlogGetStr(uchar_t *p, uchar_t *end, const char **s, 
+    size_t *iLen)
+{
+    uint64_t len = 0;
+
+    p = dfs_varint_decode(p, end, &len);
+    if (p == nullptr || len > (uint64_t)(end - p))
+    {
+        return nullptr;
+    }
+
+    *s = (const char *)p;
+    *iLen = len;
+
+    return p + len;
+}
+
+size_t EditlogRecLen(const editlog_rec_t * poRec)
+{
+    return 1 + dfs_varint_len(poRec->optype) 
+        + EditlogStrLen(poRec->key_len) + EditlogStrLen(poRec->dst_len)
+        + EditlogStrLen(poRec->owner_len) + EditlogStrLen(poRec->group_len)
+        + dfs_varint_len(poRec->permission) 
+        + dfs_varint_len(poRec->modification_time)
+        + dfs_varint_len(poRec->blk_id) + dfs_varint_len(poRec->blk_sz)
+        + dfs_varint_len(poRec->blk_rep) + dfs_varint_len(poRec->blk_seq)
+        + dfs_varint_len(poRec->total_blk) + dfs_varint_len(poRec->len);
+}
+
+// the length and the record, encoded in place at the end of sOps. a
+// buffer that is reused keeps its capacity, so this does not allocate
+void EditlogRecAppend(string & sOps, const editlog_rec_t * poRec)
+{
+    size_t   iRecLen = EditlogRecLen(poRec);
+    size_t   iOff = sOps.size();
+    uchar_t *p = nullptr;
+
+    sOps.resize(iOff + dfs_varint_len(iRecLen) + iRecLen);
+
+    p = (uchar_t *)&sOps[iOff];
+    p = dfs_varint_encode(p, iRecLen);
+    *p++ = EDITLOG_REC_TAG;
+    p = dfs_varint_encode(p, poRec->optype);
+    p = EditlogPutStr(p, poRec->key, poRec->key_len);
+    p = EditlogPutStr(p, poRec->dst, poRec->dst_len);
+    p = EditlogPutStr(p, poRec->owner, poRec->owner_len);
+    p = EditlogPutStr(p, poRec->group, poRec->group_len);
+    p = dfs_varint_encode(p, poRec->permission);
+    p = dfs_varint_encode(p, poRec->modification_time);
+    p = dfs_varint_encode(p, poRec->blk_id);
+    p = dfs_varint_encode(p, poRec->blk_sz);
+    p = dfs_varint_encode(p, poRec->blk_rep);
+    p = dfs_varint_encode(p, poRec->blk_seq);
+    p = dfs_varint_encode(p, poRec->total_blk);
+    dfs_varint_encode(p, poRec->len);
+}
+
+// DFS_DECLINED if pcBuf is not a packed record, a LogOperator then
+int EditlogRecDecode(const char * pcBuf, const size_t iLen, 
+    editlog_rec_t * poRec)
+{
+    uchar_t  *p = (uchar_t *)pcBuf;
+    uchar_t  *end = p + iLen;
+    uint64_t  v[9];
+
+    if (iLen == 0 || *p != (uchar_t)EDITLOG_REC_TAG)
+    {
+        return DFS_DECLINED;
+    }
+
+    p = dfs_varint_decode(p + 1, end, &v[0]);
+    if (p == nullptr)
+    {
+        return NGX_ERROR;
+    }
+
+    poRec->optype = (uint32_t)v[0];
+
+    if ((p = EditlogGetStr(p, end, &poRec->key, &poRec->key_len)) == nullptr
+        || (p = EditlogGetStr(p, end, &poRec->dst, &poRec->dst_len)) == nullptr
+        || (p = EditlogGetStr(p, end, &poRec->owner, 
+            &poRec->owner_len)) == nullptr
+        || (p = EditlogGetStr(p, end, &poRec->group, 
+            &poRec->group_len)) == nullptr)
+    {
+        return NGX_ERROR;
+    }
+
+    for (int i = 1; i < 9; i++)
+    {
+        p = dfs_varint_decode(p, end, &v[i]);
+        if (p == nullptr)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    poRec->permission = (uint32_t)v[1];
+    poRec->modification_time = v[2];
+    poRec->blk_id = v[3];
+    poRec->blk_sz = v[4];
+    poRec->blk_rep = (uint32_t)v[5];
+    poRec->blk_seq = (uint32_t)v[6];
+    poRec->total_blk = (uint32_t)v[7];
+    poRec->len = v[8];
 
     return NGX_OK;
 }
@@ -5,6 +5,9 @@
 #include "phxpaxos/options.h"
 #include <stdio.h>
 #include <unistd.h>
+#include <string>
+#include <vector>
+#include "dfs_types.h"
 
 using namespace phxpaxos;
 using namespace std;
@@ -24,6 +27,55 @@ public:
     }
 };
 
+// several edits proposed as one value: a 0 byte, which no serialized
+// LogOperator starts with, the count, then the length and bytes of
+// each, the numbers as varints
+#define EDITLOG_BATCH_TAG '\0'
+
+/*
+ * an edit record packed by hand: a 1 byte, which no serialized
+ * LogOperator starts with either, then the fields below in order, the
+ * numbers as varints and the strings as a varint length and the bytes.
+ * every op has all of them, the ones it does not use are 0 or empty.
+ * decoding points the strings into the value, so neither way
+ * allocates. older logs hold LogOperators, the apply path still reads
+ * them
+ */
+#define EDITLOG_REC_TAG '\1'
+
+typedef struct editlog_rec_s
+{
+    uint32_t    optype;
+    const char *key;
+    size_t      key_len;
+    const char *dst;        // rename only
+    size_t      dst_len;
+    const char *owner;
+    size_t      owner_len;
+    const char *group;
+    size_t      group_len;
+    uint32_t    permission;
+    uint64_t    modification_time;
+    uint64_t    blk_id;
+    uint64_t    blk_sz;
+    uint32_t    blk_rep;
+    uint32_t    blk_seq;
+    uint32_t    total_blk;
+    uint64_t    len;
+} editlog_rec_t;
+
+typedef std::pair<const char *, size_t> EditlogOp;
+
+bool EditlogIsBatch(const string & sValue);
+void EditlogBatchEncode(const string & sOps, const int iOpNum, 
+        string & sValue);
+int EditlogBatchDecode(const string & sValue, vector<EditlogOp> & vecOps);
+
+size_t EditlogRecLen(const editlog_rec_t * poRec);
+void EditlogRecAppend(string & sOps, const editlog_rec_t * poRec);
+int EditlogRecDecode(const char * pcBuf, const size_t iLen, 
+        editlog_rec_t * poRec);
+
 // 状态机
 class PhxEditlogSM : public StateMachine
 {
@@ -40,10 +92,21 @@ public:
     const int SMID() const;
 
     const uint64_t GetCheckpointInstanceID(const int iGroupIdx) const;
-    int SyncCheckpointInstanceID(const uint64_t llInstanceID);
+    int SyncCheckpointInstanceID(const int iGroupIdx, 
+            const uint64_t llInstanceID);
+
+    // a lagging node is sent our last checkpoint instead of the log
+    int LockCheckpointState();
+    int GetCheckpointState(const int iGroupIdx, string & sDirPath, 
+            vector<string> & vecFileList);
+    void UnLockCheckpointState();
+    int LoadCheckpointState(const int iGroupIdx, 
+            const string & sCheckpointTmpFileDirPath,
+            const vector<string> & vecFileList, 
+            const uint64_t llCheckpointInstanceID);
 
 private:
-    uint64_t m_llCheckpointInstanceID;
+    vector<uint64_t> m_vecCheckpointInstanceID; // by group
 };
 
 #endif
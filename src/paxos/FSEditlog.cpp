@@ -5,10 +5,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/time.h>
 #include "dfs_types.h"
 #include "dfs_error_log.h"
 #include "nn_cycle.h"
 #include "nn_error_log.h"
+#include "nn_file_index.h"
 
 FSEditlog::FSEditlog(int enableMaster,const NodeInfo & oMyNode, const NodeInfoList & vecNodeList,
     string & sPaxosLogPath, int iGroupCount) : m_oMyNode(oMyNode), 
@@ -27,9 +29,28 @@ FSEditlog::~FSEditlog()
 }
 
 // llInstanceId 这里是 checkpoint id
-void FSEditlog::setCheckpointInstanceID(const uint64_t llInstanceID)
+void FSEditlog::setCheckpointInstanceID(const int iGroupIdx, 
+    const uint64_t llInstanceID)
 {
-    m_oEditlogSM.SyncCheckpointInstanceID(llInstanceID);
+    m_oEditlogSM.SyncCheckpointInstanceID(iGroupIdx, llInstanceID);
+}
+
+void FSEditlog::SetCheckpointSendRate(const int iRate)
+{
+    m_oBreakpoint.m_oEditlogCheckpointBP.SetRate(iRate);
+}
+
+// paxos drops the log before the checkpoint instance of each group,
+// but for the last llHoldCount instances
+void FSEditlog::TruncateLog(const uint64_t llHoldCount)
+{
+    if (nullptr == m_poPaxosNode)
+    {
+        return;
+    }
+
+    m_poPaxosNode->SetHoldPaxosLogCount(llHoldCount);
+    m_poPaxosNode->ContinuePaxosLogCleaner();
 }
 
 int FSEditlog::RunPaxos()
@@ -63,6 +84,7 @@ int FSEditlog::RunPaxos()
     }
 
     oOptions.pLogFunc = nn_log_paxos;
+    oOptions.poBreakpoint = &m_oBreakpoint;
 
     ret = Node::RunNode(oOptions, m_poPaxosNode); //通过Node::RunNode即可获得PhxPaxos的实例指针
     if (ret != NGX_OK)
@@ -89,8 +111,11 @@ const NodeInfo FSEditlog::GetMaster(const string & sKey)
 
 const bool FSEditlog::IsIMMaster(const string & sKey)
 {
-    int iGroupIdx = GetGroupIdx(sKey);
+    return IsIMMaster(GetGroupIdx(sKey));
+}
 
+const bool FSEditlog::IsIMMaster(const int iGroupIdx)
+{
     if(enableMaster){
         return m_poPaxosNode->IsIMMaster(iGroupIdx);
     } else{
@@ -103,6 +128,12 @@ int FSEditlog::Propose(const string & sKey, const string & sPaxosValue,
 {
     int iGroupIdx = GetGroupIdx(sKey); //sKey 是目录, hash算法得到groupindex
 
+    return Propose(iGroupIdx, sPaxosValue, oEditlogSMCtx);
+}
+
+int FSEditlog::Propose(const int iGroupIdx, const string & sPaxosValue, 
+    PhxEditlogSMCtx & oEditlogSMCtx)
+{
     SMCtx oCtx;
     //smid must same to PhxEditlogSM.SMID().
     oCtx.m_iSMID = 1; //设置oCtx.m_iSMID为1，与我们刚刚编写的状态机的SMID()相对应，标识我们需要将这个请求送往SMID为1的状态机的Execute函数。
@@ -121,6 +152,17 @@ int FSEditlog::Propose(const string & sKey, const string & sPaxosValue,
     return NGX_OK;
 }
 
+// one consensus round for the iOpNum edits of sOps, as EditlogRecAppend
+// leaves them, they are applied in order under one instance id
+int FSEditlog::ProposeBatch(const string & sKey, const string & sOps, 
+    const int iOpNum, PhxEditlogSMCtx & oEditlogSMCtx)
+{
+    string sPaxosValue;
+    EditlogBatchEncode(sOps, iOpNum, sPaxosValue);
+
+    return Propose(sKey, sPaxosValue, oEditlogSMCtx);
+}
+
 int FSEditlog::MakeLogStoragePath(std::string & sLogStoragePath)
 {
     char sTmp[128] = {0};
@@ -144,15 +186,85 @@ int FSEditlog::MakeLogStoragePath(std::string & sLogStoragePath)
     return NGX_OK;
 }
 
+// a key goes to the group of its top level directory, so one group
+// orders all the edits of a subtree and a create is in the group of
+// its parent. the root itself is in group 0
 int FSEditlog::GetGroupIdx(const string & sKey)
 {
-    uint32_t iHashNum = 0;
+    uint32_t  iHashNum = 0;
+    fi_path_t oPath;
+
+    if (m_iGroupCount <= 1 
+        || fi_path_parse((uchar_t *)sKey.c_str(), &oPath) != NGX_OK 
+        || oPath.num == 0)
+    {
+        return 0;
+    }
 	
-    for (size_t i = 0; i < sKey.size(); i++)
+    for (size_t i = 0; i < oPath.lens[0]; i++)
     {
-        iHashNum = iHashNum * 7 + ((int)sKey[i]);
+        iHashNum = iHashNum * 7 + ((int)oPath.names[0][i]);
     }
 
     return iHashNum % m_iGroupCount;
 }
 
+int FSEditlog::GetGroupCount() const
+{
+    return m_iGroupCount;
+}
+
+EditlogCheckpointBP::EditlogCheckpointBP() : m_iRate(0), m_llNextUs(0)
+{
+    pthread_mutex_init(&m_oLock, nullptr);
+}
+
+EditlogCheckpointBP::~EditlogCheckpointBP()
+{
+    pthread_mutex_destroy(&m_oLock);
+}
+
+void EditlogCheckpointBP::SetRate(const int iRate)
+{
+    m_iRate = iRate;
+}
+
+// called by a sender before each block, it sleeps off its share
+void EditlogCheckpointBP::SendCheckpointOneBlock()
+{
+    struct timeval tv;
+    uint64_t llNowUs = 0;
+    uint64_t llWaitUs = 0;
+
+    if (m_iRate <= 0)
+    {
+        return;
+    }
+
+    gettimeofday(&tv, nullptr);
+    llNowUs = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+    pthread_mutex_lock(&m_oLock);
+
+    if (m_llNextUs < llNowUs)
+    {
+        m_llNextUs = llNowUs;
+    }
+
+    llWaitUs = m_llNextUs - llNowUs;
+    m_llNextUs += (uint64_t)EDITLOG_CKP_BLOCK * 1000000 
+        / ((uint64_t)m_iRate << 20);
+
+    pthread_mutex_unlock(&m_oLock);
+
+    if (llWaitUs > 0)
+    {
+        usleep(llWaitUs);
+    }
+}
+
+CheckpointBP * EditlogBreakpoint::GetCheckpointBP()
+{
+    return &m_oEditlogCheckpointBP;
+}
+
@@ -3,12 +3,43 @@
 
 #include "phxpaxos/node.h"
 #include "EditlogSM.h"
+#include "phxpaxos/breakpoint.h"
+#include <pthread.h>
 #include <string>
 #include <vector>
 
 using namespace phxpaxos;
 using namespace std;
 
+// the block size paxos streams a checkpoint in
+#define EDITLOG_CKP_BLOCK (1 << 20)
+
+// paces the checkpoint blocks we send, the senders of all groups share
+// one budget of m_iRate MB/s
+class EditlogCheckpointBP : public CheckpointBP
+{
+public:
+    EditlogCheckpointBP();
+    ~EditlogCheckpointBP();
+
+    void SetRate(const int iRate);
+    void SendCheckpointOneBlock();
+
+private:
+    pthread_mutex_t m_oLock;
+    int m_iRate;
+    uint64_t m_llNextUs; // when the next block may go
+};
+
+class EditlogBreakpoint : public Breakpoint
+{
+public:
+    CheckpointBP * GetCheckpointBP();
+
+public:
+    EditlogCheckpointBP m_oEditlogCheckpointBP;
+};
+
 class FSEditlog
 {
 public:
@@ -16,21 +47,32 @@ public:
         string & sPaxosLogPath, int iGroupCount);
     ~FSEditlog();
 
-    void setCheckpointInstanceID(const uint64_t llInstanceID);
+    void setCheckpointInstanceID(const int iGroupIdx, 
+        const uint64_t llInstanceID);
 	
     int RunPaxos();
 
     const NodeInfo GetMaster(const string & sKey);
     const bool IsIMMaster(const string & sKey);
+    const bool IsIMMaster(const int iGroupIdx);
 
 	int Propose(const string & sKey, const string & sPaxosValue, 
         PhxEditlogSMCtx & oEditlogSMCtx);
+	int Propose(const int iGroupIdx, const string & sPaxosValue, 
+        PhxEditlogSMCtx & oEditlogSMCtx);
+	int ProposeBatch(const string & sKey, const string & sOps, 
+        const int iOpNum, PhxEditlogSMCtx & oEditlogSMCtx);
+
+    int GetGroupIdx(const string & sKey);
+    int GetGroupCount() const;
+
+    void SetCheckpointSendRate(const int iRate);
+    void TruncateLog(const uint64_t llHoldCount);
 
 public:
     int enableMaster = 0; // not use Master if zero
 private:
     int MakeLogStoragePath(string & sLogStoragePath);
-    int GetGroupIdx(const string & sKey);
     
 private:
     NodeInfo m_oMyNode; //oMyNode标识本机的IP/PORT信息
@@ -40,6 +82,7 @@ private:
 
     Node * m_poPaxosNode; //本次我们需要运行的PhxPaxos实例指针
     PhxEditlogSM m_oEditlogSM; //刚刚编写的状态机类
+    EditlogBreakpoint m_oBreakpoint;
 };
 
 #endif
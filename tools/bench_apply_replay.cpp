@@ -0,0 +1,272 @@
+/*
+ * edit replay time with apply_threads 1 to 16: a recorded stream of
+ * batched instances is applied the way a follower catches up after a
+ * restart, each run in a child process as the file index is global.
+ * without a stream one is recorded first, a create storm spread over
+ * many dirs with a mkdir now and then.
+ *
+ *   bench_apply_replay [instances] [stream path]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <vector>
+
+#include "nn_file_index.h"
+#include "nn_blk_index.h"
+#include "nn_conf.h"
+#include "dfs_error_log.h"
+#include "dfs_memory.h"
+#include "dfs_memory_pool.h"
+#include "EditlogSM.h"
+
+#define BENCH_BATCH 64
+#define BENCH_DIRS  256
+
+// what nn_main.cpp gives the rest of the namenode
+string_t   config_file;
+char     **dfs_argv;
+
+static string_t *bench_log_time()
+{
+	static string_t t = string_make("-");
+
+	return &t;
+}
+
+static double bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_key(const char *path, char *key)
+{
+	memory_zero(key, KEY_LEN);
+	key_encode((uchar_t *)path, (uchar_t *)key);
+}
+
+// instance id, value length and value, one after another
+static int bench_record(const char *path, int instances)
+{
+	static char keys[BENCH_BATCH][KEY_LEN];
+	FILE       *f = fopen(path, "w");
+	uint64_t    file = 0;
+
+	if (!f)
+	{
+		return NGX_ERROR;
+	}
+
+	srand(5);
+
+	for (uint64_t id = 1; id <= (uint64_t)instances; id++)
+	{
+		std::string ops;
+		std::string value;
+		uint32_t    len = 0;
+
+		for (int i = 0; i < BENCH_BATCH; i++)
+		{
+			editlog_rec_t rec;
+			char          p[PATH_LEN];
+			int           dir = rand() % BENCH_DIRS;
+
+			memory_zero(&rec, sizeof(rec));
+			rec.owner = "hdfs";
+			rec.owner_len = 4;
+			rec.group = "supergroup";
+			rec.group_len = 10;
+			rec.permission = 0755;
+			rec.modification_time = id * 1000 + i;
+
+			// the first instances make the dirs the files go in
+			if (id <= BENCH_DIRS / BENCH_BATCH)
+			{
+				rec.optype = NN_MKDIR;
+				snprintf(p, sizeof(p), "/user/u%d/d0",
+					(int)(id - 1) * BENCH_BATCH + i);
+			}
+			else if (rand() % 32 == 0)
+			{
+				rec.optype = NN_MKDIR;
+				snprintf(p, sizeof(p), "/user/u%d/d%d", dir, 1 + rand() % 8);
+			}
+			else
+			{
+				rec.optype = NN_CREATE;
+				rec.blk_id = ++file;
+				rec.blk_sz = 64 << 20;
+				rec.blk_rep = 3;
+				rec.blk_seq = 1;
+				rec.total_blk = 1;
+				snprintf(p, sizeof(p), "/user/u%d/d0/part-%lu", dir,
+					(unsigned long)file);
+			}
+
+			bench_key(p, keys[i]);
+			rec.key = keys[i];
+			rec.key_len = strlen(keys[i]);
+
+			EditlogRecAppend(ops, &rec);
+		}
+
+		EditlogBatchEncode(ops, BENCH_BATCH, value);
+		len = (uint32_t)value.size();
+
+		if (fwrite(&id, sizeof(id), 1, f) != 1
+			|| fwrite(&len, sizeof(len), 1, f) != 1
+			|| fwrite(value.data(), 1, len, f) != len)
+		{
+			fclose(f);
+
+			return NGX_ERROR;
+		}
+	}
+
+	fclose(f);
+
+	return NGX_OK;
+}
+
+static int bench_load(const char *path, std::vector<uint64_t> &ids,
+	std::vector<std::string> &values)
+{
+	FILE     *f = fopen(path, "r");
+	uint64_t  id = 0;
+	uint32_t  len = 0;
+
+	if (!f)
+	{
+		return NGX_ERROR;
+	}
+
+	while (fread(&id, sizeof(id), 1, f) == 1
+		&& fread(&len, sizeof(len), 1, f) == 1)
+	{
+		std::string value(len, '\0');
+
+		if (fread(&value[0], 1, len, f) != len)
+		{
+			break;
+		}
+
+		ids.push_back(id);
+		values.push_back(value);
+	}
+
+	fclose(f);
+
+	return ids.empty() ? NGX_ERROR : NGX_OK;
+}
+
+static int bench_run(int threads, const char *path)
+{
+	std::vector<uint64_t>    ids;
+	std::vector<std::string> values;
+	cycle_t                  cycle;
+	conf_server_t            sconf;
+	pool_t                  *pool = pool_create(4096, 4096, nullptr);
+	double                   t = 0;
+
+	memory_zero(&cycle, sizeof(cycle));
+	memory_zero(&sconf, sizeof(sconf));
+
+	if (!pool || !(cycle.error_log = error_log_init_with_stderr(pool))
+		|| bench_load(path, ids, values) != NGX_OK)
+	{
+		return 1;
+	}
+
+	error_log_set_handle(cycle.error_log, bench_log_time, nullptr);
+	cycle.error_log->log_level = DFS_LOG_ALERT;
+	cycle.pool = pool;
+
+	sconf.index_num = 2 * ids.size() * BENCH_BATCH + BENCH_DIRS * 16;
+	sconf.index_shard_num = 64;
+	sconf.apply_threads = threads;
+	sconf.paxos_group_num = 1;
+	cycle.sconf = &sconf;
+	dfs_cycle = &cycle;
+
+	if (nn_blk_index_worker_init(&cycle) != NGX_OK
+		|| nn_file_index_worker_init(&cycle) != NGX_OK)
+	{
+		return 1;
+	}
+
+	t = bench_now();
+
+	for (size_t i = 0; i < ids.size(); i++)
+	{
+		update_fi_cache_mgmt(0, ids[i], values[i], nullptr);
+	}
+
+	t = bench_now() - t;
+
+	printf("%7d %10lu %10lu %10.1f %12.0f\n", threads,
+		(unsigned long)ids.size(), (unsigned long)ids.size() * BENCH_BATCH,
+		t * 1000, ids.size() * BENCH_BATCH / t);
+	fflush(stdout);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int         instances = argc > 1 ? atoi(argv[1]) : 2000;
+	char        tmp[64];
+	const char *path = argc > 2 ? argv[2] : nullptr;
+	int         threads[] = { 1, 2, 4, 8, 16 };
+
+	if (!path || access(path, R_OK) != 0)
+	{
+		if (!path)
+		{
+			snprintf(tmp, sizeof(tmp), "/tmp/bench_apply.%d", getpid());
+			path = tmp;
+		}
+
+		if (bench_record(path, instances) != NGX_OK)
+		{
+			fprintf(stderr, "record %s failed\n", path);
+
+			return 1;
+		}
+	}
+
+	printf("threads  instances      edits         ms      edits/s\n");
+	fflush(stdout);
+
+	for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+	{
+		pid_t pid = fork();
+		int   status = 0;
+
+		if (pid == 0)
+		{
+			_exit(bench_run(threads[i], path));
+		}
+
+		if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+			|| WEXITSTATUS(status) != 0)
+		{
+			fprintf(stderr, "replay with %d threads failed\n", threads[i]);
+		}
+	}
+
+	if (path == tmp)
+	{
+		unlink(tmp);
+	}
+
+	return 0;
+}
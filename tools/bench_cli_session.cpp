@@ -0,0 +1,316 @@
+/*
+ * small op throughput per client over nn_session, one request at a
+ * time as the client used to go against a window of NN_SESSION_WINDOW
+ * requests in flight. with no address a namenode stand-in on loopback
+ * answers every request at once, so the numbers are the client and
+ * wire cost. with an address the requests are getfileinfo of "/".
+ *
+ *   bench_cli_session [ops per client] [namenode ip] [port]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "dfscli_session.h"
+#include "dfscli_conf.h"
+#include "dfscli_cycle.h"
+
+#define BENCH_MAX_CLIENTS 16
+
+// what dfscli_main.cpp and the client cycle give the session
+cycle_t *dfs_cycle = nullptr;
+
+void dfscli_log(int level, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+int dfs_connect(char *ip, int port) {
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        return NGX_ERROR;
+    }
+
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(ip);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        dfscli_log(DFS_LOG_WARN, "connect to %s:%d err: %s", ip, port,
+                   strerror(errno));
+        close(fd);
+
+        return NGX_ERROR;
+    }
+
+    return fd;
+}
+
+typedef struct {
+    int window;
+    long ops;
+    double secs;
+    int rc;
+} bench_client_t;
+
+static volatile int bench_start;
+
+static double bench_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// answers each request with ret 0 and its seq, in the order read
+static void *bench_serve_conn(void *arg) {
+    int fd = (int) (long) arg;
+    char *in = (char *) malloc(NN_SESSION_BUF);
+    char *out = (char *) malloc(NN_SESSION_BUF);
+    int in_len = 0;
+
+    while (in && out) {
+        int rs = read(fd, in + in_len, NN_SESSION_BUF - in_len);
+        int pos = 0;
+        int out_len = 0;
+
+        if (rs <= 0) {
+            break;
+        }
+
+        in_len += rs;
+
+        for (;;) {
+            task_t t;
+
+            bzero(&t, sizeof(t));
+
+            int len = task_decodefstr(in + pos, in_len - pos, &t);
+            if (len <= 0) {
+                break;
+            }
+
+            pos += len;
+
+            task_t r;
+
+            bzero(&r, sizeof(r));
+            r.cmd = t.cmd;
+            r.seq = t.seq;
+
+            out_len += task_encode2str(&r, out + out_len,
+                                       NN_SESSION_BUF - out_len);
+        }
+
+        memmove(in, in + pos, in_len - pos);
+        in_len -= pos;
+
+        for (int w = 0; w < out_len; ) {
+            int ws = write(fd, out + w, out_len - w);
+            if (ws <= 0) {
+                goto done;
+            }
+
+            w += ws;
+        }
+    }
+
+done:
+    close(fd);
+    free(in);
+    free(out);
+
+    return nullptr;
+}
+
+static void *bench_serve(void *arg) {
+    int lfd = (int) (long) arg;
+
+    for (;;) {
+        pthread_t tid;
+        int fd = accept(lfd, nullptr, nullptr);
+
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        pthread_create(&tid, nullptr, bench_serve_conn, (void *) (long) fd);
+        pthread_detach(tid);
+    }
+}
+
+static int bench_listen(int *port) {
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || listen(fd, 128) < 0
+        || getsockname(fd, (struct sockaddr *) &addr, &alen) < 0) {
+        return NGX_ERROR;
+    }
+
+    *port = ntohs(addr.sin_port);
+
+    return fd;
+}
+
+static void *bench_client(void *arg) {
+    bench_client_t *c = (bench_client_t *) arg;
+    nn_session_t s;
+    long sent = 0;
+    long done = 0;
+
+    c->rc = NGX_ERROR;
+
+    if (nn_session_open(&s) != NGX_OK) {
+        return nullptr;
+    }
+
+    while (!bench_start) {
+        ;
+    }
+
+    c->secs = bench_now();
+
+    while (done < c->ops) {
+        while (sent < c->ops && sent - done < c->window) {
+            task_t t;
+
+            bzero(&t, sizeof(t));
+            t.cmd = NN_GET_FILE_INFO;
+            strcpy(t.key, "/");
+
+            if (nn_session_send(&s, &t) != NGX_OK) {
+                goto close;
+            }
+
+            sent++;
+        }
+
+        task_t r;
+
+        bzero(&r, sizeof(r));
+
+        if (nn_session_recv(&s, &r) != NGX_OK) {
+            goto close;
+        }
+
+        done++;
+    }
+
+    c->secs = bench_now() - c->secs;
+    c->rc = NGX_OK;
+
+close:
+    nn_session_close(&s);
+
+    return nullptr;
+}
+
+// ops per second of one client, averaged over nclients
+static double bench_run(int nclients, int window, long ops) {
+    bench_client_t c[BENCH_MAX_CLIENTS];
+    pthread_t tids[BENCH_MAX_CLIENTS];
+    double rate = 0;
+
+    bench_start = 0;
+
+    for (int i = 0; i < nclients; i++) {
+        c[i].window = window;
+        c[i].ops = ops;
+        c[i].secs = 0;
+        pthread_create(&tids[i], nullptr, bench_client, &c[i]);
+    }
+
+    // let the connections come up first
+    usleep(100 * 1000);
+    __sync_synchronize();
+    bench_start = 1;
+
+    for (int i = 0; i < nclients; i++) {
+        pthread_join(tids[i], nullptr);
+
+        if (c[i].rc != NGX_OK) {
+            fprintf(stderr, "client %d failed\n", i);
+            exit(1);
+        }
+
+        rate += ops / c[i].secs;
+    }
+
+    return rate / nclients;
+}
+
+int main(int argc, char **argv) {
+    long ops = argc > 1 ? atol(argv[1]) : 100000;
+    const char *ip = argc > 2 ? argv[2] : "127.0.0.1";
+    int port = argc > 3 ? atoi(argv[3]) : 0;
+    conf_server_t sconf;
+    server_bind_t nn_addr;
+    cycle_t cycle;
+
+    if (ops <= 0 || (argc > 2 && port <= 0)) {
+        fprintf(stderr, "usage: %s [ops per client] [namenode ip] [port]\n",
+                argv[0]);
+
+        return 1;
+    }
+
+    if (argc <= 2) {
+        pthread_t tid;
+        int lfd = bench_listen(&port);
+
+        if (lfd < 0) {
+            fprintf(stderr, "listen err: %s\n", strerror(errno));
+
+            return 1;
+        }
+
+        pthread_create(&tid, nullptr, bench_serve, (void *) (long) lfd);
+        pthread_detach(tid);
+    }
+
+    bzero(&sconf, sizeof(sconf));
+    bzero(&nn_addr, sizeof(nn_addr));
+    bzero(&cycle, sizeof(cycle));
+    nn_addr.addr.data = (uchar_t *) ip;
+    nn_addr.addr.len = strlen(ip);
+    nn_addr.port = port;
+    sconf.namenode_addr.elts = &nn_addr;
+    sconf.namenode_addr.nelts = 1;
+    cycle.sconf = &sconf;
+    dfs_cycle = &cycle;
+
+    printf("%-8s %18s %18s\n", "clients", "1 in flight op/s",
+           "window op/s");
+
+    for (int n = 1; n <= BENCH_MAX_CLIENTS; n *= 4) {
+        double one = bench_run(n, 1, ops);
+        double win = bench_run(n, NN_SESSION_WINDOW, ops);
+
+        printf("%-8d %18.0f %18.0f\n", n, one, win);
+    }
+
+    return 0;
+}
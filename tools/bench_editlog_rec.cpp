@@ -0,0 +1,242 @@
+/*
+ * edit record encode and decode, ops per second and bytes per op, as
+ * a LogOperator the way the paxos thread used to build and the apply
+ * path used to parse it, and as a packed record. the packed records go
+ * into one reused batch buffer like the open batch of the paxos thread,
+ * their bytes count the length each has in the batch.
+ *
+ *   bench_editlog_rec [ops per run]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+#include "dfs_string.h"
+#include "dfs_task_cmd.h"
+#include "dfs_varint.h"
+#include "phxeditlog.pb.h"
+#include "EditlogSM.h"
+
+using namespace phxeditlog;
+
+#define BENCH_BATCH 64
+
+// what nn_main.cpp gives the rest of the namenode
+string_t   config_file;
+char     **dfs_argv;
+
+static volatile size_t bench_sink;
+
+static const char *bench_key = "/user/hdfs/warehouse/t1/part-000017";
+
+static double bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_rec(editlog_rec_t *rec, int optype, uint64_t n)
+{
+	memset(rec, 0, sizeof(editlog_rec_t));
+	rec->optype = optype;
+	rec->key = bench_key;
+	rec->key_len = strlen(bench_key);
+	rec->modification_time = 1700000000000ULL + n;
+
+	switch (optype)
+	{
+	case NN_MKDIR:
+		rec->owner = "hdfs";
+		rec->owner_len = 4;
+		rec->group = "supergroup";
+		rec->group_len = 10;
+		rec->permission = 0755;
+		break;
+
+	case NN_CREATE:
+		rec->owner = "hdfs";
+		rec->owner_len = 4;
+		rec->group = "supergroup";
+		rec->group_len = 10;
+		rec->permission = 0644;
+		rec->blk_id = 1000000 + n;
+		rec->blk_sz = 64 << 20;
+		rec->blk_rep = 3;
+		rec->blk_seq = 1;
+		rec->total_blk = 1;
+		break;
+
+	case NN_CLOSE:
+		rec->len = 64 << 20;
+		rec->blk_rep = 3;
+		break;
+	}
+}
+
+// as the paxos thread built it before the records were packed
+static void bench_proto(LogOperator *lopr, editlog_rec_t *rec)
+{
+	lopr->set_optype(rec->optype);
+
+	switch (rec->optype)
+	{
+	case NN_MKDIR:
+		lopr->mutable_mkr()->set_key(rec->key, rec->key_len);
+		lopr->mutable_mkr()->set_permission(rec->permission);
+		lopr->mutable_mkr()->set_owner(rec->owner, rec->owner_len);
+		lopr->mutable_mkr()->set_group(rec->group, rec->group_len);
+		lopr->mutable_mkr()->set_modification_time(rec->modification_time);
+		break;
+
+	case NN_CREATE:
+		lopr->mutable_cre()->set_key(rec->key, rec->key_len);
+		lopr->mutable_cre()->set_permission(rec->permission);
+		lopr->mutable_cre()->set_owner(rec->owner, rec->owner_len);
+		lopr->mutable_cre()->set_group(rec->group, rec->group_len);
+		lopr->mutable_cre()->set_modification_time(rec->modification_time);
+		lopr->mutable_cre()->set_blk_id(rec->blk_id);
+		lopr->mutable_cre()->set_blk_sz(rec->blk_sz);
+		lopr->mutable_cre()->set_blk_rep(rec->blk_rep);
+		lopr->mutable_cre()->set_blk_seq(rec->blk_seq);
+		lopr->mutable_cre()->set_total_blk(rec->total_blk);
+		break;
+
+	case NN_CLOSE:
+		lopr->mutable_cle()->set_key(rec->key, rec->key_len);
+		lopr->mutable_cle()->set_modification_time(rec->modification_time);
+		lopr->mutable_cle()->set_len(rec->len);
+		lopr->mutable_cle()->set_blk_rep(rec->blk_rep);
+		break;
+
+	default:
+		lopr->mutable_rm()->set_key(rec->key, rec->key_len);
+		lopr->mutable_rm()->set_modification_time(rec->modification_time);
+		break;
+	}
+}
+
+static void bench_run(const char *name, int optype, long num)
+{
+	editlog_rec_t rec;
+	std::string   old_s;
+	std::string   ops;
+	double        t_oe = 0;
+	double        t_ne = 0;
+	double        t_od = 0;
+	double        t_nd = 0;
+	size_t        old_bytes = 0;
+	size_t        new_bytes = 0;
+	size_t        sink = 0;
+
+	bench_rec(&rec, optype, 0);
+
+	// encode: a LogOperator and a fresh value per edit, against the
+	// record appended to a batch buffer that keeps its capacity
+	t_oe = bench_now();
+
+	for (long i = 0; i < num; i++)
+	{
+		LogOperator lopr;
+		std::string value;
+
+		rec.modification_time++;
+		bench_proto(&lopr, &rec);
+		lopr.SerializeToString(&value);
+		sink += value.size();
+	}
+
+	t_oe = bench_now() - t_oe;
+
+	t_ne = bench_now();
+
+	for (long i = 0; i < num; i++)
+	{
+		if (i % BENCH_BATCH == 0)
+		{
+			sink += ops.size();
+			ops.clear();
+		}
+
+		rec.modification_time++;
+		EditlogRecAppend(ops, &rec);
+	}
+
+	t_ne = bench_now() - t_ne;
+
+	// decode: a parse into a fresh LogOperator per edit, against a
+	// record that points into the value
+	LogOperator lopr;
+
+	bench_proto(&lopr, &rec);
+	lopr.SerializeToString(&old_s);
+	old_bytes = old_s.size();
+
+	ops.clear();
+	EditlogRecAppend(ops, &rec);
+	new_bytes = ops.size();
+
+	t_od = bench_now();
+
+	for (long i = 0; i < num; i++)
+	{
+		LogOperator parsed;
+
+		parsed.ParseFromString(old_s);
+		sink += parsed.optype();
+	}
+
+	t_od = bench_now() - t_od;
+
+	uint64_t len = 0;
+	uchar_t *p = dfs_varint_decode((uchar_t *)&ops[0],
+		(uchar_t *)&ops[0] + ops.size(), &len);
+
+	t_nd = bench_now();
+
+	for (long i = 0; i < num; i++)
+	{
+		editlog_rec_t out;
+
+		EditlogRecDecode((const char *)p, len, &out);
+		sink += out.optype;
+	}
+
+	t_nd = bench_now() - t_nd;
+
+	bench_sink += sink;
+
+	printf("%-8s %10.2f %10.2f %10.2f %10.2f %8lu %8lu\n", name,
+		num / t_oe / 1e6, num / t_ne / 1e6, num / t_od / 1e6,
+		num / t_nd / 1e6, (unsigned long)old_bytes,
+		(unsigned long)new_bytes);
+}
+
+int main(int argc, char **argv)
+{
+	long num = argc > 1 ? atol(argv[1]) : 1000000;
+
+	if (num <= 0)
+	{
+		fprintf(stderr, "usage: %s [ops per run]\n", argv[0]);
+
+		return 1;
+	}
+
+	printf("%-8s %10s %10s %10s %10s %8s %8s\n", "op", "old enc", "new enc",
+		"old dec", "new dec", "old B", "new B");
+	printf("%-8s %10s %10s %10s %10s %8s %8s\n", "", "Mops/s", "Mops/s",
+		"Mops/s", "Mops/s", "/op", "/op");
+
+	bench_run("mkdir", NN_MKDIR, num);
+	bench_run("create", NN_CREATE, num);
+	bench_run("close", NN_CLOSE, num);
+	bench_run("rm", NN_RM, num);
+
+	return 0;
+}
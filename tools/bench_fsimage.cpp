@@ -0,0 +1,231 @@
+/*
+ * dfs_lz4 speed and ratio on fsimage like records, and fsimage save
+ * and load time on 1 to 16 threads. a save seals the sections and
+ * writes the image, a load maps it and checks and decodes every
+ * section.
+ *
+ *   bench_fsimage [records] [image path]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "nn_fsimage.h"
+#include "nn_cycle.h"
+#include "dfs_error_log.h"
+#include "dfs_memory.h"
+#include "dfs_memory_pool.h"
+#include "dfs_lz4.h"
+
+#define BENCH_SECTION_RECORDS 65536
+
+cycle_t *dfs_cycle = nullptr;
+
+typedef struct
+{
+	fsimage_section_t *secs;
+	size_t             records;
+	fsimage_t         *img;
+} bench_image_t;
+
+static double bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ino, parent, mode, times and a name, like fi_image_encode writes
+static size_t bench_record(uchar_t *p, uint64_t ino)
+{
+	uint64_t f[5] = { ino, ino / 64 + 1, 0100644,
+		1700000000000ULL + ino * 37, 1700000000000ULL + ino * 41 };
+	int      n = 0;
+
+	memcpy(p, f, sizeof(f));
+	n = sprintf((char *)p + sizeof(f) + 1, "part-%05lu.%lu",
+		(unsigned long)(ino % 100000),
+		(unsigned long)(ino * 2654435761UL % 977));
+	p[sizeof(f)] = (uchar_t)n;
+
+	return sizeof(f) + 1 + n;
+}
+
+static int bench_encode(void *arg, size_t i)
+{
+	bench_image_t *b = (bench_image_t *)arg;
+	size_t         first = i * BENCH_SECTION_RECORDS;
+
+	for (size_t r = first;
+		r < first + BENCH_SECTION_RECORDS && r < b->records; r++)
+	{
+		uchar_t *p = fsimage_section_reserve(&b->secs[i], 512);
+		if (!p)
+		{
+			return NGX_ERROR;
+		}
+
+		fsimage_section_commit(&b->secs[i], p + bench_record(p, r + 2));
+	}
+
+	return fsimage_section_seal(&b->secs[i], 1);
+}
+
+static int bench_read(void *arg, size_t i)
+{
+	bench_image_t *b = (bench_image_t *)arg;
+	uchar_t       *data = nullptr;
+	uchar_t       *buf = nullptr;
+
+	if (fsimage_section_read(b->img, i, &data, &buf) != NGX_OK)
+	{
+		return NGX_ERROR;
+	}
+
+	free(buf);
+
+	return NGX_OK;
+}
+
+static void bench_lz4(size_t records)
+{
+	size_t   cap = records * 80;
+	uchar_t *raw = (uchar_t *)malloc(cap);
+	uchar_t *z = (uchar_t *)malloc(dfs_lz4_bound(cap));
+	size_t   len = 0;
+	size_t   zlen = 0;
+	double   tc = 0;
+	double   td = 0;
+
+	if (!raw || !z)
+	{
+		exit(1);
+	}
+
+	for (size_t r = 0; r < records; r++)
+	{
+		len += bench_record(raw + len, r + 2);
+	}
+
+	tc = bench_now();
+	zlen = dfs_lz4_compress(raw, len, z, dfs_lz4_bound(len));
+	tc = bench_now() - tc;
+
+	td = bench_now();
+	if (dfs_lz4_decompress(z, zlen, raw, cap) != (ssize_t)len)
+	{
+		fprintf(stderr, "lz4 round trip failed\n");
+		exit(1);
+	}
+	td = bench_now() - td;
+
+	printf("lz4 %lu -> %lu bytes (%.2f), compress %.0f MB/s, "
+		"decompress %.0f MB/s\n", (unsigned long)len, (unsigned long)zlen,
+		(double)zlen / len, len / tc / 1e6, len / td / 1e6);
+
+	free(raw);
+	free(z);
+}
+
+static void bench_image(const char *path, size_t records, int threads)
+{
+	size_t             num = (records + BENCH_SECTION_RECORDS - 1)
+		/ BENCH_SECTION_RECORDS;
+	fsimage_section_t *secs = (fsimage_section_t *)calloc(num,
+		sizeof(fsimage_section_t));
+	fsimage_header_t   hdr;
+	fsimage_t          img;
+	bench_image_t      b;
+	double             ts = 0;
+	double             tl = 0;
+
+	memory_zero(&hdr, sizeof(hdr));
+	b.secs = secs;
+	b.records = records;
+
+	ts = bench_now();
+
+	hdr.record_num = records;
+	hdr.max_ino = records + 1;
+
+	if (!secs || fsimage_parallel(threads, num, bench_encode, &b) != NGX_OK
+		|| fsimage_write(path, &hdr, secs, num) != NGX_OK)
+	{
+		fprintf(stderr, "save failed\n");
+		exit(1);
+	}
+
+	ts = bench_now() - ts;
+
+	for (size_t i = 0; i < num; i++)
+	{
+		fsimage_section_free(&secs[i]);
+	}
+
+	free(secs);
+
+	tl = bench_now();
+	b.img = &img;
+
+	if (fsimage_open(path, &img) != NGX_OK
+		|| fsimage_parallel(threads, num, bench_read, &b) != NGX_OK)
+	{
+		fprintf(stderr, "load failed\n");
+		exit(1);
+	}
+
+	tl = bench_now() - tl;
+	fsimage_close(&img);
+
+	printf("%-8d %12.1f %12.1f\n", threads, ts * 1e3, tl * 1e3);
+}
+
+static string_t *bench_log_time()
+{
+	static string_t t = string_make("-");
+
+	return &t;
+}
+
+int main(int argc, char **argv)
+{
+	size_t      records = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000;
+	const char *path = argc > 2 ? argv[2] : "/tmp/bench_fsimage.img";
+	cycle_t     cycle;
+	pool_t     *pool = pool_create(4096, 4096, nullptr);
+
+	if (records == 0)
+	{
+		fprintf(stderr, "usage: %s [records] [image path]\n", argv[0]);
+
+		return 1;
+	}
+
+	memory_zero(&cycle, sizeof(cycle));
+
+	if (!pool || !(cycle.error_log = error_log_init_with_stderr(pool)))
+	{
+		return 1;
+	}
+
+	error_log_set_handle(cycle.error_log, bench_log_time, nullptr);
+	dfs_cycle = &cycle;
+
+	bench_lz4(records);
+
+	printf("%-8s %12s %12s\n", "threads", "save ms", "load ms");
+
+	for (int t = 1; t <= 16; t *= 2)
+	{
+		bench_image(path, records, t);
+	}
+
+	unlink(path);
+	pool_destroy(pool);
+
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * namespace lookups per second with 1 to 32 task threads, on one
+ * hashtable under a single rwlock as the file index had it and on the
+ * sharded table that replaced it. the second pair of columns has an
+ * applier doing rmr like bursts next to the readers: the old one holds
+ * the write lock for the whole burst, the sharded one a shard at a
+ * time.
+ *
+ *   bench_shard_hashtable [keys] [ms per run]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "dfs_shard_hashtable.h"
+
+#define BENCH_MAX_THREADS 32
+#define BENCH_BURST       4096
+
+typedef struct
+{
+	dfs_hashtable_link_t ln;
+	uint64_t             ino;
+} bench_item_t;
+
+typedef struct
+{
+	int                    kind; // 0 old, 1 sharded
+	dfs_hashtable_t       *ht;
+	pthread_rwlock_t      *lock;
+	dfs_shard_hashtable_t *sht;
+	bench_item_t          *items;
+	size_t                 num;
+} bench_table_t;
+
+typedef struct
+{
+	bench_table_t *t;
+	uint64_t       seed;
+	long           ops;
+} bench_reader_t;
+
+static volatile int bench_stop;
+static volatile long bench_sink;
+
+static double bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_cmp(const void *a, const void *b, size_t len)
+{
+	return memcmp(a, b, len);
+}
+
+static uint64_t bench_rand(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+
+	return *s;
+}
+
+static void *bench_read(void *arg)
+{
+	bench_reader_t *r = (bench_reader_t *)arg;
+	bench_table_t  *t = r->t;
+	long            found = 0;
+
+	while (!bench_stop)
+	{
+		uint64_t ino = t->items[bench_rand(&r->seed) % t->num].ino;
+		void    *obj = nullptr;
+
+		if (t->kind)
+		{
+			obj = dfs_shard_hashtable_lookup(t->sht, &ino, sizeof(ino));
+		}
+		else
+		{
+			pthread_rwlock_rdlock(t->lock);
+			obj = dfs_hashtable_lookup(t->ht, &ino, sizeof(ino));
+			pthread_rwlock_unlock(t->lock);
+		}
+
+		found += obj != nullptr;
+		r->ops++;
+	}
+
+	bench_sink += found;
+
+	return nullptr;
+}
+
+// takes a burst of entries out and puts them back, like a rmr of a
+// tree and the creates that follow
+static void *bench_write(void *arg)
+{
+	bench_table_t *t = (bench_table_t *)arg;
+	size_t         first = 0;
+
+	while (!bench_stop)
+	{
+		bench_item_t *burst = t->items + first;
+
+		if (t->kind)
+		{
+			for (int i = 0; i < BENCH_BURST; i++)
+			{
+				dfs_shard_hashtable_remove_link(t->sht, &burst[i].ln);
+			}
+
+			for (int i = 0; i < BENCH_BURST; i++)
+			{
+				dfs_shard_hashtable_join(t->sht, &burst[i].ln);
+			}
+		}
+		else
+		{
+			pthread_rwlock_wrlock(t->lock);
+
+			for (int i = 0; i < BENCH_BURST; i++)
+			{
+				dfs_hashtable_remove_link(t->ht, &burst[i].ln);
+			}
+
+			for (int i = 0; i < BENCH_BURST; i++)
+			{
+				dfs_hashtable_join(t->ht, &burst[i].ln);
+			}
+
+			pthread_rwlock_unlock(t->lock);
+		}
+
+		first = (first + BENCH_BURST) % (t->num - BENCH_BURST);
+	}
+
+	return nullptr;
+}
+
+// lookups per second with nthreads readers, and an applier if writer
+static double bench_run(bench_table_t *t, int nthreads, int writer, int ms)
+{
+	bench_reader_t readers[BENCH_MAX_THREADS];
+	pthread_t      tids[BENCH_MAX_THREADS];
+	pthread_t      wtid;
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	double         t0 = 0;
+	long           ops = 0;
+
+	bench_stop = 0;
+	t0 = bench_now();
+
+	for (int i = 0; i < nthreads; i++)
+	{
+		readers[i].t = t;
+		readers[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+		readers[i].ops = 0;
+		pthread_create(&tids[i], nullptr, bench_read, &readers[i]);
+	}
+
+	if (writer)
+	{
+		pthread_create(&wtid, nullptr, bench_write, t);
+	}
+
+	nanosleep(&ts, nullptr);
+	bench_stop = 1;
+
+	for (int i = 0; i < nthreads; i++)
+	{
+		pthread_join(tids[i], nullptr);
+		ops += readers[i].ops;
+	}
+
+	t0 = bench_now() - t0;
+
+	if (writer)
+	{
+		pthread_join(wtid, nullptr);
+	}
+
+	return ops / t0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t           num = argc > 1 ? atol(argv[1]) : 1 << 20;
+	int              ms = argc > 2 ? atoi(argv[2]) : 500;
+	pthread_rwlock_t lock;
+	bench_table_t    old_t;
+	bench_table_t    new_t;
+
+	if (num <= BENCH_BURST || ms <= 0)
+	{
+		fprintf(stderr, "usage: %s [keys > %d] [ms per run]\n", argv[0],
+			BENCH_BURST);
+
+		return 1;
+	}
+
+	memset(&old_t, 0, sizeof(old_t));
+	pthread_rwlock_init(&lock, nullptr);
+	old_t.kind = 0;
+	old_t.lock = &lock;
+	old_t.num = num;
+	old_t.ht = dfs_hashtable_create(bench_cmp, num, dfs_hashtable_hash_key8,
+		nullptr);
+	old_t.items = (bench_item_t *)calloc(num, sizeof(bench_item_t));
+
+	new_t = old_t;
+	new_t.kind = 1;
+	new_t.sht = dfs_shard_hashtable_create(bench_cmp, num,
+		dfs_hashtable_hash_key8, nullptr, DFS_SHARD_HASHTABLE_DEFAULT_SHARDS);
+	new_t.items = (bench_item_t *)calloc(num, sizeof(bench_item_t));
+
+	if (!old_t.ht || !old_t.items || !new_t.sht || !new_t.items)
+	{
+		fprintf(stderr, "out of memory\n");
+
+		return 1;
+	}
+
+	for (size_t i = 0; i < num; i++)
+	{
+		old_t.items[i].ino = new_t.items[i].ino = i + 2;
+		old_t.items[i].ln.key = &old_t.items[i].ino;
+		old_t.items[i].ln.len = sizeof(uint64_t);
+		new_t.items[i].ln.key = &new_t.items[i].ino;
+		new_t.items[i].ln.len = sizeof(uint64_t);
+
+		dfs_hashtable_join(old_t.ht, &old_t.items[i].ln);
+		dfs_shard_hashtable_join(new_t.sht, &new_t.items[i].ln);
+	}
+
+	printf("%-8s %14s %14s %14s %14s\n", "threads", "old Mlook/s",
+		"shard Mlook/s", "old +rmr", "shard +rmr");
+
+	for (int n = 1; n <= BENCH_MAX_THREADS; n *= 2)
+	{
+		double o = bench_run(&old_t, n, 0, ms);
+		double s = bench_run(&new_t, n, 0, ms);
+		double ow = bench_run(&old_t, n, 1, ms);
+		double sw = bench_run(&new_t, n, 1, ms);
+
+		printf("%-8d %14.2f %14.2f %14.2f %14.2f\n", n, o / 1e6, s / 1e6,
+			ow / 1e6, sw / 1e6);
+	}
+
+	dfs_shard_hashtable_free_memory(new_t.sht);
+	dfs_hashtable_free_memory(old_t.ht);
+	pthread_rwlock_destroy(&lock);
+	free(old_t.items);
+	free(new_t.items);
+
+	return 0;
+}
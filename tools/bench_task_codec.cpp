@@ -0,0 +1,145 @@
+/*
+ * encode and decode cost and packet size of task_encode2str and
+ * task_decodefstr against the old format, which copied the whole
+ * task_t behind the length, kept here to compare against.
+ *
+ *   bench_task_codec [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dfs_task.h"
+
+static int old_encode(task_t *task, char *buff, int len)
+{
+	int need_size = (int)(sizeof(int) * 2 + sizeof(task_t)) + task->data_len;
+
+	if (len < need_size)
+	{
+		return TASK_EAGIN;
+	}
+
+	*(int *)buff = need_size;
+	memcpy(buff + sizeof(int), task, sizeof(task_t));
+	*(int *)(buff + sizeof(int) + sizeof(task_t)) = task->data_len;
+
+	if (task->data_len > 0)
+	{
+		memcpy(buff + sizeof(int) * 2 + sizeof(task_t), task->data,
+			task->data_len);
+	}
+
+	return need_size;
+}
+
+static int old_decode(char *buff, int len, task_t *task)
+{
+	void *opq = task->opq;
+	int   need_size = *(int *)buff;
+
+	if (len < need_size)
+	{
+		return TASK_EAGIN;
+	}
+
+	memcpy(task, buff + sizeof(int), sizeof(task_t));
+
+	if (*(int *)(buff + sizeof(int) + sizeof(task_t)) > 0)
+	{
+		task->data = buff + sizeof(int) * 2 + sizeof(task_t);
+	}
+
+	task->opq = opq;
+
+	return need_size;
+}
+
+// keeps the loops from being optimized away
+static volatile long bench_sink;
+
+static double bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef int (*bench_enc_t)(task_t *, char *, int);
+typedef int (*bench_dec_t)(char *, int, task_t *);
+
+static void bench_run(const char *name, task_t *t, bench_enc_t enc,
+	bench_dec_t dec, long rounds)
+{
+	static char buf[65536];
+	task_t      out;
+	long        sum = 0;
+	int         len = 0;
+	double      te = 0;
+	double      td = 0;
+
+	te = bench_now();
+
+	for (long i = 0; i < rounds; i++)
+	{
+		t->seq = (uint32_t)i;
+		len = enc(t, buf, sizeof(buf));
+		sum += len;
+	}
+
+	te = bench_now() - te;
+	td = bench_now();
+
+	for (long i = 0; i < rounds; i++)
+	{
+		sum += dec(buf, len, &out);
+	}
+
+	td = bench_now() - td;
+	bench_sink = sum;
+
+	printf("%-24s %8d %12.1f %12.1f\n", name, len, te * 1e9 / rounds,
+		td * 1e9 / rounds);
+}
+
+int main(int argc, char **argv)
+{
+	long   rounds = argc > 1 ? atol(argv[1]) : 2000000;
+	char   data[4096];
+	task_t t;
+
+	if (rounds <= 0)
+	{
+		fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+
+		return 1;
+	}
+
+	memset(data, 'd', sizeof(data));
+	printf("%-24s %8s %12s %12s\n", "task", "bytes", "enc ns", "dec ns");
+
+	// a metadata request, what most of the traffic is
+	memset(&t, 0, sizeof(t));
+	t.cmd = NN_GET_FILE_INFO;
+	strcpy(t.key, "/user/data/part-00017");
+	strcpy(t.user, "hadoop");
+	strcpy(t.group, "supergroup");
+	bench_run("getfileinfo old", &t, old_encode, old_decode, rounds);
+	bench_run("getfileinfo new", &t, task_encode2str, task_decodefstr,
+		rounds);
+
+	// a reply carrying 4k of data
+	memset(&t, 0, sizeof(t));
+	t.cmd = NN_LS;
+	t.ret = 0;
+	t.data = data;
+	t.data_len = sizeof(data);
+	bench_run("ls reply 4k old", &t, old_encode, old_decode, rounds);
+	bench_run("ls reply 4k new", &t, task_encode2str, task_decodefstr,
+		rounds);
+
+	return 0;
+}
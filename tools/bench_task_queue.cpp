@@ -0,0 +1,184 @@
+/*
+ * push/pop throughput of the task queue, 1 to 32 producers and one
+ * consumer draining with pop_all like the worker lanes do. old_queue_t
+ * is the spinlocked queue it replaced, kept here to compare against.
+ *
+ *   bench_task_queue [pushes per producer]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "nn_task_queue.h"
+
+#define BENCH_MAX_PRODUCERS 32
+
+typedef struct
+{
+	queue_t            qh;
+	pthread_spinlock_t lock;
+} old_queue_t;
+
+typedef struct
+{
+	int                kind; // 0 old, 1 new
+	void              *queue;
+	task_queue_node_t *nodes;
+	long               num;
+} bench_producer_t;
+
+static volatile int bench_start;
+
+static void old_push(old_queue_t *q, task_queue_node_t *tnode)
+{
+	pthread_spin_lock(&q->lock);
+	queue_insert_head(&q->qh, &tnode->qe);
+	pthread_spin_unlock(&q->lock);
+}
+
+static void old_pop_all(old_queue_t *q, queue_t *queue)
+{
+	pthread_spin_lock(&q->lock);
+
+	if (!queue_empty(&q->qh))
+	{
+		queue->next = q->qh.next;
+		queue->prev = q->qh.prev;
+		queue->next->prev = queue;
+		queue->prev->next = queue;
+		queue_init(&q->qh);
+	}
+
+	pthread_spin_unlock(&q->lock);
+}
+
+static double bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *bench_produce(void *arg)
+{
+	bench_producer_t *p = (bench_producer_t *)arg;
+
+	while (!bench_start)
+	{
+		;
+	}
+
+	for (long i = 0; i < p->num; i++)
+	{
+		if (p->kind)
+		{
+			push_task((task_queue_t *)p->queue, &p->nodes[i]);
+		}
+		else
+		{
+			old_push((old_queue_t *)p->queue, &p->nodes[i]);
+		}
+	}
+
+	return nullptr;
+}
+
+// pushes per second with nprod producers
+static double bench_run(int kind, int nprod, long num)
+{
+	old_queue_t      oq;
+	task_queue_t     nq;
+	bench_producer_t prod[BENCH_MAX_PRODUCERS];
+	pthread_t        tids[BENCH_MAX_PRODUCERS];
+	long             total = nprod * num;
+	long             got = 0;
+	double           t0 = 0;
+
+	queue_init(&oq.qh);
+	pthread_spin_init(&oq.lock, 0);
+	task_queue_init(&nq);
+
+	for (int i = 0; i < nprod; i++)
+	{
+		prod[i].kind = kind;
+		prod[i].queue = kind ? (void *)&nq : (void *)&oq;
+		prod[i].nodes = (task_queue_node_t *)calloc(num,
+			sizeof(task_queue_node_t));
+		prod[i].num = num;
+
+		if (!prod[i].nodes)
+		{
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+
+		pthread_create(&tids[i], nullptr, bench_produce, &prod[i]);
+	}
+
+	t0 = bench_now();
+	__sync_synchronize();
+	bench_start = 1;
+
+	while (got < total)
+	{
+		queue_t  all;
+		queue_t *q = nullptr;
+
+		queue_init(&all);
+
+		if (kind)
+		{
+			pop_all(&nq, &all);
+		}
+		else
+		{
+			old_pop_all(&oq, &all);
+		}
+
+		for (q = queue_head(&all); q != queue_sentinel(&all);
+			q = queue_next(q))
+		{
+			got++;
+		}
+	}
+
+	t0 = bench_now() - t0;
+	bench_start = 0;
+
+	for (int i = 0; i < nprod; i++)
+	{
+		pthread_join(tids[i], nullptr);
+		free(prod[i].nodes);
+	}
+
+	pthread_spin_destroy(&oq.lock);
+
+	return total / t0;
+}
+
+int main(int argc, char **argv)
+{
+	long num = argc > 1 ? atol(argv[1]) : 200000;
+
+	if (num <= 0)
+	{
+		fprintf(stderr, "usage: %s [pushes per producer]\n", argv[0]);
+
+		return 1;
+	}
+
+	printf("%-10s %14s %14s\n", "producers", "old Mpush/s", "new Mpush/s");
+
+	for (int n = 1; n <= BENCH_MAX_PRODUCERS; n *= 2)
+	{
+		double o = bench_run(0, n, num);
+		double l = bench_run(1, n, num);
+
+		printf("%-10d %14.2f %14.2f\n", n, o / 1e6, l / 1e6);
+	}
+
+	return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * wake to handle latency of an I/O thread loop. a producer writes a
+ * pipe every 0.1 to 1ms, like write_back raising tq_notice, and the
+ * loop takes the time it saw each wake. the loops are the ones of
+ * thread_event_process:
+ *
+ *   sleep     epoll capped at 10ms then usleep(3000), the dn loop before
+ *   block     epoll waits until the pipe is readable
+ *   busypoll  polls for io_busy_poll us after the last wake, then blocks
+ *
+ *   bench_thread_wake [samples] [io_busy_poll us]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#define BENCH_SLEEP    0
+#define BENCH_BLOCK    1
+#define BENCH_BUSYPOLL 2
+
+static int                bench_pipe[2];
+static int                bench_num;
+static uint64_t          *bench_sent;
+static volatile int       bench_produced;
+
+static uint64_t bench_usec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void *bench_produce(void *arg)
+{
+	(void)arg;
+
+	for (int i = 0; i < bench_num; i++)
+	{
+		usleep(100 + rand() % 900);
+
+		bench_sent[i] = bench_usec();
+		__sync_synchronize();
+		bench_produced = i + 1;
+
+		if (write(bench_pipe[1], "C", 1) != 1)
+		{
+			break;
+		}
+	}
+
+	return nullptr;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void bench_run(int mode, uint64_t busy_poll)
+{
+	static const char *names[] = { "sleep", "block", "busypoll" };
+	struct epoll_event ev;
+	pthread_t          tid;
+	uint64_t          *lat = (uint64_t *)calloc(bench_num, sizeof(uint64_t));
+	uint64_t           busy_until = 0;
+	int                ep = epoll_create(1);
+	int                n = 0;
+	char               buf[4096];
+
+	if (!lat || ep < 0 || pipe(bench_pipe) < 0)
+	{
+		fprintf(stderr, "setup failed\n");
+		exit(1);
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.fd = bench_pipe[0];
+	epoll_ctl(ep, EPOLL_CTL_ADD, bench_pipe[0], &ev);
+
+	bench_produced = 0;
+	pthread_create(&tid, nullptr, bench_produce, nullptr);
+
+	while (n < bench_num)
+	{
+		struct epoll_event out;
+		int                timer = -1;
+
+		if (mode == BENCH_SLEEP)
+		{
+			timer = 10;
+		}
+		else if (mode == BENCH_BUSYPOLL && bench_usec() < busy_until)
+		{
+			timer = 0;
+		}
+
+		if (epoll_wait(ep, &out, 1, timer) > 0)
+		{
+			uint64_t now = bench_usec();
+			int      k = 0;
+
+			if (read(bench_pipe[0], buf, sizeof(buf)) <= 0)
+			{
+				break;
+			}
+
+			k = bench_produced;
+
+			while (n < k)
+			{
+				lat[n] = now - bench_sent[n];
+				n++;
+			}
+
+			busy_until = now + busy_poll;
+		}
+
+		if (mode == BENCH_SLEEP)
+		{
+			usleep(3000);
+		}
+	}
+
+	pthread_join(tid, nullptr);
+	close(bench_pipe[0]);
+	close(bench_pipe[1]);
+	close(ep);
+
+	qsort(lat, bench_num, sizeof(uint64_t), bench_cmp);
+	printf("%-10s %10llu %10llu %10llu\n", names[mode],
+		(unsigned long long)lat[bench_num / 2],
+		(unsigned long long)lat[bench_num * 99 / 100],
+		(unsigned long long)lat[bench_num - 1]);
+
+	free(lat);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t busy_poll = 0;
+
+	bench_num = argc > 1 ? atoi(argv[1]) : 3000;
+	busy_poll = argc > 2 ? strtoull(argv[2], nullptr, 10) : 50;
+
+	if (bench_num <= 0)
+	{
+		fprintf(stderr, "usage: %s [samples] [io_busy_poll us]\n", argv[0]);
+
+		return 1;
+	}
+
+	bench_sent = (uint64_t *)calloc(bench_num, sizeof(uint64_t));
+	if (!bench_sent)
+	{
+		return 1;
+	}
+
+	printf("%-10s %10s %10s %10s\n", "loop", "p50 us", "p99 us", "max us");
+
+	bench_run(BENCH_SLEEP, 0);
+	bench_run(BENCH_BLOCK, 0);
+	bench_run(BENCH_BUSYPOLL, busy_poll);
+
+	free(bench_sent);
+
+	return 0;
+}
@@ -0,0 +1,363 @@
+/*
+ * instances of batched edits applied in waves on 8 apply threads must
+ * leave the namespace the serial apply leaves, down to the inos, and so
+ * must the instances of several paxos groups applied in another order,
+ * each group under its own top dir. each run is a child process, as
+ * the file index is global, and dumps every path it might hold for the
+ * parent to compare.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <vector>
+
+#include "nn_file_index.h"
+#include "nn_blk_index.h"
+#include "nn_conf.h"
+#include "dfs_error_log.h"
+#include "dfs_memory.h"
+#include "dfs_memory_pool.h"
+#include "EditlogSM.h"
+
+#define TEST_INSTANCES 300
+#define TEST_BATCH     24
+#define TEST_NAMES     5   // dir names per level
+#define TEST_FILES     3   // file names per dir
+#define TEST_DEPTH     4
+#define TEST_GROUPS    4   // at most TEST_NAMES
+
+// what nn_main.cpp gives the rest of the namenode
+string_t   config_file;
+char     **dfs_argv;
+
+static string_t *test_log_time()
+{
+	static string_t t = string_make("-");
+
+	return &t;
+}
+
+// top is the top dir of the group, any if it is negative
+static std::string test_dir(int depth, int top)
+{
+	std::string path;
+
+	for (int i = 0; i < depth; i++)
+	{
+		path += '/';
+		path += (char)('a' + (i == 0 && top >= 0 ? top : rand() % TEST_NAMES));
+	}
+
+	return path.empty() ? "/" : path;
+}
+
+static std::string test_file(int top)
+{
+	std::string dir = test_dir(rand() % TEST_DEPTH + (top >= 0), top);
+
+	if (dir != "/")
+	{
+		dir += '/';
+	}
+
+	return dir + 'f' + (char)('0' + rand() % TEST_FILES);
+}
+
+static void test_key(const std::string &path, char *key)
+{
+	memory_zero(key, KEY_LEN);
+	key_encode((uchar_t *)path.c_str(), (uchar_t *)key);
+}
+
+// a random batch, the keys live in keys until it is applied
+static void test_batch(uint64_t id, int top, char (*keys)[2][KEY_LEN],
+	std::string &value)
+{
+	std::string ops;
+
+	for (int i = 0; i < TEST_BATCH; i++)
+	{
+		editlog_rec_t rec;
+		int           r = rand() % 10;
+
+		memory_zero(&rec, sizeof(rec));
+		rec.owner = "hdfs";
+		rec.owner_len = 4;
+		rec.group = "supergroup";
+		rec.group_len = 10;
+		rec.permission = 0755;
+		rec.modification_time = id * 1000 + i;
+
+		if (r < 5)
+		{
+			// missing parents are made too
+			rec.optype = NN_MKDIR;
+			test_key(test_dir(1 + rand() % TEST_DEPTH, top), keys[i][0]);
+		}
+		else if (r < 7)
+		{
+			rec.optype = NN_CREATE;
+			rec.blk_id = id * TEST_BATCH + i;
+			rec.blk_sz = 64 << 20;
+			rec.blk_rep = 3;
+			rec.blk_seq = 1;
+			rec.total_blk = 1;
+			test_key(test_file(top), keys[i][0]);
+		}
+		else if (r == 7)
+		{
+			// a group keeps its top dir
+			rec.optype = NN_RMR;
+			test_key(test_dir(1 + (top >= 0)
+				+ rand() % (TEST_DEPTH - 1 - (top >= 0)), top), keys[i][0]);
+		}
+		else if (r == 8)
+		{
+			rec.optype = NN_RENAME;
+			test_key(test_dir(1 + rand() % TEST_DEPTH, top), keys[i][0]);
+			test_key(test_dir(1 + rand() % TEST_DEPTH, top), keys[i][1]);
+			rec.dst = keys[i][1];
+			rec.dst_len = strlen(keys[i][1]);
+		}
+		else
+		{
+			rec.optype = NN_RM;
+			test_key(test_file(top), keys[i][0]);
+		}
+
+		rec.key = keys[i][0];
+		rec.key_len = strlen(keys[i][0]);
+
+		EditlogRecAppend(ops, &rec);
+	}
+
+	EditlogBatchEncode(ops, TEST_BATCH, value);
+}
+
+static void test_dump_path(FILE *f, const std::string &path)
+{
+	char       key[KEY_LEN];
+	fi_inode_t fin;
+	short      state = 0;
+
+	test_key(path, key);
+	memory_zero(&fin, sizeof(fin));
+
+	if (get_store_stat((uchar_t *)key, &fin, &state) == NGX_OK)
+	{
+		fprintf(f, "%s %lu %d %d\n", path.c_str(), (unsigned long)fin.ino,
+			(int)fin.is_directory, (int)state);
+	}
+}
+
+// every dir and file name the batches can make
+static void test_dump(FILE *f, const std::string &dir, int depth)
+{
+	test_dump_path(f, dir.empty() ? "/" : dir);
+
+	for (int i = 0; i < TEST_FILES; i++)
+	{
+		test_dump_path(f, dir + "/f" + (char)('0' + i));
+	}
+
+	if (depth == TEST_DEPTH)
+	{
+		return;
+	}
+
+	for (int i = 0; i < TEST_NAMES; i++)
+	{
+		test_dump(f, dir + '/' + (char)('a' + i), depth + 1);
+	}
+}
+
+// the instances of the groups go in the order seed picks, each group
+// keeps its own order as it does on every replica
+static int test_run(int threads, int groups, int seed, const char *path)
+{
+	static char    keys[TEST_BATCH][2][KEY_LEN];
+	cycle_t        cycle;
+	conf_server_t  sconf;
+	pool_t        *pool = pool_create(4096, 4096, nullptr);
+	FILE          *f = nullptr;
+	int            failed = 0;
+	std::vector<std::string> values[TEST_GROUPS];
+	size_t         next[TEST_GROUPS] = { 0 };
+
+	memory_zero(&cycle, sizeof(cycle));
+	memory_zero(&sconf, sizeof(sconf));
+
+	if (!pool || !(cycle.error_log = error_log_init_with_stderr(pool)))
+	{
+		return 1;
+	}
+
+	error_log_set_handle(cycle.error_log, test_log_time, nullptr);
+	cycle.error_log->log_level = DFS_LOG_ALERT;
+	cycle.pool = pool;
+
+	sconf.index_num = 1 << 16;
+	sconf.index_shard_num = 16;
+	sconf.apply_threads = threads;
+	sconf.paxos_group_num = groups;
+	cycle.sconf = &sconf;
+	dfs_cycle = &cycle;
+
+	if (nn_blk_index_worker_init(&cycle) != NGX_OK
+		|| nn_file_index_worker_init(&cycle) != NGX_OK)
+	{
+		return 1;
+	}
+
+	// the same edits in both runs
+	srand(11);
+
+	for (int id = 0; id < TEST_INSTANCES; id++)
+	{
+		int         g = id % groups;
+		std::string value;
+
+		test_batch(values[g].size() + 1, groups > 1 ? g : -1, keys, value);
+		values[g].push_back(value);
+	}
+
+	srand(seed);
+
+	for (int n = 0; n < TEST_INSTANCES; n++)
+	{
+		int g = rand() % groups;
+
+		while (next[g] == values[g].size())
+		{
+			g = (g + 1) % groups;
+		}
+
+		// ops that do not apply, a rmr of a missing dir, fail alike
+		if (update_fi_cache_mgmt(g, next[g] + 1, values[g][next[g]],
+				nullptr) != NGX_OK)
+		{
+			failed++;
+		}
+
+		next[g]++;
+	}
+
+	f = fopen(path, "w");
+	if (!f)
+	{
+		return 1;
+	}
+
+	fprintf(f, "failed instances %d\n", failed);
+	test_dump(f, "", 0);
+	fclose(f);
+
+	return 0;
+}
+
+static int test_child(int threads, int groups, int seed, const char *path)
+{
+	pid_t pid = fork();
+	int   status = 0;
+
+	if (pid == 0)
+	{
+		_exit(test_run(threads, groups, seed, path));
+	}
+
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+		|| WEXITSTATUS(status) != 0)
+	{
+		fprintf(stderr, "apply with %d threads did not finish\n", threads);
+
+		return NGX_ERROR;
+	}
+
+	return NGX_OK;
+}
+
+static std::string test_read(const char *path)
+{
+	std::string s;
+	char        buf[4096];
+	FILE       *f = fopen(path, "r");
+	size_t      n = 0;
+
+	while (f && (n = fread(buf, 1, sizeof(buf), f)) > 0)
+	{
+		s.append(buf, n);
+	}
+
+	if (f)
+	{
+		fclose(f);
+	}
+
+	return s;
+}
+
+// one group serial against waves, then the groups in two orders
+static int test_compare(int groups)
+{
+	char serial[64];
+	char waves[64];
+	int  rc = NGX_ERROR;
+
+	snprintf(serial, sizeof(serial), "/tmp/test_apply.%d.%d.1", getpid(),
+		groups);
+	snprintf(waves, sizeof(waves), "/tmp/test_apply.%d.%d.8", getpid(),
+		groups);
+
+	if (test_child(1, groups, 1, serial) == NGX_OK
+		&& test_child(8, groups, 2, waves) == NGX_OK)
+	{
+		std::string s = test_read(serial);
+		std::string w = test_read(waves);
+		size_t      lines = 0;
+
+		for (size_t i = 0; i < s.size(); i++)
+		{
+			lines += s[i] == '\n';
+		}
+
+		if (s != w)
+		{
+			fprintf(stderr, "groups %d: namespaces differ, see %s and %s\n",
+				groups, serial, waves);
+
+			return NGX_ERROR;
+		}
+
+		// the root and more, or the edits did not apply at all
+		if (lines < 20)
+		{
+			fprintf(stderr, "only %lu lines in %s\n", (unsigned long)lines,
+				serial);
+
+			return NGX_ERROR;
+		}
+
+		printf("groups %d: ok, %lu entries\n", groups,
+			(unsigned long)lines - 1);
+		rc = NGX_OK;
+	}
+
+	unlink(serial);
+	unlink(waves);
+
+	return rc;
+}
+
+int main()
+{
+	if (test_compare(1) != NGX_OK || test_compare(TEST_GROUPS) != NGX_OK)
+	{
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,372 @@
+/*
+ * packed edit records: every op type comes back field for field from a
+ * batch, cut or bad records are refused, and a LogOperator is left to
+ * the protobuf path. then an instance of packed and LogOperator
+ * creates is applied on apply threads, the inos must follow the log
+ * order and not the order the waves run the creates in.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "nn_file_index.h"
+#include "nn_blk_index.h"
+#include "nn_conf.h"
+#include "dfs_error_log.h"
+#include "dfs_memory.h"
+#include "dfs_memory_pool.h"
+#include "dfs_varint.h"
+#include "phxeditlog.pb.h"
+#include "EditlogSM.h"
+
+using namespace phxeditlog;
+
+// what nn_main.cpp gives the rest of the namenode
+string_t   config_file;
+char     **dfs_argv;
+
+static int test_failed;
+
+#define test_check(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		test_failed++; \
+	} \
+} while (0)
+
+static string_t *test_log_time()
+{
+	static string_t t = string_make("-");
+
+	return &t;
+}
+
+static int test_str_same(const char *a, size_t alen, const char *b,
+	size_t blen)
+{
+	return alen == blen && (alen == 0 || memcmp(a, b, alen) == 0);
+}
+
+static int test_rec_same(editlog_rec_t *a, editlog_rec_t *b)
+{
+	return a->optype == b->optype
+		&& test_str_same(a->key, a->key_len, b->key, b->key_len)
+		&& test_str_same(a->dst, a->dst_len, b->dst, b->dst_len)
+		&& test_str_same(a->owner, a->owner_len, b->owner, b->owner_len)
+		&& test_str_same(a->group, a->group_len, b->group, b->group_len)
+		&& a->permission == b->permission
+		&& a->modification_time == b->modification_time
+		&& a->blk_id == b->blk_id && a->blk_sz == b->blk_sz
+		&& a->blk_rep == b->blk_rep && a->blk_seq == b->blk_seq
+		&& a->total_blk == b->total_blk && a->len == b->len;
+}
+
+// the fields each op sets, the others stay 0 or empty
+static void test_rec(editlog_rec_t *rec, int optype, uint64_t n)
+{
+	static const char *keys[] = { "/a", "/a/b/c", "/user/hdfs/part-00001",
+		"/x/y", "/z" };
+
+	memory_zero(rec, sizeof(editlog_rec_t));
+	rec->optype = optype;
+	rec->key = keys[n % 5];
+	rec->key_len = strlen(rec->key);
+
+	switch (optype)
+	{
+	case NN_MKDIR:
+		rec->owner = "hdfs";
+		rec->owner_len = 4;
+		rec->group = "supergroup";
+		rec->group_len = 10;
+		rec->permission = 0755;
+		rec->modification_time = 1700000000000ULL + n;
+		break;
+
+	case NN_CREATE:
+		rec->owner = "u";
+		rec->owner_len = 1;
+		rec->group = "g";
+		rec->group_len = 1;
+		rec->permission = 0644;
+		rec->modification_time = UINT64_MAX;
+		rec->blk_id = UINT64_MAX - n;
+		rec->blk_sz = 64 << 20;
+		rec->blk_rep = 3;
+		rec->blk_seq = 1;
+		rec->total_blk = UINT32_MAX;
+		break;
+
+	case NN_GET_ADDITIONAL_BLK:
+		rec->blk_id = n << 40;
+		rec->blk_sz = 128 << 20;
+		rec->blk_rep = 2;
+		break;
+
+	case NN_CLOSE:
+		rec->modification_time = n;
+		rec->len = (uint64_t)INT64_MAX + n;
+		rec->blk_rep = 3;
+		break;
+
+	case NN_RENAME:
+		rec->dst = "/renamed/to/here";
+		rec->dst_len = strlen(rec->dst);
+		rec->modification_time = n * 1000;
+		break;
+
+	default: // NN_RMR, NN_RM and ops the apply path does not know
+		rec->modification_time = n + 1;
+		break;
+	}
+}
+
+static void test_round_trip()
+{
+	int optypes[] = { NN_MKDIR, NN_RMR, NN_CREATE, NN_GET_ADDITIONAL_BLK,
+		NN_CLOSE, NN_RM, NN_RENAME, 0, 1000 };
+	int num = sizeof(optypes) / sizeof(optypes[0]);
+	editlog_rec_t      in[sizeof(optypes) / sizeof(optypes[0])];
+	std::string        ops;
+	std::string        value;
+	vector<EditlogOp>  bufs;
+
+	for (int i = 0; i < num; i++)
+	{
+		test_rec(&in[i], optypes[i], i);
+		EditlogRecAppend(ops, &in[i]);
+	}
+
+	EditlogBatchEncode(ops, num, value);
+	test_check(EditlogIsBatch(value));
+	test_check(EditlogBatchDecode(value, bufs) == NGX_OK);
+	test_check((int)bufs.size() == num);
+
+	for (int i = 0; i < num && i < (int)bufs.size(); i++)
+	{
+		editlog_rec_t out;
+
+		test_check(bufs[i].second == EditlogRecLen(&in[i]));
+		test_check(EditlogRecDecode(bufs[i].first, bufs[i].second, &out)
+			== NGX_OK);
+		test_check(test_rec_same(&in[i], &out));
+
+		// the strings point into the value, nothing was copied
+		test_check(out.key >= value.data()
+			&& out.key + out.key_len <= value.data() + value.size());
+
+		// a record cut anywhere is refused
+		for (size_t n = 1; n < bufs[i].second; n++)
+		{
+			test_check(EditlogRecDecode(bufs[i].first, n, &out)
+				== NGX_ERROR);
+		}
+	}
+
+	// a batch that claims more edits than it holds
+	value[1] = (char)(num + 1);
+	test_check(EditlogBatchDecode(value, bufs) == NGX_ERROR);
+}
+
+// a LogOperator never starts with the record tag, it goes to protobuf
+static void test_legacy()
+{
+	int optypes[] = { NN_MKDIR, NN_RMR, NN_CREATE, NN_GET_ADDITIONAL_BLK,
+		NN_CLOSE, NN_RM, NN_RENAME };
+
+	for (size_t i = 0; i < sizeof(optypes) / sizeof(optypes[0]); i++)
+	{
+		LogOperator   lopr;
+		editlog_rec_t out;
+		std::string   s;
+
+		lopr.set_optype(optypes[i]);
+		lopr.mutable_mkr()->set_key("/a/b");
+		lopr.mutable_rmr()->set_key("/a/c");
+		lopr.mutable_cre()->set_key("/a/d");
+		lopr.mutable_gab()->set_blk_id(7);
+		lopr.mutable_cle()->set_len(9);
+		lopr.mutable_rm()->set_modification_time(1);
+		lopr.SerializeToString(&s);
+
+		test_check(EditlogRecDecode(s.data(), s.size(), &out)
+			== DFS_DECLINED);
+	}
+
+	test_check(EditlogRecDecode("", 0, nullptr) == DFS_DECLINED);
+}
+
+static void test_key(const char *path, char *key)
+{
+	memory_zero(key, KEY_LEN);
+	key_encode((uchar_t *)path, (uchar_t *)key);
+}
+
+static void test_create(std::string &ops, const char *path, uint64_t blk_id,
+	int legacy)
+{
+	char          key[KEY_LEN];
+	editlog_rec_t rec;
+
+	test_key(path, key);
+	test_rec(&rec, NN_CREATE, 0);
+	rec.key = key;
+	rec.key_len = strlen(key);
+	rec.blk_id = blk_id;
+	rec.total_blk = 1;
+
+	if (!legacy)
+	{
+		EditlogRecAppend(ops, &rec);
+
+		return;
+	}
+
+	LogOperator    lopr;
+	LogCreate     *cre = lopr.mutable_cre();
+	std::string    s;
+	uchar_t        len[DFS_VARINT_MAX_LEN];
+
+	lopr.set_optype(NN_CREATE);
+	cre->set_key(key);
+	cre->set_permission(rec.permission);
+	cre->set_owner("u");
+	cre->set_group("g");
+	cre->set_modification_time(rec.modification_time);
+	cre->set_blk_id(blk_id);
+	cre->set_blk_sz(rec.blk_sz);
+	cre->set_blk_rep(rec.blk_rep);
+	cre->set_blk_seq(rec.blk_seq);
+	cre->set_total_blk(rec.total_blk);
+	lopr.SerializeToString(&s);
+
+	ops.append((const char *)len, dfs_varint_encode(len, s.size()) - len);
+	ops.append(s);
+}
+
+static uint64_t test_ino(const char *path)
+{
+	char       key[KEY_LEN];
+	fi_inode_t fin;
+	short      state = 0;
+
+	test_key(path, key);
+	memory_zero(&fin, sizeof(fin));
+
+	if (get_store_stat((uchar_t *)key, &fin, &state) != NGX_OK)
+	{
+		return 0;
+	}
+
+	return fin.ino;
+}
+
+/*
+ * /a/f1 and /b/f3 run in the first wave, /a/f2 waits for /a/f1 in the
+ * second, so inos taken as the creates run would give /b/f3 the one
+ * before /a/f2. they are reserved from the decoded op type in log
+ * order, for a packed record as for a LogOperator
+ */
+static void test_apply_inos()
+{
+	cycle_t       cycle;
+	conf_server_t sconf;
+	pool_t       *pool = pool_create(4096, 4096, nullptr);
+	char          key[KEY_LEN];
+	editlog_rec_t rec;
+	std::string   ops;
+	std::string   value;
+
+	memory_zero(&cycle, sizeof(cycle));
+	memory_zero(&sconf, sizeof(sconf));
+
+	if (!pool || !(cycle.error_log = error_log_init_with_stderr(pool)))
+	{
+		test_failed++;
+
+		return;
+	}
+
+	error_log_set_handle(cycle.error_log, test_log_time, nullptr);
+	cycle.error_log->log_level = DFS_LOG_ALERT;
+	cycle.pool = pool;
+
+	sconf.index_num = 1024;
+	sconf.index_shard_num = 16;
+	sconf.apply_threads = 4;
+	sconf.paxos_group_num = 1;
+	cycle.sconf = &sconf;
+	dfs_cycle = &cycle;
+
+	if (nn_blk_index_worker_init(&cycle) != NGX_OK
+		|| nn_file_index_worker_init(&cycle) != NGX_OK)
+	{
+		test_failed++;
+
+		return;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		test_key(i ? "/b" : "/a", key);
+		test_rec(&rec, NN_MKDIR, i);
+		rec.key = key;
+		rec.key_len = strlen(key);
+		EditlogRecAppend(ops, &rec);
+	}
+
+	EditlogBatchEncode(ops, 2, value);
+	test_check(update_fi_cache_mgmt(0, 1, value, nullptr) == NGX_OK);
+
+	for (int legacy = 0; legacy < 2; legacy++)
+	{
+		char f[3][16];
+
+		for (int i = 0; i < 3; i++)
+		{
+			snprintf(f[i], sizeof(f[i]), "/%c/f%d%d", i == 2 ? 'b' : 'a',
+				legacy, i + 1);
+		}
+
+		ops.clear();
+		test_create(ops, f[0], 10 * legacy + 1, legacy);
+		test_create(ops, f[1], 10 * legacy + 2, legacy);
+		test_create(ops, f[2], 10 * legacy + 3, legacy);
+		EditlogBatchEncode(ops, 3, value);
+		test_check(update_fi_cache_mgmt(0, 2 + legacy, value, nullptr)
+			== NGX_OK);
+
+		uint64_t i1 = test_ino(f[0]);
+		uint64_t i2 = test_ino(f[1]);
+		uint64_t i3 = test_ino(f[2]);
+
+		test_check(i1 != 0);
+		test_check(i2 == i1 + 1);
+		test_check(i3 == i2 + 1);
+	}
+
+	nn_file_index_worker_release(&cycle);
+	pool_destroy(pool);
+}
+
+int main()
+{
+	test_round_trip();
+	test_legacy();
+	test_apply_inos();
+
+	if (test_failed)
+	{
+		fprintf(stderr, "%d checks failed\n", test_failed);
+
+		return 1;
+	}
+
+	printf("ok\n");
+
+	return 0;
+}
@@ -0,0 +1,387 @@
+/*
+ * dfs_lz4 round trips and bad input, and fsimage sections saved and
+ * read on many threads against one thread: the image file and the
+ * records read back must be the same.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nn_fsimage.h"
+#include "nn_cycle.h"
+#include "dfs_error_log.h"
+#include "dfs_memory.h"
+#include "dfs_memory_pool.h"
+#include "dfs_lz4.h"
+
+#define TEST_SECTIONS 37
+#define TEST_RECORDS  2000 // per section
+
+cycle_t *dfs_cycle = nullptr;
+
+static int test_failed;
+
+#define test_check(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		test_failed++; \
+	} \
+} while (0)
+
+typedef struct
+{
+	fsimage_section_t *secs;
+	fsimage_t         *img;
+	uchar_t          **out;
+	size_t            *out_len;
+} test_image_t;
+
+// a record like the ones fi_image_encode writes: ino, parent and name
+static size_t test_record(uchar_t *p, size_t sec, size_t i)
+{
+	uint64_t ino = sec * TEST_RECORDS + i + 2;
+	uint64_t parent = ino / 16 + 1;
+	int      n = 0;
+
+	memcpy(p, &ino, sizeof(ino));
+	memcpy(p + sizeof(ino), &parent, sizeof(parent));
+	n = sprintf((char *)p + 2 * sizeof(ino) + 1, "part-%05lu.%lu",
+		(unsigned long)(ino % 100000), (unsigned long)(ino * 2654435761UL
+		% 977));
+	p[2 * sizeof(ino)] = (uchar_t)n;
+
+	return 2 * sizeof(ino) + 1 + n;
+}
+
+static void test_lz4_one(const uchar_t *src, size_t len)
+{
+	size_t   cap = dfs_lz4_bound(len);
+	uchar_t *z = (uchar_t *)malloc(cap);
+	uchar_t *back = (uchar_t *)malloc(len + 1);
+	size_t   zlen = dfs_lz4_compress(src, len, z, cap);
+
+	test_check(len == 0 || zlen > 0);
+	test_check(dfs_lz4_decompress(z, zlen, back, len) == (ssize_t)len);
+	test_check(memcmp(src, back, len) == 0);
+
+	if (len > 0)
+	{
+		// the output does not fit
+		test_check(dfs_lz4_decompress(z, zlen, back, len - 1) < 0);
+	}
+
+	// a cut block must fail, not read or write out of bounds
+	for (size_t cut = zlen > 64 ? zlen - 64 : 0; cut < zlen; cut++)
+	{
+		uchar_t *c = (uchar_t *)malloc(cut + 1);
+
+		memcpy(c, z, cut);
+		ssize_t r = dfs_lz4_decompress(c, cut, back, len);
+		test_check(r < 0 || (size_t)r <= len);
+		free(c);
+	}
+
+	free(z);
+	free(back);
+}
+
+static void test_lz4()
+{
+	size_t   len = 300000;
+	uchar_t *buf = (uchar_t *)malloc(len);
+	uchar_t  z[64];
+
+	srand(5);
+
+	// empty, tiny, and lengths around the minimum match
+	for (size_t n = 0; n < 20; n++)
+	{
+		memset(buf, 'a', n);
+		test_lz4_one(buf, n);
+	}
+
+	for (size_t i = 0; i < len; i++)
+	{
+		buf[i] = (uchar_t)rand();
+	}
+
+	test_lz4_one(buf, len); // incompressible
+
+	memset(buf, 0, len);
+	test_lz4_one(buf, len); // one long match
+
+	for (size_t i = 0, n = 0; i + 64 < len; i += n)
+	{
+		n = test_record(buf + i, i / 4096, i);
+	}
+
+	test_lz4_one(buf, len); // records
+
+	// too small a cap gives 0, not a partial block
+	memset(buf, 0, 1000);
+	test_check(dfs_lz4_compress(buf, 1000, z, 4) == 0);
+
+	// random garbage never overruns the output
+	for (int i = 0; i < 20000; i++)
+	{
+		size_t n = rand() % 64;
+
+		for (size_t j = 0; j < n; j++)
+		{
+			z[j] = (uchar_t)rand();
+		}
+
+		ssize_t r = dfs_lz4_decompress(z, n, buf, 256);
+		test_check(r <= 256);
+	}
+
+	free(buf);
+}
+
+static int test_encode(void *arg, size_t i)
+{
+	test_image_t *t = (test_image_t *)arg;
+
+	for (size_t r = 0; r < TEST_RECORDS; r++)
+	{
+		uchar_t *p = fsimage_section_reserve(&t->secs[i], 512);
+		if (!p)
+		{
+			return NGX_ERROR;
+		}
+
+		fsimage_section_commit(&t->secs[i], p + test_record(p, i, r));
+	}
+
+	// every third section raw, as when lz4 does not pay
+	return fsimage_section_seal(&t->secs[i], i % 3 != 0);
+}
+
+static int test_read(void *arg, size_t i)
+{
+	test_image_t *t = (test_image_t *)arg;
+	uchar_t      *data = nullptr;
+	uchar_t      *buf = nullptr;
+
+	if (fsimage_section_read(t->img, i, &data, &buf) != NGX_OK)
+	{
+		return NGX_ERROR;
+	}
+
+	t->out[i] = (uchar_t *)malloc(t->img->refs[i].hdr.raw_len + 1);
+	memcpy(t->out[i], data, t->img->refs[i].hdr.raw_len);
+	t->out_len[i] = t->img->refs[i].hdr.raw_len;
+	free(buf);
+
+	return NGX_OK;
+}
+
+static int test_save(const char *path, int threads)
+{
+	fsimage_section_t secs[TEST_SECTIONS];
+	fsimage_header_t  hdr;
+	test_image_t      t;
+	int               rc = NGX_ERROR;
+
+	memory_zero(secs, sizeof(secs));
+	memory_zero(&hdr, sizeof(hdr));
+	t.secs = secs;
+
+	if (fsimage_parallel(threads, TEST_SECTIONS, test_encode, &t) == NGX_OK)
+	{
+		hdr.record_num = TEST_SECTIONS * TEST_RECORDS;
+		hdr.max_ino = TEST_SECTIONS * TEST_RECORDS + 1;
+		hdr.instance_id = 42;
+		rc = fsimage_write(path, &hdr, secs, TEST_SECTIONS);
+	}
+
+	for (int i = 0; i < TEST_SECTIONS; i++)
+	{
+		fsimage_section_free(&secs[i]);
+	}
+
+	return rc;
+}
+
+// the records of every section back to back
+static uchar_t *test_load(const char *path, int threads, size_t *len)
+{
+	fsimage_t    img;
+	test_image_t t;
+	uchar_t     *out[TEST_SECTIONS] = { nullptr };
+	size_t       out_len[TEST_SECTIONS] = { 0 };
+	uchar_t     *all = nullptr;
+
+	*len = 0;
+
+	if (fsimage_open(path, &img) != NGX_OK)
+	{
+		return nullptr;
+	}
+
+	test_check(img.hdr.section_num == TEST_SECTIONS);
+	test_check(img.hdr.record_num == TEST_SECTIONS * TEST_RECORDS);
+	test_check(img.hdr.instance_id == 42);
+
+	t.img = &img;
+	t.out = out;
+	t.out_len = out_len;
+
+	if (fsimage_parallel(threads, img.hdr.section_num, test_read, &t)
+		== NGX_OK)
+	{
+		size_t total = 0;
+
+		for (int i = 0; i < TEST_SECTIONS; i++)
+		{
+			total += out_len[i];
+		}
+
+		all = (uchar_t *)malloc(total + 1);
+
+		for (int i = 0; i < TEST_SECTIONS; i++)
+		{
+			memcpy(all + *len, out[i], out_len[i]);
+			*len += out_len[i];
+		}
+	}
+
+	for (int i = 0; i < TEST_SECTIONS; i++)
+	{
+		free(out[i]);
+	}
+
+	fsimage_close(&img);
+
+	return all;
+}
+
+static uchar_t *test_file(const char *path, size_t *len)
+{
+	FILE    *f = fopen(path, "rb");
+	uchar_t *buf = nullptr;
+	long     n = 0;
+
+	*len = 0;
+
+	if (!f)
+	{
+		return nullptr;
+	}
+
+	fseek(f, 0, SEEK_END);
+	n = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = (uchar_t *)malloc(n + 1);
+
+	if (fread(buf, 1, n, f) == (size_t)n)
+	{
+		*len = n;
+	}
+
+	fclose(f);
+
+	return buf;
+}
+
+static void test_image()
+{
+	char     serial[64];
+	char     parallel[64];
+	size_t   slen = 0;
+	size_t   plen = 0;
+	uchar_t *s = nullptr;
+	uchar_t *p = nullptr;
+
+	snprintf(serial, sizeof(serial), "/tmp/test_fsimage.%d.1", getpid());
+	snprintf(parallel, sizeof(parallel), "/tmp/test_fsimage.%d.8", getpid());
+
+	test_check(test_save(serial, 1) == NGX_OK);
+	test_check(test_save(parallel, 8) == NGX_OK);
+
+	// saved on 8 threads, the image is byte for byte the serial one
+	s = test_file(serial, &slen);
+	p = test_file(parallel, &plen);
+	test_check(s && p && slen > 0 && slen == plen
+		&& memcmp(s, p, slen) == 0);
+	free(s);
+	free(p);
+
+	// loaded on 8 threads, the records are the serially loaded ones
+	s = test_load(serial, 1, &slen);
+	p = test_load(serial, 8, &plen);
+	test_check(s && p && slen == plen && memcmp(s, p, slen) == 0);
+	test_check(slen > 0);
+
+	// and they are the records that went in
+	for (size_t i = 0, off = 0; s && i < TEST_SECTIONS; i++)
+	{
+		for (size_t r = 0; r < TEST_RECORDS && off < slen; r++)
+		{
+			uchar_t rec[512];
+			size_t  n = test_record(rec, i, r);
+
+			test_check(off + n <= slen && memcmp(s + off, rec, n) == 0);
+			off += n;
+		}
+	}
+
+	free(s);
+	free(p);
+
+	// a flipped byte in a section is caught by its crc
+	FILE *f = fopen(serial, "r+b");
+
+	if (f)
+	{
+		fseek(f, -10, SEEK_END);
+		fputc(fgetc(f) ^ 0xff, f);
+		fclose(f);
+		fprintf(stderr, "a crc mismatch is expected below\n");
+		test_check(test_load(serial, 8, &slen) == nullptr);
+	}
+
+	unlink(serial);
+	unlink(parallel);
+}
+
+// the log line prefix, the namenode puts its cached time there
+static string_t *test_log_time()
+{
+	static string_t t = string_make("-");
+
+	return &t;
+}
+
+int main()
+{
+	cycle_t  cycle;
+	pool_t  *pool = pool_create(4096, 4096, nullptr);
+
+	memory_zero(&cycle, sizeof(cycle));
+
+	if (!pool || !(cycle.error_log = error_log_init_with_stderr(pool)))
+	{
+		return 1;
+	}
+
+	error_log_set_handle(cycle.error_log, test_log_time, nullptr);
+	dfs_cycle = &cycle;
+
+	test_lz4();
+	test_image();
+
+	pool_destroy(pool);
+
+	if (test_failed)
+	{
+		fprintf(stderr, "%d checks failed\n", test_failed);
+
+		return 1;
+	}
+
+	printf("ok\n");
+
+	return 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * task_encode2str/task_decodefstr: round trips, and packets that are
+ * cut short, too long in a field or otherwise malformed must come back
+ * as TASK_EAGIN or TASK_ERROR without reading past the packet.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "dfs_task.h"
+#include "dfs_varint.h"
+
+static int test_failed;
+
+#define test_check(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		test_failed++; \
+	} \
+} while (0)
+
+static int task_same(task_t *a, task_t *b)
+{
+	return a->cmd == b->cmd && a->ret == b->ret && a->seq == b->seq
+		&& a->master_nodeid == b->master_nodeid
+		&& strncmp(a->key, b->key, KEY_LEN) == 0
+		&& strncmp(a->user, b->user, OWNER_LEN) == 0
+		&& strncmp(a->group, b->group, GROUP_LEN) == 0
+		&& a->permission == b->permission && a->data_len == b->data_len
+		&& (a->data_len == 0
+			|| memcmp(a->data, b->data, a->data_len) == 0);
+}
+
+// decodes from a copy of exactly len bytes, so an overread is caught
+static int test_decode(const char *pkt, int len, task_t *out)
+{
+	char *copy = (char *)malloc(len > 0 ? len : 1);
+	int   rc = 0;
+
+	memcpy(copy, pkt, len);
+	rc = task_decodefstr(copy, len, out);
+
+	if (rc > 0 && out->data_len > 0)
+	{
+		// data points into the copy, keep it valid for the caller
+		out->data = (char *)pkt + ((char *)out->data - copy);
+	}
+
+	free(copy);
+
+	return rc;
+}
+
+static void test_varint()
+{
+	uint64_t vals[] = { 0, 1, 127, 128, 300, 16383, 16384, UINT32_MAX,
+		(uint64_t)INT64_MAX, UINT64_MAX };
+	uchar_t  buf[DFS_VARINT_MAX_LEN + 1];
+
+	for (size_t i = 0; i < sizeof(vals) / sizeof(vals[0]); i++)
+	{
+		uchar_t  *e = dfs_varint_encode(buf, vals[i]);
+		uint64_t  v = 0;
+
+		test_check((size_t)(e - buf) == dfs_varint_len(vals[i]));
+		test_check(dfs_varint_decode(buf, e, &v) == e && v == vals[i]);
+
+		// every shorter prefix is incomplete
+		for (uchar_t *end = buf; end < e; end++)
+		{
+			test_check(dfs_varint_decode(buf, end, &v) == nullptr);
+		}
+	}
+
+	int64_t svals[] = { 0, -1, 1, INT32_MIN, INT32_MAX, INT64_MIN,
+		INT64_MAX };
+
+	for (size_t i = 0; i < sizeof(svals) / sizeof(svals[0]); i++)
+	{
+		test_check(dfs_zigzag_decode(dfs_zigzag_encode(svals[i]))
+			== svals[i]);
+	}
+
+	// more continuation bytes than a uint64_t holds
+	memset(buf, 0x80, sizeof(buf));
+	uint64_t v = 0;
+	test_check(dfs_varint_decode(buf, buf + sizeof(buf), &v) == nullptr);
+}
+
+static void test_round_trip()
+{
+	char    data[3000];
+	char    pkt[8192];
+	task_t  in;
+	task_t  out;
+
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (char)(i * 31);
+	}
+
+	for (int c = 0; c < 6; c++)
+	{
+		memset(&in, 0, sizeof(in));
+		in.cmd = NN_MKDIR;
+
+		switch (c)
+		{
+		case 0: // nothing but the cmd
+			break;
+
+		case 1:
+			in.ret = -2;
+			in.seq = UINT32_MAX;
+			in.master_nodeid = -1;
+			in.permission = -1;
+			break;
+
+		case 2: // the longest strings that fit their fields
+			memset(in.key, 'k', KEY_LEN - 1);
+			memset(in.user, 'u', OWNER_LEN - 1);
+			memset(in.group, 'g', GROUP_LEN - 1);
+			break;
+
+		case 3:
+			strcpy(in.key, "/a/b/c");
+			strcpy(in.user, "root");
+			strcpy(in.group, "supergroup");
+			in.seq = 12345;
+			in.permission = 0755;
+			break;
+
+		case 4:
+			in.data = data;
+			in.data_len = 1;
+			break;
+
+		default:
+			strcpy(in.key, "/big");
+			in.ret = INT_MIN;
+			in.master_nodeid = INT_MAX;
+			in.data = data;
+			in.data_len = sizeof(data);
+			break;
+		}
+
+		int len = task_encode2str(&in, pkt, sizeof(pkt));
+		test_check(len > 0);
+
+		memset(&out, 0x5a, sizeof(out));
+		out.opq = &out;
+		test_check(test_decode(pkt, len, &out) == len);
+		test_check(task_same(&in, &out));
+		test_check(out.opq == &out);
+
+		// the exact size fits, one byte less does not
+		test_check(task_encode2str(&in, pkt, len) == len);
+		test_check(task_encode2str(&in, pkt, len - 1) == TASK_EAGIN);
+
+		// a packet that has not all arrived yet
+		for (int n = 0; n < len; n++)
+		{
+			test_check(test_decode(pkt, n, &out) == TASK_EAGIN);
+		}
+
+		// a length that cuts the fields short is malformed, not a crash
+		for (int n = 0; n < len; n++)
+		{
+			char cut[8192];
+
+			memcpy(cut, pkt, n > (int)sizeof(int) ? n : sizeof(int));
+			*(int *)cut = n;
+
+			int rc = test_decode(cut, n > (int)sizeof(int) ? n : sizeof(int),
+				&out);
+
+			// only trailing fields that are absent may still parse
+			test_check(rc == TASK_ERROR || rc == TASK_EAGIN || rc == n);
+		}
+	}
+}
+
+static void test_malformed()
+{
+	char    pkt[512];
+	task_t  in;
+	task_t  out;
+	int     len = 0;
+
+	memset(&in, 0, sizeof(in));
+	in.cmd = NN_CREATE;
+	strcpy(in.key, "/x");
+	len = task_encode2str(&in, pkt, sizeof(pkt));
+	test_check(len > 0);
+
+	// unknown wire version
+	pkt[sizeof(int)] = TASK_WIRE_VERSION + 1;
+	test_check(test_decode(pkt, len, &out) == TASK_ERROR);
+	pkt[sizeof(int)] = TASK_WIRE_VERSION;
+
+	// a length below the smallest packet
+	*(int *)pkt = TASK_WIRE_HDR_LEN;
+	test_check(test_decode(pkt, len, &out) == TASK_ERROR);
+	*(int *)pkt = -1;
+	test_check(test_decode(pkt, len, &out) == TASK_ERROR);
+	*(int *)pkt = len;
+
+	// a string longer than its task_t field
+	uchar_t *p = (uchar_t *)pkt + sizeof(int);
+
+	*p++ = TASK_WIRE_VERSION;
+	p = dfs_varint_encode(p, NN_CREATE);
+	p = dfs_varint_encode(p, TASK_F_USER);
+	p = dfs_varint_encode(p, OWNER_LEN + 1);
+	memset(p, 'u', OWNER_LEN + 1);
+	p += OWNER_LEN + 1;
+	*(int *)pkt = (int)(p - (uchar_t *)pkt);
+	test_check(test_decode(pkt, *(int *)pkt, &out) == TASK_ERROR);
+
+	// a string of exactly its field size leaves no room for the nul
+	p = (uchar_t *)pkt + sizeof(int) + 1;
+	p = dfs_varint_encode(p, NN_CREATE);
+	p = dfs_varint_encode(p, TASK_F_KEY);
+	p = dfs_varint_encode(p, KEY_LEN);
+	memset(p, 'k', KEY_LEN);
+	p += KEY_LEN;
+	*(int *)pkt = (int)(p - (uchar_t *)pkt);
+	test_check(test_decode(pkt, *(int *)pkt, &out) == TASK_ERROR);
+
+	// one byte less is the longest string and comes back terminated
+	p = (uchar_t *)pkt + sizeof(int) + 1;
+	p = dfs_varint_encode(p, NN_CREATE);
+	p = dfs_varint_encode(p, TASK_F_GROUP);
+	p = dfs_varint_encode(p, GROUP_LEN - 1);
+	memset(p, 'g', GROUP_LEN - 1);
+	p += GROUP_LEN - 1;
+	*(int *)pkt = (int)(p - (uchar_t *)pkt);
+	memset(&out, 0x5a, sizeof(out));
+	test_check(test_decode(pkt, *(int *)pkt, &out) == *(int *)pkt);
+	test_check(out.group[GROUP_LEN - 1] == '\0');
+	test_check(strlen(out.group) == GROUP_LEN - 1);
+
+	// an unterminated field is sent cut to fit, not in full
+	memset(&in, 0, sizeof(in));
+	in.cmd = NN_CREATE;
+	memset(in.user, 'u', OWNER_LEN);
+	len = task_encode2str(&in, pkt, sizeof(pkt));
+	test_check(len > 0);
+	memset(&out, 0x5a, sizeof(out));
+	test_check(test_decode(pkt, len, &out) == len);
+	test_check(strlen(out.user) == OWNER_LEN - 1);
+
+	// data whose length runs past the packet
+	p = (uchar_t *)pkt + sizeof(int) + 1;
+	p = dfs_varint_encode(p, NN_CREATE);
+	p = dfs_varint_encode(p, TASK_F_DATA);
+	p = dfs_varint_encode(p, 100);
+	memset(p, 'd', 10);
+	p += 10;
+	*(int *)pkt = (int)(p - (uchar_t *)pkt);
+	test_check(test_decode(pkt, *(int *)pkt, &out) == TASK_ERROR);
+
+	// a varint that never ends
+	p = (uchar_t *)pkt + sizeof(int) + 1;
+	memset(p, 0xff, 40);
+	p += 40;
+	*(int *)pkt = (int)(p - (uchar_t *)pkt);
+	test_check(test_decode(pkt, *(int *)pkt, &out) == TASK_ERROR);
+
+	// random bytes behind a valid header never read past the packet
+	srand(7);
+
+	for (int i = 0; i < 20000; i++)
+	{
+		int n = TASK_WIRE_HDR_LEN + 2 + rand() % 64;
+
+		for (int j = sizeof(int); j < n; j++)
+		{
+			pkt[j] = (char)rand();
+		}
+
+		pkt[sizeof(int)] = TASK_WIRE_VERSION;
+		*(int *)pkt = n;
+
+		int rc = test_decode(pkt, n, &out);
+
+		test_check(rc == n || rc == TASK_ERROR);
+	}
+}
+
+int main()
+{
+	test_varint();
+	test_round_trip();
+	test_malformed();
+
+	if (test_failed)
+	{
+		fprintf(stderr, "%d checks failed\n", test_failed);
+
+		return 1;
+	}
+
+	printf("ok\n");
+
+	return 0;
+}